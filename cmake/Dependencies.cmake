@@ -27,6 +27,7 @@ if(USE_OPENMP)
   find_package(OpenMP REQUIRED)
   list(APPEND Caffe_LINKER_LIBS PRIVATE ${OpenMP_CXX_FLAGS})
   list(APPEND Caffe_COMPILE_OPTIONS PRIVATE ${OpenMP_CXX_FLAGS})
+  list(APPEND Caffe_DEFINITIONS PRIVATE -DOPEN_MP)
 endif()
 
 # ---[ Google-glog
@@ -117,6 +118,7 @@ if(NOT APPLE)
     find_package(OpenBLAS REQUIRED)
     list(APPEND Caffe_INCLUDE_DIRS PUBLIC ${OpenBLAS_INCLUDE_DIR})
     list(APPEND Caffe_LINKER_LIBS PUBLIC ${OpenBLAS_LIB})
+    list(APPEND Caffe_DEFINITIONS PUBLIC -DUSE_OPENBLAS)
   elseif(BLAS STREQUAL "MKL" OR BLAS STREQUAL "mkl")
     find_package(MKL REQUIRED)
     list(APPEND Caffe_INCLUDE_DIRS PUBLIC ${MKL_INCLUDE_DIR})
@@ -24,7 +24,8 @@ template <typename Dtype>
 class Blob {
  public:
   Blob()
-       : data_(), connectivity_(), diff_(), count_(0), capacity_(0) {}
+       : data_(), connectivity_(new Connectivity()), diff_(), count_(0),
+         capacity_(0) {}
 
   /// @brief Deprecated; use <code>Blob(const vector<int>& shape)</code>.
   explicit Blob(const int num, const int channels, const int height,
@@ -211,9 +212,9 @@ class Blob {
     return data_;
   }
 
+  /// @brief The connectivity bitmask, or NULL if the blob is fully connected.
   inline const shared_ptr<SyncedMemory>& connectivity() const {
-    CHECK(connectivity_);
-    return connectivity_;
+    return connectivity_->mask;
   }
 
   inline const shared_ptr<SyncedMemory>& diff() const {
@@ -228,26 +229,35 @@ class Blob {
   void set_gpu_data(Dtype* data);
   const Dtype* cpu_diff() const;
   const Dtype* gpu_diff() const;
-  const Dtype* cpu_connectivity() const;
-  const Dtype* gpu_connectivity() const;
+  /**
+   * @brief Connectivity is stored as a bitmask: element i is connected iff
+   *        bit (i & 31) of word (i >> 5) is set. The mask is only allocated
+   *        once the blob is disconnected; until then the const accessors
+   *        return NULL and the blob is fully connected.
+   */
+  const unsigned int* cpu_connectivity() const;
+  const unsigned int* gpu_connectivity() const;
   Dtype* mutable_cpu_data();
   Dtype* mutable_gpu_data();
   Dtype* mutable_cpu_diff();
   Dtype* mutable_gpu_diff();
-  Dtype* mutable_cpu_connectivity();
-  Dtype* mutable_gpu_connectivity();
+  unsigned int* mutable_cpu_connectivity();
+  unsigned int* mutable_gpu_connectivity();
   void Update();
   void Zerout();
   void Disconnect(DisconnectMode mode, int group=1);
-  inline void Connect(){ InitializeConnectivity(); }
+  inline void Connect(){ connectivity_->mask.reset(); }
   Dtype GetSparsity();
   void FromProto(const BlobProto& proto, bool reshape = true);
   void ToProto(BlobProto* proto, bool write_diff = false) const;
+  /// @brief Writes the data (never the diff) keeping only its nonzeros,
+  ///        located by a bitmap or CSR, whichever is smaller, and encoded as
+  ///        described by BlobCompression. FromProto reads it back.
+  void ToCompressedProto(BlobProto* proto,
+      BlobCompression_ValueEncoding encoding = BlobCompression_ValueEncoding_FLOAT,
+      int codebook_size = 256) const;
   void Snapshot(string filename = "", bool write_diff = false) const;
 
-  /// @brief snapshot to format of Matrix Market http://math.nist.gov/MatrixMarket/formats.html
-  void WriteToNistMMIO(string filename = "") const;
-
   /// @brief Compute the sum of absolute values (L1 norm) of the data.
   Dtype asum_data() const;
   /// @brief Compute the sum of absolute values (L1 norm) of the diff.
@@ -280,14 +290,33 @@ class Blob {
    * shared_ptr calls its destructor when reset with the "=" operator.
    */
   void ShareDiff(const Blob& other);
+  /**
+   * @brief Set the data_ shared_ptr to point to memory, which may be larger
+   *        than the blob and shared with other Blob%s -- used by the memory
+   *        planner of Net.
+   *
+   * The blob may then be reshaped up to the size of memory without
+   * reallocating. The diff_ is replaced by a fresh SyncedMemory of the same
+   * size, which like any SyncedMemory is only allocated when it is accessed.
+   */
+  void ShareDataMemory(const shared_ptr<SyncedMemory>& memory);
 
   bool ShapeEquals(const BlobProto& other);
 
+  /// @brief Allocate the connectivity bitmask if needed and set every bit
+  ///        to (val != 0).
   void InitializeConnectivity(Dtype val = 1.0);
 
  protected:
+  /// @brief Holds the connectivity bitmask of the data, NULL until the blob
+  ///        is disconnected. ShareData shares the holder, so the blobs
+  ///        sharing the data see the mask whichever of them allocates it.
+  struct Connectivity {
+    shared_ptr<SyncedMemory> mask;
+  };
+
   shared_ptr<SyncedMemory> data_;
-  shared_ptr<SyncedMemory> connectivity_;
+  shared_ptr<Connectivity> connectivity_;
   shared_ptr<SyncedMemory> diff_;
   shared_ptr<SyncedMemory> shape_data_;
   vector<int> shape_;
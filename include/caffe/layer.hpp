@@ -49,6 +49,7 @@ class Layer {
         }
       }
       test_time_ = 0;
+      forward_passes_ = 0;
     }
   virtual ~Layer() {}
 
@@ -98,6 +99,15 @@ class Layer {
    * */
   virtual void WeightAlign() {}
 
+  /**
+   * @brief Drops what the layer derived from its weights (sparse or int8
+   *        copies), to be rebuilt from the current weights at the next
+   *        Forward. Net calls it when the weights are shared from the
+   *        training net; new weights loaded from a file go through
+   *        WeightAlign, which also picks the AUTO modes again.
+   */
+  virtual void InvalidateWeightCaches() {}
+
   /*
    * time consumption
    * */
@@ -176,6 +186,12 @@ class Layer {
    */
   const LayerParameter& layer_param() const { return layer_param_; }
 
+  /**
+   * @brief Returns the path prefix of the files of a dump of the layer: the
+   *        prefix of the dump, or the layer name with '/' replaced by '_'.
+   */
+  string dump_prefix(const DumpParameter& param) const;
+
   /**
    * @brief Writes the layer parameter to a protocol buffer
    */
@@ -320,6 +336,8 @@ class Layer {
   vector<Dtype> loss_;
 
   double test_time_;
+  /** The number of calls to Forward, counted for layer_param_.dump. */
+  int forward_passes_;
 
   /** @brief Using the CPU device, compute the layer output. */
   virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
@@ -397,6 +415,14 @@ class Layer {
     }
   }
 
+  /**
+   * Called by Forward to queue the blobs that layer_param_.dump selects for
+   * this pass to the BlobDumpWriter: the bottoms before Forward_cpu/gpu
+   * (forwarded false), the tops and weights after it.
+   */
+  void Dump(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top, bool forwarded);
+
   /**
    * Called by SetUp to initialize the weights associated with any top blobs in
    * the loss function. Store non-zero loss weights in the diff blob.
@@ -430,6 +456,9 @@ inline Dtype Layer<Dtype>::Forward(const vector<Blob<Dtype>*>& bottom,
   Dtype loss = 0;
   Timer timer;
   Reshape(bottom, top);
+  if (layer_param_.dump_size() > 0) {
+    Dump(bottom, top, false);
+  }
   switch (Caffe::mode()) {
   case Caffe::CPU:
 	timer.Start();
@@ -462,6 +491,10 @@ inline Dtype Layer<Dtype>::Forward(const vector<Blob<Dtype>*>& bottom,
   default:
     LOG(FATAL) << "Unknown caffe mode.";
   }
+  if (layer_param_.dump_size() > 0) {
+    Dump(bottom, top, true);
+    ++forward_passes_;
+  }
   return loss;
 }
 
@@ -7,6 +7,7 @@
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/im2col.hpp"
+#include "caffe/util/workspace.hpp"
 
 namespace caffe {
 
@@ -31,15 +32,50 @@ class BaseConvolutionLayer : public Layer<Dtype> {
  protected:
   // Helper functions that abstract away the column buffer and gemm arguments.
   // The last argument in forward_cpu_gemm is so that we can skip the im2col if
-  // we just called weight_cpu_gemm with the same input.
+  // we just called weight_cpu_gemm with the same input, no other layer having
+  // borrowed the Workspace in between.
   void forward_cpu_gemm(const Dtype* input, const Dtype* weights,
       Dtype* output, bool skip_im2col = false);
   void forward_cpu_bias(Dtype* output, const Dtype* bias);
+  // The fused_activation of one image, if any, in place.
+  void forward_cpu_activation(Dtype* output);
   void backward_cpu_gemm(const Dtype* input, const Dtype* weights,
       Dtype* output);
   void weight_cpu_gemm(const Dtype* input, const Dtype* output, Dtype*
       weights);
   void backward_cpu_bias(Dtype* bias, const Dtype* input);
+  // Direct sparse convolution of all num_ images (DIRECT_SCONV): iterates
+  // over the nonzero weights only, without lowering the input.
+  void forward_cpu_sconv(const Dtype* input, Dtype* output);
+  // int8 convolution of one image (LOWERED_INT8), including the bias and
+  // the fused ReLU, if any.
+  void forward_cpu_int8(const Dtype* input, Dtype* output);
+  // Convolution of one image (LOWERED_GEMM with input_density_threshold)
+  // that only multiplies its nonzero values, if there are few enough of
+  // them. Returns false without writing output otherwise.
+  bool forward_cpu_sparse_input(const Dtype* input, Dtype* output);
+  // Convolution of all num_ images (LOWERED_BATCHED_GEMM): the images of a
+  // block are lowered side by side into one wide matrix, so that every group
+  // runs a single gemm per block, whose outputs are moved back to NCHW.
+  void forward_cpu_batched_gemm(const Dtype* input, const Dtype* weights,
+      Dtype* output);
+  // Prepare the filter weights for the sparse or int8 conv_mode, if any.
+  // Once done, forward_cpu_gemm exploits their sparsity instead of running
+  // a dense gemm.
+  void weight_cpu_sparsify();
+  // Convert the filter weights into CSR format (LOWERED_CSRMM).
+  void weight_cpu_dense2csr();
+  // Convert the filter weights into block sparse rows of
+  // bsr_block_rows_ x bsr_block_cols_ blocks (LOWERED_BSRMM).
+  void weight_cpu_dense2bsr();
+  // Remove the all-zero rows and columns of the filter weights and
+  // concatenate the remaining ones (LOWERED_CCNMM).
+  void weight_cpu_squeeze();
+  // Quantize every filter to int8 with its own scale (LOWERED_INT8).
+  void weight_cpu_quantize_int8();
+  // Transpose the filters of every group to kernel_dim_ rows of their
+  // outputs (LOWERED_GEMM with input_density_threshold).
+  void weight_cpu_transpose();
 
 #ifndef CPU_ONLY
   void forward_gpu_gemm(const Dtype* col_input, const Dtype* weights,
@@ -92,18 +128,61 @@ class BaseConvolutionLayer : public Layer<Dtype> {
   bool bias_term_;
   bool is_1x1_;
   bool force_nd_im2col_;
+  ConvolutionParameter_ConvMode conv_mode_;
+
+  /// @brief The filter weights in CSR format (LOWERED_CSRMM and
+  ///        DIRECT_SCONV): nonzero values, their column indices and the row
+  ///        pointers. For DIRECT_SCONV each row is the run of nonzeros of an
+  ///        output channel, and a column index encodes the (input channel,
+  ///        kernel row, kernel col) the value applies to. LOWERED_BSRMM
+  ///        keeps the block sparse rows of caffe_cpu_dense2bsr in them, of
+  ///        the block shape from the block_group_lasso of the weights.
+  Blob<Dtype> nz_weight_values_;
+  Blob<int> nz_weight_indices_;
+  Blob<int> nz_weight_index_pointers_;
+  int bsr_block_rows_;
+  int bsr_block_cols_;
+  /// @brief The filter weights without all-zero rows and columns
+  ///        (LOWERED_CCNMM only), and the masks of the removed ones.
+  Blob<Dtype> squeezed_weight_buffer_;
+  Blob<int> weight_row_mask_;
+  Blob<int> weight_col_mask_;
+  vector<int> left_rows_;
+  vector<int> left_cols_;
+  /// @brief The filters quantized to int8 (LOWERED_INT8), in rows of
+  ///        caffe_int8_row_size(kernel_dim_), the factors turning their
+  ///        int32 products back into outputs, the quantized input image,
+  ///        the same with channels last, and its lowered rows, one per
+  ///        output pixel.
+  vector<int8_t> int8_weights_;
+  Blob<Dtype> int8_output_scales_;
+  vector<int8_t> int8_input_;
+  vector<int8_t> int8_image_;
+  vector<int8_t> int8_rows_;
+  /// @brief The transposed filters (LOWERED_GEMM with
+  ///        input_density_threshold) and the output of an image computed
+  ///        from them, conv_out_channels_ per output pixel.
+  Blob<Dtype> weights_transposed_;
+  Blob<Dtype> output_transposed_;
+  /// @brief The images lowered together by LOWERED_BATCHED_GEMM.
+  int batched_images_;
+  bool sparse_weights_ready_;
 
  private:
   // wrap im2col/col2im so we don't have to remember the (long) argument lists
-  inline void conv_im2col_cpu(const Dtype* data, Dtype* col_buff) {
+  // rows flagged in all_zero_mask are skipped and the others packed together
+  inline void conv_im2col_cpu(const Dtype* data, Dtype* col_buff,
+      const int* all_zero_mask = NULL) {
     if (!force_nd_im2col_ && num_spatial_axes_ == 2) {
       im2col_cpu(data, conv_in_channels_,
           conv_input_shape_.cpu_data()[1], conv_input_shape_.cpu_data()[2],
           kernel_shape_.cpu_data()[0], kernel_shape_.cpu_data()[1],
           pad_.cpu_data()[0], pad_.cpu_data()[1],
           stride_.cpu_data()[0], stride_.cpu_data()[1],
-          dilation_.cpu_data()[0], dilation_.cpu_data()[1], col_buff);
+          dilation_.cpu_data()[0], dilation_.cpu_data()[1], col_buff,
+          all_zero_mask);
     } else {
+      CHECK(!all_zero_mask) << "Only 2D im2col can skip all-zero rows.";
       im2col_nd_cpu(data, num_spatial_axes_, conv_input_shape_.cpu_data(),
           col_buffer_shape_.data(), kernel_shape_.cpu_data(),
           pad_.cpu_data(), stride_.cpu_data(), dilation_.cpu_data(), col_buff);
@@ -165,8 +244,19 @@ class BaseConvolutionLayer : public Layer<Dtype> {
   int col_offset_;
   int output_offset_;
 
+  // The shape of the im2col buffer; its memory is borrowed from the Workspace
+  // of the thread, shared with the other layers.
   Blob<Dtype> col_buffer_;
   Blob<Dtype> bias_multiplier_;
+
+  inline Dtype* col_buffer_cpu() {
+    return static_cast<Dtype*>(Workspace::Get().mutable_cpu_data(
+        col_buffer_.count() * sizeof(Dtype)));
+  }
+  inline Dtype* col_buffer_gpu() {
+    return static_cast<Dtype*>(Workspace::Get().mutable_gpu_data(
+        col_buffer_.count() * sizeof(Dtype)));
+  }
 };
 
 }  // namespace caffe
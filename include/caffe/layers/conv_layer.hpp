@@ -65,6 +65,8 @@ class ConvolutionLayer : public BaseConvolutionLayer<Dtype> {
       : BaseConvolutionLayer<Dtype>(param) {}
 
   virtual inline const char* type() const { return "Convolution"; }
+  virtual void WeightAlign();
+  virtual void InvalidateWeightCaches();
 
  protected:
   virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
@@ -77,6 +79,18 @@ class ConvolutionLayer : public BaseConvolutionLayer<Dtype> {
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
   virtual inline bool reverse_dimensions() { return false; }
   virtual void compute_output_shape();
+  // Resolve conv_mode: AUTO by timing the candidate CPU modes on the actual
+  // inputs, unless the choice is already in conv_mode_cache.
+  void TuneConvMode(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  // Whether batch_threading runs the images of the batch on concurrent
+  // threads rather than one after the other.
+  bool image_threads() const;
+
+  // The weight gradients of the threads when the images run concurrently,
+  // summed into the diff of the weights at the end of Backward_cpu. As many
+  // threads run as their partials fit in kMaxWeightDiffPartialBytes.
+  Blob<Dtype> weight_diff_partials_;
 };
 
 }  // namespace caffe
@@ -11,19 +11,50 @@
 
 namespace caffe {
 
+/**
+ * @brief Convolution with product-quantized weights (engine: QUANT).
+ *
+ * blobs_[0] holds the codebook, one K x M matrix per slice of M input
+ * channels; blobs_[2] holds the packed log2(K)-bit code of every
+ * (slice, output channel, kernel tap). The forward pass multiplies each
+ * slice of the image with its codebook once and then only adds up the
+ * rows picked by the codes. The codes are not learned: give blobs_[2]
+ * lr_mult and decay_mult 0 when training the codebook.
+ */
 template <typename Dtype>
 class ConvolutionQLayer : public ConvolutionLayer<Dtype> {
 public:
 	explicit ConvolutionQLayer(const LayerParameter& param) : ConvolutionLayer<Dtype>(param) {}
 	//virtual inline const char* type() const { return "Convolution"; }
+	virtual void WeightAlign();
+	virtual void InvalidateWeightCaches() { UnpackB(); }
 
 protected:
 	virtual void Reshape(const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top);
 	virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top);
-	//virtual void Forward_gpu(const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top);
+	virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
+			const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+	// there is no GPU engine, do not fall back to the dense convolution
+	virtual void Forward_gpu(const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+		Forward_cpu(bottom, top);
+	}
+	virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
+			const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+		Backward_cpu(top, propagate_down, bottom);
+	}
 	//virtual inline bool reverse_dimensions() { return false; }
 
+	void UnpackB();
+	// the products of every slice of one image with its codebook
+	void forward_cpu_cache(const Dtype* input, Dtype* cache, bool parallel);
+	// one output channel of one image, gathered from its cache
+	void forward_cpu_channel(const Dtype* cache, const int out_channel, Dtype* output);
+
+	// the shape of the caches, borrowed from the Workspace of the thread
 	Blob<Dtype> cache_;
+	inline Dtype* cache_cpu() {
+		return static_cast<Dtype*>(Workspace::Get().mutable_cpu_data(cache_.count() * sizeof(Dtype)));
+	}
 	Blob<int> B_;
 
 private:
@@ -31,6 +62,12 @@ private:
 	int conv_in_spatial_dim_;
 	int K;
 	int M;
+	int output_h_;
+	int output_w_;
+	// for each kernel row (col), the output rows (cols) [begin, end) whose
+	// tap lands inside the image, so the inner loops need no bounds checks
+	vector<int> row_begin_, row_end_;
+	vector<int> col_begin_, col_end_;
 };
 
 }
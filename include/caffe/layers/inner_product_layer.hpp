@@ -29,6 +29,7 @@ class InnerProductLayer : public Layer<Dtype> {
   virtual inline int ExactNumBottomBlobs() const { return 1; }
   virtual inline int ExactNumTopBlobs() const { return 1; }
   virtual void WeightAlign();
+  virtual void InvalidateWeightCaches();
 
  protected:
   virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
@@ -40,6 +41,23 @@ class InnerProductLayer : public Layer<Dtype> {
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 
+  // Convert the weights into CSR format (ip_mode CSRMM), N_ rows of K_
+  // columns whatever transpose_ is. Only connected weights are kept if the
+  // weights have a connectivity mask, otherwise only the nonzero ones.
+  void weight_cpu_dense2csr();
+  // Copy the current weights into the CSR values, whose pattern is fixed.
+  void weight_cpu_refresh_csr();
+  // Convert the weights into block sparse rows (ip_mode BSRMM), N_ rows of
+  // K_ columns whatever transpose_ is.
+  void weight_cpu_dense2bsr();
+  // Quantize every output's weights to int8 with its own scale (ip_mode
+  // INT8), N_ rows of caffe_int8_row_size(K_) whatever transpose_ is.
+  void weight_cpu_quantize_int8();
+  // top = bottom * W^T from the nonzeros of every bottom row only, if there
+  // are fewer than input_density_threshold of M_ x K_ (ip_mode GEMM).
+  // Returns false without writing top_data otherwise.
+  bool forward_cpu_sparse_input(const Dtype* bottom_data, Dtype* top_data);
+
   int M_;
   int K_;
   int N_;
@@ -47,10 +65,41 @@ class InnerProductLayer : public Layer<Dtype> {
   Blob<Dtype> bias_multiplier_;
   bool transpose_;  ///< if true, assume transposed weights
 
- private:
-#ifdef USE_SNAPSHOT_FEATURE
-    int num_forward_image_;
-#endif
+  /// @brief The weights in CSR format (ip_mode CSRMM): nonzero values,
+  ///        their column indices and the row pointers. ip_mode BSRMM keeps
+  ///        the block sparse rows of caffe_cpu_dense2bsr in them, of
+  ///        bsr_block_rows_ x bsr_block_cols_ blocks.
+  Blob<Dtype> nz_weight_values_;
+  Blob<int> nz_weight_indices_;
+  Blob<int> nz_weight_index_pointers_;
+  int bsr_block_rows_;
+  int bsr_block_cols_;
+  /// @brief The bottom (K_ x M_) and the top or top diff (N_ x M_)
+  ///        transposed, so that the batch is the dense dimension of SpMM.
+  Blob<Dtype> bottom_transposed_;
+  Blob<Dtype> top_transposed_;
+  bool sparse_weights_ready_;
+  /// @brief Whether the CSR pattern is the connectivity mask of the weights.
+  bool sparse_pattern_connected_;
+  /// @brief Whether this layer runs in int8 (ip_mode INT8 outside training),
+  ///        the quantized weights and bottom rows, and the factors turning
+  ///        their int32 products back into outputs.
+  bool int8_;
+  bool int8_weights_ready_;
+  vector<int8_t> int8_weights_;
+  vector<int8_t> int8_bottom_;
+  Blob<Dtype> int8_output_scales_;
+  /// @brief Whether the input sparsity is exploited (input_density_threshold
+  ///        is set), the weights as K_ x N_ unless transpose_ stores them so
+  ///        (also the N_ x K_ weights of ip_mode BSRMM if transpose_),
+  ///        and the nonzeros of every bottom row: K_ indices and values per
+  ///        row and how many of them are set.
+  bool sparse_input_;
+  bool sparse_input_weights_ready_;
+  Blob<Dtype> weights_transposed_;
+  Blob<int> nz_bottom_indices_;
+  Blob<Dtype> nz_bottom_values_;
+  vector<int> nz_bottom_counts_;
 };
 
 }  // namespace caffe
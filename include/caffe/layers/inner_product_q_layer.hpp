@@ -9,6 +9,14 @@
 
 namespace caffe {
 
+    /**
+     * @brief Product-quantized inner product. The input is split into
+     *        num_input / M subspaces of M dims; blobs_[0] holds a codebook D
+     *        of K codewords per subspace, blobs_[1] the bias and blobs_[2]
+     *        the log2(K)-bit codeword index of every (subspace, output) pair,
+     *        bit-packed. blobs_[2] is not learnable and should be given
+     *        lr_mult: 0.
+     */
     template <typename Dtype>
     class InnerProductQLayer : public Layer<Dtype> {
     public:
@@ -18,6 +26,9 @@ namespace caffe {
         const vector<Blob<Dtype>*>& top);
         virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
         const vector<Blob<Dtype>*>& top);
+        // re-unpacks the codeword indices after new weights are loaded
+        virtual void WeightAlign();
+        virtual void InvalidateWeightCaches() { UnpackB(); }
 
         virtual inline const char* type() const { return "InnerProductQ"; }
         virtual inline int ExactNumBottomBlobs() const { return 1; }
@@ -33,10 +44,29 @@ namespace caffe {
         virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
         const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 
+        // lookup-table forward: per image, builds the products of every input
+        // slice with its codebook, then gathers each output through codes_
+        void Forward_cpu_adc(const Dtype* bottom_data, Dtype* top_data);
+
+        // unpacks blobs_[2] into B_ and codes_
+        void UnpackB();
+
         int num_output;
         int num_input;
         int batch_size;
         Blob<Dtype> bias_multiplier_;
+        // codeword index of every (subspace, output) pair, subspace-major
+        Blob<int> B_;
+        // the same indices as bytes, grouped by 8 outputs for the ADC gather
+        vector<unsigned char> codes_;
+        // (num_input / M) x K codeword products of one image
+        Blob<Dtype> lookup_tables_;
+        // input regrouped per subspace, (num_input / M) x batch_size x M;
+        // the diff holds the input gradient in the same layout
+        Blob<Dtype> input_slices_;
+        // products of one input slice with its codebook, batch_size x K;
+        // the diff holds the top gradient gathered per codeword
+        Blob<Dtype> codeword_products_;
     };
 
 }  // namespace caffe
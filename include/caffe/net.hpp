@@ -81,6 +81,20 @@ class Net {
    * a forward pass, e.g. to compute output feature size.
    */
   void Reshape();
+  /**
+   * @brief Reshape all layers and share the memory of the intermediate blobs
+   *        among those that are never alive at the same time.
+   *
+   * A blob is alive from the first to the last layer having it as a bottom
+   * or top; blobs sharing their data (in-place layers, and layers such as
+   * Split or Flatten, which share it on Reshape) are alive together. Every
+   * group of them is assigned to an arena free at its first layer: the
+   * smallest large enough one, else the largest, which grows. The inputs
+   * and outputs of the net and the tops of layers without bottoms keep their
+   * own memory. Called by Init and Reshape if NetParameter.plan_memory is set
+   * in the TEST phase.
+   */
+  void PlanMemory();
 
   Dtype ForwardBackward() {
     Dtype loss;
@@ -116,6 +130,11 @@ class Net {
   void CopyTrainedLayersFromHDF5(const string trained_filename);
   /// @brief Writes the net to a proto.
   void ToProto(NetParameter* param, bool write_diff = false) const;
+  /// @brief Writes the net to a proto with compressed weights
+  ///        (see Blob::ToCompressedProto). Params with lr_mult 0 are kept
+  ///        exact whatever the encoding.
+  void ToCompressedProto(NetParameter* param,
+      BlobCompression_ValueEncoding encoding, int codebook_size) const;
   /// @brief Writes the net to an HDF5 file.
   void ToHDF5(const string& filename, bool write_diff = false) const;
 
@@ -231,6 +250,10 @@ class Net {
   inline const vector<string>& param_display_names() const {
     return param_display_names_;
   }
+  /// @brief The (layer id, index in the layer) of each param
+  inline const vector<pair<int, int> >& param_layer_indices() const {
+    return param_layer_indices_;
+  }
   /// @brief Input and output blob numbers
   inline int num_inputs() const { return net_input_blobs_.size(); }
   inline int num_outputs() const { return net_output_blobs_.size(); }
@@ -386,6 +409,8 @@ class Net {
   size_t memory_used_;
   /// Whether to compute and display debug info for the net.
   bool debug_info_;
+  /// Whether the memory of the intermediate blobs is shared by PlanMemory.
+  bool plan_memory_;
   // Callbacks
   vector<Callback*> before_forward_;
   vector<Callback*> after_forward_;
@@ -29,11 +29,19 @@ class SGDSolver : public Solver<Dtype> {
   virtual void ApplyUpdate();
   virtual void Normalize(int param_id);
   virtual Dtype Regularize(int param_id);
+  // The sparsity of a learnable param, measured in one pass over its data.
+  ParamSparsity ComputeSparsity(int param_id, Dtype regularization_term);
+  // Log the element, column, row and block sparsity of every param.
+  void PrintSparsity(const vector<ParamSparsity>& params);
   virtual Dtype GetSparsity(int param_id);
   virtual Dtype GetGroupSparsity(int param_id, bool dimen=true);
   virtual Dtype GetGroupSparsity(int param_id, int ydimen,int xdimen);
   virtual Dtype GroupLassoRegularize(int param_id);
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
+  // Whether the CPU update of this param can run as one fused pass, and the
+  // pass itself; returns the L2 regularization term.
+  bool CanFuseUpdate(int param_id);
+  Dtype FusedUpdate(int param_id, Dtype rate);
   virtual void ClipGradients();
   virtual void SnapshotSolverState(const string& model_filename);
   virtual void SnapshotSolverStateToBinaryProto(const string& model_filename);
@@ -45,6 +53,11 @@ class SGDSolver : public Solver<Dtype> {
   // temp maintains other information that might be needed in computation
   //   of gradients/updates and is not needed in snapshots
   vector<shared_ptr<Blob<Dtype> > > history_, update_, temp_;
+  // Whether Regularize and GroupLassoRegularize should compute the
+  // regularization term; only done on iterations that display it.
+  bool track_regularization_;
+  // The names of the learnable params in the sparsity reports.
+  vector<string> sparsity_names_;
 
   DISABLE_COPY_AND_ASSIGN(SGDSolver);
 };
@@ -1,6 +1,7 @@
 #ifndef CAFFE_SOLVER_HPP_
 #define CAFFE_SOLVER_HPP_
 #include <boost/function.hpp>
+#include <iosfwd>
 #include <string>
 #include <vector>
 
@@ -32,6 +33,25 @@ namespace caffe {
  */
 typedef boost::function<SolverAction::Enum()> ActionCallback;
 
+/**
+ * @brief The sparsity of one learnable param right after an update, in
+ *        percent of zero elements, all-zero rows and columns (of the param
+ *        seen as a shape(0) x count() / shape(0) matrix) and all-zero blocks
+ *        of each of its BlockGroupLassoSpec, with the regularization term the
+ *        param added to the loss.
+ */
+struct ParamSparsity {
+  struct Block {
+    int ydimen, xdimen;
+    float sparsity;
+  };
+  string name;  // "<layer>.<param name or index>"
+  int count;
+  float element, row, column;
+  vector<Block> blocks;
+  float regularization;
+};
+
 /**
  * @brief An interface for classes that perform optimization on Net%s.
  *
@@ -88,6 +108,23 @@ class Solver {
     callbacks_.push_back(value);
   }
 
+  // Receives the sparsity of every learnable param each sparsity_interval
+  // iterations, e.g. to switch engines or to stop early through the
+  // action request function.
+  class SparsityCallback {
+   protected:
+    virtual void on_sparsity(int iter, const vector<ParamSparsity>& params) = 0;
+
+    template <typename T>
+    friend class Solver;
+  };
+  const vector<SparsityCallback*>& sparsity_callbacks() const {
+    return sparsity_callbacks_;
+  }
+  void add_sparsity_callback(SparsityCallback* value) {
+    sparsity_callbacks_.push_back(value);
+  }
+
   void CheckSnapshotWritePermissions();
   /**
    * @brief Returns the solver type.
@@ -100,6 +137,7 @@ class Solver {
   string SnapshotFilename(const string extension);
   string SnapshotToBinaryProto();
   string SnapshotToHDF5();
+  string SnapshotToCompressedProto();
   // The test routine
   void TestAll();
   void Test(const int test_net_id = 0);
@@ -107,6 +145,8 @@ class Solver {
   virtual void RestoreSolverStateFromHDF5(const string& state_file) = 0;
   virtual void RestoreSolverStateFromBinaryProto(const string& state_file) = 0;
   void DisplayOutputBlobs(const int net_id);
+  // Hands the sparsity of the params to the callbacks and to sparsity_file.
+  void ReportSparsity(const vector<ParamSparsity>& params);
   void UpdateSmoothedLoss(Dtype loss, int start_iter, int average_loss);
 
   SolverParameter param_;
@@ -116,6 +156,8 @@ class Solver {
   vector<shared_ptr<Net<Dtype> > > test_nets_;
   Dtype total_regularization_term_;
   vector<Callback*> callbacks_;
+  vector<SparsityCallback*> sparsity_callbacks_;
+  shared_ptr<std::ofstream> sparsity_file_;
   vector<Dtype> losses_;
   Dtype smoothed_loss_;
 
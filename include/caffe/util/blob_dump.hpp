@@ -0,0 +1,77 @@
+#ifndef CAFFE_UTIL_BLOB_DUMP_HPP_
+#define CAFFE_UTIL_BLOB_DUMP_HPP_
+
+#include <string>
+
+#include "caffe/blob.hpp"
+#include "caffe/internal_thread.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/blocking_queue.hpp"
+
+namespace caffe {
+
+// The RAW dump format, in host byte order:
+//   char[4]  magic "CBLB"
+//   uint32   version, kBlobDumpVersion
+//   uint32   bytes per element, 4 (float) or 8 (double)
+//   uint32   number of axes
+//   int64    the shape, one per axis
+// zero padded to a multiple of kBlobDumpAlignment bytes, then count()
+// elements in the row-major order of the blob.
+const int kBlobDumpVersion = 1;
+const int kBlobDumpAlignment = 64;
+
+/// @brief Writes the data of blob to filename in the RAW format.
+template <typename Dtype>
+void WriteBlobDump(const Blob<Dtype>& blob, const string& filename);
+
+/// @brief Reads a RAW dump of the same Dtype into blob, reshaping it.
+template <typename Dtype>
+void ReadBlobDump(const string& filename, Blob<Dtype>* blob);
+
+/// @brief Writes the nonzeros of blob to filename as a MatrixMarket
+///        coordinate matrix of shape(0) rows and count() / shape(0) columns.
+template <typename Dtype>
+void WriteBlobMatrixMarket(const Blob<Dtype>& blob, const string& filename);
+
+// A copy of a blob waiting in the BlobDumpWriter.
+class BlobDump {
+ public:
+  virtual ~BlobDump() {}
+  virtual void Write() const = 0;
+};
+
+/**
+ * @brief Writes blobs on a background thread, so that a layer dumping its
+ *        features pays for a copy of the data rather than the file I/O.
+ *        The writer is shared by the process and is started by its first
+ *        dump; dumps still queued at exit are written before it stops.
+ */
+class BlobDumpWriter : public InternalThread {
+ public:
+  static BlobDumpWriter& Get();
+  virtual ~BlobDumpWriter();
+
+  template <typename Dtype>
+  void Push(const Blob<Dtype>& blob, const string& filename,
+      DumpParameter_Format format);
+
+  /// @brief Waits until every dump pushed so far is written.
+  void Flush();
+
+ protected:
+  BlobDumpWriter();
+  virtual void InternalThreadEntry();
+
+  class sync;
+
+  BlockingQueue<BlobDump*> queue_;
+  shared_ptr<sync> sync_;
+  int pending_;
+
+  DISABLE_COPY_AND_ASSIGN(BlobDumpWriter);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_BLOB_DUMP_HPP_
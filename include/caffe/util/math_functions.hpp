@@ -78,6 +78,10 @@ void caffe_powx(const int n, const Dtype* a, const Dtype b, Dtype* y);
 template <typename Dtype>
 void caffe_powx_seperate(const int n, const Dtype* a, const Dtype b, Dtype* y);
 
+// Sets the number of threads the BLAS library runs its calls on and returns
+// the previous one; 1 and nothing is set for a library not known to thread.
+int caffe_set_blas_num_threads(const int threads);
+
 unsigned int caffe_rng_rand();
 
 template <typename Dtype>
@@ -113,7 +117,8 @@ Dtype caffe_cpu_strided_dot(const int n, const Dtype* x, const int incx,
     const Dtype* y, const int incy);
 
 // sparse matrix A *  dense matrix B
-// A is stored in CSR format
+// A is stored in zero-based CSR format; falls back to a portable
+// implementation when Caffe is not built with MKL
 template <typename Dtype>
 void caffe_cpu_sparse_mmcsr(const int M, const int N, const int K,
     const Dtype alpha,
@@ -121,12 +126,78 @@ void caffe_cpu_sparse_mmcsr(const int M, const int N, const int K,
     const Dtype* B,
     const Dtype beta,Dtype* C);
 
+// sparse matrix A *  dense vector x
+// A (M rows) is stored in zero-based CSR format with M+1 row pointers; the
+// rows are split among the threads by their number of nonzeros
+template <typename Dtype>
+void caffe_cpu_sparse_csrmv(const int M,
+    const Dtype* A_nonzero_buf, const int* A_nonzero_idx_buf, const int* A_idx_pointer_buf,
+    const Dtype* x, Dtype* y);
+
+// Stores the nonzeros of x (n values) as their indices and values and
+// returns how many there are.
+template <typename Dtype>
+int caffe_cpu_compress_nonzeros(const int n, const Dtype* x, int* indices,
+    Dtype* values);
+
+// dense matrix A^T *  sparse vector x
+// y (N) = sum over j < nnz of values[j] * row indices[j] of the row-major
+// matrix A with N columns, so only the rows that meet a nonzero are read
+template <typename Dtype>
+void caffe_cpu_sparse_input_gemv(const int N, const int nnz, const int* indices,
+    const Dtype* values, const Dtype* A, Dtype* y);
+
+// Rows of the int8 gemm operands are zero padded to a multiple of 32 bytes.
+inline int caffe_int8_row_size(const int K) { return (K + 31) / 32 * 32; }
+
+// y = round(scale * x) clamped to [-127, 127]; returns whether any y < 0
+template <typename Dtype>
+bool caffe_cpu_quantize_int8(const int n, const Dtype scale, const Dtype* x,
+    int8_t* y);
+
+// x = max(0, x) + negative_slope * min(0, x), in place
+template <typename Dtype>
+void caffe_cpu_relu(const int n, const Dtype negative_slope, Dtype* x);
+
+// x = alpha * (exp(x) - 1) where x <= 0, in place
+template <typename Dtype>
+void caffe_cpu_elu(const int n, const Dtype alpha, Dtype* x);
+
+// C = scale * (W * X^T) + bias with int32 accumulation, then max(0, .) if
+// relu. W (M x K) and X (N x K) are int8 with rows of caffe_int8_row_size(K);
+// scale and bias (optional) hold one value per row of W. C is M x N, or
+// N x M if trans_C. x_nonnegative selects the faster kernel for X >= 0.
+template <typename Dtype>
+void caffe_cpu_gemm_int8(const bool trans_C, const int M, const int N,
+    const int K, const int8_t* W, const int8_t* X, const bool x_nonnegative,
+    const Dtype* scale, const Dtype* bias, const bool relu, Dtype* C);
+
 // dense matrix A to sparse matrix A in CSR format
+// A_idx_pointer_buf holds M+1 row pointers; the other two buffers must be
+// large enough for all the nonzeros of A
 template <typename Dtype>
 void caffe_cpu_sparse_dense2csr(const int M, const int N,
     Dtype* A,
     Dtype* A_nonzero_buf, int* A_nonzero_idx_buf, int* A_idx_pointer_buf);
 
+// dense matrix A (M x N) to block sparse rows (BSR) of br x bc blocks, which
+// must tile A. Only the blocks holding a nonzero are kept: their values one
+// block after the other (each row-major), their block columns in
+// block_indices and, for each of the M/br block rows, the offset of its
+// first block in block_pointers (M/br+1 entries). values and block_indices
+// must be large enough for every block of A. Returns the number of blocks.
+template <typename Dtype>
+int caffe_cpu_dense2bsr(const int M, const int N, const int br, const int bc,
+    const Dtype* A, Dtype* values, int* block_indices, int* block_pointers);
+
+// C (M x N) = A * B, where A (M x K) is in the BSR format of
+// caffe_cpu_dense2bsr and B is dense K x N. br and bc of 1, 2, 4 or 8 run
+// a micro-kernel compiled for the block shape.
+template <typename Dtype>
+void caffe_cpu_bsrmm(const int M, const int N, const int br, const int bc,
+    const Dtype* values, const int* block_indices, const int* block_pointers,
+    const Dtype* B, Dtype* C);
+
 // Returns the sum of the absolute values of the elements of vector x
 template <typename Dtype>
 Dtype caffe_cpu_asum(const int n, const Dtype* x);
@@ -194,10 +265,41 @@ void caffe_cpu_if_all_zero(const int M, const int N, const Dtype *X, int* y, boo
 template <typename Dtype>
 void caffe_cpu_all_zero_mask(const int M, const int N, const Dtype *X, Dtype* y);
 
+//Connectivity bitmasks: element i is connected iff bit (i & 31) of y[i >> 5] is set.
+//set the bits of the elements in x which are not zerout
+template <typename Dtype>
+void caffe_cpu_nonzerout_bitmask(const int n, const Dtype* x, unsigned int* y);
+
+//clear the bits of all-zero columns and rows in matrix X, whose first element maps to bit offset of y
+template <typename Dtype>
+void caffe_cpu_all_zero_bitmask(const int M, const int N, const Dtype *X, unsigned int* y, const int offset = 0);
+
+//y -= x for the connected elements in mask and x = 0 for the disconnected ones
+template <typename Dtype>
+void caffe_cpu_connected_update(const int n, const unsigned int* mask, Dtype* x, Dtype* y);
+
+//one fused SGD step for the connected elements in mask (all elements if mask is NULL):
+//  h = rate*(diff + decay*data) + momentum*h; diff = h; data -= h; zerout data
+//returns the sum of squares of the visited data before the step (for the L2 term)
+template <typename Dtype>
+Dtype caffe_cpu_sgd_update(const int n, const unsigned int* mask,
+		const Dtype decay, const Dtype momentum, const Dtype rate,
+		Dtype* data, Dtype* diff, Dtype* history);
+
 //get column(true)/row(false) sparsity in matrix
 template <typename Dtype>
 Dtype caffe_cpu_group_sparsity(const int M, const int N, const Dtype *X, bool dimen=true);
 
+//count the zero elements, all-zero rows and all-zero columns of the MxN matrix x in one pass
+template <typename Dtype>
+void caffe_cpu_sparsity_stats(const int M, const int N, const Dtype *x,
+		int* zeros, int* zero_rows, int* zero_cols);
+
+//count the all-zero blk_size_n x blk_size_c blocks of the n x c matrix x
+template <typename Dtype>
+int caffe_cpu_zero_blocks(const int n, const int c,
+		const int blk_size_n, const int blk_size_c, const Dtype *x);
+
 //get masked cols
 template <typename Dtype>
 void caffe_cpu_del_zero_cols(const int M, const int N, const Dtype *x, Dtype *y, int * left_cols, const int* mask);
@@ -210,6 +312,10 @@ void caffe_cpu_concatenate_rows_cols(const int M, const int N, const Dtype *x, D
 template <typename Dtype>
 void caffe_cpu_dispatch_rows(const int M, const int N, Dtype *x, const int* row_mask);
 
+//get sqrt sum of weights within bars(column(true)/row(false)) and copy them at each position
+template <typename Dtype>
+void caffe_cpu_bar_group_lasso(const int n, const int c, const Dtype *x, Dtype* y, bool along_column_or_row = true);
+
 //get sqrt sum of weights within blocks and copy them at each position
 template <typename Dtype>
 void caffe_cpu_block_group_lasso(const int n, const int c,
@@ -356,6 +462,9 @@ void caffe_gpu_if_nonzerout(const int n, const Dtype* x, Dtype* y);
 template<typename Dtype>
 void caffe_gpu_eltwise_multi(const int n, const Dtype* x, Dtype* y);
 
+template<typename Dtype>
+void caffe_gpu_connected_update(const int n, const unsigned int* mask, Dtype* x, Dtype* y);
+
 template<typename Dtype>
 void caffe_gpu_sgnbit(const int n, const Dtype* x, Dtype* y);
 
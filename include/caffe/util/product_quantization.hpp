@@ -0,0 +1,77 @@
+#ifndef CAFFE_UTIL_PRODUCT_QUANTIZATION_HPP_
+#define CAFFE_UTIL_PRODUCT_QUANTIZATION_HPP_
+
+#include "caffe/blob.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+struct ProductQuantizationOptions {
+  ProductQuantizationOptions()
+      : k(32), m(4), max_iter(30), batch_size(0), seed(1701) {}
+  // codewords per subspace, a power of two up to 256
+  int k;
+  // dimensions per subspace
+  int m;
+  // Lloyd iterations, or mini-batch steps when batch_size > 0
+  int max_iter;
+  // rows sampled per mini-batch step; 0 runs full Lloyd iterations
+  int batch_size;
+  // subspace s is seeded with seed + s, so results do not depend on the
+  // number of threads
+  unsigned int seed;
+};
+
+/**
+ * @brief Clusters the n rows of the row-major n x dim matrix data into k
+ *        centroids (row-major k x dim) with k-means++ seeding. labels
+ *        receives the nearest centroid of every row.
+ */
+template <typename Dtype>
+void caffe_cpu_kmeans(const int n, const int dim, const Dtype* data,
+    const int k, const int max_iter, const int batch_size,
+    const unsigned int seed, Dtype* centroids, int* labels);
+
+// Words of 32 bits needed for n codes of the given bit width.
+inline int caffe_packed_codes_size(const int n, const int bits) {
+  return (static_cast<long long>(n) * bits + 31) / 32;  // NOLINT(runtime/int)
+}
+
+// Packs n codes of the given bit width most significant bit first into
+// 32-bit words, the order in which the Q layers unpack blobs_[2].
+void caffe_pack_codes(const int n, const int* codes, const int bits,
+    unsigned int* packed);
+
+/**
+ * @brief Product-quantizes the num_output x num_input weights of an
+ *        InnerProduct layer into the blobs_[0] (num_input x k) and
+ *        blobs_[2] of an InnerProductQ layer; the subspaces are clustered
+ *        in parallel.
+ */
+template <typename Dtype>
+void QuantizeInnerProductWeights(const Blob<Dtype>& weights,
+    const ProductQuantizationOptions& options, Blob<Dtype>* codebook,
+    Blob<Dtype>* packed_codes);
+
+/**
+ * @brief Product-quantizes the num_output x channels x kernel_h x kernel_w
+ *        weights of a Convolution layer along the channels into the
+ *        blobs_[0] (k * channels / m x m) and blobs_[2] of a quantized
+ *        (engine: QUANT) Convolution layer.
+ */
+template <typename Dtype>
+void QuantizeConvolutionWeights(const Blob<Dtype>& weights,
+    const ProductQuantizationOptions& options, Blob<Dtype>* codebook,
+    Blob<Dtype>* packed_codes);
+
+/**
+ * @brief Gives the packed codeword indices, blobs_[2] of a quantized layer,
+ *        a zero learning rate and weight decay, adding the param specs of
+ *        the blobs before them if the layer has none, so that the solver
+ *        leaves the codes bit-exact.
+ */
+void FreezeQuantizedCodes(LayerParameter* layer);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_PRODUCT_QUANTIZATION_HPP_
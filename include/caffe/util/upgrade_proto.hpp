@@ -71,6 +71,12 @@ bool NetNeedsBatchNormUpgrade(const NetParameter& net_param);
 // Perform all necessary transformations to upgrade batch norm layers.
 void UpgradeNetBatchNorm(NetParameter* net_param);
 
+// Return true iff the Net contains layers with the deprecated int8_fused_relu.
+bool NetNeedsInt8FusedReluUpgrade(const NetParameter& net_param);
+
+// Replace int8_fused_relu by fused_activation: RELU.
+void UpgradeNetInt8FusedRelu(NetParameter* net_param);
+
 // Return true iff the solver contains any old solver_type specified as enums
 bool SolverNeedsTypeUpgrade(const SolverParameter& solver_param);
 
@@ -0,0 +1,52 @@
+#ifndef CAFFE_UTIL_WORKSPACE_HPP_
+#define CAFFE_UTIL_WORKSPACE_HPP_
+
+#include "caffe/common.hpp"
+#include "caffe/syncedmem.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Scratch memory shared by the layers running on a thread, such as
+ *        the im2col buffers of the convolutions.
+ *
+ * Only one layer runs at a time on a thread, so rather than each of them
+ * owning its scratch buffers, they borrow the workspace of the thread, which
+ * is as large as the largest request. What a layer writes there is only
+ * valid until the next layer borrows the workspace. The host and device
+ * borrowers get buffers of their own, so that neither has its contents
+ * copied over to the other side.
+ */
+class Workspace {
+ public:
+  /// @brief The workspace of the calling thread.
+  static Workspace& Get();
+
+  /// @brief Make the workspace at least size bytes, allocated when next used.
+  void Reserve(size_t size);
+  /// @brief At least size bytes of the workspace, on the host or device.
+  ///        Its contents are not preserved when it grows.
+  void* mutable_cpu_data(size_t size);
+  void* mutable_gpu_data(size_t size);
+
+  /// @brief The bytes of the larger of the host and device buffers.
+  size_t size() const;
+  /// @brief The sum of the sizes reserved so far. The layers reserve their
+  ///        buffers on every Reshape; over the setup of a net this is what
+  ///        they would have allocated on their own.
+  size_t requested() const { return requested_; }
+
+ private:
+  Workspace() : requested_(0) {}
+  static void Grow(shared_ptr<SyncedMemory>* memory, size_t size);
+
+  shared_ptr<SyncedMemory> cpu_memory_;
+  shared_ptr<SyncedMemory> gpu_memory_;
+  size_t requested_;
+
+  DISABLE_COPY_AND_ASSIGN(Workspace);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_WORKSPACE_HPP_
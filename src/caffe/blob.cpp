@@ -1,4 +1,8 @@
+#include <algorithm>
 #include <climits>
+#include <cmath>
+#include <cstring>
+#include <string>
 #include <vector>
 
 #include "caffe/blob.hpp"
@@ -6,7 +10,6 @@
 #include "caffe/syncedmem.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/util/io.hpp"
-#include "caffe/util/mmio.hpp"
 
 namespace caffe {
 
@@ -42,9 +45,9 @@ void Blob<Dtype>::Reshape(const vector<int>& shape) {
   if (count_ > capacity_) {
     capacity_ = count_;
     data_.reset(new SyncedMemory(capacity_ * sizeof(Dtype)));
-    connectivity_.reset(new SyncedMemory(capacity_ * sizeof(Dtype)));
     diff_.reset(new SyncedMemory(capacity_ * sizeof(Dtype)));
-    InitializeConnectivity();
+    // the connectivity mask is allocated lazily by Disconnect
+    connectivity_.reset(new Connectivity());
   }
 }
 
@@ -67,14 +70,14 @@ template <typename Dtype>
 Blob<Dtype>::Blob(const int num, const int channels, const int height,
     const int width)
   // capacity_ must be initialized before calling Reshape
-  : capacity_(0) {
+  : connectivity_(new Connectivity()), capacity_(0) {
   Reshape(num, channels, height, width);
 }
 
 template <typename Dtype>
 Blob<Dtype>::Blob(const vector<int>& shape)
   // capacity_ must be initialized before calling Reshape
-  : capacity_(0) {
+  : connectivity_(new Connectivity()), capacity_(0) {
   Reshape(shape);
 }
 
@@ -109,16 +112,17 @@ const Dtype* Blob<Dtype>::gpu_data() const {
 }
 
 template <typename Dtype>
-const Dtype* Blob<Dtype>::cpu_connectivity() const {
-  CHECK(connectivity_);
-  return (const Dtype*)connectivity_->cpu_data();
+const unsigned int* Blob<Dtype>::cpu_connectivity() const {
+  if (!connectivity_->mask) { return NULL; }
+  return (const unsigned int*)connectivity_->mask->cpu_data();
 }
 
 template <typename Dtype>
-const Dtype* Blob<Dtype>::gpu_connectivity() const {
-  CHECK(connectivity_);
-  return (const Dtype*)connectivity_->gpu_data();
+const unsigned int* Blob<Dtype>::gpu_connectivity() const {
+  if (!connectivity_->mask) { return NULL; }
+  return (const unsigned int*)connectivity_->mask->gpu_data();
 }
+
 template<typename Dtype> void Blob<Dtype>::set_gpu_data(Dtype* data) {
   CHECK(data);
   // Make sure CPU and GPU sizes remain equal
@@ -167,22 +171,22 @@ Dtype* Blob<Dtype>::mutable_gpu_diff() {
 }
 
 template <typename Dtype>
-Dtype* Blob<Dtype>::mutable_cpu_connectivity() {
-  CHECK(connectivity_);
-  return static_cast<Dtype*>(connectivity_->mutable_cpu_data());
+unsigned int* Blob<Dtype>::mutable_cpu_connectivity() {
+  if (!connectivity_->mask) { InitializeConnectivity(); }
+  return static_cast<unsigned int*>(connectivity_->mask->mutable_cpu_data());
 }
 
 template <typename Dtype>
-Dtype* Blob<Dtype>::mutable_gpu_connectivity() {
-  CHECK(connectivity_);
-  return static_cast<Dtype*>(connectivity_->mutable_gpu_data());
+unsigned int* Blob<Dtype>::mutable_gpu_connectivity() {
+  if (!connectivity_->mask) { InitializeConnectivity(); }
+  return static_cast<unsigned int*>(connectivity_->mask->mutable_gpu_data());
 }
 
 template <typename Dtype>
 void Blob<Dtype>::ShareData(const Blob& other) {
   CHECK_EQ(count_, other.count());
   data_ = other.data();
-  connectivity_ = other.connectivity();
+  connectivity_ = other.connectivity_;
 }
 
 template <typename Dtype>
@@ -191,6 +195,16 @@ void Blob<Dtype>::ShareDiff(const Blob& other) {
   diff_ = other.diff();
 }
 
+template <typename Dtype>
+void Blob<Dtype>::ShareDataMemory(const shared_ptr<SyncedMemory>& memory) {
+  CHECK(memory);
+  CHECK_GE(memory->size(), count_ * sizeof(Dtype));
+  capacity_ = memory->size() / sizeof(Dtype);
+  data_ = memory;
+  diff_.reset(new SyncedMemory(capacity_ * sizeof(Dtype)));
+  connectivity_.reset(new Connectivity());
+}
+
 // The "update" method is used for parameter blobs in a Net, which are stored
 // as Blob<float> or Blob<double> -- hence we do not define it for
 // Blob<int> or Blob<unsigned int>.
@@ -203,23 +217,29 @@ void Blob<Dtype>::Update() {
   switch (data_->head()) {
   case SyncedMemory::HEAD_AT_CPU:
     // perform computation on CPU
-	caffe_cpu_eltwise_multi(count_,
-			static_cast<const Dtype*>(connectivity_->cpu_data()),
-			static_cast<Dtype*>(diff_->mutable_cpu_data()) );
-    caffe_axpy<Dtype>(count_, Dtype(-1),
-        static_cast<const Dtype*>(diff_->cpu_data()),
-        static_cast<Dtype*>(data_->mutable_cpu_data()));
+    if (connectivity_->mask) {
+      caffe_cpu_connected_update(count_, cpu_connectivity(),
+          static_cast<Dtype*>(diff_->mutable_cpu_data()),
+          static_cast<Dtype*>(data_->mutable_cpu_data()));
+    } else {
+      caffe_axpy<Dtype>(count_, Dtype(-1),
+          static_cast<const Dtype*>(diff_->cpu_data()),
+          static_cast<Dtype*>(data_->mutable_cpu_data()));
+    }
     break;
   case SyncedMemory::HEAD_AT_GPU:
   case SyncedMemory::SYNCED:
 #ifndef CPU_ONLY
     // perform computation on GPU
-	caffe_gpu_eltwise_multi(count_,
-			static_cast<const Dtype*>(connectivity_->gpu_data()),
-			static_cast<Dtype*>(diff_->mutable_gpu_data()) );
-    caffe_gpu_axpy<Dtype>(count_, Dtype(-1),
-        static_cast<const Dtype*>(diff_->gpu_data()),
-        static_cast<Dtype*>(data_->mutable_gpu_data()));
+    if (connectivity_->mask) {
+      caffe_gpu_connected_update(count_, gpu_connectivity(),
+          static_cast<Dtype*>(diff_->mutable_gpu_data()),
+          static_cast<Dtype*>(data_->mutable_gpu_data()));
+    } else {
+      caffe_gpu_axpy<Dtype>(count_, Dtype(-1),
+          static_cast<const Dtype*>(diff_->gpu_data()),
+          static_cast<Dtype*>(data_->mutable_gpu_data()));
+    }
 #else
     NO_GPU;
 #endif
@@ -271,34 +291,19 @@ void Blob<Dtype>::Zerout() {
 template <typename Dtype>
 void Blob<Dtype>::Disconnect(DisconnectMode mode,int group) {
 	this->Zerout();
+	// The mask is built once on the CPU; Update syncs it to the GPU if needed.
 	if(mode == ELTWISE){
-		switch (Caffe::mode()) {
-			case Caffe::CPU: {
-				  caffe_cpu_if_nonzerout(count_,
-						  static_cast<const Dtype*>(data_->cpu_data()),
-						  static_cast<Dtype*>(connectivity_->mutable_cpu_data()));
-				  break;
-			}
-			case Caffe::GPU: {
-#ifndef CPU_ONLY
-				  caffe_gpu_if_nonzerout(count_,
-						  static_cast<const Dtype*>(data_->gpu_data()),
-						  static_cast<Dtype*>(connectivity_->mutable_gpu_data()));
-#else
-			  NO_GPU;
-#endif
-				break;
-			}
-			default:
-			  LOG(FATAL) << "Unknown caffe mode: " << Caffe::mode();
-		}
+		caffe_cpu_nonzerout_bitmask(count_,
+				static_cast<const Dtype*>(data_->cpu_data()),
+				mutable_cpu_connectivity());
 	}else if(mode == GRPWISE){
 		CHECK_GE(group,1);
+		InitializeConnectivity();
 		for (int g = 0; g < group; ++g) {
-			caffe_cpu_all_zero_mask(shape_[0]/group,
+			caffe_cpu_all_zero_bitmask(shape_[0]/group,
 					count_/shape_[0],
 					static_cast<const Dtype*>(data_->cpu_data()) + count_/group * g,
-					static_cast<Dtype*>(connectivity_->mutable_cpu_data()) + count_/group * g);
+					mutable_cpu_connectivity(), count_/group * g);
 		}
 	}
 
@@ -550,8 +555,12 @@ bool Blob<Dtype>::ShapeEquals(const BlobProto& other) {
 
 template <typename Dtype>
 void Blob<Dtype>::InitializeConnectivity(Dtype val){
-    CHECK(connectivity_);
-    caffe_set(count_, val, static_cast<Dtype*>(connectivity_->mutable_cpu_data()));
+    const size_t size = (capacity_ + 31) / 32 * sizeof(unsigned int);
+    if (!connectivity_->mask || connectivity_->mask->size() < size) {
+      connectivity_->mask.reset(new SyncedMemory(size));
+    }
+    caffe_memset(size, val != Dtype(0) ? 0xFF : 0,
+        connectivity_->mask->mutable_cpu_data());
 }
 
 template <typename Dtype>
@@ -571,8 +580,12 @@ void Blob<Dtype>::CopyFrom(const Blob& source, bool copy_diff, bool reshape) {
     } else {
       caffe_copy(count_, source.gpu_data(),
           static_cast<Dtype*>(data_->mutable_gpu_data()));
-      caffe_copy(count_, source.gpu_connectivity(),
-                static_cast<Dtype*>(connectivity_->mutable_gpu_data()));
+      if (source.connectivity()) {
+        caffe_copy((count_ + 31) / 32, source.gpu_connectivity(),
+            mutable_gpu_connectivity());
+      } else {
+        connectivity_->mask.reset();
+      }
     }
     break;
   case Caffe::CPU:
@@ -582,8 +595,12 @@ void Blob<Dtype>::CopyFrom(const Blob& source, bool copy_diff, bool reshape) {
     } else {
       caffe_copy(count_, source.cpu_data(),
           static_cast<Dtype*>(data_->mutable_cpu_data()));
-      caffe_copy(count_, source.cpu_connectivity(),
-                static_cast<Dtype*>(connectivity_->mutable_cpu_data()));
+      if (source.connectivity()) {
+        caffe_copy((count_ + 31) / 32, source.cpu_connectivity(),
+            mutable_cpu_connectivity());
+      } else {
+        connectivity_->mask.reset();
+      }
     }
     break;
   default:
@@ -591,6 +608,196 @@ void Blob<Dtype>::CopyFrom(const Blob& source, bool copy_diff, bool reshape) {
   }
 }
 
+// IEEE half precision conversions, rounding to nearest even.
+static uint16_t float_to_half(const float f) {
+  uint32_t x;
+  memcpy(&x, &f, sizeof(x));
+  const uint32_t sign = (x >> 16) & 0x8000;
+  x &= 0x7fffffff;
+  if (x >= 0x7f800000) {  // inf or nan
+    return sign | 0x7c00 | (x > 0x7f800000 ? 0x200 : 0);
+  }
+  if (x >= 0x477ff000) {  // rounds beyond the largest half
+    return sign | 0x7c00;
+  }
+  if (x < 0x38800000) {  // below the smallest normal half
+    if (x <= 0x33000000) { return sign; }
+    const uint32_t mantissa = (x & 0x7fffff) | 0x800000;
+    const int shift = 126 - (x >> 23);
+    uint32_t h = mantissa >> shift;
+    const uint32_t rest = mantissa & ((1u << shift) - 1);
+    const uint32_t half_way = 1u << (shift - 1);
+    if (rest > half_way || (rest == half_way && (h & 1))) { ++h; }
+    return sign | h;
+  }
+  uint32_t h = (x >> 13) - (112 << 10);
+  const uint32_t rest = x & 0x1fff;
+  if (rest > 0x1000 || (rest == 0x1000 && (h & 1))) { ++h; }
+  return sign | h;
+}
+
+static float half_to_float(const uint16_t h) {
+  const uint32_t sign = (h & 0x8000) << 16;
+  uint32_t exponent = (h >> 10) & 0x1f;
+  uint32_t mantissa = h & 0x3ff;
+  uint32_t x;
+  if (exponent == 0) {
+    if (mantissa == 0) {
+      x = sign;
+    } else {  // subnormal half, normal float
+      exponent = 113;
+      while (!(mantissa & 0x400)) {
+        mantissa <<= 1;
+        --exponent;
+      }
+      x = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+    }
+  } else if (exponent == 31) {
+    x = sign | 0x7f800000 | (mantissa << 13);
+  } else {
+    x = sign | ((exponent + 112) << 23) | (mantissa << 13);
+  }
+  float f;
+  memcpy(&f, &x, sizeof(f));
+  return f;
+}
+
+// Whether an element is left out of a compressed blob. Negative zeros are
+// kept so that blobs holding raw bits (e.g. packed indices) survive intact.
+template <typename Dtype>
+static inline bool compressed_zero(const Dtype x) {
+  return x == 0 && !std::signbit(static_cast<double>(x));
+}
+
+// 1-D k-means of the values into at most k codewords. In one dimension the
+// clusters are runs of the sorted values, so each iteration only needs the
+// boundaries between consecutive codewords and prefix sums.
+template <typename Dtype>
+static void codebook_quantize(const vector<Dtype>& values, int k,
+    BlobCompression* compression) {
+  const int n = values.size();
+  k = std::min(k, n);
+  vector<double> sorted(values.begin(), values.end());
+  std::sort(sorted.begin(), sorted.end());
+  vector<double> prefix(n + 1, 0);
+  for (int i = 0; i < n; ++i) {
+    prefix[i + 1] = prefix[i] + sorted[i];
+  }
+  // start from the quantiles
+  vector<double> codewords(k);
+  for (int c = 0; c < k; ++c) {
+    codewords[c] = sorted[(2 * static_cast<int64_t>(c) + 1) * n / (2 * k)];
+  }
+  vector<double> midpoints(std::max(k - 1, 0));
+  for (int iter = 0; iter < 30; ++iter) {
+    for (int c = 0; c + 1 < k; ++c) {
+      midpoints[c] = (codewords[c] + codewords[c + 1]) / 2;
+    }
+    bool changed = false;
+    int begin = 0;
+    for (int c = 0; c < k; ++c) {
+      const int end = c + 1 < k ? std::lower_bound(sorted.begin(),
+          sorted.end(), midpoints[c]) - sorted.begin() : n;
+      if (end > begin) {
+        const double mean = (prefix[end] - prefix[begin]) / (end - begin);
+        changed |= mean != codewords[c];
+        codewords[c] = mean;
+      }
+      begin = std::max(begin, end);
+    }
+    if (!changed) { break; }
+  }
+  for (int c = 0; c + 1 < k; ++c) {
+    midpoints[c] = (codewords[c] + codewords[c + 1]) / 2;
+  }
+  compression->clear_codebook();
+  for (int c = 0; c < k; ++c) {
+    compression->add_codebook(codewords[c]);
+  }
+  string codes(n, 0);
+  for (int i = 0; i < n; ++i) {
+    codes[i] = std::upper_bound(midpoints.begin(), midpoints.end(),
+        static_cast<double>(values[i])) - midpoints.begin();
+  }
+  compression->set_values(codes);
+}
+
+static inline void add_compressed_value(BlobProto* proto, const float x) {
+  proto->add_data(x);
+}
+
+static inline void add_compressed_value(BlobProto* proto, const double x) {
+  proto->add_double_data(x);
+}
+
+template <typename Dtype>
+static void DecodeCompressedData(const BlobProto& proto, const int count,
+    Dtype* data) {
+  const BlobCompression& compression = proto.compression();
+  vector<Dtype> values;
+  switch (compression.encoding()) {
+  case BlobCompression_ValueEncoding_FLOAT:
+    if (proto.double_data_size() > 0) {
+      values.assign(proto.double_data().begin(), proto.double_data().end());
+    } else {
+      values.assign(proto.data().begin(), proto.data().end());
+    }
+    break;
+  case BlobCompression_ValueEncoding_HALF: {
+    const string& bytes = compression.values();
+    CHECK_EQ(bytes.size() % 2, 0) << "Truncated half precision values";
+    values.resize(bytes.size() / 2);
+    for (int j = 0; j < values.size(); ++j) {
+      values[j] = half_to_float(static_cast<uint8_t>(bytes[2 * j]) |
+          static_cast<uint8_t>(bytes[2 * j + 1]) << 8);
+    }
+    break;
+  }
+  case BlobCompression_ValueEncoding_CODEBOOK: {
+    const string& codes = compression.values();
+    values.resize(codes.size());
+    for (int j = 0; j < values.size(); ++j) {
+      const int code = static_cast<uint8_t>(codes[j]);
+      CHECK_LT(code, compression.codebook_size()) << "Invalid codeword index";
+      values[j] = compression.codebook(code);
+    }
+    break;
+  }
+  default:
+    LOG(FATAL) << "Unknown value encoding " << compression.encoding();
+  }
+  caffe_set(count, Dtype(0), data);
+  int j = 0;
+  if (compression.has_bitmap()) {
+    const string& bitmap = compression.bitmap();
+    CHECK_EQ(bitmap.size(), (count + 7) / 8) << "Bitmap size mismatch";
+    for (int b = 0; b < bitmap.size(); ++b) {
+      for (unsigned int bits = static_cast<uint8_t>(bitmap[b]), i = 8 * b;
+          bits; bits >>= 1, ++i) {
+        if (bits & 1) {
+          CHECK_LT(j, values.size()) << "Too few values for the bitmap";
+          data[i] = values[j++];
+        }
+      }
+    }
+  } else {
+    const int rows = compression.row_pointer_size() - 1;
+    CHECK_GT(rows, 0) << "Missing nonzero locations";
+    const int cols = count / rows;
+    CHECK_EQ(compression.column_index_size(), compression.row_pointer(rows));
+    CHECK_EQ(compression.column_index_size(), values.size());
+    for (int r = 0; r < rows; ++r) {
+      for (j = compression.row_pointer(r); j < compression.row_pointer(r + 1);
+          ++j) {
+        const int c = compression.column_index(j);
+        CHECK_LT(c, cols) << "Column index out of range";
+        data[r * cols + c] = values[j];
+      }
+    }
+  }
+  CHECK_EQ(j, values.size()) << "Too many values for the nonzeros";
+}
+
 template <typename Dtype>
 void Blob<Dtype>::FromProto(const BlobProto& proto, bool reshape) {
   if (reshape) {
@@ -616,7 +823,9 @@ void Blob<Dtype>::FromProto(const BlobProto& proto, bool reshape) {
   }
   // copy data
   Dtype* data_vec = mutable_cpu_data();
-  if (proto.double_data_size() > 0) {
+  if (proto.has_compression()) {
+    DecodeCompressedData(proto, count_, data_vec);
+  } else if (proto.double_data_size() > 0) {
     CHECK_EQ(count_, proto.double_data_size());
     for (int i = 0; i < count_; ++i) {
       data_vec[i] = proto.double_data(i);
@@ -685,6 +894,74 @@ void Blob<float>::ToProto(BlobProto* proto, bool write_diff) const {
 template <> void Blob<unsigned int>::ToProto(BlobProto* proto, bool write_diff) const { NOT_IMPLEMENTED; }
 template <> void Blob<int>::ToProto(BlobProto* proto, bool write_diff) const { NOT_IMPLEMENTED; }
 
+template <typename Dtype>
+void Blob<Dtype>::ToCompressedProto(BlobProto* proto,
+    BlobCompression_ValueEncoding encoding, int codebook_size) const {
+  proto->Clear();
+  for (int i = 0; i < shape_.size(); ++i) {
+    proto->mutable_shape()->add_dim(shape_[i]);
+  }
+  BlobCompression* compression = proto->mutable_compression();
+  compression->set_encoding(encoding);
+  const Dtype* data_vec = cpu_data();
+  const int rows = shape_.size() > 0 && shape_[0] > 0 ? shape_[0] : 1;
+  const int cols = count_ / rows;
+  vector<Dtype> values;
+  for (int i = 0; i < count_; ++i) {
+    if (!compressed_zero(data_vec[i])) { values.push_back(data_vec[i]); }
+  }
+  const int nnz = values.size();
+  // A bitmap takes count / 8 bytes; CSR about 2 bytes (varint) per nonzero
+  // and per row.
+  if ((count_ + 7) / 8 <= 2 * (nnz + rows + 1)) {
+    string bitmap((count_ + 7) / 8, 0);
+    for (int i = 0; i < count_; ++i) {
+      if (!compressed_zero(data_vec[i])) { bitmap[i / 8] |= 1 << (i % 8); }
+    }
+    compression->set_bitmap(bitmap);
+  } else {
+    for (int r = 0, j = 0; r < rows; ++r) {
+      compression->add_row_pointer(j);
+      for (int c = 0; c < cols; ++c) {
+        if (!compressed_zero(data_vec[r * cols + c])) {
+          compression->add_column_index(c);
+          ++j;
+        }
+      }
+    }
+    compression->add_row_pointer(nnz);
+  }
+  switch (encoding) {
+  case BlobCompression_ValueEncoding_FLOAT:
+    for (int j = 0; j < nnz; ++j) {
+      add_compressed_value(proto, values[j]);
+    }
+    break;
+  case BlobCompression_ValueEncoding_HALF: {
+    string bytes(2 * nnz, 0);
+    for (int j = 0; j < nnz; ++j) {
+      const uint16_t h = float_to_half(values[j]);
+      bytes[2 * j] = h & 0xff;
+      bytes[2 * j + 1] = h >> 8;
+    }
+    compression->set_values(bytes);
+    break;
+  }
+  case BlobCompression_ValueEncoding_CODEBOOK:
+    CHECK_GE(codebook_size, 1);
+    CHECK_LE(codebook_size, 256) << "Codeword indices are stored in a byte";
+    codebook_quantize(values, codebook_size, compression);
+    break;
+  default:
+    LOG(FATAL) << "Unknown value encoding " << encoding;
+  }
+}
+
+template <> void Blob<unsigned int>::ToCompressedProto(BlobProto* proto,
+    BlobCompression_ValueEncoding encoding, int codebook_size) const { NOT_IMPLEMENTED; }
+template <> void Blob<int>::ToCompressedProto(BlobProto* proto,
+    BlobCompression_ValueEncoding encoding, int codebook_size) const { NOT_IMPLEMENTED; }
+
 template <typename Dtype>
 void Blob<Dtype>::Snapshot(string filename, bool write_diff) const{
 	if(filename.empty()){
@@ -695,51 +972,6 @@ void Blob<Dtype>::Snapshot(string filename, bool write_diff) const{
 	WriteProtoToBinaryFile(proto, filename.c_str());
 }
 
-template <typename Dtype>
-void Blob<Dtype>:: WriteToNistMMIO(string filename) const{
-	if(filename.empty()){
-		filename = shape_string()+".blob";
-	}
-	MM_typecode matcode;
-	FILE * fp = fopen(filename.c_str(), "w+");
-	mm_initialize_typecode(&matcode);
-	mm_set_matrix(&matcode);
-	mm_set_array(&matcode);
-	mm_set_real(&matcode);
-	mm_set_general(&matcode);
-	if(NULL==fp) {
-		LOG(WARNING)<<"NULL file pointer to " << filename;
-		return;
-	}
-	mm_write_banner(fp, matcode);
-	int M = this->shape(0);//column of the stored matrix
-	int N = this->count()/M;
-	mm_write_mtx_array_size(fp, M, N);
-
-	/* NOTE: matrix market files use 1-based indices, i.e. first element
-	 of a vector has index 1, not 0.  */
-	const Dtype * data_ptr = this->cpu_data();
-	if(num_axes()==4){
-		for (int c=0; c<this->shape(1); c++) {
-			for (int h=0; h<this->shape(2); h++) {
-				for (int w=0; w<this->shape(3); w++) {
-					for (int n=0; n<this->shape(0); n++) {
-						fprintf(fp, "%20g\n", (double)(*(data_ptr+((n * this->shape(1) + c) * this->shape(2) + h) * this->shape(3) + w)));
-					}
-				}
-			}
-		}
-	}else if(num_axes()==2){
-		for (int c=0; c<this->shape(1); c++) {
-			for (int n=0; n<this->shape(0); n++) {
-				fprintf(fp, "%20g\n", (double)(*(data_ptr + n * this->shape(1) + c)) );
-			}
-		}
-	}
-
-	fclose(fp);
-}
-
 INSTANTIATE_CLASS(Blob);
 template class Blob<int>;
 template class Blob<unsigned int>;
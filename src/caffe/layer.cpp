@@ -1,7 +1,69 @@
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <vector>
+
 #include "caffe/layer.hpp"
+#include "caffe/util/blob_dump.hpp"
 
 namespace caffe {
 
+template <typename Dtype>
+void Layer<Dtype>::Dump(const vector<Blob<Dtype>*>& bottom,
+    const vector<Blob<Dtype>*>& top, bool forwarded) {
+  for (int i = 0; i < layer_param_.dump_size(); ++i) {
+    const DumpParameter& param = layer_param_.dump(i);
+    if ((param.source() != DumpParameter_Source_BOTTOM) != forwarded) {
+      continue;
+    }
+    CHECK_GT(param.period(), 0) << "dump period must be positive.";
+    const int step = forward_passes_ - static_cast<int>(param.first_pass());
+    const int period = param.period();
+    const int num_passes = param.num_passes();
+    if (step < 0 || step % period != 0 ||
+        (num_passes > 0 && step / period >= num_passes)) {
+      continue;
+    }
+    vector<Blob<Dtype>*> blobs;
+    string source;
+    switch (param.source()) {
+    case DumpParameter_Source_BOTTOM:
+      blobs = bottom;
+      source = "bottom";
+      break;
+    case DumpParameter_Source_TOP:
+      blobs = top;
+      source = "top";
+      break;
+    case DumpParameter_Source_WEIGHTS:
+      for (int j = 0; j < blobs_.size(); ++j) {
+        blobs.push_back(blobs_[j].get());
+      }
+      source = "param";
+      break;
+    default:
+      LOG(FATAL) << "Unknown dump source: " << param.source();
+    }
+    const string prefix = dump_prefix(param);
+    for (int j = 0; j < blobs.size(); ++j) {
+      std::ostringstream filename;
+      filename << prefix << "." << source << j << "." << forward_passes_
+          << (param.format() == DumpParameter_Format_RAW ? ".bin" : ".mtx");
+      BlobDumpWriter::Get().Push(*blobs[j], filename.str(), param.format());
+    }
+  }
+}
+
+template <typename Dtype>
+string Layer<Dtype>::dump_prefix(const DumpParameter& param) const {
+  if (!param.prefix().empty()) {
+    return param.prefix();
+  }
+  string prefix = layer_param_.name();
+  std::replace(prefix.begin(), prefix.end(), '/', '_');
+  return prefix;
+}
+
 INSTANTIATE_CLASS(Layer);
 
 }  // namespace caffe
@@ -1,6 +1,10 @@
 #include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <vector>
 
+#include <unistd.h>
+
 #include "caffe/filler.hpp"
 #include "caffe/layers/base_conv_layer.hpp"
 #include "caffe/util/im2col.hpp"
@@ -8,17 +12,80 @@
 
 namespace caffe {
 
+static size_t QueryLastLevelCacheBytes() {
+  long bytes = 0;  // NOLINT(runtime/int)
+#ifdef _SC_LEVEL3_CACHE_SIZE
+  bytes = sysconf(_SC_LEVEL3_CACHE_SIZE);
+  if (bytes <= 0) {
+    bytes = sysconf(_SC_LEVEL2_CACHE_SIZE);
+  }
+#endif
+  return bytes > 0 ? bytes : 8 << 20;
+}
+
+// The cache a block of images lowered by LOWERED_BATCHED_GEMM should fit in
+// together with its outputs.
+static size_t LastLevelCacheBytes() {
+  static const size_t bytes = QueryLastLevelCacheBytes();
+  return bytes;
+}
+
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
   // Configure the kernel size, padding, stride, and inputs.
   ConvolutionParameter conv_param = this->layer_param_.convolution_param();
   force_nd_im2col_ = conv_param.force_nd_im2col();
+  conv_mode_ = conv_param.conv_mode();
+  sparse_weights_ready_ = false;
   channel_axis_ = bottom[0]->CanonicalAxisIndex(conv_param.axis());
   const int first_spatial_axis = channel_axis_ + 1;
   const int num_axes = bottom[0]->num_axes();
   num_spatial_axes_ = num_axes - first_spatial_axis;
   CHECK_GE(num_spatial_axes_, 0);
+  if (conv_mode_ == ConvolutionParameter_ConvMode_LOWERED_CCNMM) {
+    CHECK(!force_nd_im2col_ && num_spatial_axes_ == 2)
+        << "LOWERED_CCNMM is only implemented for 2D convolution.";
+  }
+  if (conv_mode_ == ConvolutionParameter_ConvMode_DIRECT_SCONV) {
+    CHECK_EQ(num_spatial_axes_, 2)
+        << "DIRECT_SCONV is only implemented for 2D convolution.";
+  }
+  if (conv_mode_ == ConvolutionParameter_ConvMode_LOWERED_INT8) {
+    CHECK(!force_nd_im2col_ && num_spatial_axes_ == 2 &&
+        !reverse_dimensions())
+        << "LOWERED_INT8 is only implemented for 2D convolution.";
+    if (this->phase_ == TRAIN) {
+      LOG(INFO) << "layer " << this->layer_param_.name()
+          << " uses LOWERED_GEMM for conv_mode LOWERED_INT8 while training";
+      conv_mode_ = ConvolutionParameter_ConvMode_LOWERED_GEMM;
+    } else {
+      CHECK_GT(conv_param.int8_input_scale(), 0)
+          << "LOWERED_INT8 needs int8_input_scale; see tools/calibrate_int8.";
+    }
+  }
+  if (conv_mode_ == ConvolutionParameter_ConvMode_LOWERED_BSRMM) {
+    CHECK(!reverse_dimensions())
+        << "LOWERED_BSRMM is only implemented for convolution.";
+  }
+  if (conv_mode_ == ConvolutionParameter_ConvMode_LOWERED_BATCHED_GEMM) {
+    CHECK(!reverse_dimensions())
+        << "LOWERED_BATCHED_GEMM is only implemented for convolution.";
+  }
+  CHECK(!conv_param.int8_fused_relu()) << "int8_fused_relu is deprecated; "
+      << "use fused_activation: RELU (see tools/upgrade_net_proto_text).";
+  if (conv_param.fused_activation() !=
+      ConvolutionParameter_FusedActivation_NO_ACTIVATION) {
+    CHECK(!reverse_dimensions() && this->phase_ == TEST)
+        << "fused_activation is only implemented for convolution inference.";
+  }
+  CHECK_GE(conv_param.input_density_threshold(), 0);
+  CHECK_LE(conv_param.input_density_threshold(), 1);
+  if (conv_param.input_density_threshold() > 0) {
+    CHECK(!force_nd_im2col_ && num_spatial_axes_ == 2 &&
+        !reverse_dimensions())
+        << "input_density_threshold is only implemented for 2D convolution.";
+  }
   vector<int> bottom_dim_blob_shape(1, num_spatial_axes_ + 1);
   vector<int> spatial_dim_blob_shape(1, std::max(num_spatial_axes_, 1));
   // Setup filter kernel dimensions (kernel_shape_).
@@ -171,6 +238,27 @@ void BaseConvolutionLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   }
   kernel_dim_ = this->blobs_[0]->count(1);
   weight_offset_ = conv_out_channels_ * kernel_dim_ / group_;
+  // The LOWERED_BSRMM block shape is the ydimen x xdimen of the first
+  // block_group_lasso of the weights, if its blocks tile the
+  // conv_out_channels_ / group_ x kernel_dim_ filters of every group.
+  bsr_block_rows_ = 0;
+  bsr_block_cols_ = 0;
+  if (!reverse_dimensions() && this->layer_param_.param_size() > 0 &&
+      this->layer_param_.param(0).block_group_lasso_size() > 0) {
+    const BlockGroupLassoSpec& block =
+        this->layer_param_.param(0).block_group_lasso(0);
+    if (conv_out_channels_ / group_ % block.ydimen() == 0 &&
+        kernel_dim_ % block.xdimen() == 0) {
+      bsr_block_rows_ = block.ydimen();
+      bsr_block_cols_ = block.xdimen();
+    }
+  }
+  if (conv_mode_ == ConvolutionParameter_ConvMode_LOWERED_BSRMM) {
+    CHECK_GT(bsr_block_rows_, 0) << "LOWERED_BSRMM needs a block_group_lasso "
+        << "in the weights' param whose blocks tile the "
+        << conv_out_channels_ / group_ << " x " << kernel_dim_
+        << " filters of a group.";
+  }
   // Propagate gradients to the parameters (as directed by backward pass).
   this->param_propagate_down_.resize(this->blobs_.size(), true);
 }
@@ -221,7 +309,8 @@ void BaseConvolutionLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   }
   // The im2col result buffer will only hold one image at a time to avoid
   // overly large memory usage. In the special case of 1x1 convolution
-  // it goes lazily unused to save memory.
+  // it goes lazily unused to save memory. It is borrowed from the Workspace,
+  // whose size is reserved here.
   col_buffer_shape_.clear();
   col_buffer_shape_.push_back(kernel_dim_ * group_);
   for (int i = 0; i < num_spatial_axes_; ++i) {
@@ -231,9 +320,38 @@ void BaseConvolutionLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
       col_buffer_shape_.push_back(output_shape_[i]);
     }
   }
-  col_buffer_.Reshape(col_buffer_shape_);
+  // DIRECT_SCONV does not lower the input, so unless gradients may be
+  // needed the (usually largest) buffer of the layer is not set up at all.
+  if (conv_mode_ != ConvolutionParameter_ConvMode_DIRECT_SCONV ||
+      reverse_dimensions() || this->phase_ == TRAIN) {
+    col_buffer_.Reshape(col_buffer_shape_);
+    if (!is_1x1_ &&
+        conv_mode_ != ConvolutionParameter_ConvMode_LOWERED_BATCHED_GEMM) {
+      Workspace::Get().Reserve(col_buffer_.count() * sizeof(Dtype));
+    }
+  }
+  // LOWERED_BATCHED_GEMM lowers as many images at once as fit in the last
+  // level cache with their outputs.
+  const size_t batched_image_bytes = sizeof(Dtype) * conv_out_spatial_dim_ *
+      (kernel_dim_ * group_ + conv_out_channels_);
+  batched_images_ = std::max(1, static_cast<int>(std::min<size_t>(num_,
+      LastLevelCacheBytes() / std::max<size_t>(batched_image_bytes, 1))));
+  if (conv_mode_ == ConvolutionParameter_ConvMode_LOWERED_BATCHED_GEMM) {
+    Workspace::Get().Reserve(batched_images_ * batched_image_bytes +
+        (is_1x1_ ? 0 : col_buffer_.count() * sizeof(Dtype)));
+  }
   bottom_dim_ = bottom[0]->count(channel_axis_);
   top_dim_ = top[0]->count(channel_axis_);
+  if (conv_mode_ == ConvolutionParameter_ConvMode_LOWERED_INT8) {
+    // the row padding is never written, so it stays zero
+    int8_input_.resize(bottom_dim_);
+    int8_image_.resize(bottom_dim_);
+    int8_rows_.assign(
+        conv_out_spatial_dim_ * caffe_int8_row_size(kernel_dim_), 0);
+  }
+  if (this->layer_param_.convolution_param().input_density_threshold() > 0) {
+    output_transposed_.Reshape(vector<int>(1, top_dim_));
+  }
   num_kernels_im2col_ = conv_in_channels_ * conv_out_spatial_dim_;
   num_kernels_col2im_ = reverse_dimensions() ? top_dim_ : bottom_dim_;
   // Set up the all ones "bias multiplier" for adding biases by BLAS
@@ -249,12 +367,71 @@ void BaseConvolutionLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::forward_cpu_gemm(const Dtype* input,
     const Dtype* weights, Dtype* output, bool skip_im2col) {
+  if (sparse_weights_ready_ &&
+      conv_mode_ == ConvolutionParameter_ConvMode_LOWERED_CCNMM) {
+    // Only lower the columns that meet a nonzero weight; they are packed
+    // group after group, so the buffer may not hold a full im2col and
+    // skip_im2col cannot be honored. The images of Forward_cpu may run
+    // concurrently, so the masks weight_cpu_squeeze made are only read.
+    Dtype* col_buffer = col_buffer_cpu();
+    conv_im2col_cpu(input, col_buffer, weight_col_mask_.cpu_data());
+    const Dtype* col_buff = col_buffer;
+    const Dtype* squeezed_weights = squeezed_weight_buffer_.cpu_data();
+    const int M = conv_out_channels_ / group_;
+    for (int g = 0; g < group_; ++g) {
+      if (left_rows_[g] > 0) {
+        caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, left_rows_[g],
+            conv_out_spatial_dim_, left_cols_[g],
+            (Dtype)1., squeezed_weights + weight_offset_ * g, col_buff,
+            (Dtype)0., output + output_offset_ * g);
+      }
+      // Move the outputs of the remaining filters back into place and zero
+      // out those of the removed ones.
+      caffe_cpu_dispatch_rows(M, conv_out_spatial_dim_,
+          output + output_offset_ * g, weight_row_mask_.cpu_data() + M * g);
+      col_buff += left_cols_[g] * conv_out_spatial_dim_;
+    }
+    return;
+  }
   const Dtype* col_buff = input;
   if (!is_1x1_) {
+    Dtype* col_buffer = col_buffer_cpu();
     if (!skip_im2col) {
-      conv_im2col_cpu(input, col_buffer_.mutable_cpu_data());
+      conv_im2col_cpu(input, col_buffer);
     }
-    col_buff = col_buffer_.cpu_data();
+    col_buff = col_buffer;
+  }
+  if (sparse_weights_ready_ &&
+      conv_mode_ == ConvolutionParameter_ConvMode_LOWERED_CSRMM) {
+    // The rows of group g start at row_offset in the single CSR matrix that
+    // holds all the filters.
+    const int M = conv_out_channels_ / group_;
+    const int* index_pointers = nz_weight_index_pointers_.cpu_data();
+    for (int g = 0; g < group_; ++g) {
+      const int row_offset = M * g;
+      const int nz_offset = index_pointers[row_offset];
+      caffe_cpu_sparse_mmcsr<Dtype>(M, conv_out_spatial_dim_, kernel_dim_,
+          (Dtype)1., nz_weight_values_.cpu_data() + nz_offset,
+          nz_weight_indices_.cpu_data() + nz_offset,
+          index_pointers + row_offset, index_pointers + row_offset + 1,
+          col_buff + col_offset_ * g, (Dtype)0., output + output_offset_ * g);
+    }
+    return;
+  }
+  if (sparse_weights_ready_ &&
+      conv_mode_ == ConvolutionParameter_ConvMode_LOWERED_BSRMM) {
+    // The block pointers are absolute, the block rows of group g start at
+    // block row M / bsr_block_rows_ * g.
+    const int M = conv_out_channels_ / group_;
+    const int* block_pointers = nz_weight_index_pointers_.cpu_data();
+    for (int g = 0; g < group_; ++g) {
+      caffe_cpu_bsrmm<Dtype>(M, conv_out_spatial_dim_, bsr_block_rows_,
+          bsr_block_cols_, nz_weight_values_.cpu_data(),
+          nz_weight_indices_.cpu_data(),
+          block_pointers + M / bsr_block_rows_ * g,
+          col_buff + col_offset_ * g, output + output_offset_ * g);
+    }
+    return;
   }
   for (int g = 0; g < group_; ++g) {
     caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, conv_out_channels_ /
@@ -264,6 +441,54 @@ void BaseConvolutionLayer<Dtype>::forward_cpu_gemm(const Dtype* input,
   }
 }
 
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::forward_cpu_batched_gemm(const Dtype* input,
+    const Dtype* weights, Dtype* output) {
+  const int rows = kernel_dim_ * group_;
+  const int M = conv_out_channels_ / group_;
+  const int spatial_dim = conv_out_spatial_dim_;
+  // The lowered block of images, then the outputs of the block, preceded by
+  // room for the im2col of an image on its way into the block.
+  const size_t block_count =
+      static_cast<size_t>(batched_images_) * spatial_dim * rows;
+  const size_t image_col_count = is_1x1_ ? 0 : col_buffer_.count();
+  Dtype* col_block = static_cast<Dtype*>(Workspace::Get().mutable_cpu_data(
+      (block_count + image_col_count + static_cast<size_t>(batched_images_) *
+      spatial_dim * conv_out_channels_) * sizeof(Dtype)));
+  Dtype* image_col = col_block + block_count;
+  Dtype* output_block = image_col + image_col_count;
+  for (int n = 0; n < num_; n += batched_images_) {
+    const int images = std::min(batched_images_, num_ - n);
+    // the columns of the block, image after image
+    const int N = images * spatial_dim;
+    for (int b = 0; b < images; ++b) {
+      const Dtype* lowered = input + static_cast<long>(n + b) * bottom_dim_;
+      if (!is_1x1_) {
+        conv_im2col_cpu(lowered, image_col);
+        lowered = image_col;
+      }
+      for (int r = 0; r < rows; ++r) {
+        caffe_copy(spatial_dim, lowered + static_cast<long>(r) * spatial_dim,
+            col_block + static_cast<long>(r) * N + b * spatial_dim);
+      }
+    }
+    for (int g = 0; g < group_; ++g) {
+      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M, N, kernel_dim_,
+          (Dtype)1., weights + weight_offset_ * g,
+          col_block + static_cast<long>(kernel_dim_) * g * N,
+          (Dtype)0., output_block + static_cast<long>(M) * g * N);
+    }
+    for (int b = 0; b < images; ++b) {
+      Dtype* image_output = output + static_cast<long>(n + b) * top_dim_;
+      for (int m = 0; m < conv_out_channels_; ++m) {
+        caffe_copy(spatial_dim,
+            output_block + static_cast<long>(m) * N + b * spatial_dim,
+            image_output + static_cast<long>(m) * spatial_dim);
+      }
+    }
+  }
+}
+
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::forward_cpu_bias(Dtype* output,
     const Dtype* bias) {
@@ -272,12 +497,32 @@ void BaseConvolutionLayer<Dtype>::forward_cpu_bias(Dtype* output,
       (Dtype)1., output);
 }
 
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::forward_cpu_activation(Dtype* output) {
+  const ConvolutionParameter& conv_param =
+      this->layer_param_.convolution_param();
+  switch (conv_param.fused_activation()) {
+  case ConvolutionParameter_FusedActivation_RELU:
+    if (conv_mode_ == ConvolutionParameter_ConvMode_LOWERED_INT8 &&
+        conv_param.fused_alpha() == 0) {
+      break;  // applied by the int8 gemm
+    }
+    caffe_cpu_relu(top_dim_, Dtype(conv_param.fused_alpha()), output);
+    break;
+  case ConvolutionParameter_FusedActivation_ELU:
+    caffe_cpu_elu(top_dim_, Dtype(conv_param.fused_alpha()), output);
+    break;
+  default:
+    break;
+  }
+}
+
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::backward_cpu_gemm(const Dtype* output,
     const Dtype* weights, Dtype* input) {
-  Dtype* col_buff = col_buffer_.mutable_cpu_data();
-  if (is_1x1_) {
-    col_buff = input;
+  Dtype* col_buff = input;
+  if (!is_1x1_) {
+    col_buff = col_buffer_cpu();
   }
   for (int g = 0; g < group_; ++g) {
     caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, kernel_dim_,
@@ -295,8 +540,9 @@ void BaseConvolutionLayer<Dtype>::weight_cpu_gemm(const Dtype* input,
     const Dtype* output, Dtype* weights) {
   const Dtype* col_buff = input;
   if (!is_1x1_) {
-    conv_im2col_cpu(input, col_buffer_.mutable_cpu_data());
-    col_buff = col_buffer_.cpu_data();
+    Dtype* col_buffer = col_buffer_cpu();
+    conv_im2col_cpu(input, col_buffer);
+    col_buff = col_buffer;
   }
   for (int g = 0; g < group_; ++g) {
     caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, conv_out_channels_ / group_,
@@ -313,6 +559,359 @@ void BaseConvolutionLayer<Dtype>::backward_cpu_bias(Dtype* bias,
       input, bias_multiplier_.cpu_data(), 1., bias);
 }
 
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::forward_cpu_sconv(const Dtype* input,
+    Dtype* output) {
+  CHECK(sparse_weights_ready_);
+  const int height = conv_input_shape_.cpu_data()[1];
+  const int width = conv_input_shape_.cpu_data()[2];
+  const int kernel_h = kernel_shape_.cpu_data()[0];
+  const int kernel_w = kernel_shape_.cpu_data()[1];
+  const int pad_h = pad_.cpu_data()[0];
+  const int pad_w = pad_.cpu_data()[1];
+  const int stride_h = stride_.cpu_data()[0];
+  const int stride_w = stride_.cpu_data()[1];
+  const int dilation_h = dilation_.cpu_data()[0];
+  const int dilation_w = dilation_.cpu_data()[1];
+  const int output_h = output_shape_[0];
+  const int output_w = output_shape_[1];
+  // For each kernel row (col), the range of output rows (cols) that fall
+  // inside the input; the loops below then need no bounds checks.
+  vector<int> output_h_begin(kernel_h), output_h_end(kernel_h);
+  for (int kh = 0; kh < kernel_h; ++kh) {
+    const int offset = kh * dilation_h - pad_h;
+    output_h_begin[kh] = std::max(0, (stride_h - 1 - offset) / stride_h);
+    output_h_end[kh] = std::min(output_h,
+        std::max(0, (height - offset + stride_h - 1) / stride_h));
+  }
+  vector<int> output_w_begin(kernel_w), output_w_end(kernel_w);
+  for (int kw = 0; kw < kernel_w; ++kw) {
+    const int offset = kw * dilation_w - pad_w;
+    output_w_begin[kw] = std::max(0, (stride_w - 1 - offset) / stride_w);
+    output_w_end[kw] = std::min(output_w,
+        std::max(0, (width - offset + stride_w - 1) / stride_w));
+  }
+  const int M = conv_out_channels_ / group_;
+  const int kernel_size = kernel_h * kernel_w;
+  const int input_channel_size = height * width;
+  const int output_channel_size = output_h * output_w;
+  const Dtype* nz_values = nz_weight_values_.cpu_data();
+  const int* nz_indices = nz_weight_indices_.cpu_data();
+  const int* index_pointers = nz_weight_index_pointers_.cpu_data();
+#pragma omp parallel for collapse(2) schedule(dynamic)
+  for (int n = 0; n < num_; ++n) {
+    for (int oc = 0; oc < conv_out_channels_; ++oc) {
+      const Dtype* input_g = input + n * bottom_dim_ +
+          (oc / M) * (conv_in_channels_ / group_) * input_channel_size;
+      Dtype* output_c = output + n * top_dim_ + oc * output_channel_size;
+      caffe_set(output_channel_size, Dtype(0), output_c);
+      for (int j = index_pointers[oc]; j < index_pointers[oc + 1]; ++j) {
+        const Dtype value = nz_values[j];
+        const int kh = (nz_indices[j] / kernel_w) % kernel_h;
+        const int kw = nz_indices[j] % kernel_w;
+        const Dtype* input_c = input_g +
+            (nz_indices[j] / kernel_size) * input_channel_size +
+            (kh * dilation_h - pad_h) * width + kw * dilation_w - pad_w;
+        const int ow_begin = output_w_begin[kw];
+        const int ow_end = output_w_end[kw];
+        for (int oh = output_h_begin[kh]; oh < output_h_end[kh]; ++oh) {
+          const Dtype* input_row = input_c + oh * stride_h * width;
+          Dtype* output_row = output_c + oh * output_w;
+          if (stride_w == 1) {
+#pragma omp simd
+            for (int ow = ow_begin; ow < ow_end; ++ow) {
+              output_row[ow] += value * input_row[ow];
+            }
+          } else {
+            for (int ow = ow_begin; ow < ow_end; ++ow) {
+              output_row[ow] += value * input_row[ow * stride_w];
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+// The transpose of im2col for an int8 image stored channels last: row p,
+// padded to row_size, holds the values the kernel meets at output pixel p,
+// ordered by kernel row, kernel column and then channel, so that every
+// kernel position copies the channels of one pixel at once.
+static void im2row_int8(const int8_t* data, const int channels,
+    const int data_channels, const int height, const int width,
+    const int kernel_h, const int kernel_w, const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w, const int dilation_h,
+    const int dilation_w, const int output_h, const int output_w,
+    const int row_size, int8_t* rows) {
+#pragma omp parallel for
+  for (int oh = 0; oh < output_h; ++oh) {
+    for (int ow = 0; ow < output_w; ++ow) {
+      int8_t* row = rows + (oh * output_w + ow) * row_size;
+      for (int kh = 0; kh < kernel_h; ++kh) {
+        const int ih = oh * stride_h - pad_h + kh * dilation_h;
+        for (int kw = 0; kw < kernel_w; ++kw) {
+          const int iw = ow * stride_w - pad_w + kw * dilation_w;
+          if (static_cast<unsigned>(ih) < static_cast<unsigned>(height) &&
+              static_cast<unsigned>(iw) < static_cast<unsigned>(width)) {
+            memcpy(row, data + (ih * width + iw) * data_channels, channels);
+          } else {
+            memset(row, 0, channels);
+          }
+          row += channels;
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::forward_cpu_int8(const Dtype* input,
+    Dtype* output) {
+  CHECK(sparse_weights_ready_);
+  const ConvolutionParameter& conv_param =
+      this->layer_param_.convolution_param();
+  const bool negative = caffe_cpu_quantize_int8(bottom_dim_,
+      Dtype(conv_param.int8_input_scale()), input, &int8_input_[0]);
+  const int height = conv_input_shape_.cpu_data()[1];
+  const int width = conv_input_shape_.cpu_data()[2];
+  const int spatial_dim = height * width;
+  // channels last
+#pragma omp parallel for
+  for (int p = 0; p < spatial_dim; ++p) {
+    for (int c = 0; c < conv_in_channels_; ++c) {
+      int8_image_[p * conv_in_channels_ + c] = int8_input_[c * spatial_dim + p];
+    }
+  }
+  const int row_size = caffe_int8_row_size(kernel_dim_);
+  const int M = conv_out_channels_ / group_;
+  const int channels = conv_in_channels_ / group_;
+  const Dtype* bias = bias_term_ ? this->blobs_[1]->cpu_data() : NULL;
+  const bool relu = conv_param.fused_activation() ==
+      ConvolutionParameter_FusedActivation_RELU &&
+      conv_param.fused_alpha() == 0;
+  for (int g = 0; g < group_; ++g) {
+    im2row_int8(&int8_image_[g * channels], channels, conv_in_channels_,
+        height, width, kernel_shape_.cpu_data()[0],
+        kernel_shape_.cpu_data()[1], pad_.cpu_data()[0], pad_.cpu_data()[1],
+        stride_.cpu_data()[0], stride_.cpu_data()[1],
+        dilation_.cpu_data()[0], dilation_.cpu_data()[1], output_shape_[0],
+        output_shape_[1], row_size, &int8_rows_[0]);
+    caffe_cpu_gemm_int8<Dtype>(false, M, conv_out_spatial_dim_, kernel_dim_,
+        &int8_weights_[M * g * row_size], &int8_rows_[0], !negative,
+        int8_output_scales_.cpu_data() + M * g, bias ? bias + M * g : NULL,
+        relu, output + output_offset_ * g);
+  }
+}
+
+template <typename Dtype>
+bool BaseConvolutionLayer<Dtype>::forward_cpu_sparse_input(const Dtype* input,
+    Dtype* output) {
+  CHECK(sparse_weights_ready_);
+  int nnz = 0;
+  for (int i = 0; i < bottom_dim_; ++i) {
+    nnz += input[i] != 0;
+  }
+  if (nnz >= this->layer_param_.convolution_param().input_density_threshold() *
+      bottom_dim_) {
+    return false;
+  }
+  const int height = conv_input_shape_.cpu_data()[1];
+  const int width = conv_input_shape_.cpu_data()[2];
+  const int kernel_h = kernel_shape_.cpu_data()[0];
+  const int kernel_w = kernel_shape_.cpu_data()[1];
+  const int pad_h = pad_.cpu_data()[0];
+  const int pad_w = pad_.cpu_data()[1];
+  const int stride_h = stride_.cpu_data()[0];
+  const int stride_w = stride_.cpu_data()[1];
+  const int dilation_h = dilation_.cpu_data()[0];
+  const int dilation_w = dilation_.cpu_data()[1];
+  const int output_w = output_shape_[1];
+  const int M = conv_out_channels_ / group_;
+  const int channels = conv_in_channels_ / group_;
+  const Dtype* weights = weights_transposed_.cpu_data();
+  Dtype* output_t = output_transposed_.mutable_cpu_data();
+  // Every output pixel gathers the nonzeros of its receptive field, so it
+  // is the sum of as many rows of the transposed filters.
+#pragma omp parallel
+  {
+    vector<int> indices(kernel_dim_);
+    vector<Dtype> values(kernel_dim_);
+#pragma omp for
+    for (int p = 0; p < conv_out_spatial_dim_; ++p) {
+      const int h_start = p / output_w * stride_h - pad_h;
+      const int w_start = p % output_w * stride_w - pad_w;
+      for (int g = 0; g < group_; ++g) {
+        int count = 0;
+        for (int c = 0; c < channels; ++c) {
+          const Dtype* image = input + (g * channels + c) * height * width;
+          for (int kh = 0; kh < kernel_h; ++kh) {
+            const int h = h_start + kh * dilation_h;
+            if (h < 0 || h >= height) { continue; }
+            for (int kw = 0; kw < kernel_w; ++kw) {
+              const int w = w_start + kw * dilation_w;
+              if (w < 0 || w >= width || image[h * width + w] == 0) {
+                continue;
+              }
+              indices[count] = (c * kernel_h + kh) * kernel_w + kw;
+              values[count] = image[h * width + w];
+              ++count;
+            }
+          }
+        }
+        caffe_cpu_sparse_input_gemv(M, count, &indices[0], &values[0],
+            weights + weight_offset_ * g,
+            output_t + p * conv_out_channels_ + M * g);
+      }
+    }
+  }
+  // back to channels first
+#pragma omp parallel for
+  for (int oc = 0; oc < conv_out_channels_; ++oc) {
+    for (int p = 0; p < conv_out_spatial_dim_; ++p) {
+      output[oc * conv_out_spatial_dim_ + p] =
+          output_t[p * conv_out_channels_ + oc];
+    }
+  }
+  return true;
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::weight_cpu_sparsify() {
+  switch (conv_mode_) {
+  case ConvolutionParameter_ConvMode_LOWERED_GEMM:
+    if (this->layer_param_.convolution_param().input_density_threshold() == 0) {
+      return;
+    }
+    weight_cpu_transpose();
+    break;
+  case ConvolutionParameter_ConvMode_LOWERED_CSRMM:
+  case ConvolutionParameter_ConvMode_DIRECT_SCONV:
+    weight_cpu_dense2csr();
+    break;
+  case ConvolutionParameter_ConvMode_LOWERED_CCNMM:
+    weight_cpu_squeeze();
+    break;
+  case ConvolutionParameter_ConvMode_LOWERED_INT8:
+    weight_cpu_quantize_int8();
+    break;
+  case ConvolutionParameter_ConvMode_LOWERED_BSRMM:
+    weight_cpu_dense2bsr();
+    break;
+  default:
+    return;
+  }
+  sparse_weights_ready_ = true;
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::weight_cpu_dense2csr() {
+  const int count = this->blobs_[0]->count();
+  const Dtype* weights = this->blobs_[0]->cpu_data();
+  int nnz = 0;
+  for (int i = 0; i < count; ++i) {
+    if (weights[i] != 0) { ++nnz; }
+  }
+  // Keep the buffers non-empty even if every filter has been pruned.
+  nz_weight_values_.Reshape(vector<int>(1, std::max(nnz, 1)));
+  nz_weight_indices_.Reshape(vector<int>(1, std::max(nnz, 1)));
+  nz_weight_index_pointers_.Reshape(vector<int>(1, conv_out_channels_ + 1));
+  caffe_cpu_sparse_dense2csr<Dtype>(conv_out_channels_, kernel_dim_,
+      this->blobs_[0]->mutable_cpu_data(),
+      nz_weight_values_.mutable_cpu_data(),
+      nz_weight_indices_.mutable_cpu_data(),
+      nz_weight_index_pointers_.mutable_cpu_data());
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::weight_cpu_dense2bsr() {
+  // Room for every block; dense2bsr only keeps those holding a nonzero.
+  const int count = this->blobs_[0]->count();
+  nz_weight_values_.Reshape(vector<int>(1, count));
+  nz_weight_indices_.Reshape(
+      vector<int>(1, count / (bsr_block_rows_ * bsr_block_cols_)));
+  nz_weight_index_pointers_.Reshape(
+      vector<int>(1, conv_out_channels_ / bsr_block_rows_ + 1));
+  const int blocks = caffe_cpu_dense2bsr<Dtype>(conv_out_channels_,
+      kernel_dim_, bsr_block_rows_, bsr_block_cols_,
+      this->blobs_[0]->cpu_data(), nz_weight_values_.mutable_cpu_data(),
+      nz_weight_indices_.mutable_cpu_data(),
+      nz_weight_index_pointers_.mutable_cpu_data());
+  DLOG(INFO) << "layer " << this->layer_param_.name() << " keeps " << blocks
+      << " of " << count / (bsr_block_rows_ * bsr_block_cols_)
+      << " weight blocks";
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::weight_cpu_squeeze() {
+  const int M = conv_out_channels_ / group_;
+  squeezed_weight_buffer_.Reshape(this->blobs_[0]->shape());
+  weight_row_mask_.Reshape(vector<int>(1, conv_out_channels_));
+  weight_col_mask_.Reshape(vector<int>(1, kernel_dim_ * group_));
+  left_rows_.resize(group_);
+  left_cols_.resize(group_);
+  const Dtype* weights = this->blobs_[0]->cpu_data();
+  Dtype* squeezed_weights = squeezed_weight_buffer_.mutable_cpu_data();
+  int* row_mask = weight_row_mask_.mutable_cpu_data();
+  int* col_mask = weight_col_mask_.mutable_cpu_data();
+  for (int g = 0; g < group_; ++g) {
+    caffe_cpu_if_all_zero(M, kernel_dim_, weights + weight_offset_ * g,
+        row_mask + M * g, false);
+    caffe_cpu_if_all_zero(M, kernel_dim_, weights + weight_offset_ * g,
+        col_mask + kernel_dim_ * g, true);
+    caffe_cpu_concatenate_rows_cols(M, kernel_dim_,
+        weights + weight_offset_ * g, squeezed_weights + weight_offset_ * g,
+        col_mask + kernel_dim_ * g, row_mask + M * g);
+    left_rows_[g] = M - caffe_cpu_asum(M, row_mask + M * g);
+    left_cols_[g] = kernel_dim_ -
+        caffe_cpu_asum(kernel_dim_, col_mask + kernel_dim_ * g);
+  }
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::weight_cpu_quantize_int8() {
+  const int row_size = caffe_int8_row_size(kernel_dim_);
+  const Dtype input_scale =
+      this->layer_param_.convolution_param().int8_input_scale();
+  const Dtype* weights = this->blobs_[0]->cpu_data();
+  const int channels = conv_in_channels_ / group_;
+  const int kernel_size = kernel_dim_ / channels;
+  int8_weights_.assign(conv_out_channels_ * row_size, 0);
+  int8_output_scales_.Reshape(vector<int>(1, conv_out_channels_));
+  Dtype* output_scales = int8_output_scales_.mutable_cpu_data();
+  vector<Dtype> filter(kernel_dim_);
+  for (int oc = 0; oc < conv_out_channels_; ++oc) {
+    // in the order of the rows im2row_int8 makes: channels last
+    Dtype max_abs = 0;
+    for (int c = 0; c < channels; ++c) {
+      for (int k = 0; k < kernel_size; ++k) {
+        const Dtype w = weights[(oc * channels + c) * kernel_size + k];
+        filter[k * channels + c] = w;
+        max_abs = std::max(max_abs, std::abs(w));
+      }
+    }
+    const Dtype weight_scale = max_abs > 0 ? 127 / max_abs : 1;
+    caffe_cpu_quantize_int8(kernel_dim_, weight_scale, &filter[0],
+        &int8_weights_[oc * row_size]);
+    output_scales[oc] = 1 / (input_scale * weight_scale);
+  }
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::weight_cpu_transpose() {
+  const Dtype* weights = this->blobs_[0]->cpu_data();
+  weights_transposed_.ReshapeLike(*this->blobs_[0]);
+  Dtype* weights_t = weights_transposed_.mutable_cpu_data();
+  const int M = conv_out_channels_ / group_;
+  for (int g = 0; g < group_; ++g) {
+    for (int m = 0; m < M; ++m) {
+      for (int k = 0; k < kernel_dim_; ++k) {
+        weights_t[weight_offset_ * g + k * M + m] =
+            weights[weight_offset_ * g + m * kernel_dim_ + k];
+      }
+    }
+  }
+}
+
 #ifndef CPU_ONLY
 
 template <typename Dtype>
@@ -320,10 +919,11 @@ void BaseConvolutionLayer<Dtype>::forward_gpu_gemm(const Dtype* input,
     const Dtype* weights, Dtype* output, bool skip_im2col) {
   const Dtype* col_buff = input;
   if (!is_1x1_) {
+    Dtype* col_buffer = col_buffer_gpu();
     if (!skip_im2col) {
-      conv_im2col_gpu(input, col_buffer_.mutable_gpu_data());
+      conv_im2col_gpu(input, col_buffer);
     }
-    col_buff = col_buffer_.gpu_data();
+    col_buff = col_buffer;
   }
   for (int g = 0; g < group_; ++g) {
     caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, conv_out_channels_ /
@@ -344,9 +944,9 @@ void BaseConvolutionLayer<Dtype>::forward_gpu_bias(Dtype* output,
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::backward_gpu_gemm(const Dtype* output,
     const Dtype* weights, Dtype* input) {
-  Dtype* col_buff = col_buffer_.mutable_gpu_data();
-  if (is_1x1_) {
-    col_buff = input;
+  Dtype* col_buff = input;
+  if (!is_1x1_) {
+    col_buff = col_buffer_gpu();
   }
   for (int g = 0; g < group_; ++g) {
     caffe_gpu_gemm<Dtype>(CblasTrans, CblasNoTrans, kernel_dim_,
@@ -364,8 +964,9 @@ void BaseConvolutionLayer<Dtype>::weight_gpu_gemm(const Dtype* input,
     const Dtype* output, Dtype* weights) {
   const Dtype* col_buff = input;
   if (!is_1x1_) {
-    conv_im2col_gpu(input, col_buffer_.mutable_gpu_data());
-    col_buff = col_buffer_.gpu_data();
+    Dtype* col_buffer = col_buffer_gpu();
+    conv_im2col_gpu(input, col_buffer);
+    col_buff = col_buffer;
   }
   for (int g = 0; g < group_; ++g) {
     caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasTrans, conv_out_channels_ / group_,
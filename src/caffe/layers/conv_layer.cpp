@@ -1,9 +1,78 @@
+#include <algorithm>
+#include <fstream>  // NOLINT(readability/streams)
+#include <string>
 #include <vector>
 
+#ifdef OPEN_MP
+#include <omp.h>
+#endif
+
 #include "caffe/layers/conv_layer.hpp"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/math_functions.hpp"
 
 namespace caffe {
 
+// FNV-1a, to key the conv_mode cache on the contents of a layer
+static uint64_t HashBytes(const void* data, size_t size,
+    uint64_t hash = 14695981039346656037ULL) {
+  const unsigned char* bytes = static_cast<const unsigned char*>(data);
+  for (size_t i = 0; i < size; ++i) {
+    hash = (hash ^ bytes[i]) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+// The CPU model and the number of threads the kernels may use, since the
+// fastest mode depends on both.
+static string CPUSignature() {
+  string model = "unknown";
+  std::ifstream cpuinfo("/proc/cpuinfo");
+  string line;
+  while (std::getline(cpuinfo, line)) {
+    if (line.compare(0, 10, "model name") == 0) {
+      model = line.substr(line.find(':') + 2);
+      break;
+    }
+  }
+  std::ostringstream signature;
+#ifdef OPEN_MP
+  signature << model << " x" << omp_get_max_threads();
+#else
+  signature << model << " x1";
+#endif
+  return signature.str();
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::WeightAlign(){
+	const LayerParameter& layerparam = this->layer_param();
+	LOG(INFO)<<"layer\t"<<layerparam.name()<<"\t"<<"has sparsity of "<< this->blobs_[0]->GetSparsity();
+
+	//disconnect connections
+	if( layerparam.connectivity_mode() == caffe::LayerParameter_ConnectivityMode_DISCONNECTED_ELTWISE ){
+		LOG(INFO)<<"all zero weights of "<<layerparam.name()<<" are frozen";
+		this->blobs_[0]->Disconnect(Blob<Dtype>::ELTWISE);
+	}else if(layerparam.connectivity_mode() == caffe::LayerParameter_ConnectivityMode_DISCONNECTED_GRPWISE){
+		LOG(INFO)<<"weights lying in all-zero groups of "<<layerparam.name()<<" are frozen";
+		this->blobs_[0]->Disconnect(Blob<Dtype>::GRPWISE, this->group_);
+	}
+
+	//the weights are final now, convert them once for sparse convolution
+	//(or pick the mode again for the new weights)
+	if( layerparam.convolution_param().conv_mode() == caffe::ConvolutionParameter_ConvMode_AUTO ){
+		this->conv_mode_ = caffe::ConvolutionParameter_ConvMode_AUTO;
+	}
+	this->weight_cpu_sparsify();
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::InvalidateWeightCaches() {
+  // The mode AUTO picked is kept: timing the candidates again at every test
+  // round of a training would cost more than it saves.
+  this->sparse_weights_ready_ = false;
+}
+
 template <typename Dtype>
 void ConvolutionLayer<Dtype>::compute_output_shape() {
   const int* kernel_shape_data = this->kernel_shape_.cpu_data();
@@ -21,22 +90,214 @@ void ConvolutionLayer<Dtype>::compute_output_shape() {
   }
 }
 
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::TuneConvMode(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  const LayerParameter& layerparam = this->layer_param();
+  if (this->phase_ == TRAIN) {
+    // The weights keep changing and backward is dense anyway.
+    LOG(INFO) << "layer " << layerparam.name()
+        << " uses LOWERED_GEMM for conv_mode AUTO while training";
+    this->conv_mode_ = ConvolutionParameter_ConvMode_LOWERED_GEMM;
+    return;
+  }
+  const Blob<Dtype>& weights = *this->blobs_[0];
+  const string cache_file =
+      layerparam.convolution_param().conv_mode_cache();
+  const string cpu = CPUSignature();
+  uint64_t hash = HashBytes(layerparam.name().data(), layerparam.name().size());
+  hash = HashBytes(bottom[0]->shape().data(),
+      bottom[0]->shape().size() * sizeof(int), hash);
+  const string conv_param =
+      layerparam.convolution_param().SerializeAsString();
+  hash = HashBytes(conv_param.data(), conv_param.size(), hash);
+  hash = HashBytes(weights.cpu_data(), weights.count() * sizeof(Dtype), hash);
+  std::ostringstream key;
+  key << std::hex << hash;
+
+  // cache lines are: cpu signature <TAB> layer key <TAB> conv mode
+  if (!cache_file.empty()) {
+    std::ifstream cache(cache_file.c_str());
+    string line;
+    while (std::getline(cache, line)) {
+      std::istringstream fields(line);
+      string cached_cpu, cached_key, cached_mode;
+      ConvolutionParameter_ConvMode mode;
+      if (std::getline(fields, cached_cpu, '\t') &&
+          std::getline(fields, cached_key, '\t') &&
+          std::getline(fields, cached_mode) && cached_cpu == cpu &&
+          cached_key == key.str() &&
+          ConvolutionParameter_ConvMode_Parse(cached_mode, &mode)) {
+        LOG(INFO) << "layer " << layerparam.name() << " uses conv_mode "
+            << cached_mode << " from " << cache_file;
+        this->conv_mode_ = mode;
+        this->sparse_weights_ready_ = false;
+        return;
+      }
+    }
+  }
+
+  // Only time the sparse modes that the weights can benefit from.
+  const int rows = weights.shape(0);
+  const int cols = weights.count(1);
+  const Dtype sparsity = this->blobs_[0]->GetSparsity();
+  const Dtype col_sparsity =
+      caffe_cpu_group_sparsity(rows, cols, weights.cpu_data(), true);
+  const Dtype row_sparsity =
+      caffe_cpu_group_sparsity(rows, cols, weights.cpu_data(), false);
+  LOG(INFO) << "layer " << layerparam.name() << " with input "
+      << bottom[0]->shape_string() << " has sparsity " << sparsity
+      << ", column sparsity " << col_sparsity
+      << ", row sparsity " << row_sparsity;
+  vector<ConvolutionParameter_ConvMode> candidates;
+  candidates.push_back(ConvolutionParameter_ConvMode_LOWERED_GEMM);
+  if (sparsity > 0) {
+    candidates.push_back(ConvolutionParameter_ConvMode_LOWERED_CSRMM);
+  }
+  if ((col_sparsity > 0 || row_sparsity > 0) &&
+      !this->force_nd_im2col_ && this->num_spatial_axes_ == 2) {
+    candidates.push_back(ConvolutionParameter_ConvMode_LOWERED_CCNMM);
+  }
+  if (sparsity > 0 && this->num_spatial_axes_ == 2) {
+    candidates.push_back(ConvolutionParameter_ConvMode_DIRECT_SCONV);
+  }
+  if (this->num_ > 1) {
+    candidates.push_back(ConvolutionParameter_ConvMode_LOWERED_BATCHED_GEMM);
+  }
+  if (this->bsr_block_rows_ > 0 && caffe_cpu_zero_blocks(rows, cols,
+      this->bsr_block_rows_, this->bsr_block_cols_, weights.cpu_data()) > 0) {
+    candidates.push_back(ConvolutionParameter_ConvMode_LOWERED_BSRMM);
+  }
+
+  const int kTimedRuns = 3;
+  CPUTimer timer;
+  ConvolutionParameter_ConvMode best_mode = candidates[0];
+  float best_time = 0;
+  for (int i = 0; i < candidates.size(); ++i) {
+    this->conv_mode_ = candidates[i];
+    this->sparse_weights_ready_ = false;
+    // warm up, which also prepares the sparse weights
+    Forward_cpu(bottom, top);
+    timer.Start();
+    for (int run = 0; run < kTimedRuns; ++run) {
+      Forward_cpu(bottom, top);
+    }
+    timer.Stop();
+    const float time = timer.MilliSeconds() / kTimedRuns;
+    LOG(INFO) << "layer " << layerparam.name() << " conv_mode "
+        << ConvolutionParameter_ConvMode_Name(candidates[i]) << ": "
+        << time << " ms";
+    if (i == 0 || time < best_time) {
+      best_mode = candidates[i];
+      best_time = time;
+    }
+  }
+  LOG(INFO) << "layer " << layerparam.name() << " uses conv_mode "
+      << ConvolutionParameter_ConvMode_Name(best_mode);
+  this->conv_mode_ = best_mode;
+  this->sparse_weights_ready_ = false;
+
+  if (!cache_file.empty()) {
+    std::ofstream cache(cache_file.c_str(), std::ios::app);
+    cache << cpu << '\t' << key.str() << '\t'
+        << ConvolutionParameter_ConvMode_Name(best_mode) << std::endl;
+    if (!cache) {
+      LOG(WARNING) << "Failed to write conv_mode cache " << cache_file;
+    }
+  }
+}
+
+// Threaded BLAS shares the columns of the gemm of an image, its output
+// pixels, among the threads, which pays off little below this many each.
+static const int kMinColumnsPerBlasThread = 256;
+// The most the partial weight gradients of the threads may take together;
+// past it fewer threads run the images of Backward_cpu.
+static const size_t kMaxWeightDiffPartialBytes = 64 << 20;
+
+template <typename Dtype>
+bool ConvolutionLayer<Dtype>::image_threads() const {
+#ifdef OPEN_MP
+  const int threads = omp_get_max_threads();
+#else
+  const int threads = 1;
+#endif
+  if (threads < 2 || this->num_ < 2) {
+    return false;
+  }
+  switch (this->layer_param_.convolution_param().batch_threading()) {
+  case ConvolutionParameter_BatchThreading_IMAGE_THREADS:
+    return true;
+  case ConvolutionParameter_BatchThreading_AUTO_THREADS:
+    return this->out_spatial_dim_ < kMinColumnsPerBlasThread * threads;
+  default:
+    return false;
+  }
+}
+
 template <typename Dtype>
 void ConvolutionLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
+  if (this->conv_mode_ == ConvolutionParameter_ConvMode_AUTO) {
+    TuneConvMode(bottom, top);
+  }
+  // Weights keep changing while training, so only a model that is not being
+  // trained can reuse the sparse copy made by WeightAlign, until its weights
+  // are shared or copied again (InvalidateWeightCaches).
+  const bool sparse_input = this->conv_mode_ ==
+      ConvolutionParameter_ConvMode_LOWERED_GEMM &&
+      this->layer_param_.convolution_param().input_density_threshold() > 0;
+  if ((this->conv_mode_ != ConvolutionParameter_ConvMode_LOWERED_GEMM ||
+      sparse_input) &&
+      (!this->sparse_weights_ready_ || this->phase_ == TRAIN)) {
+    this->weight_cpu_sparsify();
+  }
+  // Every image borrows the im2col buffer of its thread; the int8 and sparse
+  // input kernels have buffers of the layer and the direct and batched ones
+  // run all the images at once.
+  const bool batched =
+      this->conv_mode_ == ConvolutionParameter_ConvMode_LOWERED_BATCHED_GEMM;
+  const bool parallel = image_threads() && !sparse_input && !batched &&
+      this->conv_mode_ != ConvolutionParameter_ConvMode_LOWERED_INT8 &&
+      this->conv_mode_ != ConvolutionParameter_ConvMode_DIRECT_SCONV;
   const Dtype* weight = this->blobs_[0]->cpu_data();
+  const Dtype* bias = this->bias_term_ ? this->blobs_[1]->cpu_data() : NULL;
+  // The threads already share out the images, so each gemm runs on one.
+  const int blas_threads = parallel ? caffe_set_blas_num_threads(1) : 0;
   for (int i = 0; i < bottom.size(); ++i) {
     const Dtype* bottom_data = bottom[i]->cpu_data();
     Dtype* top_data = top[i]->mutable_cpu_data();
+    if (this->conv_mode_ == ConvolutionParameter_ConvMode_DIRECT_SCONV) {
+      // the direct kernel parallelizes over images itself
+      this->forward_cpu_sconv(bottom_data, top_data);
+    }
+    if (batched) {
+      this->forward_cpu_batched_gemm(bottom_data, weight, top_data);
+    }
+#pragma omp parallel for if (parallel)
     for (int n = 0; n < this->num_; ++n) {
-      this->forward_cpu_gemm(bottom_data + n * this->bottom_dim_, weight,
-          top_data + n * this->top_dim_);
-      if (this->bias_term_) {
-        const Dtype* bias = this->blobs_[1]->cpu_data();
-        this->forward_cpu_bias(top_data + n * this->top_dim_, bias);
+      if (this->conv_mode_ == ConvolutionParameter_ConvMode_LOWERED_INT8) {
+        // the int8 gemm adds the bias itself
+        this->forward_cpu_int8(bottom_data + n * this->bottom_dim_,
+            top_data + n * this->top_dim_);
+      } else {
+        if (this->conv_mode_ != ConvolutionParameter_ConvMode_DIRECT_SCONV &&
+            !batched && !(sparse_input && this->forward_cpu_sparse_input(
+                bottom_data + n * this->bottom_dim_,
+                top_data + n * this->top_dim_))) {
+          this->forward_cpu_gemm(bottom_data + n * this->bottom_dim_, weight,
+              top_data + n * this->top_dim_);
+        }
+        if (this->bias_term_) {
+          this->forward_cpu_bias(top_data + n * this->top_dim_, bias);
+        }
       }
+      // while the outputs of the image are still in cache
+      this->forward_cpu_activation(top_data + n * this->top_dim_);
     }
   }
+  if (parallel) {
+    caffe_set_blas_num_threads(blas_threads);
+  }
 }
 
 template <typename Dtype>
@@ -56,18 +317,63 @@ void ConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
       }
     }
     if (this->param_propagate_down_[0] || propagate_down[i]) {
-      for (int n = 0; n < this->num_; ++n) {
-        // gradient w.r.t. weight. Note that we will accumulate diffs.
-        if (this->param_propagate_down_[0]) {
-          this->weight_cpu_gemm(bottom_data + n * this->bottom_dim_,
-              top_diff + n * this->top_dim_, weight_diff);
+      // With the images on concurrent threads, every thread accumulates the
+      // weight gradient of its images into a partial sum of its own.
+      const int weight_count = this->blobs_[0]->count();
+#ifdef OPEN_MP
+      int threads = omp_get_max_threads();
+#else
+      int threads = 1;
+#endif
+      if (this->param_propagate_down_[0]) {
+        threads = std::min<size_t>(threads, std::max<size_t>(1,
+            kMaxWeightDiffPartialBytes / (weight_count * sizeof(Dtype))));
+      }
+      const bool parallel = image_threads() && threads > 1;
+      Dtype* partials = NULL;
+      if (parallel && this->param_propagate_down_[0]) {
+        weight_diff_partials_.Reshape(vector<int>(1, threads * weight_count));
+        partials = weight_diff_partials_.mutable_cpu_data();
+        caffe_set(weight_diff_partials_.count(), Dtype(0), partials);
+      }
+      const int blas_threads = parallel ? caffe_set_blas_num_threads(1) : 0;
+#pragma omp parallel if (parallel) num_threads(threads)
+      {
+        Dtype* thread_weight_diff = weight_diff;
+#ifdef OPEN_MP
+        if (partials) {
+          thread_weight_diff = partials + omp_get_thread_num() * weight_count;
         }
-        // gradient w.r.t. bottom data, if necessary.
-        if (propagate_down[i]) {
-          this->backward_cpu_gemm(top_diff + n * this->top_dim_, weight,
-              bottom_diff + n * this->bottom_dim_);
+#endif
+#pragma omp for
+        for (int n = 0; n < this->num_; ++n) {
+          // gradient w.r.t. weight. Note that we will accumulate diffs.
+          if (this->param_propagate_down_[0]) {
+            this->weight_cpu_gemm(bottom_data + n * this->bottom_dim_,
+                top_diff + n * this->top_dim_, thread_weight_diff);
+          }
+          // gradient w.r.t. bottom data, if necessary.
+          if (propagate_down[i]) {
+            this->backward_cpu_gemm(top_diff + n * this->top_dim_, weight,
+                bottom_diff + n * this->bottom_dim_);
+          }
         }
       }
+      if (parallel) {
+        caffe_set_blas_num_threads(blas_threads);
+      }
+#ifdef OPEN_MP
+      if (partials) {
+#pragma omp parallel for
+        for (int j = 0; j < weight_count; ++j) {
+          Dtype sum = 0;
+          for (int t = 0; t < threads; ++t) {
+            sum += partials[t * weight_count + j];
+          }
+          weight_diff[j] += sum;
+        }
+      }
+#endif
     }
   }
 }
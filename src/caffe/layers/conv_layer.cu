@@ -7,6 +7,9 @@ namespace caffe {
 template <typename Dtype>
 void ConvolutionLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
+  CHECK_EQ(this->layer_param_.convolution_param().fused_activation(),
+      ConvolutionParameter_FusedActivation_NO_ACTIVATION)
+      << "fused_activation is only implemented on the CPU.";
   const Dtype* weight = this->blobs_[0]->gpu_data();
   for (int i = 0; i < bottom.size(); ++i) {
     const Dtype* bottom_data = bottom[i]->gpu_data();
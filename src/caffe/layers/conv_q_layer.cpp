@@ -1,10 +1,65 @@
 #include <vector>
 #include <time.h>
 
+#ifdef OPEN_MP
+#include <omp.h>
+#endif
+
 #include "caffe/layers/conv_q_layer.hpp"
+#include "caffe/util/math_functions.hpp"
 
 namespace caffe {
 
+	// The outputs [begin, end) whose input o * stride - pad + offset lies in
+	// [0, size), where offset is the position of a tap in the kernel.
+	static void tap_range(const int size, const int pad, const int stride,
+			const int offset, const int output_size, int* begin, int* end) {
+		*begin = 0;
+		while (*begin < output_size && *begin * stride - pad + offset < 0) {
+			++*begin;
+		}
+		*end = output_size;
+		while (*end > *begin && (*end - 1) * stride - pad + offset >= size) {
+			--*end;
+		}
+	}
+
+	static inline int max_threads() {
+#ifdef OPEN_MP
+		return omp_get_max_threads();
+#else
+		return 1;
+#endif
+	}
+
+	template <typename Dtype>
+	void ConvolutionQLayer<Dtype>::UnpackB() {
+		const int K = this->layer_param_.convolution_param().k();
+		const int M = this->layer_param_.convolution_param().m();
+		// bits per number in B hash
+		const int BITS = (int)log2(K);
+		const int TOTAL_BITS = 32;
+		const int REST_BITS = TOTAL_BITS - BITS;
+		const int kernel_dim_ = this->kernel_shape_.cpu_data()[0] * this->kernel_shape_.cpu_data()[1];
+		const int b_shape_size = this->channels_ / M * kernel_dim_ * this->num_output_;
+		B_.Reshape(vector<int>(1, b_shape_size));
+		// hash with indexes of D columns, each number uses log2(K) bits
+		const unsigned int* B_hash = (const unsigned int*)(this->blobs_[2]->cpu_data());
+		int* B = B_.mutable_cpu_data();
+		for (int i = 0, total_bit_shift = 0; i < b_shape_size; ++i, total_bit_shift += BITS) {
+			int byte_shift = total_bit_shift / TOTAL_BITS;
+			int bit_shift = total_bit_shift % TOTAL_BITS;
+			int shift = REST_BITS - bit_shift;
+			B[i] = (int)((shift < 0 ? B_hash[byte_shift] << -shift | B_hash[byte_shift + 1] >> (TOTAL_BITS + shift) :
+									  B_hash[byte_shift] >> shift) & (K - 1));
+		}
+	}
+
+	template <typename Dtype>
+	void ConvolutionQLayer<Dtype>::WeightAlign() {
+		UnpackB();
+	}
+
 	template <typename Dtype>
 	void ConvolutionQLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
 		BaseConvolutionLayer<Dtype>::Reshape(bottom, top);
@@ -14,10 +69,11 @@ namespace caffe {
 		K = this->layer_param_.convolution_param().k();
 		M = this->layer_param_.convolution_param().m();
 		const int BITS = (int)log2(K);
-		const int TOTAL_BITS = 32;
-		const int REST_BITS = TOTAL_BITS - BITS;
-		vector<int> cache_shape_(1, K * this->channels_ / M * conv_in_spatial_dim_);
+		// one cache per thread when the images run in parallel
+		const int caches = this->num_ >= max_threads() ? max_threads() : 1;
+		vector<int> cache_shape_(1, caches * K * this->channels_ / M * conv_in_spatial_dim_);
 		cache_.Reshape(cache_shape_);
+		Workspace::Get().Reserve(cache_.count() * sizeof(Dtype));
 
 		const int kernel_h = this->kernel_shape_.cpu_data()[0];
 		const int kernel_w = this->kernel_shape_.cpu_data()[1];
@@ -32,103 +88,206 @@ namespace caffe {
 			vector<int> b_binary_shape(1, BITS * b_shape_size / (8 * sizeof(Dtype)) + (BITS * b_shape_size % (8 * sizeof(Dtype)) ? 1 : 0));
 			this->blobs_[2].reset(new Blob<Dtype>(b_binary_shape));
 		}
-		else {
-			if (B_.count() == 0) {
-				vector<int> b_shape(1, b_shape_size);
-				B_.Reshape(b_shape);
-			}
-			int* B_hash = (int*)(this->blobs_[2]->cpu_data());
-			int* B = B_.mutable_cpu_data();
-			for (int i = 0, total_bit_shift = 0; i < b_shape_size; ++i, total_bit_shift += BITS) {
-				int byte_shift = total_bit_shift / TOTAL_BITS;
-				int bit_shift = total_bit_shift % TOTAL_BITS;
-				int shift = REST_BITS - bit_shift;
-				B[i] = (int)((shift < 0 ? B_hash[byte_shift] << -shift | B_hash[byte_shift + 1] >> (TOTAL_BITS + shift) :
-										  B_hash[byte_shift] >> shift) & (K - 1));
-			}
+		// B is unpacked once; WeightAlign refreshes it when weights are loaded
+		if (B_.count() != b_shape_size) {
+			UnpackB();
+		}
+
+		const int height = this->conv_input_shape_.cpu_data()[1];
+		const int width = this->conv_input_shape_.cpu_data()[2];
+		output_h_ = this->output_shape_[0];
+		output_w_ = this->output_shape_[1];
+		row_begin_.resize(kernel_h);
+		row_end_.resize(kernel_h);
+		for (int kernel_row = 0; kernel_row < kernel_h; ++kernel_row) {
+			tap_range(height, this->pad_.cpu_data()[0], this->stride_.cpu_data()[0],
+					kernel_row * this->dilation_.cpu_data()[0], output_h_,
+					&row_begin_[kernel_row], &row_end_[kernel_row]);
+		}
+		col_begin_.resize(kernel_w);
+		col_end_.resize(kernel_w);
+		for (int kernel_col = 0; kernel_col < kernel_w; ++kernel_col) {
+			tap_range(width, this->pad_.cpu_data()[1], this->stride_.cpu_data()[1],
+					kernel_col * this->dilation_.cpu_data()[1], output_w_,
+					&col_begin_[kernel_col], &col_end_[kernel_col]);
 		}
 	}
 
 	template <typename Dtype>
-	void ConvolutionQLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+	void ConvolutionQLayer<Dtype>::forward_cpu_cache(const Dtype* input, Dtype* cache, bool parallel) {
 		const Dtype* D = this->blobs_[0]->cpu_data();
-		// hash with indexes of D columns, each number uses log2(K) bits
-		const int* B = B_.cpu_data();
+#pragma omp parallel for if (parallel)
+		for (int slice = 0; slice < this->channels_ / M; ++slice) {
+			caffe_cpu_gemm(CblasNoTrans, CblasNoTrans, K, conv_in_spatial_dim_, M, (Dtype)1.,
+					D + slice * M * K, input + slice * M * conv_in_spatial_dim_, (Dtype)0.,
+					cache + slice * K * conv_in_spatial_dim_);
+		}
+	}
 
-		const int height = this->conv_input_shape_.cpu_data()[1];
+	template <typename Dtype>
+	void ConvolutionQLayer<Dtype>::forward_cpu_channel(const Dtype* cache, const int out_channel,
+			Dtype* output) {
+		const int* B = B_.cpu_data();
 		const int width = this->conv_input_shape_.cpu_data()[2];
 		const int kernel_h = this->kernel_shape_.cpu_data()[0];
 		const int kernel_w = this->kernel_shape_.cpu_data()[1];
-		const int kernel_dim_ = kernel_h * kernel_w;
 		const int pad_h = this->pad_.cpu_data()[0];
 		const int pad_w = this->pad_.cpu_data()[1];
 		const int stride_h = this->stride_.cpu_data()[0];
 		const int stride_w = this->stride_.cpu_data()[1];
 		const int dilation_h = this->dilation_.cpu_data()[0];
 		const int dilation_w = this->dilation_.cpu_data()[1];
-		const int output_h = (height + 2 * pad_h - (dilation_h * (kernel_h - 1) + 1)) / stride_h + 1;
-		const int output_w = (width + 2 * pad_w -(dilation_w * (kernel_w - 1) + 1)) / stride_w + 1;
+		caffe_set(conv_out_spatial_dim_, this->bias_term_ ?
+				this->blobs_[1]->cpu_data()[out_channel] : Dtype(0), output);
+		for (int slice = 0; slice < this->channels_ / M; ++slice) {
+			const int* b_out_channel = &B[(slice * this->num_output_ + out_channel) * kernel_h * kernel_w];
+			const Dtype* cache_slice = cache + slice * K * conv_in_spatial_dim_;
+			for (int kernel_row = 0; kernel_row < kernel_h; ++kernel_row) {
+				for (int kernel_col = 0; kernel_col < kernel_w; ++kernel_col) {
+					const Dtype* cache_row = cache_slice +
+							b_out_channel[kernel_row * kernel_w + kernel_col] * conv_in_spatial_dim_;
+					const int col_begin = col_begin_[kernel_col];
+					const int cols = col_end_[kernel_col] - col_begin;
+					const int input_col = col_begin * stride_w - pad_w + kernel_col * dilation_w;
+					for (int output_row = row_begin_[kernel_row]; output_row < row_end_[kernel_row]; ++output_row) {
+						const int input_row = output_row * stride_h - pad_h + kernel_row * dilation_h;
+						const Dtype* in = cache_row + input_row * width + input_col;
+						Dtype* out = output + output_row * output_w_ + col_begin;
+#pragma omp simd
+						for (int i = 0; i < cols; ++i) {
+							out[i] += in[i * stride_w];
+						}
+					}
+				}
+			}
+		}
+	}
 
+	template <typename Dtype>
+	void ConvolutionQLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+		const int cache_size = K * this->channels_ / M * conv_in_spatial_dim_;
+		// Reshape made one cache per thread if there are enough images
+		const bool parallel_images = cache_.count() >= max_threads() * cache_size;
+		// bring the parameters to the host before the threads read them
+		this->blobs_[0]->cpu_data();
+		if (this->bias_term_) {
+			this->blobs_[1]->cpu_data();
+		}
 		// TODO: support for multiple bottoms and tops
 		for (int i = 0; i < bottom.size(); ++i) {
 			const Dtype* bottom_data = bottom[i]->cpu_data();
 			Dtype* top_data = top[i]->mutable_cpu_data();
+			Dtype* caches = cache_cpu();
+			if (parallel_images) {
+				// images in parallel, each thread with its own cache
+#pragma omp parallel
+				{
+#ifdef OPEN_MP
+					Dtype* cache = caches + omp_get_thread_num() * cache_size;
+#else
+					Dtype* cache = caches;
+#endif
+#pragma omp for
+					for (int n = 0; n < this->num_; ++n) {
+						forward_cpu_cache(bottom_data + n * this->bottom_dim_, cache, false);
+						for (int out_channel = 0; out_channel < this->num_output_; ++out_channel) {
+							forward_cpu_channel(cache, out_channel, top_data + n * this->top_dim_ +
+									out_channel * conv_out_spatial_dim_);
+						}
+					}
+				}
+			} else {
+				// output channels in parallel, sharing the cache of the image
+				for (int n = 0; n < this->num_; ++n) {
+					forward_cpu_cache(bottom_data + n * this->bottom_dim_, caches, true);
+#pragma omp parallel for
+					for (int out_channel = 0; out_channel < this->num_output_; ++out_channel) {
+						forward_cpu_channel(caches, out_channel, top_data + n * this->top_dim_ +
+								out_channel * conv_out_spatial_dim_);
+					}
+				}
+			}
+		}
+	}
 
+	template <typename Dtype>
+	void ConvolutionQLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
+			const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+		const Dtype* D = this->blobs_[0]->cpu_data();
+		Dtype* D_diff = this->param_propagate_down_[0] ? this->blobs_[0]->mutable_cpu_diff() : NULL;
+		const int* B = B_.cpu_data();
+		const int width = this->conv_input_shape_.cpu_data()[2];
+		const int kernel_h = this->kernel_shape_.cpu_data()[0];
+		const int kernel_w = this->kernel_shape_.cpu_data()[1];
+		const int pad_h = this->pad_.cpu_data()[0];
+		const int pad_w = this->pad_.cpu_data()[1];
+		const int stride_h = this->stride_.cpu_data()[0];
+		const int stride_w = this->stride_.cpu_data()[1];
+		const int dilation_h = this->dilation_.cpu_data()[0];
+		const int dilation_w = this->dilation_.cpu_data()[1];
+		const int slices = this->channels_ / M;
+		for (int i = 0; i < top.size(); ++i) {
+			const Dtype* top_diff = top[i]->cpu_diff();
+			const Dtype* bottom_data = bottom[i]->cpu_data();
+			Dtype* bottom_diff = propagate_down[i] ? bottom[i]->mutable_cpu_diff() : NULL;
+			if (this->bias_term_ && this->param_propagate_down_[1]) {
+				Dtype* bias_diff = this->blobs_[1]->mutable_cpu_diff();
+				for (int n = 0; n < this->num_; ++n) {
+					this->backward_cpu_bias(bias_diff, top_diff + n * this->top_dim_);
+				}
+			}
+			if (!D_diff && !bottom_diff) {
+				continue;
+			}
+			// The gradient of the cache: the top diff summed into the input
+			// pixels of every codeword. Slices own disjoint parts of it, of
+			// the bottom diff and of the codebook diff.
+			Dtype* cache_diff = cache_cpu();
 			for (int n = 0; n < this->num_; ++n) {
-				Dtype* top_data_image = &top_data[n * this->top_dim_];
-				caffe_set(this->top_dim_, (Dtype)0., top_data_image);
-				const Dtype* bottom_data_image = &bottom_data[n * this->bottom_dim_];
-
-				for (int slice = 0; slice < this->channels_ / M; ++slice) {
-					caffe_cpu_gemm(CblasNoTrans, CblasNoTrans, K, conv_in_spatial_dim_, M, (Dtype)1.,
-							D + slice * M * K, bottom_data_image + slice * M * conv_in_spatial_dim_, (Dtype)0.,
-							this->cache_.mutable_cpu_data());
-					const int* b_slice = &B[slice * this->num_output_ * kernel_dim_];
-
+				const Dtype* top_diff_image = top_diff + n * this->top_dim_;
+#pragma omp parallel for
+				for (int slice = 0; slice < slices; ++slice) {
+					Dtype* cache_slice = cache_diff + slice * K * conv_in_spatial_dim_;
+					caffe_set(K * conv_in_spatial_dim_, Dtype(0), cache_slice);
 					for (int out_channel = 0; out_channel < this->num_output_; ++out_channel) {
-						const int* b_out_channel = &b_slice[out_channel * kernel_dim_];
-						Dtype* top_data_channel = &top_data_image[out_channel * this->conv_out_spatial_dim_];
-
+						const int* b_out_channel = &B[(slice * this->num_output_ + out_channel) * kernel_h * kernel_w];
+						const Dtype* top_diff_channel = top_diff_image + out_channel * conv_out_spatial_dim_;
 						for (int kernel_row = 0; kernel_row < kernel_h; ++kernel_row) {
-							const int* b_kernel_row = &b_out_channel[kernel_row * kernel_w];
-
 							for (int kernel_col = 0; kernel_col < kernel_w; ++kernel_col) {
-								int b = b_kernel_row[kernel_col];
-								int input_row = -pad_h + kernel_row * dilation_h;
-								const Dtype* cache_row = &this->cache_.cpu_data()[b * conv_in_spatial_dim_];
-
-								for (int output_row = 0; output_row < output_h; ++output_row) {
-									if (static_cast<unsigned>(input_row) < static_cast<unsigned>(height)) {
-										const Dtype* cache_row_row = &cache_row[input_row * width];
-										Dtype* top_data_row = &top_data_channel[output_row * output_w];
-										int input_col = -pad_w + kernel_col * dilation_w;
-										for (int output_col = 0; output_col < output_w; ++output_col) {
-											if (static_cast<unsigned>(input_col) < static_cast<unsigned>(width)) {
-												top_data_row[output_col] += cache_row_row[input_col];
-											}
-											input_col += stride_w;
-										}
+								Dtype* cache_row = cache_slice +
+										b_out_channel[kernel_row * kernel_w + kernel_col] * conv_in_spatial_dim_;
+								const int col_begin = col_begin_[kernel_col];
+								const int cols = col_end_[kernel_col] - col_begin;
+								const int input_col = col_begin * stride_w - pad_w + kernel_col * dilation_w;
+								for (int output_row = row_begin_[kernel_row]; output_row < row_end_[kernel_row]; ++output_row) {
+									const int input_row = output_row * stride_h - pad_h + kernel_row * dilation_h;
+									Dtype* in = cache_row + input_row * width + input_col;
+									const Dtype* out = top_diff_channel + output_row * output_w_ + col_begin;
+#pragma omp simd
+									for (int j = 0; j < cols; ++j) {
+										in[j * stride_w] += out[j];
 									}
-									input_row += stride_h;
 								}
 							}
 						}
 					}
-				}
-
-				if (this->bias_term_) {
-					const Dtype* bias = this->blobs_[1]->cpu_data();
-					this->forward_cpu_bias(top_data_image, bias);
+					if (bottom_diff) {
+						// bottom diff (M x HW) = D^T (M x K) * cache diff (K x HW)
+						caffe_cpu_gemm(CblasTrans, CblasNoTrans, M, conv_in_spatial_dim_, K, (Dtype)1.,
+								D + slice * M * K, cache_slice, (Dtype)0.,
+								bottom_diff + n * this->bottom_dim_ + slice * M * conv_in_spatial_dim_);
+					}
+					if (D_diff) {
+						// D diff (K x M) += cache diff (K x HW) * bottom^T (HW x M)
+						caffe_cpu_gemm(CblasNoTrans, CblasTrans, K, M, conv_in_spatial_dim_, (Dtype)1.,
+								cache_slice, bottom_data + n * this->bottom_dim_ + slice * M * conv_in_spatial_dim_,
+								(Dtype)1., D_diff + slice * M * K);
+					}
 				}
 			}
 		}
 	}
 
-    
-//#ifdef CPU_ONLY
-//STUB_GPU(ConvolutionQLayer);
-//#endif
-
 INSTANTIATE_CLASS(ConvolutionQLayer);
 
 }  // namespace caffe
@@ -1,16 +1,16 @@
+#include <algorithm>
+#include <cmath>
 #include <vector>
 
 #include "caffe/filler.hpp"
 #include "caffe/layers/inner_product_layer.hpp"
 #include "caffe/util/math_functions.hpp"
-#include "caffe/util/mmio.hpp"
 
 namespace caffe {
 template <typename Dtype>
 void InnerProductLayer<Dtype>::WeightAlign(){
 	const LayerParameter& layerparam = this->layer_param();
 	LOG(INFO)<<"layer\t"<<layerparam.name()<<"\t"<<"has sparsity of "<< this->blobs_[0]->GetSparsity();
-//	this->blobs_[0]->WriteToNistMMIO(layerparam.name()+".weight");
 
 	//disconnect connections
 	if( layerparam.connectivity_mode() == caffe::LayerParameter_ConnectivityMode_DISCONNECTED_ELTWISE ){
@@ -21,6 +21,138 @@ void InnerProductLayer<Dtype>::WeightAlign(){
 		this->blobs_[0]->Disconnect(Blob<Dtype>::GRPWISE);
 	}
 
+	//the weights are final now, convert them once for sparse inner product
+	if( layerparam.inner_product_param().ip_mode() == caffe::InnerProductParameter_IpMode_CSRMM ){
+		weight_cpu_dense2csr();
+	}else if( layerparam.inner_product_param().ip_mode() == caffe::InnerProductParameter_IpMode_BSRMM ){
+		weight_cpu_dense2bsr();
+	}else if( int8_ ){
+		weight_cpu_quantize_int8();
+	}
+	sparse_input_weights_ready_ = false;
+}
+
+template <typename Dtype>
+void InnerProductLayer<Dtype>::InvalidateWeightCaches() {
+  sparse_weights_ready_ = false;
+  sparse_pattern_connected_ = false;
+  int8_weights_ready_ = false;
+  sparse_input_weights_ready_ = false;
+}
+
+// Whether weight i is kept in the CSR copy: connected if there is a mask,
+// nonzero otherwise.
+template <typename Dtype>
+static inline bool csr_keeps(const Dtype* weights, const unsigned int* mask,
+    const int i) {
+  return mask ? (mask[i >> 5] >> (i & 31)) & 1 : weights[i] != 0;
+}
+
+template <typename Dtype>
+void InnerProductLayer<Dtype>::weight_cpu_dense2csr() {
+  const Dtype* weights = this->blobs_[0]->cpu_data();
+  const unsigned int* mask = this->blobs_[0]->cpu_connectivity();
+  // weight (n, k) of the N_ x K_ matrix is stored at n * row_step + k * col_step
+  const int row_step = transpose_ ? 1 : K_;
+  const int col_step = transpose_ ? N_ : 1;
+  nz_weight_index_pointers_.Reshape(vector<int>(1, N_ + 1));
+  int* pointers = nz_weight_index_pointers_.mutable_cpu_data();
+  int nnz = 0;
+  for (int n = 0; n < N_; ++n) {
+    pointers[n] = nnz;
+    for (int k = 0; k < K_; ++k) {
+      if (csr_keeps(weights, mask, n * row_step + k * col_step)) { ++nnz; }
+    }
+  }
+  pointers[N_] = nnz;
+  // Keep the buffers non-empty even if every weight has been pruned.
+  nz_weight_values_.Reshape(vector<int>(1, std::max(nnz, 1)));
+  nz_weight_indices_.Reshape(vector<int>(1, std::max(nnz, 1)));
+  Dtype* values = nz_weight_values_.mutable_cpu_data();
+  int* indices = nz_weight_indices_.mutable_cpu_data();
+  for (int n = 0, j = 0; n < N_; ++n) {
+    for (int k = 0; k < K_; ++k) {
+      const int i = n * row_step + k * col_step;
+      if (csr_keeps(weights, mask, i)) {
+        values[j] = weights[i];
+        indices[j] = k;
+        ++j;
+      }
+    }
+  }
+  sparse_pattern_connected_ = mask != NULL;
+  sparse_weights_ready_ = true;
+}
+
+template <typename Dtype>
+void InnerProductLayer<Dtype>::weight_cpu_refresh_csr() {
+  const Dtype* weights = this->blobs_[0]->cpu_data();
+  const int row_step = transpose_ ? 1 : K_;
+  const int col_step = transpose_ ? N_ : 1;
+  const int* pointers = nz_weight_index_pointers_.cpu_data();
+  const int* indices = nz_weight_indices_.cpu_data();
+  Dtype* values = nz_weight_values_.mutable_cpu_data();
+#pragma omp parallel for
+  for (int n = 0; n < N_; ++n) {
+    for (int j = pointers[n]; j < pointers[n + 1]; ++j) {
+      values[j] = weights[n * row_step + indices[j] * col_step];
+    }
+  }
+}
+
+template <typename Dtype>
+void InnerProductLayer<Dtype>::weight_cpu_quantize_int8() {
+  const int row_size = caffe_int8_row_size(K_);
+  const Dtype input_scale =
+      this->layer_param_.inner_product_param().int8_input_scale();
+  const Dtype* weights = this->blobs_[0]->cpu_data();
+  int8_weights_.assign(N_ * row_size, 0);
+  int8_output_scales_.Reshape(vector<int>(1, N_));
+  Dtype* output_scales = int8_output_scales_.mutable_cpu_data();
+  vector<Dtype> row(K_);
+  for (int n = 0; n < N_; ++n) {
+    Dtype max_abs = 0;
+    for (int k = 0; k < K_; ++k) {
+      row[k] = weights[transpose_ ? k * N_ + n : n * K_ + k];
+      max_abs = std::max(max_abs, std::abs(row[k]));
+    }
+    const Dtype weight_scale = max_abs > 0 ? 127 / max_abs : 1;
+    caffe_cpu_quantize_int8(K_, weight_scale, &row[0],
+        &int8_weights_[n * row_size]);
+    output_scales[n] = 1 / (input_scale * weight_scale);
+  }
+  int8_weights_ready_ = true;
+}
+
+// B (N x M) = A^T, where A is M x N
+template <typename Dtype>
+static void transpose_cpu(const int M, const int N, const Dtype* A, Dtype* B) {
+#pragma omp parallel for
+  for (int j = 0; j < N; ++j) {
+    for (int i = 0; i < M; ++i) {
+      B[j * M + i] = A[i * N + j];
+    }
+  }
+}
+
+template <typename Dtype>
+void InnerProductLayer<Dtype>::weight_cpu_dense2bsr() {
+  const Dtype* weights = this->blobs_[0]->cpu_data();
+  if (transpose_) {
+    weights_transposed_.Reshape(vector<int>(1, N_ * K_));
+    transpose_cpu(K_, N_, weights, weights_transposed_.mutable_cpu_data());
+    weights = weights_transposed_.cpu_data();
+  }
+  // Room for every block; dense2bsr only keeps those holding a nonzero.
+  nz_weight_values_.Reshape(vector<int>(1, N_ * K_));
+  nz_weight_indices_.Reshape(
+      vector<int>(1, N_ * K_ / (bsr_block_rows_ * bsr_block_cols_)));
+  nz_weight_index_pointers_.Reshape(vector<int>(1, N_ / bsr_block_rows_ + 1));
+  caffe_cpu_dense2bsr<Dtype>(N_, K_, bsr_block_rows_, bsr_block_cols_,
+      weights, nz_weight_values_.mutable_cpu_data(),
+      nz_weight_indices_.mutable_cpu_data(),
+      nz_weight_index_pointers_.mutable_cpu_data());
+  sparse_weights_ready_ = true;
 }
 
 template <typename Dtype>
@@ -69,9 +201,51 @@ void InnerProductLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
     }
   }  // parameter initialization
   this->param_propagate_down_.resize(this->blobs_.size(), true);
-#ifdef USE_SNAPSHOT_FEATURE
-  num_forward_image_ = 0;
-#endif
+  sparse_weights_ready_ = false;
+  sparse_pattern_connected_ = false;
+  const InnerProductParameter& ip_param =
+      this->layer_param_.inner_product_param();
+  int8_ = ip_param.ip_mode() == InnerProductParameter_IpMode_INT8;
+  if (int8_ && this->phase_ == TRAIN) {
+    LOG(INFO) << "layer " << this->layer_param_.name()
+        << " uses ip_mode GEMM for ip_mode INT8 while training";
+    int8_ = false;
+  } else if (int8_) {
+    CHECK_GT(ip_param.int8_input_scale(), 0)
+        << "ip_mode INT8 needs int8_input_scale; see tools/calibrate_int8.";
+  }
+  CHECK(!ip_param.int8_fused_relu()) << "int8_fused_relu is deprecated; "
+      << "use fused_activation: RELU (see tools/upgrade_net_proto_text).";
+  CHECK(ip_param.fused_activation() ==
+      ConvolutionParameter_FusedActivation_NO_ACTIVATION ||
+      this->phase_ == TEST)
+      << "fused_activation is only implemented for inference.";
+  int8_weights_ready_ = false;
+  CHECK_GE(ip_param.input_density_threshold(), 0);
+  CHECK_LE(ip_param.input_density_threshold(), 1);
+  sparse_input_ = ip_param.input_density_threshold() > 0;
+  CHECK(!sparse_input_ ||
+      ip_param.ip_mode() == InnerProductParameter_IpMode_GEMM)
+      << "input_density_threshold is only implemented by ip_mode GEMM.";
+  sparse_input_weights_ready_ = false;
+  bsr_block_rows_ = 0;
+  bsr_block_cols_ = 0;
+  if (ip_param.ip_mode() == InnerProductParameter_IpMode_BSRMM) {
+    CHECK(this->layer_param_.param_size() > 0 &&
+        this->layer_param_.param(0).block_group_lasso_size() > 0)
+        << "ip_mode BSRMM takes its block shape from the block_group_lasso "
+        << "of the weights' param.";
+    // the block shape is given over the weights as stored, K_ x N_ if
+    // transpose_
+    const BlockGroupLassoSpec& block =
+        this->layer_param_.param(0).block_group_lasso(0);
+    bsr_block_rows_ = transpose_ ? block.xdimen() : block.ydimen();
+    bsr_block_cols_ = transpose_ ? block.ydimen() : block.xdimen();
+    CHECK_EQ(N_ % bsr_block_rows_, 0) << "ip_mode BSRMM blocks of "
+        << bsr_block_rows_ << " outputs do not tile " << N_ << " outputs.";
+    CHECK_EQ(K_ % bsr_block_cols_, 0) << "ip_mode BSRMM blocks of "
+        << bsr_block_cols_ << " inputs do not tile " << K_ << " inputs.";
+  }
 }
 
 template <typename Dtype>
@@ -98,6 +272,55 @@ void InnerProductLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
     bias_multiplier_.Reshape(bias_shape);
     caffe_set(M_, Dtype(1), bias_multiplier_.mutable_cpu_data());
   }
+  const InnerProductParameter_IpMode ip_mode =
+      this->layer_param_.inner_product_param().ip_mode();
+  if ((ip_mode == InnerProductParameter_IpMode_CSRMM ||
+      ip_mode == InnerProductParameter_IpMode_BSRMM) && M_ > 1) {
+    bottom_transposed_.Reshape(vector<int>(1, K_ * M_));
+    top_transposed_.Reshape(vector<int>(1, N_ * M_));
+  }
+  if (int8_ && int8_bottom_.size() != M_ * caffe_int8_row_size(K_)) {
+    // the row padding is never written, so it stays zero
+    int8_bottom_.assign(M_ * caffe_int8_row_size(K_), 0);
+  }
+  if (sparse_input_) {
+    nz_bottom_indices_.Reshape(vector<int>(1, M_ * K_));
+    nz_bottom_values_.Reshape(vector<int>(1, M_ * K_));
+    nz_bottom_counts_.resize(M_);
+  }
+}
+
+template <typename Dtype>
+bool InnerProductLayer<Dtype>::forward_cpu_sparse_input(
+    const Dtype* bottom_data, Dtype* top_data) {
+  int* indices = nz_bottom_indices_.mutable_cpu_data();
+  Dtype* values = nz_bottom_values_.mutable_cpu_data();
+  long nnz = 0;  // NOLINT(runtime/int)
+  for (int m = 0; m < M_; ++m) {
+    nz_bottom_counts_[m] = caffe_cpu_compress_nonzeros(K_,
+        bottom_data + m * K_, indices + m * K_, values + m * K_);
+    nnz += nz_bottom_counts_[m];
+  }
+  if (nnz >= this->layer_param_.inner_product_param().input_density_threshold()
+      * M_ * K_) {
+    return false;
+  }
+  // the weights as K_ rows of N_ outputs
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  if (!transpose_) {
+    if (!sparse_input_weights_ready_ || this->phase_ == TRAIN) {
+      weights_transposed_.Reshape(vector<int>(1, K_ * N_));
+      transpose_cpu(N_, K_, weight, weights_transposed_.mutable_cpu_data());
+      sparse_input_weights_ready_ = true;
+    }
+    weight = weights_transposed_.cpu_data();
+  }
+#pragma omp parallel for
+  for (int m = 0; m < M_; ++m) {
+    caffe_cpu_sparse_input_gemv<Dtype>(N_, nz_bottom_counts_[m],
+        indices + m * K_, values + m * K_, weight, top_data + m * N_);
+  }
+  return true;
 }
 
 template <typename Dtype>
@@ -105,49 +328,149 @@ void InnerProductLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
-  const Dtype* weight = this->blobs_[0]->cpu_data();
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, transpose_ ? CblasNoTrans : CblasTrans,
-      M_, N_, K_, (Dtype)1.,
-      bottom_data, weight, (Dtype)0., top_data);
-  if (bias_term_) {
+  // a RELU without slope is applied by the int8 gemm
+  bool relu_in_gemm = false;
+  if (int8_) {
+    if (!int8_weights_ready_) {
+      weight_cpu_quantize_int8();
+    }
+    const InnerProductParameter& ip_param =
+        this->layer_param_.inner_product_param();
+    const int row_size = caffe_int8_row_size(K_);
+    relu_in_gemm = ip_param.fused_activation() ==
+        ConvolutionParameter_FusedActivation_RELU &&
+        ip_param.fused_alpha() == 0;
+    bool negative = false;
+    for (int m = 0; m < M_; ++m) {
+      negative |= caffe_cpu_quantize_int8(K_, Dtype(ip_param.int8_input_scale()),
+          bottom_data + m * K_, &int8_bottom_[m * row_size]);
+    }
+    // top^T (N_ x M_), stored transposed, with the bias added by the gemm
+    caffe_cpu_gemm_int8<Dtype>(true, N_, M_, K_, &int8_weights_[0],
+        &int8_bottom_[0], !negative, int8_output_scales_.cpu_data(),
+        bias_term_ ? this->blobs_[1]->cpu_data() : NULL,
+        relu_in_gemm, top_data);
+  } else if (this->layer_param_.inner_product_param().ip_mode() ==
+      InnerProductParameter_IpMode_CSRMM) {
+    // Weights keep changing while training. A connectivity mask fixes the
+    // pattern, so then only the values need to be copied again.
+    if (!sparse_weights_ready_) {
+      weight_cpu_dense2csr();
+    } else if (this->phase_ == TRAIN) {
+      if (sparse_pattern_connected_) {
+        weight_cpu_refresh_csr();
+      } else {
+        weight_cpu_dense2csr();
+      }
+    }
+    const Dtype* values = nz_weight_values_.cpu_data();
+    const int* indices = nz_weight_indices_.cpu_data();
+    const int* pointers = nz_weight_index_pointers_.cpu_data();
+    if (M_ == 1) {
+      caffe_cpu_sparse_csrmv<Dtype>(N_, values, indices, pointers,
+          bottom_data, top_data);
+    } else {
+      // top^T (N_ x M_) = W (N_ x K_) * bottom^T (K_ x M_)
+      transpose_cpu(M_, K_, bottom_data, bottom_transposed_.mutable_cpu_data());
+      caffe_cpu_sparse_mmcsr<Dtype>(N_, M_, K_, (Dtype)1.,
+          values, indices, pointers, pointers + 1,
+          bottom_transposed_.cpu_data(), (Dtype)0.,
+          top_transposed_.mutable_cpu_data());
+      transpose_cpu(N_, M_, top_transposed_.cpu_data(), top_data);
+    }
+  } else if (this->layer_param_.inner_product_param().ip_mode() ==
+      InnerProductParameter_IpMode_BSRMM) {
+    if (!sparse_weights_ready_ || this->phase_ == TRAIN) {
+      weight_cpu_dense2bsr();
+    }
+    const Dtype* values = nz_weight_values_.cpu_data();
+    const int* indices = nz_weight_indices_.cpu_data();
+    const int* pointers = nz_weight_index_pointers_.cpu_data();
+    if (M_ == 1) {
+      caffe_cpu_bsrmm<Dtype>(N_, 1, bsr_block_rows_, bsr_block_cols_,
+          values, indices, pointers, bottom_data, top_data);
+    } else {
+      // top^T (N_ x M_) = W (N_ x K_) * bottom^T (K_ x M_)
+      transpose_cpu(M_, K_, bottom_data, bottom_transposed_.mutable_cpu_data());
+      caffe_cpu_bsrmm<Dtype>(N_, M_, bsr_block_rows_, bsr_block_cols_,
+          values, indices, pointers, bottom_transposed_.cpu_data(),
+          top_transposed_.mutable_cpu_data());
+      transpose_cpu(N_, M_, top_transposed_.cpu_data(), top_data);
+    }
+  } else if (!sparse_input_ ||
+      !forward_cpu_sparse_input(bottom_data, top_data)) {
+    const Dtype* weight = this->blobs_[0]->cpu_data();
+    if (M_ == 1) {
+      // a gemm of a single row is much slower than gemv in some BLAS
+      caffe_cpu_gemv<Dtype>(transpose_ ? CblasTrans : CblasNoTrans,
+          transpose_ ? K_ : N_, transpose_ ? N_ : K_, (Dtype)1.,
+          weight, bottom_data, (Dtype)0., top_data);
+    } else {
+      caffe_cpu_gemm<Dtype>(CblasNoTrans,
+          transpose_ ? CblasNoTrans : CblasTrans, M_, N_, K_, (Dtype)1.,
+          bottom_data, weight, (Dtype)0., top_data);
+    }
+  }
+  if (bias_term_ && !int8_) {
     caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, N_, 1, (Dtype)1.,
         bias_multiplier_.cpu_data(),
         this->blobs_[1]->cpu_data(), (Dtype)1., top_data);
   }
-#ifdef USE_SNAPSHOT_FEATURE
-	  if(num_forward_image_ < 5){
-		ostringstream filename_stream;
-		filename_stream << this->layer_param().name() <<".feature" << num_forward_image_;
-		MM_typecode matcode;
-		FILE * fp = fopen(filename_stream.str().c_str(), "w+");
-		mm_initialize_typecode(&matcode);
-		mm_set_matrix(&matcode);
-		mm_set_array(&matcode);
-		mm_set_real(&matcode);
-		mm_set_general(&matcode);
-
-		mm_write_banner(fp, matcode);
-		mm_write_mtx_array_size(fp, M_, K_);
-		for (int col=0; col<K_; col++) {
-			for (int row=0; row<M_; row++) {
-				fprintf(fp, "%20g\n", (double)(*(bottom_data + row * K_ + col)) );
-			}
-		}
-		fclose(fp);
-		num_forward_image_ += 1;
-	  }
-#endif
+  const InnerProductParameter& ip_param =
+      this->layer_param_.inner_product_param();
+  switch (ip_param.fused_activation()) {
+  case ConvolutionParameter_FusedActivation_RELU:
+    if (!relu_in_gemm) {
+      caffe_cpu_relu(M_ * N_, Dtype(ip_param.fused_alpha()), top_data);
+    }
+    break;
+  case ConvolutionParameter_FusedActivation_ELU:
+    caffe_cpu_elu(M_ * N_, Dtype(ip_param.fused_alpha()), top_data);
+    break;
+  default:
+    break;
+  }
 }
 
 template <typename Dtype>
 void InnerProductLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     const vector<bool>& propagate_down,
     const vector<Blob<Dtype>*>& bottom) {
+  const bool sparse = sparse_weights_ready_ &&
+      this->layer_param_.inner_product_param().ip_mode() ==
+      InnerProductParameter_IpMode_CSRMM;
   if (this->param_propagate_down_[0]) {
     const Dtype* top_diff = top[0]->cpu_diff();
     const Dtype* bottom_data = bottom[0]->cpu_data();
     // Gradient with respect to weight
-    if (transpose_) {
+    if (sparse && sparse_pattern_connected_) {
+      // Only the connected weights get a gradient; the others stay frozen.
+      const Dtype* bottom_t = bottom_data;
+      const Dtype* top_diff_t = top_diff;
+      if (M_ > 1) {
+        transpose_cpu(M_, K_, bottom_data, bottom_transposed_.mutable_cpu_data());
+        transpose_cpu(M_, N_, top_diff, top_transposed_.mutable_cpu_data());
+        bottom_t = bottom_transposed_.cpu_data();
+        top_diff_t = top_transposed_.cpu_data();
+      }
+      const int* indices = nz_weight_indices_.cpu_data();
+      const int* pointers = nz_weight_index_pointers_.cpu_data();
+      const int row_step = transpose_ ? 1 : K_;
+      const int col_step = transpose_ ? N_ : 1;
+      Dtype* weight_diff = this->blobs_[0]->mutable_cpu_diff();
+#pragma omp parallel for
+      for (int n = 0; n < N_; ++n) {
+        const Dtype* top_diff_n = top_diff_t + n * M_;
+        for (int j = pointers[n]; j < pointers[n + 1]; ++j) {
+          const Dtype* bottom_k = bottom_t + indices[j] * M_;
+          Dtype sum = 0;
+          for (int m = 0; m < M_; ++m) {
+            sum += top_diff_n[m] * bottom_k[m];
+          }
+          weight_diff[n * row_step + indices[j] * col_step] += sum;
+        }
+      }
+    } else if (transpose_) {
       caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans,
           K_, N_, M_,
           (Dtype)1., bottom_data, top_diff,
@@ -169,7 +492,25 @@ void InnerProductLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   if (propagate_down[0]) {
     const Dtype* top_diff = top[0]->cpu_diff();
     // Gradient with respect to bottom data
-    if (transpose_) {
+    if (sparse) {
+      // bottom_diff (M_ x K_) = top_diff (M_ x N_) * W (N_ x K_)
+      const Dtype* values = nz_weight_values_.cpu_data();
+      const int* indices = nz_weight_indices_.cpu_data();
+      const int* pointers = nz_weight_index_pointers_.cpu_data();
+      Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
+      caffe_set(M_ * K_, Dtype(0), bottom_diff);
+#pragma omp parallel for
+      for (int m = 0; m < M_; ++m) {
+        Dtype* bottom_diff_m = bottom_diff + m * K_;
+        for (int n = 0; n < N_; ++n) {
+          const Dtype t = top_diff[m * N_ + n];
+          if (t == 0) { continue; }
+          for (int j = pointers[n]; j < pointers[n + 1]; ++j) {
+            bottom_diff_m[indices[j]] += t * values[j];
+          }
+        }
+      }
+    } else if (transpose_) {
       caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans,
           M_, K_, N_,
           (Dtype)1., top_diff, this->blobs_[0]->cpu_data(),
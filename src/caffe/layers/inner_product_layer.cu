@@ -9,6 +9,9 @@ namespace caffe {
 template <typename Dtype>
 void InnerProductLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
+  CHECK_EQ(this->layer_param_.inner_product_param().fused_activation(),
+      ConvolutionParameter_FusedActivation_NO_ACTIVATION)
+      << "fused_activation is only implemented on the CPU.";
   const Dtype* bottom_data = bottom[0]->gpu_data();
   Dtype* top_data = top[0]->mutable_gpu_data();
   const Dtype* weight = this->blobs_[0]->gpu_data();
@@ -1,11 +1,19 @@
+#include <algorithm>
 #include <vector>
 
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
 #include "caffe/filler.hpp"
 #include "caffe/layers/inner_product_q_layer.hpp"
 #include "caffe/util/math_functions.hpp"
 
 namespace caffe {
 
+    // outputs gathered together by the ADC kernel, one AVX2 register of floats
+    static const int ADC_GROUP = 8;
+
     template <typename Dtype>
     void InnerProductQLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
                                                const vector<Blob<Dtype>*>& top) {
@@ -16,6 +24,8 @@ namespace caffe {
         num_output = this->layer_param_.inner_product_q_param().num_output();
         const int axis = bottom[0]->CanonicalAxisIndex(this->layer_param_.inner_product_q_param().axis());
         num_input = bottom[0]->count(axis);
+        CHECK_EQ(num_input % M, 0) << "Input size must be a multiple of m.";
+        CHECK_LE(K, 256) << "Codeword indices must fit in a byte.";
         // Check if we need to set up the weights
         if (this->blobs_.size() > 0) {
             LOG(INFO) << "Skipping parameter initialization";
@@ -29,15 +39,57 @@ namespace caffe {
             vector<int> bias_shape(1, num_output);
             this->blobs_[1].reset(new Blob<Dtype>(bias_shape));
             int b_shape_size = num_output * num_input / M;
-            vector<int> b_shape(1, BITS * b_shape_size / (TOTAL_BITS * sizeof(Dtype)) + BITS * b_shape_size % (TOTAL_BITS * sizeof(Dtype)));
+            vector<int> b_shape(1, BITS * b_shape_size / (TOTAL_BITS * sizeof(Dtype)) + (BITS * b_shape_size % (TOTAL_BITS * sizeof(Dtype)) ? 1 : 0));
             this->blobs_[2].reset(new Blob<Dtype>(b_shape));
         }
         this->param_propagate_down_.resize(this->blobs_.size(), true);
+        // the packed codeword indices are not differentiable
+        this->param_propagate_down_[2] = false;
+    }
+
+    template <typename Dtype>
+    void InnerProductQLayer<Dtype>::UnpackB() {
+        const int K = this->layer_param_.inner_product_q_param().k();
+        const int M = this->layer_param_.inner_product_q_param().m();
+        // bits per number in B hash
+        const int BITS = log2(K);
+        const int TOTAL_BITS = 32;
+        const int REST_BITS = TOTAL_BITS - BITS;
+        const int b_size = num_output * num_input / M;
+        B_.Reshape(vector<int>(1, b_size));
+        // hash with indexes of D columns, each number uses log2(K) bits
+        const unsigned int* B_hash = (const unsigned int*)(this->blobs_[2]->cpu_data());
+        int* B = B_.mutable_cpu_data();
+        for (int i = 0, total_bit_shift = 0; i < b_size; ++i, total_bit_shift += BITS) {
+            int byte_shift = total_bit_shift / TOTAL_BITS;
+            int bit_shift = total_bit_shift % TOTAL_BITS;
+            int shift = REST_BITS - bit_shift;
+            B[i] = (int)((shift < 0 ? B_hash[byte_shift] << -shift | B_hash[byte_shift + 1] >> (TOTAL_BITS + shift) :
+                                      B_hash[byte_shift] >> shift) & (K - 1));
+        }
+        // regroup by ADC_GROUP outputs: within a group, the codes of one
+        // subspace are ADC_GROUP consecutive bytes; the last group is padded
+        const int num_slices = num_input / M;
+        const int num_groups = (num_output + ADC_GROUP - 1) / ADC_GROUP;
+        codes_.assign(num_groups * num_slices * ADC_GROUP, 0);
+        for (int s = 0; s < num_slices; ++s) {
+            for (int l = 0; l < num_output; ++l) {
+                codes_[(l / ADC_GROUP * num_slices + s) * ADC_GROUP + l % ADC_GROUP] =
+                        static_cast<unsigned char>(B[s * num_output + l]);
+            }
+        }
+    }
+
+    template <typename Dtype>
+    void InnerProductQLayer<Dtype>::WeightAlign() {
+        UnpackB();
     }
 
     template <typename Dtype>
     void InnerProductQLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
                                             const vector<Blob<Dtype>*>& top) {
+        const int K = this->layer_param_.inner_product_q_param().k();
+        const int M = this->layer_param_.inner_product_q_param().m();
         // Figure out the dimensions
         const int axis = bottom[0]->CanonicalAxisIndex(
                 this->layer_param_.inner_product_q_param().axis());
@@ -46,13 +98,43 @@ namespace caffe {
             << "Input size incompatible with inner product parameters.";
         batch_size = bottom[0]->count(0, axis);
         vector<int> top_shape = bottom[0]->shape();
-        top_shape.resize(2);
+        top_shape.resize(axis + 1);
         top_shape[axis] = num_output;
         top[0]->Reshape(top_shape);
 
-        vector<int> bias_shape(1, num_input);
+        // B is unpacked once; WeightAlign refreshes it when weights are loaded
+        if (B_.count() != num_output * num_input / M) {
+            UnpackB();
+        }
+        vector<int> slices_shape(3);
+        slices_shape[0] = num_input / M;
+        slices_shape[1] = batch_size;
+        slices_shape[2] = M;
+        input_slices_.Reshape(slices_shape);
+        vector<int> products_shape(2);
+        products_shape[0] = batch_size;
+        products_shape[1] = K;
+        codeword_products_.Reshape(products_shape);
+        vector<int> tables_shape(2);
+        tables_shape[0] = num_input / M;
+        tables_shape[1] = K;
+        lookup_tables_.Reshape(tables_shape);
+
+        vector<int> bias_shape(1, batch_size);
         bias_multiplier_.Reshape(bias_shape);
-        caffe_set(num_input, Dtype(1), bias_multiplier_.mutable_cpu_data());
+        caffe_set(batch_size, Dtype(1), bias_multiplier_.mutable_cpu_data());
+    }
+
+    // regroups batch_size x num_input into (num_input / M) x batch_size x M
+    template <typename Dtype>
+    static void gather_slices(const int batch_size, const int num_input, const int M,
+                              const Dtype* x, Dtype* slices) {
+        for (int j = 0; j < num_input; j += M) {
+            Dtype* slice = slices + j * batch_size;
+            for (int i = 0; i < batch_size; ++i) {
+                caffe_copy(M, x + i * num_input + j, slice + i * M);
+            }
+        }
     }
 
     template <typename Dtype>
@@ -60,140 +142,213 @@ namespace caffe {
                                                 const vector<Blob<Dtype>*>& top) {
         // number of columns in the reduced weights matrix
         const int K = this->layer_param_.inner_product_q_param().k();
-        // bits per number in B hash
-        const int BITS = log2(K);
-        const int TOTAL_BITS = 32;
-        const int REST_BITS = TOTAL_BITS - BITS;
         // number of lines in the slices of the source matrix
         const int M = this->layer_param_.inner_product_q_param().m();
 
-        // input image batch
         const Dtype* bottom_data = bottom[0]->cpu_data();
-        // output image batch
         Dtype* top_data = top[0]->mutable_cpu_data();
-        // reduced weights matrix
-        const Dtype* D = this->blobs_[0]->cpu_data();
-        // free member weights
         const Dtype* bias = this->blobs_[1]->cpu_data();
-        // hash with indexes of D columns, each number uses log2(K) bits
-        int* B_hash = (int*)(this->blobs_[2]->cpu_data());
-        // D columns indexes unpacked from hash
-        unsigned char* B = new unsigned char[num_output * num_input / M];
-        for (int i = 0, total_bit_shift = 0; i < num_output * num_input / M; ++i, total_bit_shift += BITS) {
-            int byte_shift = total_bit_shift / TOTAL_BITS;
-            int bit_shift = total_bit_shift % TOTAL_BITS;
-            int shift = REST_BITS - bit_shift;
-            B[i] = (unsigned char)((shift < 0 ? B_hash[byte_shift] << -shift | B_hash[byte_shift + 1] >> (TOTAL_BITS + shift) :
-                                      B_hash[byte_shift] >> shift) & (K - 1));
-        }
 
-        // result of the multiplication of a slice of the source matrix on a D slice
-	
-#define BATCHING
-//#define INNER_CLOCK
-
-#ifdef BATCHING
-	Dtype *batched_input = new Dtype[batch_size * M];
-	caffe_set(batch_size * M, Dtype(0), batched_input);
-	Dtype *batched_output = new Dtype[batch_size * K];
-	Dtype *new_d = new Dtype[M * K];
-#ifdef INNER_CLOCK
-	time_t sum_transp = 0;
-	time_t sum_mult = 0;
-	time_t sum_batch = 0;
-	time_t sum_add = 0;
-#endif
+        const InnerProductQParameter_Engine engine =
+                this->layer_param_.inner_product_q_param().engine();
+        if (engine == InnerProductQParameter_Engine_ADC ||
+            (engine == InnerProductQParameter_Engine_DEFAULT && batch_size == 1)) {
+            Forward_cpu_adc(bottom_data, top_data);
+        } else {
+            // reduced weights matrix, an M x K codebook per subspace
+            const Dtype* D = this->blobs_[0]->cpu_data();
+            // D columns indexes, num_output per subspace
+            const int* B = B_.cpu_data();
 
-	volatile Dtype not_optimized = 0.0;
-	for (int j = 0; j < num_input; j += M) {
-#ifdef INNER_CLOCK
-	    time_t cur_t = clock();
-	    time_t prev_t;
-#endif
-	    for (int i = 0; i < batch_size; ++i) {
-	        for (int l = 0; l < M; ++l) {
-		    batched_input[i * M + l] = bottom_data[i * num_input + j + l];
-		}
-	    }
-#ifdef INNER_CLOCK
-	    prev_t = cur_t;
-	    cur_t=clock();
-	    sum_batch += cur_t - prev_t;
-#endif
-	    const Dtype *d = D + K * j;
-	    for (int i = 0; i < K; ++i) {
-	        for (int j = 0; j < M; ++j) {
-		    new_d[i * M + j] = d[j * K + i];
-	        }
-	    }
-#ifdef INNER_CLOCK
-	    prev_t = cur_t;
-	    cur_t=clock();
-	    sum_transp += cur_t - prev_t;
-#endif
-	    caffe_cpu_gemm(CblasNoTrans, CblasTrans, 
-			    batch_size, M, K,
-			    (Dtype)1., batched_input,new_d, (Dtype)0., batched_output);
-#ifdef INNER_CLOCK
-	    prev_t = cur_t;
-	    cur_t=clock();
-	    sum_mult += cur_t - prev_t;
-#endif
-	    const int j_shift = j / M * num_output;
-	    //not_optimized += B[j_shift];
-	    for (int i = 0; i < batch_size; ++i) {
-		const int i_shift = i * num_output;
-		const int i_k_shift = K * i;
-		not_optimized += batched_output[i_k_shift];
-		for (int l = 0; l < num_output; ++l) {
-		    top_data[i_shift + l] += batched_output[i_k_shift + B[j_shift + l]];
-		}
-	    }
-#ifdef INNER_CLOCK
-	    prev_t = cur_t;
-	    cur_t=clock();
-	    sum_add += cur_t - prev_t;
-#endif
-	}
-#ifdef INNER_CLOCK
-	LOG(ERROR) << "TRANSPOSE: " << 1000.0 * sum_transp / CLOCKS_PER_SEC; 
-	LOG(ERROR) << " MULTIPLY: " << 1000.0 * sum_mult / CLOCKS_PER_SEC; 
-	LOG(ERROR) << " BATCHING: " << 1000.0 * sum_batch / CLOCKS_PER_SEC; 
-	LOG(ERROR) << " ADDITION: " << 1000.0 * sum_add / CLOCKS_PER_SEC << "\n";
-#endif	
-	delete[] batched_input;
-	delete[] batched_output;
-#else //BATCHING
-        Dtype *output = new Dtype[K];
-        caffe_set(K, Dtype(0), output);
-        // the most time-consuming part of code
-        for (int i = 0; i < batch_size; ++i) {
-            caffe_set(num_output, Dtype(0), top_data + i * num_output);
-            for (int j = 0; j < num_input / M; ++j) {
-                // subvector of the source image vector
-                const Dtype *s = bottom_data + i * num_input + j * M;
-                // submatrix of the reduced weights matrix
-                const Dtype *d = D + K * M * j;
-                // multiplies vector on matrix
-                caffe_cpu_gemv(CblasTrans, M, K, (Dtype)1., d, s, (Dtype)0., output);
-
-                for (int l = 0; l < num_output; ++l) {
-                    top_data[i * num_output + l] += output[B[j * num_output + l]];
+            // a single image needs no regrouping
+            const Dtype* slices = bottom_data;
+            if (batch_size > 1) {
+                gather_slices(batch_size, num_input, M, bottom_data,
+                              input_slices_.mutable_cpu_data());
+                slices = input_slices_.cpu_data();
+            }
+            Dtype* products = codeword_products_.mutable_cpu_data();
+            caffe_set(batch_size * num_output, Dtype(0), top_data);
+            for (int j = 0; j < num_input; j += M) {
+                // products of every image slice with every codeword of the subspace
+                caffe_cpu_gemm(CblasNoTrans, CblasNoTrans,
+                               batch_size, K, M,
+                               (Dtype)1., slices + j * batch_size, D + K * j, (Dtype)0., products);
+                const int* b = B + j / M * num_output;
+                for (int i = 0; i < batch_size; ++i) {
+                    const Dtype* products_i = products + i * K;
+                    Dtype* top_i = top_data + i * num_output;
+                    for (int l = 0; l < num_output; ++l) {
+                        top_i[l] += products_i[b[l]];
+                    }
                 }
             }
         }
-        delete[] output;
-#endif //BATCHING
-        delete[] B;
         // adds bias to the resulting matrix
         caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, batch_size, num_output, 1, (Dtype)1.,
                               bias_multiplier_.cpu_data(), bias, (Dtype)1., top_data);
     }
 
+    // sums[j] = sum_s tables[s * K + codes[s * ADC_GROUP + j]] for the outputs
+    // j of a group
+    template <typename Dtype>
+    static void adc_gather_scalar(const int num_slices, const int K, const Dtype* tables,
+                                  const unsigned char* codes, Dtype* sums) {
+        for (int j = 0; j < ADC_GROUP; ++j) {
+            sums[j] = 0;
+        }
+        for (int s = 0; s < num_slices; ++s) {
+            const Dtype* table = tables + s * K;
+            const unsigned char* c = codes + s * ADC_GROUP;
+            for (int j = 0; j < ADC_GROUP; ++j) {
+                sums[j] += table[c[j]];
+            }
+        }
+    }
+
+    template <typename Dtype>
+    static void adc_gather(const int num_slices, const int K, const Dtype* tables,
+                           const unsigned char* codes, Dtype* sums) {
+        adc_gather_scalar(num_slices, K, tables, codes, sums);
+    }
+
+#ifdef __AVX2__
+    // A table of 8 or 16 floats fits in one or two registers, so the lookups
+    // of a whole group are permutes (and a blend on bit 3 of the codes)
+    // instead of ADC_GROUP loads.
+    template <>
+    void adc_gather<float>(const int num_slices, const int K, const float* tables,
+                           const unsigned char* codes, float* sums) {
+        if (K != 8 && K != 16) {
+            adc_gather_scalar(num_slices, K, tables, codes, sums);
+            return;
+        }
+        __m256 sum0 = _mm256_setzero_ps();
+        __m256 sum1 = _mm256_setzero_ps();
+        for (int s = 0; s < num_slices; ++s) {
+            const float* table = tables + s * K;
+            const __m256i c = _mm256_cvtepu8_epi32(
+                    _mm_loadl_epi64(reinterpret_cast<const __m128i*>(codes + s * ADC_GROUP)));
+            __m256 v = _mm256_permutevar8x32_ps(_mm256_loadu_ps(table), c);
+            if (K == 16) {
+                const __m256 high = _mm256_permutevar8x32_ps(_mm256_loadu_ps(table + 8), c);
+                v = _mm256_blendv_ps(v, high, _mm256_castsi256_ps(_mm256_slli_epi32(c, 28)));
+            }
+            // two accumulators to hide the latency of the additions
+            if (s & 1) {
+                sum1 = _mm256_add_ps(sum1, v);
+            } else {
+                sum0 = _mm256_add_ps(sum0, v);
+            }
+        }
+        _mm256_storeu_ps(sums, _mm256_add_ps(sum0, sum1));
+    }
+#endif
+
+    template <typename Dtype>
+    void InnerProductQLayer<Dtype>::Forward_cpu_adc(const Dtype* bottom_data, Dtype* top_data) {
+        const int K = this->layer_param_.inner_product_q_param().k();
+        const int M = this->layer_param_.inner_product_q_param().m();
+        const int num_slices = num_input / M;
+        const Dtype* D = this->blobs_[0]->cpu_data();
+        const int num_groups = (num_output + ADC_GROUP - 1) / ADC_GROUP;
+        const unsigned char* codes = &codes_[0];
+        Dtype* tables = lookup_tables_.mutable_cpu_data();
+        for (int i = 0; i < batch_size; ++i) {
+            const Dtype* x = bottom_data + i * num_input;
+            // tables[s][k] = <x_s, D_s[:, k]>, accumulated row by row of the
+            // codebook so the inner loop runs over K contiguous codewords
+#pragma omp parallel for
+            for (int s = 0; s < num_slices; ++s) {
+                Dtype* table = tables + s * K;
+                const Dtype* x_s = x + s * M;
+                const Dtype* D_s = D + s * M * K;
+                for (int k = 0; k < K; ++k) {
+                    table[k] = 0;
+                }
+                for (int r = 0; r < M; ++r) {
+                    const Dtype x_r = x_s[r];
+                    const Dtype* D_r = D_s + r * K;
+#pragma omp simd
+                    for (int k = 0; k < K; ++k) {
+                        table[k] += x_r * D_r[k];
+                    }
+                }
+            }
+            // every output sums one table entry per subspace
+            Dtype* top_i = top_data + i * num_output;
+#pragma omp parallel for
+            for (int g = 0; g < num_groups; ++g) {
+                Dtype sums[ADC_GROUP];
+                adc_gather(num_slices, K, tables, codes + g * num_slices * ADC_GROUP, sums);
+                const int group_size = std::min(ADC_GROUP, num_output - g * ADC_GROUP);
+                for (int j = 0; j < group_size; ++j) {
+                    top_i[g * ADC_GROUP + j] = sums[j];
+                }
+            }
+        }
+    }
+
     template <typename Dtype>
     void InnerProductQLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
                                                  const vector<bool>& propagate_down,
                                                  const vector<Blob<Dtype>*>& bottom) {
+        const int K = this->layer_param_.inner_product_q_param().k();
+        const int M = this->layer_param_.inner_product_q_param().m();
+        const Dtype* top_diff = top[0]->cpu_diff();
+        if (this->param_propagate_down_[1]) {
+            // Gradient with respect to bias
+            caffe_cpu_gemv<Dtype>(CblasTrans, batch_size, num_output, (Dtype)1.,
+                                  top_diff, bias_multiplier_.cpu_data(), (Dtype)1.,
+                                  this->blobs_[1]->mutable_cpu_diff());
+        }
+        if (!this->param_propagate_down_[0] && !propagate_down[0]) {
+            return;
+        }
+        const Dtype* D = this->blobs_[0]->cpu_data();
+        const int* B = B_.cpu_data();
+        const Dtype* slices = bottom[0]->cpu_data();
+        if (batch_size > 1 && this->param_propagate_down_[0]) {
+            gather_slices(batch_size, num_input, M, bottom[0]->cpu_data(),
+                          input_slices_.mutable_cpu_data());
+            slices = input_slices_.cpu_data();
+        }
+        Dtype* slices_diff = input_slices_.mutable_cpu_diff();
+        Dtype* grouped_diff = codeword_products_.mutable_cpu_diff();
+        for (int j = 0; j < num_input; j += M) {
+            // sum the top gradient of the outputs sharing a codeword
+            const int* b = B + j / M * num_output;
+            caffe_set(batch_size * K, Dtype(0), grouped_diff);
+            for (int i = 0; i < batch_size; ++i) {
+                const Dtype* top_diff_i = top_diff + i * num_output;
+                Dtype* grouped_diff_i = grouped_diff + i * K;
+                for (int l = 0; l < num_output; ++l) {
+                    grouped_diff_i[b[l]] += top_diff_i[l];
+                }
+            }
+            if (this->param_propagate_down_[0]) {
+                // Gradient with respect to the codebook of this subspace
+                caffe_cpu_gemm(CblasTrans, CblasNoTrans, M, K, batch_size,
+                               (Dtype)1., slices + j * batch_size, grouped_diff,
+                               (Dtype)1., this->blobs_[0]->mutable_cpu_diff() + K * j);
+            }
+            if (propagate_down[0]) {
+                // Gradient with respect to the input slices
+                caffe_cpu_gemm(CblasNoTrans, CblasTrans, batch_size, M, K,
+                               (Dtype)1., grouped_diff, D + K * j,
+                               (Dtype)0., slices_diff + j * batch_size);
+            }
+        }
+        if (propagate_down[0]) {
+            // scatter the slices back into the input layout
+            Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
+            for (int j = 0; j < num_input; j += M) {
+                const Dtype* slice_diff = slices_diff + j * batch_size;
+                for (int i = 0; i < batch_size; ++i) {
+                    caffe_copy(M, slice_diff + i * M, bottom_diff + i * num_input + j);
+                }
+            }
+        }
     }
 
 #ifdef CPU_ONLY
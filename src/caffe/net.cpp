@@ -19,6 +19,7 @@
 #include "caffe/util/insert_splits.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/util/upgrade_proto.hpp"
+#include "caffe/util/workspace.hpp"
 
 //#include "caffe/test/test_caffe_main.hpp"
 //#include "caffe/util/benchmark.hpp"
@@ -70,6 +71,9 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
   map<string, int> blob_name_to_idx;
   set<string> available_blobs;
   memory_used_ = 0;
+#ifdef CAFFE_LOG
+  const size_t workspace_requested = Workspace::Get().requested();
+#endif
   // For each layer, set up its input and output
   bottom_vecs_.resize(param.layer_size());
   top_vecs_.resize(param.layer_size());
@@ -82,6 +86,13 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
     if (!param.layer(layer_id).has_phase()) {
       param.mutable_layer(layer_id)->set_phase(phase_);
     }
+    // Inherit the conv_mode cache from net if unset.
+    if (param.has_conv_mode_cache() &&
+        param.layer(layer_id).has_convolution_param() &&
+        !param.layer(layer_id).convolution_param().has_conv_mode_cache()) {
+      param.mutable_layer(layer_id)->mutable_convolution_param()->
+          set_conv_mode_cache(param.conv_mode_cache());
+    }
     // Setup layer.
     const LayerParameter& layer_param = param.layer(layer_id);
     if (layer_param.propagate_down_size() > 0) {
@@ -179,6 +190,12 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
       }
     }
   }
+#ifdef CAFFE_LOG
+  LOG_IF(INFO, Caffe::root_solver())
+      << "Memory required for the workspace: " << Workspace::Get().size()
+      << ", shared by buffers of "
+      << Workspace::Get().requested() - workspace_requested;
+#endif
   // Go through the net backwards to determine which blobs contribute to the
   // loss.  We can skip backward computation for blobs that don't contribute
   // to the loss.
@@ -275,6 +292,12 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
   }
   ShareWeights();
   debug_info_ = param.debug_info();
+  LOG_IF(WARNING, param.plan_memory() && phase_ != TEST)
+      << "plan_memory is ignored outside the TEST phase";
+  plan_memory_ = param.plan_memory() && phase_ == TEST;
+  if (plan_memory_) {
+    PlanMemory();
+  }
 #ifdef CAFFE_LOG
   LOG_IF(INFO, Caffe::root_solver()) << "Network initialization done.";
 #endif
@@ -859,6 +882,7 @@ void Net<Dtype>::ShareTrainedLayersWith(const Net* other) {
           << target_blobs[j]->shape_string();
       target_blobs[j]->ShareData(*source_blob);
     }
+    layers_[target_layer_id]->InvalidateWeightCaches();
   }
 }
 
@@ -893,11 +917,122 @@ void Net<Dtype>::Backward() {
 
 template <typename Dtype>
 void Net<Dtype>::Reshape() {
+  if (plan_memory_) {
+    PlanMemory();
+    return;
+  }
   for (int i = 0; i < layers_.size(); ++i) {
     layers_[i]->Reshape(bottom_vecs_[i], top_vecs_[i]);
   }
 }
 
+template <typename Dtype>
+void Net<Dtype>::PlanMemory() {
+  // Plan with the current shapes. Blobs growing here get memory of their own,
+  // which is only allocated if accessed before being replaced below.
+  for (int i = 0; i < layers_.size(); ++i) {
+    layers_[i]->Reshape(bottom_vecs_[i], top_vecs_[i]);
+  }
+  // Group the blobs by their data and find when each group is alive.
+  vector<int> blob_group(blobs_.size(), -1);
+  map<SyncedMemory*, int> memory_group;
+  vector<size_t> group_bytes;
+  vector<int> group_first, group_last;
+  vector<bool> group_planned;
+  for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    SyncedMemory* memory = blobs_[blob_id]->data().get();
+    if (!memory) { continue; }
+    map<SyncedMemory*, int>::iterator it = memory_group.find(memory);
+    if (it == memory_group.end()) {
+      it = memory_group.insert(make_pair(memory, group_bytes.size())).first;
+      group_bytes.push_back(0);
+      group_first.push_back(layers_.size());
+      group_last.push_back(-1);
+      group_planned.push_back(true);
+    }
+    const int group = it->second;
+    blob_group[blob_id] = group;
+    group_bytes[group] = std::max(group_bytes[group],
+        blobs_[blob_id]->count() * sizeof(Dtype));
+  }
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    vector<int> blob_ids(bottom_id_vecs_[layer_id]);
+    blob_ids.insert(blob_ids.end(), top_id_vecs_[layer_id].begin(),
+        top_id_vecs_[layer_id].end());
+    for (int i = 0; i < blob_ids.size(); ++i) {
+      const int group = blob_group[blob_ids[i]];
+      if (group < 0) { continue; }
+      group_first[group] = std::min(group_first[group], layer_id);
+      group_last[group] = std::max(group_last[group], layer_id);
+      // Data layers may point their tops at memory of their own.
+      if (bottom_vecs_[layer_id].empty()) { group_planned[group] = false; }
+    }
+  }
+  vector<int> kept(net_input_blob_indices_);
+  kept.insert(kept.end(), net_output_blob_indices_.begin(),
+      net_output_blob_indices_.end());
+  for (int i = 0; i < kept.size(); ++i) {
+    if (blob_group[kept[i]] >= 0) { group_planned[blob_group[kept[i]]] = false; }
+  }
+  // Assign the groups to arenas in the order they come alive.
+  vector<pair<int, int> > first_use;
+  for (int group = 0; group < group_bytes.size(); ++group) {
+    if (group_planned[group] && group_bytes[group] > 0) {
+      first_use.push_back(make_pair(group_first[group], group));
+    }
+  }
+  std::sort(first_use.begin(), first_use.end());
+  vector<size_t> arena_bytes;
+  vector<int> arena_last;
+  vector<int> group_arena(group_bytes.size(), -1);
+  size_t planned_bytes = 0;
+  for (int i = 0; i < first_use.size(); ++i) {
+    const int group = first_use[i].second;
+    const size_t bytes = group_bytes[group];
+    int fit = -1, largest = -1;
+    for (int arena = 0; arena < arena_bytes.size(); ++arena) {
+      if (arena_last[arena] >= group_first[group]) { continue; }
+      if (arena_bytes[arena] >= bytes) {
+        if (fit < 0 || arena_bytes[arena] < arena_bytes[fit]) { fit = arena; }
+      } else if (largest < 0 || arena_bytes[arena] > arena_bytes[largest]) {
+        largest = arena;
+      }
+    }
+    int arena = fit >= 0 ? fit : largest;
+    if (arena < 0) {
+      arena = arena_bytes.size();
+      arena_bytes.push_back(0);
+      arena_last.push_back(-1);
+    }
+    arena_bytes[arena] = std::max(arena_bytes[arena], bytes);
+    arena_last[arena] = group_last[group];
+    group_arena[group] = arena;
+    planned_bytes += bytes;
+  }
+  vector<shared_ptr<SyncedMemory> > arenas(arena_bytes.size());
+  size_t arenas_bytes = 0;
+  for (int arena = 0; arena < arena_bytes.size(); ++arena) {
+    arenas[arena].reset(new SyncedMemory(arena_bytes[arena]));
+    arenas_bytes += arena_bytes[arena];
+  }
+  for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    const int group = blob_group[blob_id];
+    if (group >= 0 && group_arena[group] >= 0) {
+      blobs_[blob_id]->ShareDataMemory(arenas[group_arena[group]]);
+    }
+  }
+  // Let the layers share their bottoms with their tops again.
+  for (int i = 0; i < layers_.size(); ++i) {
+    layers_[i]->Reshape(bottom_vecs_[i], top_vecs_[i]);
+  }
+#ifdef CAFFE_LOG
+  LOG_IF(INFO, Caffe::root_solver())
+      << "Memory planned for data: " << first_use.size()
+      << " blob groups in " << arenas.size() << " arenas of " << arenas_bytes
+      << " bytes instead of " << planned_bytes;
+#endif
+}
+
 template <typename Dtype>
 void Net<Dtype>::CopyTrainedLayersFrom(const NetParameter& param) {
   int num_source_layers = param.layer_size();
@@ -1003,6 +1138,7 @@ void Net<Dtype>::CopyTrainedLayersFromHDF5(const string trained_filename) {
       hdf5_load_nd_dataset(layer_hid, dataset_name.c_str(), 0, kMaxBlobAxes,
           target_blobs[j].get());
     }
+    layers_[target_layer_id]->WeightAlign();
     H5Gclose(layer_hid);
   }
   H5Gclose(data_hid);
@@ -1022,6 +1158,31 @@ void Net<Dtype>::ToProto(NetParameter* param, bool write_diff) const {
   }
 }
 
+template <typename Dtype>
+void Net<Dtype>::ToCompressedProto(NetParameter* param,
+    BlobCompression_ValueEncoding encoding, int codebook_size) const {
+  param->Clear();
+  param->set_name(name_);
+  DLOG(INFO) << "Serializing " << layers_.size() << " compressed layers";
+  for (int i = 0; i < layers_.size(); ++i) {
+    LayerParameter* layer_param = param->add_layer();
+    layer_param->CopyFrom(layers_[i]->layer_param());
+    layer_param->clear_blobs();
+    const vector<shared_ptr<Blob<Dtype> > >& blobs = layers_[i]->blobs();
+    for (int j = 0; j < blobs.size(); ++j) {
+      const int learnable_param_id =
+          learnable_param_ids_[param_id_vecs_[i][j]];
+      // blobs that are not learned may hold raw bits (e.g. the packed
+      // indices of InnerProductQ), which only survive exact storage
+      const BlobCompression_ValueEncoding blob_encoding =
+          params_lr_[learnable_param_id] != 0 ? encoding :
+          BlobCompression_ValueEncoding_FLOAT;
+      blobs[j]->ToCompressedProto(layer_param->add_blobs(), blob_encoding,
+          codebook_size);
+    }
+  }
+}
+
 #ifdef HDF5
 template <typename Dtype>
 void Net<Dtype>::ToHDF5(const string& filename, bool write_diff) const {
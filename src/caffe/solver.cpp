@@ -1,5 +1,6 @@
 #include <cstdio>
 
+#include <fstream>  // NOLINT(readability/streams)
 #include <string>
 #include <vector>
 #ifndef CPU_ONLY
@@ -60,6 +61,18 @@ void Solver<Dtype>::Init(const SolverParameter& param) {
   iter_ = 0;
   current_step_ = 0;
   total_regularization_term_ = 0;
+  if (param_.sparsity_interval() && param_.has_sparsity_file() &&
+      Caffe::root_solver()) {
+    // append, so that a resumed run continues the same file
+    sparsity_file_.reset(new std::ofstream(param_.sparsity_file().c_str(),
+        std::ios::out | std::ios::app));
+    CHECK(sparsity_file_->good()) << "Cannot open " << param_.sparsity_file();
+    if (param_.sparsity_format() == SolverParameter_SparsityFormat_CSV &&
+        sparsity_file_->tellp() == 0) {
+      *sparsity_file_ << "iter,param,count,element,row,column,blocks,"
+          "regularization" << std::endl;
+    }
+  }
 }
 
 template <typename Dtype>
@@ -411,6 +424,65 @@ void Solver<Dtype>::Test(const int test_net_id) {
   }
 }
 
+// Quotes s as a JSON string.
+static string JSONString(const string& s) {
+  string quoted = "\"";
+  for (int i = 0; i < s.size(); ++i) {
+    if (s[i] == '"' || s[i] == '\\') {
+      quoted += '\\';
+    }
+    quoted += s[i];
+  }
+  return quoted + "\"";
+}
+
+template <typename Dtype>
+void Solver<Dtype>::ReportSparsity(const vector<ParamSparsity>& params) {
+  for (int i = 0; i < sparsity_callbacks_.size(); ++i) {
+    sparsity_callbacks_[i]->on_sparsity(iter_, params);
+  }
+  if (!sparsity_file_) {
+    return;
+  }
+  std::ofstream& out = *sparsity_file_;
+  switch (param_.sparsity_format()) {
+  case SolverParameter_SparsityFormat_CSV:
+    for (int i = 0; i < params.size(); ++i) {
+      const ParamSparsity& param = params[i];
+      out << iter_ << "," << param.name << "," << param.count << ","
+          << param.element << "," << param.row << "," << param.column << ",";
+      for (int j = 0; j < param.blocks.size(); ++j) {
+        out << (j ? ";" : "") << param.blocks[j].ydimen << "x"
+            << param.blocks[j].xdimen << ":" << param.blocks[j].sparsity;
+      }
+      out << "," << param.regularization << "\n";
+    }
+    break;
+  case SolverParameter_SparsityFormat_JSON:
+    out << "{\"iter\": " << iter_ << ", \"params\": [";
+    for (int i = 0; i < params.size(); ++i) {
+      const ParamSparsity& param = params[i];
+      out << (i ? ", " : "") << "{\"name\": " << JSONString(param.name)
+          << ", \"count\": " << param.count
+          << ", \"element\": " << param.element
+          << ", \"row\": " << param.row
+          << ", \"column\": " << param.column << ", \"blocks\": [";
+      for (int j = 0; j < param.blocks.size(); ++j) {
+        out << (j ? ", " : "") << "{\"ydimen\": " << param.blocks[j].ydimen
+            << ", \"xdimen\": " << param.blocks[j].xdimen
+            << ", \"sparsity\": " << param.blocks[j].sparsity << "}";
+      }
+      out << "], \"regularization\": " << param.regularization << "}";
+    }
+    out << "]}\n";
+    break;
+  default:
+    LOG(FATAL) << "Unknown sparsity format: " << param_.sparsity_format();
+  }
+  // readers follow the file while training runs
+  out.flush();
+}
+
 template <typename Dtype>
 void Solver<Dtype>::Snapshot() {
   CHECK(Caffe::root_solver());
@@ -422,6 +494,9 @@ void Solver<Dtype>::Snapshot() {
   case caffe::SolverParameter_SnapshotFormat_HDF5:
     model_filename = SnapshotToHDF5();
     break;
+  case caffe::SolverParameter_SnapshotFormat_COMPRESSED:
+    model_filename = SnapshotToCompressedProto();
+    break;
   default:
     LOG(FATAL) << "Unsupported snapshot format.";
   }
@@ -471,6 +546,20 @@ string Solver<Dtype>::SnapshotToHDF5() {
   return model_filename;
 }
 
+template <typename Dtype>
+string Solver<Dtype>::SnapshotToCompressedProto() {
+  string model_filename = SnapshotFilename(".caffemodel");
+  LOG(INFO) << "Snapshotting to compressed binary proto file "
+      << model_filename;
+  LOG_IF(WARNING, param_.snapshot_diff())
+      << "Compressed snapshots do not include diffs";
+  NetParameter net_param;
+  net_->ToCompressedProto(&net_param, param_.snapshot_encoding(),
+      param_.snapshot_codebook_size());
+  WriteProtoToBinaryFile(net_param, model_filename);
+  return model_filename;
+}
+
 template <typename Dtype>
 void Solver<Dtype>::Restore(const char* state_file) {
   string state_filename(state_file);
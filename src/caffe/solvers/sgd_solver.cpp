@@ -69,6 +69,7 @@ void SGDSolver<Dtype>::PreSolve() {
   history_.clear();
   update_.clear();
   temp_.clear();
+  track_regularization_ = true;
   for (int i = 0; i < net_params.size(); ++i) {
     const vector<int>& shape = net_params[i]->shape();
     history_.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>(shape)));
@@ -101,75 +102,172 @@ void SGDSolver<Dtype>::ClipGradients() {
 template <typename Dtype>
 void SGDSolver<Dtype>::ApplyUpdate() {
   Dtype rate = GetLearningRate();
-  if (this->param_.display() && this->iter_ % this->param_.display() == 0) {
-/*<<<<<<< HEAD
-    LOG(INFO) << "Iteration " << this->iter_ << ", lr = " << rate;
-
-    //display sparsity
-	//const vector<float>& net_params_weight_decay =
-	//	  this->net_->params_weight_decay();
-	//Dtype weight_decay = this->param_.weight_decay();
+  const bool display =
+      this->param_.display() && this->iter_ % this->param_.display() == 0;
+  if (display) {
+    LOG_IF(INFO, Caffe::root_solver()) << "Iteration " << this->iter_
+        << ", lr = " << rate;
+  }
+  const bool print_sparsity = display && this->param_.print_sparsity() &&
+      Caffe::root_solver();
+  const bool report_sparsity = this->param_.sparsity_interval() &&
+      this->iter_ % this->param_.sparsity_interval() == 0 &&
+      Caffe::root_solver();
+  // The regularization terms are only computed when they are reported.
+  track_regularization_ = display || report_sparsity;
+
+  ClipGradients();
+  Solver<Dtype>::total_regularization_term_ = Dtype(0);
+  const vector<Blob<Dtype>*>& net_params = this->net_->learnable_params();
+  vector<ParamSparsity> sparsity;
+  for (int param_id = 0; param_id < net_params.size(); ++param_id) {
+    Dtype regularization_term = Dtype(0);
+    // frozen params are left bit-exact: the packed codeword indices of the
+    // quantized layers would not survive Zerout
+    if (this->net_->params_lr()[param_id]) {
+      Normalize(param_id);
+      if (CanFuseUpdate(param_id)) {
+        // group lasso still needs its own pass to compute the group norms
+        regularization_term += GroupLassoRegularize(param_id);
+        regularization_term += FusedUpdate(param_id, rate);
+      } else {
+        regularization_term += Regularize(param_id);
+        regularization_term += GroupLassoRegularize(param_id);
+        ComputeUpdateValue(param_id, rate);
+        net_params[param_id]->Update();
+        net_params[param_id]->Zerout();
+      }
+    }
+    Solver<Dtype>::total_regularization_term_ += regularization_term;
+    if (print_sparsity || report_sparsity) {
+      // measured while the freshly updated param is still in the cache
+      sparsity.push_back(ComputeSparsity(param_id, regularization_term));
+    }
+  }
+  if (print_sparsity) {
+    PrintSparsity(sparsity);
+  }
+  if (report_sparsity) {
+    this->ReportSparsity(sparsity);
+  }
+}
+
+template <typename Dtype>
+bool SGDSolver<Dtype>::CanFuseUpdate(int param_id) {
+  // Subclasses override ComputeUpdateValue, so only plain SGD is fused.
+  if (Caffe::mode() != Caffe::CPU || string(this->type()) != "SGD") {
+    return false;
+  }
+  const Dtype local_decay = this->param_.weight_decay() *
+      this->net_->params_weight_decay()[param_id];
+  if (!local_decay) { return true; }
+  string regularization_type = this->param_.regularization_type();
+  const string& local_regularization_type =
+      this->net_->params_regularization_type()[param_id];
+  if (!local_regularization_type.empty()) {
+    regularization_type = local_regularization_type;
+  }
+  return regularization_type == "L2" &&
+      !this->net_->params_individual_weight_decay()[param_id];
+}
+
+template <typename Dtype>
+Dtype SGDSolver<Dtype>::FusedUpdate(int param_id, Dtype rate) {
+  // Regularize, ComputeUpdateValue, Blob::Update and Blob::Zerout in a single
+  // pass over the connected elements of the parameter.
+  Blob<Dtype>* param = this->net_->learnable_params()[param_id];
+  const Dtype local_decay = this->param_.weight_decay() *
+      this->net_->params_weight_decay()[param_id];
+  const Dtype local_rate = rate * this->net_->params_lr()[param_id];
+  const Dtype sumsq = caffe_cpu_sgd_update(param->count(),
+      param->cpu_connectivity(), local_decay, Dtype(this->param_.momentum()),
+      local_rate, param->mutable_cpu_data(), param->mutable_cpu_diff(),
+      history_[param_id]->mutable_cpu_data());
+  return sumsq * local_decay / Dtype(2);
+}
+
+// "<layer>.<param name or index>" of each learnable param.
+template <typename Dtype>
+static vector<string> LearnableParamNames(const Net<Dtype>& net) {
+  vector<string> names;
+  for (int i = 0; i < net.params().size(); ++i) {
+    // shared params are named after their owner, which comes first
+    if (net.param_owners()[i] < 0) {
+      names.push_back(net.layer_names()[net.param_layer_indices()[i].first] +
+          "." + net.param_display_names()[i]);
+    }
+  }
+  return names;
+}
+
+template <typename Dtype>
+ParamSparsity SGDSolver<Dtype>::ComputeSparsity(int param_id,
+    Dtype regularization_term) {
+  const Blob<Dtype>& param = *this->net_->learnable_params()[param_id];
+  if (sparsity_names_.empty()) {
+    sparsity_names_ = LearnableParamNames(*this->net_);
+  }
+  ParamSparsity sparsity;
+  sparsity.name = sparsity_names_[param_id];
+  sparsity.count = param.count();
+  sparsity.regularization = regularization_term;
+  const int rows = param.num_axes() ? param.shape(0) : 1;
+  const int cols = rows ? param.count() / rows : 0;
+  int zeros = 0, zero_rows = 0, zero_cols = 0;
+  if (param.count()) {
+    caffe_cpu_sparsity_stats(rows, cols, param.cpu_data(), &zeros,
+        &zero_rows, &zero_cols);
+  }
+  sparsity.element = param.count() ? 100.f * zeros / param.count() : 0;
+  sparsity.row = rows ? 100.f * zero_rows / rows : 0;
+  sparsity.column = cols ? 100.f * zero_cols / cols : 0;
+  const vector<BlockGroupLassoSpec>& block_group_lasso =
+      this->net_->params_block_group_lasso()[param_id];
+  for (int i = 0; i < block_group_lasso.size(); ++i) {
+    ParamSparsity::Block block;
+    block.ydimen = block_group_lasso[i].ydimen();
+    block.xdimen = block_group_lasso[i].xdimen();
+    const int blocks = rows / block.ydimen * (cols / block.xdimen);
+    block.sparsity = 100.f * caffe_cpu_zero_blocks(rows, cols, block.ydimen,
+        block.xdimen, param.cpu_data()) / blocks;
+    sparsity.blocks.push_back(block);
+  }
+  return sparsity;
+}
+
+template <typename Dtype>
+void SGDSolver<Dtype>::PrintSparsity(const vector<ParamSparsity>& params) {
 	ostringstream sparsity_msg_stream;
 	sparsity_msg_stream << "    Element Sparsity %: \n";
-	for (int param_id = 0; param_id < this->net_->learnable_params().size(); ++param_id) {
-		//Dtype local_decay = weight_decay * net_params_weight_decay[param_id];
-		sparsity_msg_stream << GetSparsity(param_id) <<"\t";
-		//if(local_decay) sparsity_msg_stream << GetSparsity(param_id) <<"\t";
-		//else sparsity_msg_stream << -1 <<"\t";
+	for (int i = 0; i < params.size(); ++i) {
+		sparsity_msg_stream << params[i].element <<"\t";
 	}
-	if (this->param_.print_sparsity())
-		LOG(INFO) << sparsity_msg_stream.str();
+	LOG(INFO) << sparsity_msg_stream.str();
 
 	sparsity_msg_stream.str("");
 	sparsity_msg_stream << "     Column Sparsity %: \n";
-	for (int param_id = 0; param_id < this->net_->learnable_params().size(); ++param_id) {
-		//Dtype local_decay = this->param_.kernel_shape_decay() * this->net_->params_kernel_shape_decay()[param_id];
-		sparsity_msg_stream << GetGroupSparsity(param_id, true) <<"\t";
-		//if(local_decay) sparsity_msg_stream << GetGroupSparsity(param_id, true) <<"\t";
-		//else sparsity_msg_stream << -1 <<"\t";
+	for (int i = 0; i < params.size(); ++i) {
+		sparsity_msg_stream << params[i].column <<"\t";
 	}
-	if (this->param_.print_sparsity())
-		LOG(INFO) << sparsity_msg_stream.str();
+	LOG(INFO) << sparsity_msg_stream.str();
 
 	sparsity_msg_stream.str("");
 	sparsity_msg_stream << "        Row Sparsity %: \n";
-	for (int param_id = 0; param_id < this->net_->learnable_params().size(); ++param_id) {
-		sparsity_msg_stream << GetGroupSparsity(param_id, false) <<"\t";
-		//if(local_decay) sparsity_msg_stream << GetGroupSparsity(param_id, false) <<"\t";
-		//else sparsity_msg_stream << -1 <<"\t";
+	for (int i = 0; i < params.size(); ++i) {
+		sparsity_msg_stream << params[i].row <<"\t";
 	}
-	if (this->param_.print_sparsity())
-		LOG(INFO) << sparsity_msg_stream.str();
+	LOG(INFO) << sparsity_msg_stream.str();
 
 	sparsity_msg_stream.str("");
 	sparsity_msg_stream << "      Block Sparsity %: \n";
-	for (int param_id = 0; param_id < this->net_->learnable_params().size(); ++param_id) {
-		const vector<BlockGroupLassoSpec> net_params_block_group_lasso =
-							 this->net_->params_block_group_lasso()[param_id];
-		for (int blk_idx=0;blk_idx<net_params_block_group_lasso.size();blk_idx++){
-			int xdimen = net_params_block_group_lasso[blk_idx].xdimen();
-			int ydimen = net_params_block_group_lasso[blk_idx].ydimen();
-			sparsity_msg_stream << "("<<xdimen<<","<<ydimen<<"):"<<GetGroupSparsity(param_id, ydimen, xdimen) <<";";
+	for (int i = 0; i < params.size(); ++i) {
+		for (int j = 0; j < params[i].blocks.size(); ++j) {
+			const ParamSparsity::Block& block = params[i].blocks[j];
+			sparsity_msg_stream << "("<<block.xdimen<<","<<block.ydimen<<"):"<<block.sparsity <<";";
 		}
 		sparsity_msg_stream << "\t";
 	}
-	if (this->param_.print_sparsity())
-		LOG(INFO) << sparsity_msg_stream.str();
-*/
-    LOG_IF(INFO, Caffe::root_solver()) << "Iteration " << this->iter_
-        << ", lr = " << rate;
-  }
-
-  ClipGradients();
-  Solver<Dtype>::total_regularization_term_ = Dtype(0);
-  for (int param_id = 0; param_id < this->net_->learnable_params().size();
-       ++param_id) {
-    Normalize(param_id);
-    Solver<Dtype>::total_regularization_term_ += Regularize(param_id);
-    Solver<Dtype>::total_regularization_term_ += GroupLassoRegularize(param_id);
-    ComputeUpdateValue(param_id, rate);
-  }
-  this->net_->Update();
+	LOG(INFO) << sparsity_msg_stream.str();
 }
 
 template <typename Dtype>
@@ -238,10 +336,12 @@ Dtype SGDSolver<Dtype>::Regularize(int param_id) {
 					temp_[param_id]->cpu_data(),
 					net_params[param_id]->mutable_cpu_diff());
 				//calcuate the l2 regularization term
-				regularization_term = caffe_cpu_dot(
-						net_params[param_id]->count(),
-						temp_[param_id]->cpu_data(),
-						net_params[param_id]->cpu_data());
+				if (track_regularization_) {
+					regularization_term = caffe_cpu_dot(
+							net_params[param_id]->count(),
+							temp_[param_id]->cpu_data(),
+							net_params[param_id]->cpu_data());
+				}
     	  }else{
 			// add weight decay
 			caffe_axpy(net_params[param_id]->count(),
@@ -249,10 +349,12 @@ Dtype SGDSolver<Dtype>::Regularize(int param_id) {
 				net_params[param_id]->cpu_data(),
 				net_params[param_id]->mutable_cpu_diff());
 			//calcuate the l2 regularization term
-			regularization_term = caffe_cpu_dot(
-					net_params[param_id]->count(),
-					net_params[param_id]->cpu_data(),
-					net_params[param_id]->cpu_data());
+			if (track_regularization_) {
+				regularization_term = caffe_cpu_dot(
+						net_params[param_id]->count(),
+						net_params[param_id]->cpu_data(),
+						net_params[param_id]->cpu_data());
+			}
     	  }
 		regularization_term *= local_decay/(Dtype)2.0;
       } else if (regularization_type == "L1") {
@@ -271,14 +373,14 @@ Dtype SGDSolver<Dtype>::Regularize(int param_id) {
             temp_[param_id]->cpu_data(),
             net_params[param_id]->mutable_cpu_diff());
         //calcuate the l1 regularization term
-        if(params_individual_decays[param_id]){
+        if(track_regularization_ && params_individual_decays[param_id]){
         	caffe_mul(net_params[param_id]->count(),
 				  net_params[param_id]->cpu_data(),
 				  params_individual_decays[param_id]->cpu_data(),
 				  temp_[param_id]->mutable_cpu_data()
 				);
         	regularization_term = caffe_cpu_asum(net_params[param_id]->count(),temp_[param_id]->cpu_data());
-        } else {
+        } else if(track_regularization_) {
         	regularization_term = caffe_cpu_asum(net_params[param_id]->count(),net_params[param_id]->cpu_data());
         }
 		regularization_term *= local_decay;
@@ -305,7 +407,7 @@ Dtype SGDSolver<Dtype>::Regularize(int param_id) {
     		  				temp_[param_id]->gpu_data(),
     		  				net_params[param_id]->mutable_gpu_diff());
     		  //term: 0.5*w*w*lamda_w
-    		  caffe_gpu_dot(net_params[param_id]->count(),
+    		  if (track_regularization_) caffe_gpu_dot(net_params[param_id]->count(),
     				  net_params[param_id]->gpu_data(),
     				  temp_[param_id]->gpu_data(),
     				  &regularization_term);
@@ -316,7 +418,7 @@ Dtype SGDSolver<Dtype>::Regularize(int param_id) {
 				net_params[param_id]->gpu_data(),
 				net_params[param_id]->mutable_gpu_diff());
 			//calcuate the l2 regularization term
-			caffe_gpu_dot(net_params[param_id]->count(),net_params[param_id]->gpu_data(),net_params[param_id]->gpu_data(),&regularization_term);
+			if (track_regularization_) caffe_gpu_dot(net_params[param_id]->count(),net_params[param_id]->gpu_data(),net_params[param_id]->gpu_data(),&regularization_term);
     	}
     	regularization_term *= local_decay/(Dtype)2.0;
       } else if (regularization_type == "L1") {
@@ -334,12 +436,12 @@ Dtype SGDSolver<Dtype>::Regularize(int param_id) {
             temp_[param_id]->gpu_data(),
             net_params[param_id]->mutable_gpu_diff());
         //calcuate the l1 regularization term
-        if(params_individual_decays[param_id]){
+        if(track_regularization_ && params_individual_decays[param_id]){
         	caffe_gpu_eltwise_multi(net_params[param_id]->count(),
         			  net_params[param_id]->gpu_data(),
 					  temp_[param_id]->mutable_gpu_data());
         	caffe_gpu_asum(net_params[param_id]->count(),temp_[param_id]->gpu_data(),&regularization_term);
-        }else{
+        }else if(track_regularization_){
         	caffe_gpu_asum(net_params[param_id]->count(),net_params[param_id]->gpu_data(),&regularization_term);
         }
 		regularization_term *= local_decay;
@@ -364,11 +466,15 @@ Dtype SGDSolver<Dtype>::GetSparsity(int param_id) {
   Dtype sparsity = Dtype(0);
   switch (Caffe::mode()) {
   case Caffe::CPU: {
-        caffe_cpu_if_zerout(net_params[param_id]->count(),
-            net_params[param_id]->cpu_data(),
-            temp_[param_id]->mutable_cpu_data());
-        //calcuate the sparsity
-        sparsity = caffe_cpu_asum(net_params[param_id]->count(),temp_[param_id]->cpu_data())*Dtype(100)/net_params[param_id]->count();
+        //count the zerout elements in one pass, without a temporary mask
+        const int count = net_params[param_id]->count();
+        const Dtype* data = net_params[param_id]->cpu_data();
+        int zeros = 0;
+#pragma omp parallel for reduction(+:zeros)
+        for (int i = 0; i < count; ++i) {
+          zeros += caffe_if_zerout<Dtype>(data[i]);
+        }
+        sparsity = Dtype(zeros)*Dtype(100)/count;
         break;
   }
   case Caffe::GPU: {
@@ -448,8 +554,49 @@ Dtype SGDSolver<Dtype>::GroupLassoRegularize(int param_id) {
   switch (Caffe::mode()) {
   case Caffe::CPU: {
 
-	if(if_learn_breadth || if_learn_kernel_shape){
-		LOG(FATAL)<< "Deprecated in CPU mode: breadth and kernel shape decay (use block group decay instead)";
+	//group lasso along columns (channels)
+	if (if_learn_kernel_shape) {
+		int group_size = net_params[param_id]->shape(0)/net_param_groups[param_id];//number of kernels in each group
+		for (int g=0;g<net_param_groups[param_id];g++){
+			int offset = g*group_size*equivalent_ch;
+			caffe_cpu_bar_group_lasso(group_size,
+					equivalent_ch,
+					net_params[param_id]->cpu_data()+offset,
+					temp_[param_id]->mutable_cpu_data()+offset, true);//get the denominator of each w
+			if (track_regularization_) {
+				Dtype term = caffe_cpu_asum(equivalent_ch,temp_[param_id]->cpu_data()+offset);
+				regularization_term += term*local_kernel_shape_decay;
+			}
+		}
+		caffe_div_checkzero(net_params[param_id]->count(), net_params[param_id]->cpu_data(), temp_[param_id]->cpu_data(), temp_[param_id]->mutable_cpu_data());
+		caffe_axpy(net_params[param_id]->count(),
+				local_kernel_shape_decay,
+				temp_[param_id]->cpu_data(),
+				net_params[param_id]->mutable_cpu_diff());
+	}
+
+	//group lasso along rows (kernels)
+	if (if_learn_breadth) {
+		int group_size = net_params[param_id]->shape(0)/net_param_groups[param_id];//number of kernels in each group
+		for (int g=0;g<net_param_groups[param_id];g++){
+			int offset = g*group_size*equivalent_ch;
+			caffe_cpu_bar_group_lasso(group_size,
+					equivalent_ch,
+					net_params[param_id]->cpu_data()+offset,
+					temp_[param_id]->mutable_cpu_data()+offset, false);//get the denominator of each w
+			if (track_regularization_) {
+				Dtype term = 0;
+				for (int k=0;k<group_size;k++){
+					term += temp_[param_id]->cpu_data()[offset+k*equivalent_ch];
+				}
+				regularization_term += term*local_breadth_decay;
+			}
+		}
+		caffe_div_checkzero(net_params[param_id]->count(), net_params[param_id]->cpu_data(), temp_[param_id]->cpu_data(), temp_[param_id]->mutable_cpu_data());
+		caffe_axpy(net_params[param_id]->count(),
+				local_breadth_decay,
+				temp_[param_id]->cpu_data(),
+				net_params[param_id]->mutable_cpu_diff());
 	}
 
 	for (int blk_idx=0;blk_idx<net_params_block_group_lasso.size();blk_idx++){
@@ -464,10 +611,12 @@ Dtype SGDSolver<Dtype>::GroupLassoRegularize(int param_id) {
 					ydimen, xdimen,
 					net_params[param_id]->cpu_data(),
 					temp_[param_id]->mutable_cpu_data());
-			Dtype term;
-			term = caffe_cpu_asum(temp_[param_id]->count(),temp_[param_id]->cpu_data());
-			term /= (xdimen*ydimen);
-			regularization_term += term*local_block_group_decay;
+			if (track_regularization_) {
+				Dtype term;
+				term = caffe_cpu_asum(temp_[param_id]->count(),temp_[param_id]->cpu_data());
+				term /= (xdimen*ydimen);
+				regularization_term += term*local_block_group_decay;
+			}
 
 			caffe_div_checkzero(net_params[param_id]->count(),
 				  net_params[param_id]->cpu_data(),
@@ -480,37 +629,6 @@ Dtype SGDSolver<Dtype>::GroupLassoRegularize(int param_id) {
 		}
 	}
 
-	/*
-    if (if_learn_kernel_shape) {
-      if((net_params[param_id]->shape(2)>1) || (net_params[param_id]->shape(3)>1) || net_param_groups[param_id]>1){
-    	  LOG(FATAL)<< "Unsupported in CPU mode: group lasso for convolutional layers with kernel > 1x1 or with more than 1 kernel bank";
-      }
-
-      for(int c=0;c<net_params[param_id]->shape(1);c++){
-    	  Dtype tmp = caffe_cpu_strided_dot(net_params[param_id]->shape(0),
-    			  net_params[param_id]->cpu_data()+c,net_params[param_id]->shape(1),
-    			  net_params[param_id]->cpu_data()+c,net_params[param_id]->shape(1));
-		  tmp = sqrt(tmp);
-		  regularization_term += tmp;
-		  temp_[param_id]->mutable_cpu_data()[c] = tmp;
-      }
-      regularization_term *= local_breadth_decay;
-      //copy memory
-      for(int num=1;num<net_params[param_id]->shape(0);num++){
-    	  memcpy(temp_[param_id]->mutable_cpu_data()+num*net_params[param_id]->shape(1),
-    			  temp_[param_id]->cpu_data(),
-    			  net_params[param_id]->shape(1)*sizeof(Dtype));
-      }
-      caffe_div_checkzero(net_params[param_id]->count(),
-    		  net_params[param_id]->cpu_data(),
-    		  temp_[param_id]->cpu_data(),
-    		  temp_[param_id]->mutable_cpu_data());
-      caffe_axpy(net_params[param_id]->count(),
-    		  	  local_breadth_decay,
-    		  	  temp_[param_id]->cpu_data(),
-                  net_params[param_id]->mutable_cpu_diff());
-    }
-    */
     break;
   }
   case Caffe::GPU: {
@@ -524,9 +642,11 @@ Dtype SGDSolver<Dtype>::GroupLassoRegularize(int param_id) {
 					equivalent_ch,
 					net_params[param_id]->gpu_data()+offset,
 					temp_[param_id]->mutable_gpu_data()+offset, true);//get the denominator of each w
-			Dtype term;
-			caffe_gpu_asum(equivalent_ch,temp_[param_id]->gpu_data()+offset,&term);
-			regularization_term += term*local_kernel_shape_decay;
+			if (track_regularization_) {
+				Dtype term;
+				caffe_gpu_asum(equivalent_ch,temp_[param_id]->gpu_data()+offset,&term);
+				regularization_term += term*local_kernel_shape_decay;
+			}
     	}
     	caffe_gpu_div_checkzero(net_params[param_id]->count(), net_params[param_id]->gpu_data(), temp_[param_id]->gpu_data(), temp_[param_id]->mutable_gpu_data());
 		caffe_gpu_axpy(net_params[param_id]->count(),
@@ -544,9 +664,11 @@ Dtype SGDSolver<Dtype>::GroupLassoRegularize(int param_id) {
 					equivalent_ch,
 					net_params[param_id]->gpu_data()+offset,
 					temp_[param_id]->mutable_gpu_data()+offset, false);//get the denominator of each w
-			Dtype term;
-			caffe_gpu_asum(group_size,temp_[param_id]->gpu_data()+offset,&term,equivalent_ch);
-			regularization_term += term*local_breadth_decay;
+			if (track_regularization_) {
+				Dtype term;
+				caffe_gpu_asum(group_size,temp_[param_id]->gpu_data()+offset,&term,equivalent_ch);
+				regularization_term += term*local_breadth_decay;
+			}
 		}
 		caffe_gpu_div_checkzero(net_params[param_id]->count(), net_params[param_id]->gpu_data(), temp_[param_id]->gpu_data(), temp_[param_id]->mutable_gpu_data());
 		caffe_gpu_axpy(net_params[param_id]->count(),
@@ -567,10 +689,12 @@ Dtype SGDSolver<Dtype>::GroupLassoRegularize(int param_id) {
 					ydimen, xdimen,
 					net_params[param_id]->gpu_data(),
 					temp_[param_id]->mutable_gpu_data());
-			Dtype term;
-			caffe_gpu_asum(temp_[param_id]->count(),temp_[param_id]->gpu_data(),&term);
-			term /= (xdimen*ydimen);
-			regularization_term += term*local_block_group_decay;
+			if (track_regularization_) {
+				Dtype term;
+				caffe_gpu_asum(temp_[param_id]->count(),temp_[param_id]->gpu_data(),&term);
+				term /= (xdimen*ydimen);
+				regularization_term += term*local_block_group_decay;
+			}
 
 			caffe_gpu_div_checkzero(net_params[param_id]->count(), net_params[param_id]->gpu_data(), temp_[param_id]->gpu_data(), temp_[param_id]->mutable_gpu_data());
 			caffe_gpu_axpy(net_params[param_id]->count(),
@@ -634,6 +758,7 @@ template <typename Dtype>
 void SGDSolver<Dtype>::SnapshotSolverState(const string& model_filename) {
   switch (this->param_.snapshot_format()) {
     case caffe::SolverParameter_SnapshotFormat_BINARYPROTO:
+    case caffe::SolverParameter_SnapshotFormat_COMPRESSED:
       SnapshotSolverStateToBinaryProto(model_filename);
       break;
     case caffe::SolverParameter_SnapshotFormat_HDF5:
@@ -112,6 +112,77 @@ TYPED_TEST(BlobSimpleTest, TestLegacyBlobProtoShapeEquals) {
   EXPECT_FALSE(this->blob_->ShapeEquals(blob_proto));
 }
 
+TYPED_TEST(BlobSimpleTest, TestCompressedProto) {
+  // two thirds zeros are stored as a bitmap, a single nonzero as CSR
+  Blob<TypeParam> sparse(2, 3, 4, 5);
+  FillerParameter filler_param;
+  GaussianFiller<TypeParam> filler(filler_param);
+  filler.Fill(&sparse);
+  TypeParam* data = sparse.mutable_cpu_data();
+  for (int i = 0; i < sparse.count(); ++i) {
+    if (i % 3 != 0) {
+      data[i] = 0;
+    }
+  }
+  Blob<TypeParam> very_sparse(4, 50, 1, 1);
+  caffe_set(very_sparse.count(), TypeParam(0),
+      very_sparse.mutable_cpu_data());
+  very_sparse.mutable_cpu_data()[77] = 3;
+  Blob<TypeParam>* blobs[2] = { &sparse, &very_sparse };
+  for (int b = 0; b < 2; ++b) {
+    BlobProto proto;
+    blobs[b]->ToCompressedProto(&proto);
+    EXPECT_EQ(b == 0, proto.compression().has_bitmap());
+    // only the nonzeros are stored
+    EXPECT_EQ(b == 0 ? 40 : 1, proto.data_size() + proto.double_data_size());
+    Blob<TypeParam> decoded;
+    decoded.FromProto(proto);
+    ASSERT_TRUE(decoded.ShapeEquals(proto));
+    for (int i = 0; i < blobs[b]->count(); ++i) {
+      EXPECT_EQ(blobs[b]->cpu_data()[i], decoded.cpu_data()[i]);
+    }
+  }
+
+  // half precision keeps zeros exact and the rest to 11 significant bits
+  BlobProto half_proto;
+  sparse.ToCompressedProto(&half_proto, BlobCompression_ValueEncoding_HALF);
+  Blob<TypeParam> half;
+  half.FromProto(half_proto);
+  for (int i = 0; i < sparse.count(); ++i) {
+    const TypeParam value = sparse.cpu_data()[i];
+    if (value == 0) {
+      EXPECT_EQ(0, half.cpu_data()[i]);
+    } else {
+      EXPECT_NEAR(value, half.cpu_data()[i], 1e-3 * fabs(value));
+    }
+  }
+
+  // the codebook maps every nonzero to its nearest codeword
+  const int codebook_size = 4;
+  BlobProto codebook_proto;
+  sparse.ToCompressedProto(&codebook_proto,
+      BlobCompression_ValueEncoding_CODEBOOK, codebook_size);
+  const BlobCompression& compression = codebook_proto.compression();
+  ASSERT_EQ(codebook_size, compression.codebook_size());
+  Blob<TypeParam> quantized;
+  quantized.FromProto(codebook_proto);
+  for (int i = 0; i < sparse.count(); ++i) {
+    const TypeParam value = sparse.cpu_data()[i];
+    const TypeParam decoded = quantized.cpu_data()[i];
+    if (value == 0) {
+      EXPECT_EQ(0, decoded);
+      continue;
+    }
+    bool in_codebook = false;
+    for (int k = 0; k < codebook_size; ++k) {
+      in_codebook |= (decoded == TypeParam(compression.codebook(k)));
+      EXPECT_LE(fabs(value - decoded),
+          fabs(value - TypeParam(compression.codebook(k))) + 1e-6);
+    }
+    EXPECT_TRUE(in_codebook);
+  }
+}
+
 template <typename TypeParam>
 class BlobMathTest : public MultiDeviceTest<TypeParam> {
   typedef typename TypeParam::Dtype Dtype;
@@ -298,4 +369,80 @@ TYPED_TEST(BlobMathTest, TestScaleData) {
               this->epsilon_ * expected_diff_asum);
 }
 
+TYPED_TEST(BlobMathTest, TestDisconnectedUpdate) {
+  typedef typename TypeParam::Dtype Dtype;
+  // A fresh blob is fully connected and carries no mask.
+  EXPECT_FALSE(this->blob_->connectivity().get());
+  EXPECT_TRUE(this->blob_->cpu_connectivity() == NULL);
+  const int count = this->blob_->count();
+  Dtype* data = this->blob_->mutable_cpu_data();
+  for (int i = 0; i < count; ++i) {
+    data[i] = (i % 3) ? Dtype(i) : Dtype(0);
+  }
+  caffe_set(count, Dtype(1), this->blob_->mutable_cpu_diff());
+  this->blob_->Disconnect(Blob<Dtype>::ELTWISE);
+  ASSERT_TRUE(this->blob_->connectivity().get());
+  // One bit per element.
+  EXPECT_EQ((count + 31) / 32 * sizeof(unsigned int),
+            this->blob_->connectivity()->size());
+  switch (TypeParam::device) {
+  case Caffe::CPU:
+    this->blob_->mutable_cpu_data();
+    break;
+  case Caffe::GPU:
+    this->blob_->mutable_gpu_data();
+    break;
+  default:
+    LOG(FATAL) << "Unknown device: " << TypeParam::device;
+  }
+  this->blob_->Update();
+  data = this->blob_->mutable_cpu_data();
+  const Dtype* diff = this->blob_->cpu_diff();
+  for (int i = 0; i < count; ++i) {
+    if (i % 3) {
+      EXPECT_EQ(Dtype(i - 1), data[i]);
+      EXPECT_EQ(Dtype(1), diff[i]);
+    } else {
+      EXPECT_EQ(Dtype(0), data[i]);
+      EXPECT_EQ(Dtype(0), diff[i]);
+    }
+  }
+  // Group-wise: zero out the second row and a column of the 2 x 60 matrix.
+  const int cols = count / this->blob_->shape(0);
+  for (int i = 0; i < count; ++i) {
+    data[i] = (i >= cols || i % cols == 7) ? Dtype(0) : Dtype(1);
+  }
+  this->blob_->Disconnect(Blob<Dtype>::GRPWISE);
+  const unsigned int* mask = this->blob_->cpu_connectivity();
+  for (int i = 0; i < count; ++i) {
+    const bool connected = (mask[i >> 5] >> (i & 31)) & 1u;
+    EXPECT_EQ(i < cols && i % cols != 7, connected) << "element " << i;
+  }
+  this->blob_->Connect();
+  EXPECT_FALSE(this->blob_->connectivity().get());
+}
+
+TYPED_TEST(BlobMathTest, TestShareDataConnectivity) {
+  typedef typename TypeParam::Dtype Dtype;
+  // The blobs sharing the data share the mask, whichever of them allocates
+  // it, even if it is allocated after the sharing.
+  Blob<Dtype> shared(this->blob_->shape());
+  shared.ShareData(*this->blob_);
+  Blob<Dtype> sharing(this->blob_->shape());
+  this->blob_->ShareData(sharing);
+  const int count = this->blob_->count();
+  Dtype* data = this->blob_->mutable_cpu_data();
+  for (int i = 0; i < count; ++i) {
+    data[i] = (i % 3) ? Dtype(i) : Dtype(0);
+  }
+  this->blob_->Disconnect(Blob<Dtype>::ELTWISE);
+  ASSERT_TRUE(sharing.connectivity().get());
+  EXPECT_EQ(this->blob_->cpu_connectivity(), sharing.cpu_connectivity());
+  EXPECT_FALSE(shared.connectivity().get());
+  sharing.Connect();
+  EXPECT_FALSE(this->blob_->connectivity().get());
+  sharing.Disconnect(Blob<Dtype>::ELTWISE);
+  EXPECT_EQ(sharing.cpu_connectivity(), this->blob_->cpu_connectivity());
+}
+
 }  // namespace caffe
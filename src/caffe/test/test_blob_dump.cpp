@@ -0,0 +1,161 @@
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/layers/inner_product_layer.hpp"
+#include "caffe/util/blob_dump.hpp"
+#include "caffe/util/format.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/mmio.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class BlobDumpTest : public CPUDeviceTest<Dtype> {
+ protected:
+  BlobDumpTest()
+      : blob_(new Blob<Dtype>(2, 3, 4, 5)) {}
+  virtual void SetUp() {
+    char dir[] = "/tmp/caffe_blob_dump_XXXXXX";
+    ASSERT_TRUE(mkdtemp(dir) != NULL);
+    dir_ = dir;
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(blob_);
+  }
+  virtual ~BlobDumpTest() {
+    for (int i = 0; i < files_.size(); ++i) {
+      std::remove(files_[i].c_str());
+    }
+    rmdir(dir_.c_str());
+    delete blob_;
+  }
+
+  string File(const string& name) {
+    files_.push_back(dir_ + "/" + name);
+    return files_.back();
+  }
+
+  bool Exists(const string& filename) {
+    return access(filename.c_str(), F_OK) == 0;
+  }
+
+  Blob<Dtype>* const blob_;
+  string dir_;
+  vector<string> files_;
+};
+
+TYPED_TEST_CASE(BlobDumpTest, TestDtypes);
+
+TYPED_TEST(BlobDumpTest, TestRawRoundTrip) {
+  const string filename = this->File("blob.bin");
+  WriteBlobDump(*this->blob_, filename);
+  // the data starts at the first aligned offset after the header
+  FILE* fp = fopen(filename.c_str(), "rb");
+  ASSERT_TRUE(fp != NULL);
+  fseek(fp, 0, SEEK_END);
+  EXPECT_EQ(kBlobDumpAlignment + this->blob_->count() * sizeof(TypeParam),
+      static_cast<size_t>(ftell(fp)));
+  fclose(fp);
+  Blob<TypeParam> read;
+  ReadBlobDump(filename, &read);
+  EXPECT_EQ(this->blob_->shape(), read.shape());
+  for (int i = 0; i < read.count(); ++i) {
+    EXPECT_EQ(this->blob_->cpu_data()[i], read.cpu_data()[i]);
+  }
+}
+
+TYPED_TEST(BlobDumpTest, TestMatrixMarket) {
+  TypeParam* data = this->blob_->mutable_cpu_data();
+  for (int i = 0; i < this->blob_->count(); i += 3) {
+    data[i] = 0;
+  }
+  const string filename = this->File("blob.mtx");
+  WriteBlobMatrixMarket(*this->blob_, filename);
+  FILE* fp = fopen(filename.c_str(), "r");
+  ASSERT_TRUE(fp != NULL);
+  MM_typecode matcode;
+  ASSERT_EQ(0, mm_read_banner(fp, &matcode));
+  EXPECT_TRUE(mm_is_coordinate(matcode));
+  int rows, cols, nnz;
+  ASSERT_EQ(0, mm_read_mtx_crd_size(fp, &rows, &cols, &nnz));
+  EXPECT_EQ(2, rows);
+  EXPECT_EQ(60, cols);
+  EXPECT_EQ(this->blob_->count() - 40, nnz);
+  Blob<TypeParam> read;
+  read.ReshapeLike(*this->blob_);
+  caffe_set(read.count(), TypeParam(0), read.mutable_cpu_data());
+  for (int i = 0; i < nnz; ++i) {
+    int row, col;
+    double value;
+    ASSERT_EQ(3, fscanf(fp, "%d %d %lg", &row, &col, &value));
+    read.mutable_cpu_data()[(row - 1) * cols + col - 1] = value;
+  }
+  fclose(fp);
+  for (int i = 0; i < read.count(); ++i) {
+    EXPECT_EQ(this->blob_->cpu_data()[i], read.cpu_data()[i]);
+  }
+}
+
+TYPED_TEST(BlobDumpTest, TestLayerDump) {
+  typedef TypeParam Dtype;
+  vector<Blob<Dtype>*> bottom(1, this->blob_);
+  Blob<Dtype> top;
+  vector<Blob<Dtype>*> tops(1, &top);
+  LayerParameter layer_param;
+  layer_param.set_name("fc/1");
+  layer_param.mutable_inner_product_param()->set_num_output(4);
+  // the bottoms of passes 1 and 3, the weights of pass 0
+  DumpParameter* dump = layer_param.add_dump();
+  dump->set_first_pass(1);
+  dump->set_num_passes(2);
+  dump->set_period(2);
+  dump->set_prefix(this->dir_ + "/fc");
+  dump = layer_param.add_dump();
+  dump->set_source(DumpParameter_Source_WEIGHTS);
+  dump->set_format(DumpParameter_Format_MATRIX_MARKET);
+  dump->set_prefix(this->dir_ + "/weights");
+  InnerProductLayer<Dtype> layer(layer_param);
+  layer.SetUp(bottom, tops);
+  vector<shared_ptr<Blob<Dtype> > > bottoms;
+  for (int pass = 0; pass < 6; ++pass) {
+    bottoms.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+    bottoms.back()->CopyFrom(*this->blob_, false, true);
+    layer.Forward(bottom, tops);
+    // the dump holds a copy, the bottom can change right away
+    caffe_add_scalar(this->blob_->count(), Dtype(1),
+        this->blob_->mutable_cpu_data());
+  }
+  BlobDumpWriter::Get().Flush();
+  for (int pass = 0; pass < 6; ++pass) {
+    const string filename =
+        this->File("fc.bottom0." + format_int(pass) + ".bin");
+    if (pass != 1 && pass != 3) {
+      EXPECT_FALSE(this->Exists(filename));
+      continue;
+    }
+    Blob<Dtype> read;
+    ReadBlobDump(filename, &read);
+    for (int i = 0; i < read.count(); ++i) {
+      EXPECT_EQ(bottoms[pass]->cpu_data()[i], read.cpu_data()[i]);
+    }
+  }
+  for (int i = 0; i < 2; ++i) {
+    EXPECT_TRUE(this->Exists(
+        this->File("weights.param" + format_int(i) + ".0.mtx")));
+  }
+  // the default prefix is the layer name
+  EXPECT_EQ("fc_1", layer.dump_prefix(DumpParameter()));
+}
+
+}  // namespace caffe
@@ -1,5 +1,11 @@
+#include <algorithm>
+#include <cmath>
 #include <vector>
 
+#ifdef OPEN_MP
+#include <omp.h>
+#endif
+
 #include "gtest/gtest.h"
 
 #include "caffe/blob.hpp"
@@ -264,6 +270,51 @@ TYPED_TEST(ConvolutionLayerTest, TestSimpleConvolution) {
   }
 }
 
+TYPED_TEST(ConvolutionLayerTest, TestSharedWorkspace) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Two layers borrow their im2col buffers from the workspace of the thread,
+  // which is as large as the larger one; each computes from its own im2col.
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->set_num_output(4);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("constant");
+  convolution_param->mutable_bias_filler()->set_value(0.1);
+  LayerParameter strided_layer_param(layer_param);
+  ConvolutionParameter* strided_convolution_param =
+      strided_layer_param.mutable_convolution_param();
+  strided_convolution_param->add_stride(2);
+  vector<Blob<Dtype>*> strided_top_vec(1, this->blob_top_2_);
+  const size_t requested = Workspace::Get().requested();
+  ConvolutionLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  ConvolutionLayer<Dtype> strided_layer(strided_layer_param);
+  strided_layer.SetUp(this->blob_bottom_vec_, strided_top_vec);
+  // 3 * 3 * 3 rows of 4 x 2 and 2 x 1 columns
+  const size_t bytes = 27 * 8 * sizeof(Dtype);
+  const size_t strided_bytes = 27 * 2 * sizeof(Dtype);
+  EXPECT_EQ(bytes + strided_bytes, Workspace::Get().requested() - requested);
+  EXPECT_GE(Workspace::Get().size(), bytes);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  strided_layer.Forward(this->blob_bottom_vec_, strided_top_vec);
+  caffe_conv(this->blob_bottom_, convolution_param, layer.blobs(),
+      this->MakeReferenceTop(this->blob_top_));
+  const Dtype* top_data = this->blob_top_->cpu_data();
+  const Dtype* ref_top_data = this->ref_blob_top_->cpu_data();
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(top_data[i], ref_top_data[i], 1e-4);
+  }
+  caffe_conv(this->blob_bottom_, strided_convolution_param,
+      strided_layer.blobs(), this->MakeReferenceTop(this->blob_top_2_));
+  top_data = this->blob_top_2_->cpu_data();
+  ref_top_data = this->ref_blob_top_->cpu_data();
+  for (int i = 0; i < this->blob_top_2_->count(); ++i) {
+    EXPECT_NEAR(top_data[i], ref_top_data[i], 1e-4);
+  }
+}
+
 TYPED_TEST(ConvolutionLayerTest, TestDilatedConvolution) {
   typedef typename TypeParam::Dtype Dtype;
   vector<int> bottom_shape;
@@ -498,6 +549,537 @@ TYPED_TEST(ConvolutionLayerTest, TestSimpleConvolutionGroup) {
   }
 }
 
+TYPED_TEST(ConvolutionLayerTest, TestSparseConvolutionCSRMM) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->blob_bottom_vec_.push_back(this->blob_bottom_2_);
+  this->blob_top_vec_.push_back(this->blob_top_2_);
+  LayerParameter layer_param;
+  layer_param.set_phase(TEST);
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_stride(2);
+  convolution_param->set_num_output(4);
+  convolution_param->set_conv_mode(ConvolutionParameter_ConvMode_LOWERED_CSRMM);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("constant");
+  convolution_param->mutable_bias_filler()->set_value(0.1);
+  shared_ptr<Layer<Dtype> > layer(
+      new ConvolutionLayer<Dtype>(layer_param));
+  layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  // Sparsify the weights: prune the second filter and two thirds of the rest.
+  Blob<Dtype>* weights = layer->blobs()[0].get();
+  Dtype* weight_data = weights->mutable_cpu_data();
+  for (int i = 0; i < weights->count(); ++i) {
+    if (i % 3 != 0 || i / weights->count(1) == 1) {
+      weight_data[i] = 0;
+    }
+  }
+  layer->WeightAlign();
+  layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  // Check against reference convolution.
+  const Dtype* top_data;
+  const Dtype* ref_top_data;
+  caffe_conv(this->blob_bottom_, convolution_param, layer->blobs(),
+      this->MakeReferenceTop(this->blob_top_));
+  top_data = this->blob_top_->cpu_data();
+  ref_top_data = this->ref_blob_top_->cpu_data();
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(top_data[i], ref_top_data[i], 1e-4);
+  }
+  caffe_conv(this->blob_bottom_2_, convolution_param, layer->blobs(),
+      this->MakeReferenceTop(this->blob_top_2_));
+  top_data = this->blob_top_2_->cpu_data();
+  ref_top_data = this->ref_blob_top_->cpu_data();
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(top_data[i], ref_top_data[i], 1e-4);
+  }
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestSparseConvolutionGroupCSRMM) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_stride(2);
+  convolution_param->set_num_output(3);
+  convolution_param->set_group(3);
+  convolution_param->set_conv_mode(ConvolutionParameter_ConvMode_LOWERED_CSRMM);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("constant");
+  convolution_param->mutable_bias_filler()->set_value(0.1);
+  shared_ptr<Layer<Dtype> > layer(
+      new ConvolutionLayer<Dtype>(layer_param));
+  layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  Blob<Dtype>* weights = layer->blobs()[0].get();
+  Dtype* weight_data = weights->mutable_cpu_data();
+  for (int i = 0; i < weights->count(); i += 2) {
+    weight_data[i] = 0;
+  }
+  layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  // Check against reference convolution.
+  const Dtype* top_data;
+  const Dtype* ref_top_data;
+  caffe_conv(this->blob_bottom_, convolution_param, layer->blobs(),
+      this->MakeReferenceTop(this->blob_top_));
+  top_data = this->blob_top_->cpu_data();
+  ref_top_data = this->ref_blob_top_->cpu_data();
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(top_data[i], ref_top_data[i], 1e-4);
+  }
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestSparseConvolutionBSRMM) {
+  typedef typename TypeParam::Dtype Dtype;
+  // wide enough for full strips of every row besides the partial last one
+  Blob<Dtype> bottom(2, 6, 10, 12);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&bottom);
+  this->blob_bottom_vec_.clear();
+  this->blob_bottom_vec_.push_back(&bottom);
+  // block rows x block columns x groups: compiled micro-kernels, the generic
+  // kernel, and groups of 4 x 27 filters
+  const int configs[][3] = {{4, 2, 1}, {2, 9, 1}, {2, 1, 2}};
+  for (int c = 0; c < 3; ++c) {
+    LayerParameter layer_param;
+    layer_param.set_phase(TEST);
+    BlockGroupLassoSpec* block =
+        layer_param.add_param()->add_block_group_lasso();
+    block->set_ydimen(configs[c][0]);
+    block->set_xdimen(configs[c][1]);
+    ConvolutionParameter* convolution_param =
+        layer_param.mutable_convolution_param();
+    convolution_param->add_kernel_size(3);
+    convolution_param->add_pad(1);
+    convolution_param->set_num_output(8);
+    convolution_param->set_group(configs[c][2]);
+    convolution_param->set_conv_mode(
+        ConvolutionParameter_ConvMode_LOWERED_BSRMM);
+    convolution_param->mutable_weight_filler()->set_type("gaussian");
+    convolution_param->mutable_bias_filler()->set_type("constant");
+    convolution_param->mutable_bias_filler()->set_value(0.1);
+    shared_ptr<Layer<Dtype> > layer(
+        new ConvolutionLayer<Dtype>(layer_param));
+    layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    // Prune every other block, and some weights of the blocks left.
+    Blob<Dtype>* weights = layer->blobs()[0].get();
+    const int cols = weights->count(1);
+    Dtype* weight_data = weights->mutable_cpu_data();
+    for (int i = 0; i < weights->count(); ++i) {
+      const int block_row = i / cols / configs[c][0];
+      const int block_col = i % cols / configs[c][1];
+      if ((block_row + block_col) % 2 == 0 || i % 5 == 0) {
+        weight_data[i] = 0;
+      }
+    }
+    layer->WeightAlign();
+    layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    caffe_conv(&bottom, convolution_param, layer->blobs(),
+        this->MakeReferenceTop(this->blob_top_));
+    const Dtype* top_data = this->blob_top_->cpu_data();
+    const Dtype* ref_top_data = this->ref_blob_top_->cpu_data();
+    for (int i = 0; i < this->blob_top_->count(); ++i) {
+      EXPECT_NEAR(top_data[i], ref_top_data[i], 1e-4);
+    }
+  }
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestBatchedGemmConvolution) {
+  typedef typename TypeParam::Dtype Dtype;
+  Blob<Dtype> bottom(3, 4, 7, 6);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&bottom);
+  this->blob_bottom_vec_.clear();
+  this->blob_bottom_vec_.push_back(&bottom);
+  // kernel x stride x pad x groups: lowered images, and packed 1x1 ones
+  const int configs[][4] = {{3, 1, 1, 2}, {3, 2, 0, 1}, {1, 1, 0, 1}};
+  for (int c = 0; c < 3; ++c) {
+    LayerParameter layer_param;
+    ConvolutionParameter* convolution_param =
+        layer_param.mutable_convolution_param();
+    convolution_param->add_kernel_size(configs[c][0]);
+    convolution_param->add_stride(configs[c][1]);
+    convolution_param->add_pad(configs[c][2]);
+    convolution_param->set_num_output(6);
+    convolution_param->set_group(configs[c][3]);
+    convolution_param->set_conv_mode(
+        ConvolutionParameter_ConvMode_LOWERED_BATCHED_GEMM);
+    convolution_param->mutable_weight_filler()->set_type("gaussian");
+    convolution_param->mutable_bias_filler()->set_type("constant");
+    convolution_param->mutable_bias_filler()->set_value(0.1);
+    shared_ptr<Layer<Dtype> > layer(
+        new ConvolutionLayer<Dtype>(layer_param));
+    layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    caffe_conv(&bottom, convolution_param, layer->blobs(),
+        this->MakeReferenceTop(this->blob_top_));
+    const Dtype* top_data = this->blob_top_->cpu_data();
+    const Dtype* ref_top_data = this->ref_blob_top_->cpu_data();
+    for (int i = 0; i < this->blob_top_->count(); ++i) {
+      EXPECT_NEAR(top_data[i], ref_top_data[i], 1e-4);
+    }
+  }
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestFusedActivation) {
+  typedef typename TypeParam::Dtype Dtype;
+  if (Caffe::mode() != Caffe::CPU) {
+    // the activation is only fused on the CPU
+    return;
+  }
+  this->blob_bottom_vec_.push_back(this->blob_bottom_2_);
+  this->blob_top_vec_.push_back(this->blob_top_2_);
+  const ConvolutionParameter_FusedActivation activations[] = {
+      ConvolutionParameter_FusedActivation_RELU,
+      ConvolutionParameter_FusedActivation_RELU,
+      ConvolutionParameter_FusedActivation_ELU};
+  const float alphas[] = {0, 0.1, 0.5};
+  for (int a = 0; a < 3; ++a) {
+    LayerParameter layer_param;
+    layer_param.set_phase(TEST);
+    ConvolutionParameter* convolution_param =
+        layer_param.mutable_convolution_param();
+    convolution_param->add_kernel_size(3);
+    convolution_param->add_stride(2);
+    convolution_param->set_num_output(4);
+    convolution_param->mutable_weight_filler()->set_type("gaussian");
+    convolution_param->mutable_bias_filler()->set_type("constant");
+    convolution_param->mutable_bias_filler()->set_value(0.1);
+    convolution_param->set_fused_activation(activations[a]);
+    convolution_param->set_fused_alpha(alphas[a]);
+    shared_ptr<Layer<Dtype> > layer(
+        new ConvolutionLayer<Dtype>(layer_param));
+    layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    for (int b = 0; b < 2; ++b) {
+      caffe_conv(this->blob_bottom_vec_[b], convolution_param,
+          layer->blobs(), this->MakeReferenceTop(this->blob_top_vec_[b]));
+      const Dtype* top_data = this->blob_top_vec_[b]->cpu_data();
+      const Dtype* ref_top_data = this->ref_blob_top_->cpu_data();
+      for (int i = 0; i < this->blob_top_vec_[b]->count(); ++i) {
+        const Dtype x = ref_top_data[i];
+        const Dtype ref = x > 0 ? x : (a < 2 ? alphas[a] * x :
+            alphas[a] * (std::exp(x) - 1));
+        EXPECT_NEAR(top_data[i], ref, 1e-4);
+      }
+    }
+  }
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestSparseConvolutionCCNMM) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->blob_bottom_vec_.push_back(this->blob_bottom_2_);
+  this->blob_top_vec_.push_back(this->blob_top_2_);
+  LayerParameter layer_param;
+  layer_param.set_phase(TEST);
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_stride(2);
+  convolution_param->set_num_output(4);
+  convolution_param->set_conv_mode(ConvolutionParameter_ConvMode_LOWERED_CCNMM);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("constant");
+  convolution_param->mutable_bias_filler()->set_value(0.1);
+  shared_ptr<Layer<Dtype> > layer(
+      new ConvolutionLayer<Dtype>(layer_param));
+  layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  // Prune the third filter and every other column of the weight matrix.
+  Blob<Dtype>* weights = layer->blobs()[0].get();
+  const int kernel_dim = weights->count(1);
+  Dtype* weight_data = weights->mutable_cpu_data();
+  for (int i = 0; i < weights->count(); ++i) {
+    if (i / kernel_dim == 2 || (i % kernel_dim) % 2 == 1) {
+      weight_data[i] = 0;
+    }
+  }
+  layer->WeightAlign();
+  layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  // Check against reference convolution.
+  const Dtype* top_data;
+  const Dtype* ref_top_data;
+  caffe_conv(this->blob_bottom_, convolution_param, layer->blobs(),
+      this->MakeReferenceTop(this->blob_top_));
+  top_data = this->blob_top_->cpu_data();
+  ref_top_data = this->ref_blob_top_->cpu_data();
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(top_data[i], ref_top_data[i], 1e-4);
+  }
+  caffe_conv(this->blob_bottom_2_, convolution_param, layer->blobs(),
+      this->MakeReferenceTop(this->blob_top_2_));
+  top_data = this->blob_top_2_->cpu_data();
+  ref_top_data = this->ref_blob_top_->cpu_data();
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(top_data[i], ref_top_data[i], 1e-4);
+  }
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestSparseConvolutionGroupCCNMM) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_stride(2);
+  convolution_param->set_num_output(6);
+  convolution_param->set_group(3);
+  convolution_param->set_conv_mode(ConvolutionParameter_ConvMode_LOWERED_CCNMM);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("constant");
+  convolution_param->mutable_bias_filler()->set_value(0.1);
+  shared_ptr<Layer<Dtype> > layer(
+      new ConvolutionLayer<Dtype>(layer_param));
+  layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  // Prune both filters of the second group, one filter of the third group
+  // and the first three columns of every group.
+  Blob<Dtype>* weights = layer->blobs()[0].get();
+  const int kernel_dim = weights->count(1);
+  Dtype* weight_data = weights->mutable_cpu_data();
+  for (int i = 0; i < weights->count(); ++i) {
+    const int filter = i / kernel_dim;
+    if (filter == 2 || filter == 3 || filter == 5 || i % kernel_dim < 3) {
+      weight_data[i] = 0;
+    }
+  }
+  layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  // Check against reference convolution.
+  const Dtype* top_data;
+  const Dtype* ref_top_data;
+  caffe_conv(this->blob_bottom_, convolution_param, layer->blobs(),
+      this->MakeReferenceTop(this->blob_top_));
+  top_data = this->blob_top_->cpu_data();
+  ref_top_data = this->ref_blob_top_->cpu_data();
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(top_data[i], ref_top_data[i], 1e-4);
+  }
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestSparseConvolutionSCONV) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->blob_bottom_vec_.push_back(this->blob_bottom_2_);
+  this->blob_top_vec_.push_back(this->blob_top_2_);
+  LayerParameter layer_param;
+  layer_param.set_phase(TEST);
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_stride(2);
+  convolution_param->add_pad(1);
+  convolution_param->set_num_output(4);
+  convolution_param->set_conv_mode(ConvolutionParameter_ConvMode_DIRECT_SCONV);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("constant");
+  convolution_param->mutable_bias_filler()->set_value(0.1);
+  shared_ptr<Layer<Dtype> > layer(
+      new ConvolutionLayer<Dtype>(layer_param));
+  layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  // Prune the last filter and two thirds of the other weights.
+  Blob<Dtype>* weights = layer->blobs()[0].get();
+  Dtype* weight_data = weights->mutable_cpu_data();
+  for (int i = 0; i < weights->count(); ++i) {
+    if (i % 3 != 1 || i / weights->count(1) == 3) {
+      weight_data[i] = 0;
+    }
+  }
+  layer->WeightAlign();
+  layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  // Check against reference convolution.
+  const Dtype* top_data;
+  const Dtype* ref_top_data;
+  caffe_conv(this->blob_bottom_, convolution_param, layer->blobs(),
+      this->MakeReferenceTop(this->blob_top_));
+  top_data = this->blob_top_->cpu_data();
+  ref_top_data = this->ref_blob_top_->cpu_data();
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(top_data[i], ref_top_data[i], 1e-4);
+  }
+  caffe_conv(this->blob_bottom_2_, convolution_param, layer->blobs(),
+      this->MakeReferenceTop(this->blob_top_2_));
+  top_data = this->blob_top_2_->cpu_data();
+  ref_top_data = this->ref_blob_top_->cpu_data();
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(top_data[i], ref_top_data[i], 1e-4);
+  }
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestSparseDilatedConvolutionGroupSCONV) {
+  typedef typename TypeParam::Dtype Dtype;
+  vector<int> bottom_shape;
+  bottom_shape.push_back(2);
+  bottom_shape.push_back(3);
+  bottom_shape.push_back(8);
+  bottom_shape.push_back(7);
+  this->blob_bottom_->Reshape(bottom_shape);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_dilation(2);
+  convolution_param->add_pad(1);
+  convolution_param->set_num_output(6);
+  convolution_param->set_group(3);
+  convolution_param->set_conv_mode(ConvolutionParameter_ConvMode_DIRECT_SCONV);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("constant");
+  convolution_param->mutable_bias_filler()->set_value(0.1);
+  shared_ptr<Layer<Dtype> > layer(
+      new ConvolutionLayer<Dtype>(layer_param));
+  layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  Blob<Dtype>* weights = layer->blobs()[0].get();
+  Dtype* weight_data = weights->mutable_cpu_data();
+  for (int i = 0; i < weights->count(); i += 2) {
+    weight_data[i] = 0;
+  }
+  layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  // Check against reference convolution.
+  const Dtype* top_data;
+  const Dtype* ref_top_data;
+  caffe_conv(this->blob_bottom_, convolution_param, layer->blobs(),
+      this->MakeReferenceTop(this->blob_top_));
+  top_data = this->blob_top_->cpu_data();
+  ref_top_data = this->ref_blob_top_->cpu_data();
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(top_data[i], ref_top_data[i], 1e-4);
+  }
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestSparseConvolutionAUTO) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  layer_param.set_phase(TEST);
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_stride(2);
+  convolution_param->set_num_output(4);
+  convolution_param->set_conv_mode(ConvolutionParameter_ConvMode_AUTO);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("constant");
+  convolution_param->mutable_bias_filler()->set_value(0.1);
+  shared_ptr<Layer<Dtype> > layer(
+      new ConvolutionLayer<Dtype>(layer_param));
+  layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  // Prune a filter and some columns so that every mode is a candidate.
+  Blob<Dtype>* weights = layer->blobs()[0].get();
+  const int kernel_dim = weights->count(1);
+  Dtype* weight_data = weights->mutable_cpu_data();
+  for (int i = 0; i < weights->count(); ++i) {
+    if (i / kernel_dim == 1 || (i % kernel_dim) % 3 == 0) {
+      weight_data[i] = 0;
+    }
+  }
+  layer->WeightAlign();
+  // Whatever mode is picked, the first and later passes must be right.
+  for (int pass = 0; pass < 2; ++pass) {
+    layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    caffe_conv(this->blob_bottom_, convolution_param, layer->blobs(),
+        this->MakeReferenceTop(this->blob_top_));
+    const Dtype* top_data = this->blob_top_->cpu_data();
+    const Dtype* ref_top_data = this->ref_blob_top_->cpu_data();
+    for (int i = 0; i < this->blob_top_->count(); ++i) {
+      EXPECT_NEAR(top_data[i], ref_top_data[i], 1e-4);
+    }
+  }
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestInt8Convolution) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  layer_param.set_phase(TEST);
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_stride(2);
+  convolution_param->add_pad(1);
+  convolution_param->set_num_output(6);
+  convolution_param->set_group(3);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("constant");
+  convolution_param->mutable_bias_filler()->set_value(0.1);
+  Dtype max_input = 0;
+  for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+    max_input = std::max(max_input, std::abs(this->blob_bottom_->cpu_data()[i]));
+  }
+  convolution_param->set_conv_mode(ConvolutionParameter_ConvMode_LOWERED_INT8);
+  convolution_param->set_int8_input_scale(127 / max_input);
+  // the GPU runs in floating point and cannot fuse the ReLU
+  const int fusions = Caffe::mode() == Caffe::CPU ? 2 : 1;
+  for (int relu = 0; relu < fusions; ++relu) {
+    convolution_param->set_fused_activation(relu == 1 ?
+        ConvolutionParameter_FusedActivation_RELU :
+        ConvolutionParameter_FusedActivation_NO_ACTIVATION);
+    shared_ptr<Layer<Dtype> > layer(
+        new ConvolutionLayer<Dtype>(layer_param));
+    layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer->WeightAlign();
+    layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    caffe_conv(this->blob_bottom_, convolution_param, layer->blobs(),
+        this->MakeReferenceTop(this->blob_top_));
+    // each operand is off by up to half a step of its 127 steps, so every
+    // product by up to max_input * max_weight / 127
+    const Blob<Dtype>& weights = *layer->blobs()[0];
+    Dtype max_weight = 0;
+    for (int i = 0; i < weights.count(); ++i) {
+      max_weight = std::max(max_weight, std::abs(weights.cpu_data()[i]));
+    }
+    const Dtype tolerance = weights.count(1) * max_input * max_weight / 127;
+    const Dtype* top_data = this->blob_top_->cpu_data();
+    const Dtype* ref_top_data = this->ref_blob_top_->cpu_data();
+    for (int i = 0; i < this->blob_top_->count(); ++i) {
+      const Dtype ref = relu ? std::max(ref_top_data[i], Dtype(0)) :
+          ref_top_data[i];
+      EXPECT_NEAR(ref, top_data[i], tolerance);
+    }
+  }
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestSparseInputConvolution) {
+  typedef typename TypeParam::Dtype Dtype;
+  // about 70% zeros, as after a ReLU
+  Dtype* data = this->blob_bottom_->mutable_cpu_data();
+  for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+    data[i] = std::max(data[i] - Dtype(0.5), Dtype(0));
+  }
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_stride(2);
+  convolution_param->add_pad(1);
+  convolution_param->add_dilation(2);
+  convolution_param->set_num_output(6);
+  convolution_param->set_group(3);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("constant");
+  convolution_param->mutable_bias_filler()->set_value(0.1);
+  // the inputs are sparse enough for the first threshold only
+  const float thresholds[] = {0.9, 0.1};
+  for (int phase = 0; phase < 2; ++phase) {
+    layer_param.set_phase(phase == 0 ? TRAIN : TEST);
+    for (int i = 0; i < 2; ++i) {
+      convolution_param->set_input_density_threshold(thresholds[i]);
+      shared_ptr<Layer<Dtype> > layer(
+          new ConvolutionLayer<Dtype>(layer_param));
+      layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+      layer->WeightAlign();
+      layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+      caffe_conv(this->blob_bottom_, convolution_param, layer->blobs(),
+          this->MakeReferenceTop(this->blob_top_));
+      const Dtype* top_data = this->blob_top_->cpu_data();
+      const Dtype* ref_top_data = this->ref_blob_top_->cpu_data();
+      for (int j = 0; j < this->blob_top_->count(); ++j) {
+        EXPECT_NEAR(top_data[j], ref_top_data[j], 1e-4);
+      }
+    }
+  }
+}
+
 TYPED_TEST(ConvolutionLayerTest, TestSobelConvolution) {
   // Test separable convolution by computing the Sobel operator
   // as a single filter then comparing the result
@@ -727,6 +1309,72 @@ TYPED_TEST(ConvolutionLayerTest, TestGradient) {
       this->blob_top_vec_);
 }
 
+TYPED_TEST(ConvolutionLayerTest, TestImageThreads) {
+  typedef typename TypeParam::Dtype Dtype;
+  // The images of the batch on concurrent threads give the outputs and
+  // gradients of one image after the other.
+#ifdef OPEN_MP
+  const int max_threads = omp_get_max_threads();
+  omp_set_num_threads(3);
+#endif
+  Blob<Dtype> bottom(5, 4, 6, 5);
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&bottom);
+  vector<Blob<Dtype>*> bottom_vec(1, &bottom);
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_pad(1);
+  convolution_param->set_num_output(6);
+  convolution_param->set_group(2);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  ConvolutionLayer<Dtype> layer(layer_param);
+  Blob<Dtype> top;
+  vector<Blob<Dtype>*> top_vec(1, &top);
+  layer.SetUp(bottom_vec, top_vec);
+  convolution_param->set_batch_threading(
+      ConvolutionParameter_BatchThreading_IMAGE_THREADS);
+  ConvolutionLayer<Dtype> threaded_layer(layer_param);
+  Blob<Dtype> threaded_top;
+  vector<Blob<Dtype>*> threaded_top_vec(1, &threaded_top);
+  threaded_layer.SetUp(bottom_vec, threaded_top_vec);
+  for (int i = 0; i < layer.blobs().size(); ++i) {
+    threaded_layer.blobs()[i]->CopyFrom(*layer.blobs()[i]);
+  }
+  layer.Forward(bottom_vec, top_vec);
+  threaded_layer.Forward(bottom_vec, threaded_top_vec);
+  for (int i = 0; i < top.count(); ++i) {
+    EXPECT_NEAR(top.cpu_data()[i], threaded_top.cpu_data()[i], 1e-4);
+  }
+  filler.Fill(&top);
+  caffe_copy(top.count(), top.cpu_data(), top.mutable_cpu_diff());
+  caffe_copy(top.count(), top.cpu_data(), threaded_top.mutable_cpu_diff());
+  const vector<bool> propagate_down(1, true);
+  Blob<Dtype> bottom_diff;
+  bottom_diff.ReshapeLike(bottom);
+  layer.Backward(top_vec, propagate_down, bottom_vec);
+  caffe_copy(bottom.count(), bottom.cpu_diff(),
+      bottom_diff.mutable_cpu_data());
+  threaded_layer.Backward(threaded_top_vec, propagate_down, bottom_vec);
+  for (int i = 0; i < bottom.count(); ++i) {
+    EXPECT_NEAR(bottom_diff.cpu_data()[i], bottom.cpu_diff()[i], 1e-4);
+  }
+  for (int i = 0; i < layer.blobs().size(); ++i) {
+    const Blob<Dtype>& param = *layer.blobs()[i];
+    const Blob<Dtype>& threaded_param = *threaded_layer.blobs()[i];
+    for (int j = 0; j < param.count(); ++j) {
+      EXPECT_NEAR(param.cpu_diff()[j], threaded_param.cpu_diff()[j], 1e-4);
+    }
+  }
+#ifdef OPEN_MP
+  omp_set_num_threads(max_threads);
+#endif
+}
+
 TYPED_TEST(ConvolutionLayerTest, TestDilatedGradient) {
   typedef typename TypeParam::Dtype Dtype;
   LayerParameter layer_param;
@@ -1,12 +1,21 @@
+#include <cstring>
 #include <vector>
 
+#ifdef OPEN_MP
+#include <omp.h>
+#endif
+
 #include "gtest/gtest.h"
 
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
+#include "caffe/filler.hpp"
 #include "caffe/layers/conv_q_layer.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/product_quantization.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
+#include "caffe/test/test_gradient_check_util.hpp"
 
 namespace caffe {
 
@@ -32,6 +41,44 @@ protected:
 
 	virtual ~ConvolutionQLayerTest() { }
 
+	// Fills the codebook and the codes of a quantized layer at random and
+	// returns the equivalent dense weights in weights.
+	void FillQuantized(ConvolutionQLayer<Dtype>* layer, const int k, const int m,
+			Blob<Dtype>* weights) {
+		Blob<Dtype>& codebook = *layer->blobs()[0];
+		FillerParameter filler_param;
+		GaussianFiller<Dtype> filler(filler_param);
+		filler.Fill(&codebook);
+		const int num_output = weights->shape(0);
+		const int channels = weights->shape(1);
+		const int kernel_dim = weights->count(2);
+		const int n = channels / m * num_output * kernel_dim;
+		vector<int> codes(n);
+		for (int i = 0; i < n; ++i) {
+			codes[i] = caffe_rng_rand() % k;
+		}
+		const int bits = (int)log2(k);
+		vector<unsigned int> packed(caffe_packed_codes_size(n, bits));
+		caffe_pack_codes(n, &codes[0], bits, &packed[0]);
+		Blob<Dtype>& packed_codes = *layer->blobs()[2];
+		packed_codes.Reshape(vector<int>(1,
+				(packed.size() * sizeof(unsigned int) + sizeof(Dtype) - 1) / sizeof(Dtype)));
+		memcpy(packed_codes.mutable_cpu_data(), &packed[0], packed.size() * sizeof(unsigned int));
+		layer->WeightAlign();
+		Dtype* data = weights->mutable_cpu_data();
+		for (int slice = 0; slice < channels / m; ++slice) {
+			for (int out_channel = 0; out_channel < num_output; ++out_channel) {
+				for (int tap = 0; tap < kernel_dim; ++tap) {
+					const int code = codes[(slice * num_output + out_channel) * kernel_dim + tap];
+					for (int r = 0; r < m; ++r) {
+						data[(out_channel * channels + slice * m + r) * kernel_dim + tap] =
+								codebook.cpu_data()[(slice * k + code) * m + r];
+					}
+				}
+			}
+		}
+	}
+
 	Blob<Dtype>* const blob_bottom_;
 	Blob<Dtype>* const blob_top_;
 	Blob<Dtype>* const D_;
@@ -48,11 +95,10 @@ TYPED_TEST(ConvolutionQLayerTest, TestForward) {
 	Blob<Dtype>* const B_ = new Blob<Dtype>(shape);
 	int val1 = 88848439;
 	int val2 = 1879048192;
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wstrict-aliasing"
-	B_->mutable_cpu_data()[0] = reinterpret_cast<Dtype&>(val1);
-	B_->mutable_cpu_data()[1] = reinterpret_cast<Dtype&>(val2);
-#pragma GCC diagnostic pop
+	// the codes are packed into 32-bit words whatever the Dtype
+	unsigned int* packed = reinterpret_cast<unsigned int*>(B_->mutable_cpu_data());
+	packed[0] = val1;
+	packed[1] = val2;
 	Blob<Dtype>* const bias_ = new Blob<Dtype>(shape);
 	bias_->mutable_cpu_data()[0] = 0;
 	bias_->mutable_cpu_data()[1] = -1;
@@ -86,4 +132,79 @@ TYPED_TEST(ConvolutionQLayerTest, TestForward) {
 	}
 }
 
+TYPED_TEST(ConvolutionQLayerTest, TestForwardStrideDilation) {
+	typedef typename TypeParam::Dtype Dtype;
+	this->blob_bottom_->Reshape(3, 4, 7, 6);
+	FillerParameter filler_param;
+	GaussianFiller<Dtype> filler(filler_param);
+	filler.Fill(this->blob_bottom_);
+	LayerParameter layer_param;
+	ConvolutionParameter* convolution_param = layer_param.mutable_convolution_param();
+	convolution_param->set_kernel_h(3);
+	convolution_param->set_kernel_w(2);
+	convolution_param->set_stride_h(2);
+	convolution_param->set_stride_w(1);
+	convolution_param->set_pad_h(1);
+	convolution_param->set_pad_w(2);
+	convolution_param->add_dilation(2);
+	convolution_param->set_num_output(3);
+	convolution_param->mutable_bias_filler()->set_type("gaussian");
+	ConvolutionLayer<Dtype> layer(layer_param);
+	layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+	convolution_param->set_k(4);
+	convolution_param->set_m(2);
+	ConvolutionQLayer<Dtype> q_layer(layer_param);
+	Blob<Dtype> top_q;
+	vector<Blob<Dtype>*> top_q_vec(1, &top_q);
+	q_layer.SetUp(this->blob_bottom_vec_, top_q_vec);
+	q_layer.blobs()[1] = layer.blobs()[1];
+	this->FillQuantized(&q_layer, 4, 2, layer.blobs()[0].get());
+	layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+	// the images in parallel, then the output channels when there are
+	// more threads than images
+	int threads[] = {1, 4};
+	for (int t = 0; t < 2; ++t) {
+#ifdef OPEN_MP
+		const int max_threads = omp_get_max_threads();
+		omp_set_num_threads(threads[t]);
+#endif
+		q_layer.Forward(this->blob_bottom_vec_, top_q_vec);
+#ifdef OPEN_MP
+		omp_set_num_threads(max_threads);
+#endif
+		ASSERT_EQ(this->blob_top_->shape(), top_q.shape());
+		for (int i = 0; i < top_q.count(); ++i) {
+			EXPECT_NEAR(this->blob_top_->cpu_data()[i], top_q.cpu_data()[i],
+					1e-4 * (1 + fabs(this->blob_top_->cpu_data()[i]))) << threads[t];
+		}
+	}
+}
+
+TYPED_TEST(ConvolutionQLayerTest, TestGradient) {
+	typedef typename TypeParam::Dtype Dtype;
+	this->blob_bottom_->Reshape(2, 4, 6, 7);
+	FillerParameter filler_param;
+	GaussianFiller<Dtype> filler(filler_param);
+	filler.Fill(this->blob_bottom_);
+	LayerParameter layer_param;
+	ConvolutionParameter* convolution_param = layer_param.mutable_convolution_param();
+	convolution_param->add_kernel_size(3);
+	convolution_param->add_stride(2);
+	convolution_param->add_pad(1);
+	convolution_param->add_dilation(2);
+	convolution_param->set_num_output(3);
+	convolution_param->mutable_bias_filler()->set_type("gaussian");
+	convolution_param->set_k(4);
+	convolution_param->set_m(2);
+	ConvolutionQLayer<Dtype> layer(layer_param);
+	layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+	Blob<Dtype> weights(3, 4, 3, 3);
+	this->FillQuantized(&layer, 4, 2, &weights);
+	// the codes get no gradient, the checker finds none either since
+	// they are only unpacked by WeightAlign
+	GradientChecker<Dtype> checker(1e-2, 1e-3);
+	checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+			this->blob_top_vec_);
+}
+
 }
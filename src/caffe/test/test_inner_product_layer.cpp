@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cmath>
 #include <vector>
 
 #include "gtest/gtest.h"
@@ -388,4 +390,334 @@ TYPED_TEST(InnerProductLayerTest, TestBackwardTranspose) {
   }
 }
 
+// Prunes two thirds of the weights of an InnerProduct layer.
+template <typename Dtype>
+static void PruneWeights(Blob<Dtype>* weights) {
+  Dtype* weight_data = weights->mutable_cpu_data();
+  for (int i = 0; i < weights->count(); ++i) {
+    if (i % 3 != 0) {
+      weight_data[i] = 0;
+    }
+  }
+}
+
+TYPED_TEST(InnerProductLayerTest, TestForwardCSRMM) {
+  typedef typename TypeParam::Dtype Dtype;
+  FillerParameter filler_param;
+  UniformFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_nobatch_);
+  // the batch of two takes the SpMM path, the single input the SpMV one
+  Blob<Dtype>* const bottoms[] = {this->blob_bottom_, this->blob_bottom_nobatch_};
+  for (int b = 0; b < 2; ++b) {
+    for (int t = 0; t < 2; ++t) {
+      this->blob_bottom_vec_.clear();
+      this->blob_bottom_vec_.push_back(bottoms[b]);
+      LayerParameter layer_param;
+      layer_param.set_phase(TEST);
+      InnerProductParameter* inner_product_param =
+          layer_param.mutable_inner_product_param();
+      inner_product_param->set_num_output(10);
+      inner_product_param->set_transpose(t == 1);
+      inner_product_param->mutable_weight_filler()->set_type("gaussian");
+      inner_product_param->mutable_bias_filler()->set_type("uniform");
+      shared_ptr<InnerProductLayer<Dtype> > layer(
+          new InnerProductLayer<Dtype>(layer_param));
+      layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+      PruneWeights(layer->blobs()[0].get());
+      layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+      Blob<Dtype> ref_top;
+      ref_top.CopyFrom(*this->blob_top_, false, true);
+
+      inner_product_param->set_ip_mode(InnerProductParameter_IpMode_CSRMM);
+      shared_ptr<InnerProductLayer<Dtype> > sparse_layer(
+          new InnerProductLayer<Dtype>(layer_param));
+      sparse_layer->blobs() = layer->blobs();
+      sparse_layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+      sparse_layer->WeightAlign();
+      sparse_layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+      for (int i = 0; i < ref_top.count(); ++i) {
+        EXPECT_NEAR(ref_top.cpu_data()[i], this->blob_top_->cpu_data()[i], 1e-4);
+      }
+    }
+  }
+}
+
+TYPED_TEST(InnerProductLayerTest, TestForwardBSRMM) {
+  typedef typename TypeParam::Dtype Dtype;
+  FillerParameter filler_param;
+  UniformFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_nobatch_);
+  Blob<Dtype>* const bottoms[] = {this->blob_bottom_, this->blob_bottom_nobatch_};
+  for (int b = 0; b < 2; ++b) {
+    for (int t = 0; t < 2; ++t) {
+      this->blob_bottom_vec_.clear();
+      this->blob_bottom_vec_.push_back(bottoms[b]);
+      LayerParameter layer_param;
+      layer_param.set_phase(TEST);
+      InnerProductParameter* inner_product_param =
+          layer_param.mutable_inner_product_param();
+      inner_product_param->set_num_output(10);
+      inner_product_param->set_transpose(t == 1);
+      inner_product_param->mutable_weight_filler()->set_type("gaussian");
+      inner_product_param->mutable_bias_filler()->set_type("uniform");
+      shared_ptr<InnerProductLayer<Dtype> > layer(
+          new InnerProductLayer<Dtype>(layer_param));
+      layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+      // Prune every other 2 x 4 block of the 10 x K weights, stored K x 10
+      // if transposed.
+      Blob<Dtype>* weights = layer->blobs()[0].get();
+      const int cols = weights->shape(1);
+      const int block_rows = t == 1 ? 4 : 2;
+      const int block_cols = t == 1 ? 2 : 4;
+      Dtype* weight_data = weights->mutable_cpu_data();
+      for (int i = 0; i < weights->count(); ++i) {
+        if ((i / cols / block_rows + i % cols / block_cols) % 2 == 0) {
+          weight_data[i] = 0;
+        }
+      }
+      layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+      Blob<Dtype> ref_top;
+      ref_top.CopyFrom(*this->blob_top_, false, true);
+
+      inner_product_param->set_ip_mode(InnerProductParameter_IpMode_BSRMM);
+      BlockGroupLassoSpec* block =
+          layer_param.add_param()->add_block_group_lasso();
+      block->set_ydimen(block_rows);
+      block->set_xdimen(block_cols);
+      shared_ptr<InnerProductLayer<Dtype> > sparse_layer(
+          new InnerProductLayer<Dtype>(layer_param));
+      sparse_layer->blobs() = layer->blobs();
+      sparse_layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+      sparse_layer->WeightAlign();
+      sparse_layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+      for (int i = 0; i < ref_top.count(); ++i) {
+        EXPECT_NEAR(ref_top.cpu_data()[i], this->blob_top_->cpu_data()[i], 1e-4);
+      }
+    }
+  }
+}
+
+TYPED_TEST(InnerProductLayerTest, TestForwardSparseInput) {
+  typedef typename TypeParam::Dtype Dtype;
+  FillerParameter filler_param;
+  UniformFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_nobatch_);
+  // about 60% zeros, as after a ReLU
+  Blob<Dtype>* const bottoms[] = {this->blob_bottom_, this->blob_bottom_nobatch_};
+  for (int b = 0; b < 2; ++b) {
+    Dtype* data = bottoms[b]->mutable_cpu_data();
+    for (int i = 0; i < bottoms[b]->count(); ++i) {
+      data[i] = std::max(data[i] - Dtype(0.6), Dtype(0));
+    }
+  }
+  for (int b = 0; b < 2; ++b) {
+    for (int t = 0; t < 2; ++t) {
+      this->blob_bottom_vec_.clear();
+      this->blob_bottom_vec_.push_back(bottoms[b]);
+      LayerParameter layer_param;
+      InnerProductParameter* inner_product_param =
+          layer_param.mutable_inner_product_param();
+      inner_product_param->set_num_output(10);
+      inner_product_param->set_transpose(t == 1);
+      inner_product_param->mutable_weight_filler()->set_type("gaussian");
+      inner_product_param->mutable_bias_filler()->set_type("uniform");
+      shared_ptr<InnerProductLayer<Dtype> > layer(
+          new InnerProductLayer<Dtype>(layer_param));
+      layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+      layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+      Blob<Dtype> ref_top;
+      ref_top.CopyFrom(*this->blob_top_, false, true);
+
+      // the inputs are sparse enough for the first threshold only
+      const float thresholds[] = {0.9, 0.1};
+      for (int i = 0; i < 2; ++i) {
+        inner_product_param->set_input_density_threshold(thresholds[i]);
+        shared_ptr<InnerProductLayer<Dtype> > sparse_layer(
+            new InnerProductLayer<Dtype>(layer_param));
+        sparse_layer->blobs() = layer->blobs();
+        sparse_layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+        sparse_layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+        for (int j = 0; j < ref_top.count(); ++j) {
+          EXPECT_NEAR(ref_top.cpu_data()[j], this->blob_top_->cpu_data()[j],
+              1e-4);
+        }
+      }
+    }
+  }
+}
+
+TYPED_TEST(InnerProductLayerTest, TestForwardFusedActivation) {
+  typedef typename TypeParam::Dtype Dtype;
+  if (Caffe::mode() != Caffe::CPU) {
+    // the activation is only fused on the CPU
+    return;
+  }
+  this->blob_bottom_vec_.push_back(this->blob_bottom_);
+  const ConvolutionParameter_FusedActivation activations[] = {
+      ConvolutionParameter_FusedActivation_RELU,
+      ConvolutionParameter_FusedActivation_ELU};
+  const float alphas[] = {0.2, 1};
+  for (int a = 0; a < 2; ++a) {
+    LayerParameter layer_param;
+    layer_param.set_phase(TEST);
+    InnerProductParameter* inner_product_param =
+        layer_param.mutable_inner_product_param();
+    inner_product_param->set_num_output(10);
+    inner_product_param->mutable_weight_filler()->set_type("gaussian");
+    inner_product_param->mutable_bias_filler()->set_type("uniform");
+    inner_product_param->mutable_bias_filler()->set_min(-1);
+    shared_ptr<InnerProductLayer<Dtype> > layer(
+        new InnerProductLayer<Dtype>(layer_param));
+    layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    Blob<Dtype> ref_top;
+    ref_top.CopyFrom(*this->blob_top_, false, true);
+
+    inner_product_param->set_fused_activation(activations[a]);
+    inner_product_param->set_fused_alpha(alphas[a]);
+    shared_ptr<InnerProductLayer<Dtype> > fused_layer(
+        new InnerProductLayer<Dtype>(layer_param));
+    fused_layer->blobs() = layer->blobs();
+    fused_layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    fused_layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    for (int i = 0; i < ref_top.count(); ++i) {
+      const Dtype x = ref_top.cpu_data()[i];
+      const Dtype ref = x > 0 ? x : (a == 0 ? alphas[a] * x :
+          alphas[a] * (std::exp(x) - 1));
+      EXPECT_NEAR(ref, this->blob_top_->cpu_data()[i], 1e-4);
+    }
+  }
+}
+
+TYPED_TEST(InnerProductLayerTest, TestForwardInt8) {
+  typedef typename TypeParam::Dtype Dtype;
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_nobatch_);
+  // the uniform batch takes the nonnegative kernel, the gaussian input not
+  Blob<Dtype>* const bottoms[] = {this->blob_bottom_, this->blob_bottom_nobatch_};
+  // the GPU runs in floating point and cannot fuse the ReLU
+  const int fusions = Caffe::mode() == Caffe::CPU ? 2 : 1;
+  for (int b = 0; b < 2; ++b) {
+    Dtype max_input = 0;
+    for (int i = 0; i < bottoms[b]->count(); ++i) {
+      max_input = std::max(max_input, std::abs(bottoms[b]->cpu_data()[i]));
+    }
+    for (int t = 0; t < 2 * fusions; ++t) {
+      this->blob_bottom_vec_.clear();
+      this->blob_bottom_vec_.push_back(bottoms[b]);
+      LayerParameter layer_param;
+      layer_param.set_phase(TEST);
+      InnerProductParameter* inner_product_param =
+          layer_param.mutable_inner_product_param();
+      inner_product_param->set_num_output(10);
+      inner_product_param->set_transpose(t % 2 == 1);
+      inner_product_param->mutable_weight_filler()->set_type("gaussian");
+      inner_product_param->mutable_bias_filler()->set_type("uniform");
+      shared_ptr<InnerProductLayer<Dtype> > layer(
+          new InnerProductLayer<Dtype>(layer_param));
+      layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+      layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+      Blob<Dtype> ref_top;
+      ref_top.CopyFrom(*this->blob_top_, false, true);
+
+      const bool relu = t >= 2;
+      inner_product_param->set_ip_mode(InnerProductParameter_IpMode_INT8);
+      inner_product_param->set_int8_input_scale(127 / max_input);
+      inner_product_param->set_fused_activation(relu ?
+          ConvolutionParameter_FusedActivation_RELU :
+          ConvolutionParameter_FusedActivation_NO_ACTIVATION);
+      shared_ptr<InnerProductLayer<Dtype> > int8_layer(
+          new InnerProductLayer<Dtype>(layer_param));
+      int8_layer->blobs() = layer->blobs();
+      int8_layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+      int8_layer->WeightAlign();
+      int8_layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+      // each operand is off by up to half a step of its 127 steps, so every
+      // product by up to max_input * max_weight / 127
+      const Blob<Dtype>& weights = *layer->blobs()[0];
+      Dtype max_weight = 0;
+      for (int i = 0; i < weights.count(); ++i) {
+        max_weight = std::max(max_weight, std::abs(weights.cpu_data()[i]));
+      }
+      const Dtype tolerance =
+          bottoms[b]->count(1) * max_input * max_weight / 127;
+      for (int i = 0; i < ref_top.count(); ++i) {
+        const Dtype ref = relu ? std::max(ref_top.cpu_data()[i], Dtype(0)) :
+            ref_top.cpu_data()[i];
+        EXPECT_NEAR(ref, this->blob_top_->cpu_data()[i], tolerance);
+      }
+    }
+  }
+}
+
+TYPED_TEST(InnerProductLayerTest, TestBackwardCSRMM) {
+  typedef typename TypeParam::Dtype Dtype;
+  FillerParameter filler_param;
+  UniformFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_nobatch_);
+  Blob<Dtype>* const bottoms[] = {this->blob_bottom_, this->blob_bottom_nobatch_};
+  for (int b = 0; b < 2; ++b) {
+    this->blob_bottom_vec_.clear();
+    this->blob_bottom_vec_.push_back(bottoms[b]);
+    LayerParameter layer_param;
+    InnerProductParameter* inner_product_param =
+        layer_param.mutable_inner_product_param();
+    inner_product_param->set_num_output(10);
+    inner_product_param->mutable_weight_filler()->set_type("gaussian");
+    inner_product_param->mutable_bias_filler()->set_type("uniform");
+    shared_ptr<InnerProductLayer<Dtype> > layer(
+        new InnerProductLayer<Dtype>(layer_param));
+    layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    PruneWeights(layer->blobs()[0].get());
+
+    // the sparse layer trains a copy of the weights with the zeros frozen
+    layer_param.set_connectivity_mode(
+        LayerParameter_ConnectivityMode_DISCONNECTED_ELTWISE);
+    inner_product_param->set_ip_mode(InnerProductParameter_IpMode_CSRMM);
+    shared_ptr<InnerProductLayer<Dtype> > sparse_layer(
+        new InnerProductLayer<Dtype>(layer_param));
+    for (int i = 0; i < layer->blobs().size(); ++i) {
+      sparse_layer->blobs().push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+      sparse_layer->blobs()[i]->CopyFrom(*layer->blobs()[i], false, true);
+    }
+    sparse_layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    sparse_layer->WeightAlign();
+
+    Blob<Dtype> top_diff;
+    vector<bool> propagate_down(1, true);
+    layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    top_diff.ReshapeLike(*this->blob_top_);
+    filler.Fill(&top_diff);
+    caffe_copy(top_diff.count(), top_diff.cpu_data(),
+        this->blob_top_->mutable_cpu_diff());
+    layer->Backward(this->blob_top_vec_, propagate_down, this->blob_bottom_vec_);
+    Blob<Dtype> ref_bottom_diff;
+    ref_bottom_diff.CopyFrom(*this->blob_bottom_vec_[0], true, true);
+
+    sparse_layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    caffe_copy(top_diff.count(), top_diff.cpu_data(),
+        this->blob_top_->mutable_cpu_diff());
+    sparse_layer->Backward(this->blob_top_vec_, propagate_down,
+        this->blob_bottom_vec_);
+    for (int i = 0; i < ref_bottom_diff.count(); ++i) {
+      EXPECT_NEAR(ref_bottom_diff.cpu_diff()[i],
+          this->blob_bottom_vec_[0]->cpu_diff()[i], 1e-4);
+    }
+    const Blob<Dtype>& weights = *layer->blobs()[0];
+    for (int i = 0; i < weights.count(); ++i) {
+      if (weights.cpu_data()[i] != 0) {
+        EXPECT_NEAR(weights.cpu_diff()[i],
+            sparse_layer->blobs()[0]->cpu_diff()[i], 1e-4);
+      } else {
+        EXPECT_EQ(0, sparse_layer->blobs()[0]->cpu_diff()[i]);
+      }
+    }
+    for (int i = 0; i < layer->blobs()[1]->count(); ++i) {
+      EXPECT_NEAR(layer->blobs()[1]->cpu_diff()[i],
+          sparse_layer->blobs()[1]->cpu_diff()[i], 1e-4);
+    }
+  }
+}
+
 }  // namespace caffe
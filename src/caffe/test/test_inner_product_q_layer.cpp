@@ -9,6 +9,8 @@
 #include "caffe/layers/inner_product_layer.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
+#include "caffe/test/test_gradient_check_util.hpp"
+#include "caffe/util/benchmark.hpp"
 
 namespace caffe {
 
@@ -88,6 +90,86 @@ TYPED_TEST(InnerProductQLayerTest, TestForward) {
 }
 
 
+// Builds a small layer with random codebook, bias and codeword indices.
+template <typename Dtype>
+static shared_ptr<InnerProductQLayer<Dtype> > MakeSmallQLayer(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+    LayerParameter layer_param;
+    InnerProductQParameter *inner_product_q_param = layer_param.mutable_inner_product_q_param();
+    inner_product_q_param->set_num_output(5);
+    inner_product_q_param->set_k(4);
+    inner_product_q_param->set_m(3);
+    shared_ptr<InnerProductQLayer<Dtype> > layer(new InnerProductQLayer<Dtype>(layer_param));
+    layer->SetUp(bottom, top);
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(layer->blobs()[0].get());
+    filler.Fill(layer->blobs()[1].get());
+    Blob<Dtype>* B = layer->blobs()[2].get();
+    srand(1701);
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wstrict-aliasing"
+    for (int i = 0; i < B->count(); ++i) {
+        int tmp = (rand() << 16) | rand();
+        B->mutable_cpu_data()[i] = reinterpret_cast<Dtype&>(tmp);
+    }
+#pragma GCC diagnostic pop
+    // the indices are unpacked once; refresh them as after loading weights
+    layer->WeightAlign();
+    return layer;
+}
+
+TYPED_TEST(InnerProductQLayerTest, TestForwardBatch) {
+    typedef typename TypeParam::Dtype Dtype;
+    this->blob_bottom_ = new Blob<Dtype>(3, 2, 3, 2);
+    this->blob_top_ = new Blob<Dtype>();
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_);
+    this->blob_bottom_vec_.push_back(this->blob_bottom_);
+    this->blob_top_vec_.push_back(this->blob_top_);
+    shared_ptr<InnerProductQLayer<Dtype> > layer =
+        MakeSmallQLayer(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    EXPECT_EQ(3, this->blob_top_->num());
+    EXPECT_EQ(5, this->blob_top_->channels());
+    // every image of the batch matches a forward pass of that image alone
+    const int dim = this->blob_bottom_->count(1);
+    Blob<Dtype> single_bottom(1, 2, 3, 2);
+    Blob<Dtype> single_top;
+    vector<Blob<Dtype>*> single_bottom_vec(1, &single_bottom);
+    vector<Blob<Dtype>*> single_top_vec(1, &single_top);
+    for (int n = 0; n < 3; ++n) {
+        caffe_copy(dim, this->blob_bottom_->cpu_data() + n * dim,
+                   single_bottom.mutable_cpu_data());
+        layer->Forward(single_bottom_vec, single_top_vec);
+        for (int l = 0; l < 5; ++l) {
+            EXPECT_NEAR(this->blob_top_->cpu_data()[n * 5 + l],
+                        single_top.cpu_data()[l], 1e-4);
+        }
+    }
+    delete this->blob_bottom_;
+    delete this->blob_top_;
+}
+
+TYPED_TEST(InnerProductQLayerTest, TestGradient) {
+    typedef typename TypeParam::Dtype Dtype;
+    this->blob_bottom_ = new Blob<Dtype>(2, 2, 3, 2);
+    this->blob_top_ = new Blob<Dtype>();
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_);
+    this->blob_bottom_vec_.push_back(this->blob_bottom_);
+    this->blob_top_vec_.push_back(this->blob_top_);
+    shared_ptr<InnerProductQLayer<Dtype> > layer =
+        MakeSmallQLayer(this->blob_bottom_vec_, this->blob_top_vec_);
+    GradientChecker<Dtype> checker(1e-2, 1e-3);
+    checker.CheckGradientExhaustive(layer.get(), this->blob_bottom_vec_,
+        this->blob_top_vec_);
+    delete this->blob_bottom_;
+    delete this->blob_top_;
+}
+
 TYPED_TEST(InnerProductQLayerTest, TestBigData) {  
     const int BATCH_SIZE = 47;	
     const int INPUT_LAYER = 10000;
@@ -170,4 +252,71 @@ TYPED_TEST(InnerProductQLayerTest, TestBigData) {
     }
 }
 
+TYPED_TEST(InnerProductQLayerTest, TestBatchOneLatency) {
+    const int INPUT_LAYER = 10000;
+    const int OUTPUT_LAYER = 512;
+    const int TEST_NUM = 50;
+    const int M = 4;
+    // K = 16 takes the in-register lookups of the ADC kernel where available
+    const int Ks[] = {16, 32};
+    typedef typename TypeParam::Dtype Dtype;
+    this->blob_bottom_ = new Blob<Dtype>(1, 1, INPUT_LAYER, 1);
+    this->blob_top_ = new Blob<Dtype>();
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_);
+    this->blob_bottom_vec_.push_back(this->blob_bottom_);
+    this->blob_top_vec_.push_back(this->blob_top_);
+
+    for (int t = 0; t < 2; ++t) {
+        const int K = Ks[t];
+        LayerParameter layer_param;
+        InnerProductQParameter *inner_product_q_param = layer_param.mutable_inner_product_q_param();
+        inner_product_q_param->set_num_output(OUTPUT_LAYER);
+        inner_product_q_param->set_k(K);
+        inner_product_q_param->set_m(M);
+        inner_product_q_param->set_engine(InnerProductQParameter_Engine_GEMM);
+        InnerProductQLayer<Dtype> gemm_layer(layer_param);
+        gemm_layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+        filler.Fill(gemm_layer.blobs()[0].get());
+        filler.Fill(gemm_layer.blobs()[1].get());
+        Blob<Dtype>* B = gemm_layer.blobs()[2].get();
+        srand(138531);
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wstrict-aliasing"
+        for (int i = 0; i < B->count(); ++i) {
+            int tmp = (rand() << 16) | rand();
+            B->mutable_cpu_data()[i] = reinterpret_cast<Dtype&>(tmp);
+        }
+#pragma GCC diagnostic pop
+        gemm_layer.WeightAlign();
+        inner_product_q_param->set_engine(InnerProductQParameter_Engine_ADC);
+        InnerProductQLayer<Dtype> adc_layer(layer_param);
+        adc_layer.blobs() = gemm_layer.blobs();
+        adc_layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+        adc_layer.WeightAlign();
+
+        CPUTimer timer;
+        timer.Start();
+        for (int x = 0; x < TEST_NUM; ++x) {
+            gemm_layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+        }
+        const float gemm_ms = timer.MilliSeconds() / TEST_NUM;
+        Blob<Dtype> gemm_top;
+        gemm_top.CopyFrom(*this->blob_top_, false, true);
+        timer.Start();
+        for (int x = 0; x < TEST_NUM; ++x) {
+            adc_layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+        }
+        const float adc_ms = timer.MilliSeconds() / TEST_NUM;
+        LOG(INFO) << "Batch-1 forward with K = " << K << ": GEMM " << gemm_ms
+                  << " ms, ADC " << adc_ms << " ms";
+        for (int l = 0; l < OUTPUT_LAYER; ++l) {
+            EXPECT_NEAR(gemm_top.cpu_data()[l], this->blob_top_->cpu_data()[l], 1e-2);
+        }
+    }
+    delete this->blob_bottom_;
+    delete this->blob_top_;
+}
+
 }
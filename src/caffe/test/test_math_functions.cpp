@@ -1,6 +1,8 @@
 #include <stdint.h>  // for uint32_t & uint64_t
 #include <time.h>
+#include <algorithm>
 #include <cmath>  // for std::fabs
+#include <vector>
 
 #include "gtest/gtest.h"
 
@@ -119,6 +121,123 @@ TYPED_TEST(CPUMathFunctionsTest, TestCopy) {
   }
 }
 
+TYPED_TEST(CPUMathFunctionsTest, TestSgdUpdate) {
+  const int n = this->blob_bottom_->count();
+  const TypeParam decay = 0.01, momentum = 0.9, rate = 0.1;
+  // every fifth element is disconnected
+  vector<unsigned int> mask((n + 31) / 32, 0);
+  for (int i = 0; i < n; ++i) {
+    if (i % 5) { mask[i >> 5] |= 1u << (i & 31); }
+  }
+  vector<TypeParam> data(this->blob_bottom_->cpu_data(),
+      this->blob_bottom_->cpu_data() + n);
+  vector<TypeParam> diff(this->blob_top_->cpu_data(),
+      this->blob_top_->cpu_data() + n);
+  vector<TypeParam> history(n);
+  for (int i = 0; i < n; ++i) {
+    history[i] = diff[(i + 1) % n];
+  }
+  const vector<TypeParam> data0(data), diff0(diff), history0(history);
+  const TypeParam sumsq = caffe_cpu_sgd_update(n, &mask[0], decay, momentum,
+      rate, &data[0], &diff[0], &history[0]);
+  TypeParam expected_sumsq = 0;
+  for (int i = 0; i < n; ++i) {
+    if (i % 5 == 0) {
+      EXPECT_EQ(data0[i], data[i]);
+      EXPECT_EQ(history0[i], history[i]);
+      continue;
+    }
+    expected_sumsq += data0[i] * data0[i];
+    const TypeParam h = rate * (diff0[i] + decay * data0[i]) +
+        momentum * history0[i];
+    EXPECT_NEAR(h, history[i], 1e-5);
+    EXPECT_NEAR(h, diff[i], 1e-5);
+    const TypeParam w = data0[i] - h;
+    EXPECT_NEAR(std::fabs(w) < ZEROUT_THRESHOLD ? 0 : w, data[i], 1e-5);
+  }
+  EXPECT_NEAR(expected_sumsq, sumsq, 1e-4 * expected_sumsq);
+}
+
+TYPED_TEST(CPUMathFunctionsTest, TestBarGroupLasso) {
+  // 17 rows by 19*23*11 columns, so the columns do not fill whole tiles
+  const int n = this->blob_bottom_->shape(1);
+  const int c = this->blob_bottom_->count() / n;
+  TypeParam* x = this->blob_bottom_->mutable_cpu_data();
+  caffe_set(c, TypeParam(0), x + 3 * c);  // an all-zero row
+  for (int row = 0; row < n; ++row) {
+    x[row * c + 5] = 0;  // an all-zero column
+  }
+  TypeParam* y = this->blob_top_->mutable_cpu_data();
+  caffe_cpu_bar_group_lasso(n, c, x, y, true);
+  for (int col = 0; col < c; ++col) {
+    TypeParam sum = 0;
+    for (int row = 0; row < n; ++row) {
+      sum += x[row * c + col] * x[row * c + col];
+    }
+    for (int row = 0; row < n; ++row) {
+      EXPECT_NEAR(std::sqrt(sum), y[row * c + col], 1e-4);
+    }
+  }
+  caffe_cpu_bar_group_lasso(n, c, x, y, false);
+  for (int row = 0; row < n; ++row) {
+    TypeParam sum = 0;
+    for (int col = 0; col < c; ++col) {
+      sum += x[row * c + col] * x[row * c + col];
+    }
+    for (int col = 0; col < c; ++col) {
+      EXPECT_NEAR(std::sqrt(sum), y[row * c + col], 1e-3);
+    }
+  }
+}
+
+TYPED_TEST(CPUMathFunctionsTest, TestGemmInt8) {
+  // 70 x 19 outputs leave partial register blocks and a partial row block,
+  // and K = 45 leaves zero padding in the rows
+  const int M = 70, N = 19, K = 45;
+  const int ld = caffe_int8_row_size(K);
+  vector<int8_t> W(M * ld, 0);
+  vector<int8_t> X(N * ld, 0);
+  vector<TypeParam> scale(M);
+  vector<TypeParam> bias(M);
+  caffe_rng_uniform<TypeParam>(M, 0.01, 0.02, &scale[0]);
+  caffe_rng_uniform<TypeParam>(M, -20, 20, &bias[0]);
+  vector<TypeParam> values(K);
+  vector<TypeParam> C(M * N);
+  for (int nonnegative = 0; nonnegative < 2; ++nonnegative) {
+    for (int i = 0; i < M; ++i) {
+      caffe_rng_uniform<TypeParam>(K, -127, 127, &values[0]);
+      for (int k = 0; k < K; ++k) {
+        W[i * ld + k] = static_cast<int8_t>(std::floor(values[k]));
+      }
+    }
+    for (int j = 0; j < N; ++j) {
+      caffe_rng_uniform<TypeParam>(K, nonnegative ? 0 : -127, 127,
+          &values[0]);
+      for (int k = 0; k < K; ++k) {
+        X[j * ld + k] = static_cast<int8_t>(std::floor(values[k]));
+      }
+    }
+    for (int variant = 0; variant < 4; ++variant) {
+      const bool trans_C = variant & 1;
+      const bool relu = variant & 2;
+      caffe_cpu_gemm_int8(trans_C, M, N, K, &W[0], &X[0], nonnegative == 1,
+          &scale[0], &bias[0], relu, &C[0]);
+      for (int i = 0; i < M; ++i) {
+        for (int j = 0; j < N; ++j) {
+          int acc = 0;
+          for (int k = 0; k < K; ++k) {
+            acc += W[i * ld + k] * X[j * ld + k];
+          }
+          TypeParam expected = scale[i] * acc + bias[i];
+          if (relu) { expected = std::max(expected, TypeParam(0)); }
+          EXPECT_NEAR(expected, C[trans_C ? j * M + i : i * N + j],
+              1e-5 * (1 + std::fabs(expected)));
+        }
+      }
+    }
+  }
+}
+
 #ifndef CPU_ONLY
 
 template <typename Dtype>
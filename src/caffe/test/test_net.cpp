@@ -2446,6 +2446,132 @@ TYPED_TEST(NetTest, TestReshape) {
   EXPECT_FALSE(same_spatial_shape);
 }
 
+TYPED_TEST(NetTest, TestPlanMemory) {
+  typedef typename TypeParam::Dtype Dtype;
+  // The planned net shares the memory of its intermediate blobs and computes
+  // the same outputs as the unplanned one, also after growing its input.
+  const string& proto =
+      "name: 'PlannedNetwork' "
+      "layer { "
+      "  name: 'data' "
+      "  type: 'Input' "
+      "  top: 'data' "
+      "  input_param { "
+      "  shape: { dim: 2 dim: 3 dim: 12 dim: 10 } "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'conv1' "
+      "  type: 'Convolution' "
+      "  bottom: 'data' "
+      "  top: 'conv1' "
+      "  convolution_param { "
+      "    num_output: 5 "
+      "    kernel_size: 3 "
+      "    weight_filler { "
+      "      type: 'gaussian' "
+      "      std: 0.1 "
+      "    } "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'relu1' "
+      "  type: 'ReLU' "
+      "  bottom: 'conv1' "
+      "  top: 'conv1' "
+      "} "
+      "layer { "
+      "  name: 'pool1' "
+      "  type: 'Pooling' "
+      "  bottom: 'conv1' "
+      "  top: 'pool1' "
+      "  pooling_param { "
+      "    pool: MAX "
+      "    kernel_size: 2 "
+      "    stride: 2 "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'conv2' "
+      "  type: 'Convolution' "
+      "  bottom: 'pool1' "
+      "  top: 'conv2' "
+      "  convolution_param { "
+      "    num_output: 4 "
+      "    kernel_size: 1 "
+      "    weight_filler { "
+      "      type: 'gaussian' "
+      "      std: 0.1 "
+      "    } "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'flatten' "
+      "  type: 'Flatten' "
+      "  bottom: 'conv2' "
+      "  top: 'flatten' "
+      "} "
+      "layer { "
+      "  name: 'ip' "
+      "  type: 'InnerProduct' "
+      "  bottom: 'flatten' "
+      "  top: 'ip' "
+      "  inner_product_param { "
+      "    num_output: 6 "
+      "    weight_filler { "
+      "      type: 'gaussian' "
+      "      std: 0.1 "
+      "    } "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'softmax' "
+      "  type: 'Softmax' "
+      "  bottom: 'ip' "
+      "  top: 'softmax' "
+      "} ";
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  param.mutable_state()->set_phase(TEST);
+  Caffe::set_random_seed(this->seed_);
+  Net<Dtype> net(param);
+  param.set_plan_memory(true);
+  Caffe::set_random_seed(this->seed_);
+  Net<Dtype> planned_net(param);
+  // conv1 is dead once pool1 is computed and conv2 once flattened.
+  EXPECT_EQ(planned_net.blob_by_name("flatten")->data(),
+      planned_net.blob_by_name("conv2")->data());
+  EXPECT_EQ(planned_net.blob_by_name("conv1")->data(),
+      planned_net.blob_by_name("conv2")->data());
+  EXPECT_EQ(planned_net.blob_by_name("pool1")->data(),
+      planned_net.blob_by_name("ip")->data());
+  EXPECT_NE(planned_net.blob_by_name("conv1")->data(),
+      planned_net.blob_by_name("pool1")->data());
+  EXPECT_NE(planned_net.blob_by_name("data")->data(),
+      planned_net.blob_by_name("pool1")->data());
+  EXPECT_NE(planned_net.blob_by_name("softmax")->data(),
+      planned_net.blob_by_name("ip")->data());
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  for (int num = 2; num <= 4; num += 2) {
+    Blob<Dtype> input(num, 3, 12, 10);
+    filler.Fill(&input);
+    net.input_blobs()[0]->ReshapeLike(input);
+    net.input_blobs()[0]->CopyFrom(input);
+    planned_net.input_blobs()[0]->ReshapeLike(input);
+    planned_net.input_blobs()[0]->CopyFrom(input);
+    net.Reshape();
+    planned_net.Reshape();
+    const Blob<Dtype>* output = net.Forward()[0];
+    const Blob<Dtype>* planned_output = planned_net.Forward()[0];
+    ASSERT_EQ(output->count(), planned_output->count());
+    for (int i = 0; i < output->count(); ++i) {
+      EXPECT_EQ(output->cpu_data()[i], planned_output->cpu_data()[i]);
+    }
+  }
+}
+
 TYPED_TEST(NetTest, TestSkipPropagateDown) {
   // check bottom_need_backward if propagate_down is true
   this->InitSkipPropNet(false);
@@ -0,0 +1,284 @@
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/layers/conv_layer.hpp"
+#include "caffe/layers/conv_q_layer.hpp"
+#include "caffe/layers/inner_product_layer.hpp"
+#include "caffe/layers/inner_product_q_layer.hpp"
+#include "caffe/sgd_solvers.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/product_quantization.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class ProductQuantizationTest : public CPUDeviceTest<Dtype> {
+ protected:
+  ProductQuantizationTest()
+      : blob_bottom_(new Blob<Dtype>()),
+        blob_top_(new Blob<Dtype>()),
+        blob_top_q_(new Blob<Dtype>()) {}
+  virtual void SetUp() {
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_top_vec_.push_back(blob_top_);
+    blob_top_q_vec_.push_back(blob_top_q_);
+  }
+  virtual ~ProductQuantizationTest() {
+    delete blob_bottom_;
+    delete blob_top_;
+    delete blob_top_q_;
+  }
+
+  // Makes every m-dimensional slice of a row one of k random sub-vectors of
+  // its slice, so that k-means reproduces the weights exactly. The weights
+  // are seen as outer x cols x inner, with slices along cols.
+  void FillFromCodebook(const int k, const int m, const int inner,
+      Blob<Dtype>* weights) {
+    const int outer = weights->shape(0);
+    const int cols = weights->shape(1);
+    Blob<Dtype> codewords(cols / m, k, m, 1);
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(&codewords);
+    Dtype* data = weights->mutable_cpu_data();
+    for (int a = 0; a < outer; ++a) {
+      for (int p = 0; p < inner; ++p) {
+        const int c = (a * inner + p) % k;
+        for (int s = 0; s < cols / m; ++s) {
+          const int code = (c + s) % k;
+          for (int r = 0; r < m; ++r) {
+            data[(a * cols + s * m + r) * inner + p] =
+                codewords.cpu_data()[(s * k + code) * m + r];
+          }
+        }
+      }
+    }
+  }
+
+  void CheckTopsEqual() {
+    ASSERT_EQ(blob_top_->count(), blob_top_q_->count());
+    for (int i = 0; i < blob_top_->count(); ++i) {
+      EXPECT_NEAR(blob_top_->cpu_data()[i], blob_top_q_->cpu_data()[i],
+          1e-4 * (1 + fabs(blob_top_->cpu_data()[i])));
+    }
+  }
+
+  Blob<Dtype>* const blob_bottom_;
+  Blob<Dtype>* const blob_top_;
+  Blob<Dtype>* const blob_top_q_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+  vector<Blob<Dtype>*> blob_top_q_vec_;
+};
+
+TYPED_TEST_CASE(ProductQuantizationTest, TestDtypes);
+
+TYPED_TEST(ProductQuantizationTest, TestKMeans) {
+  // three well separated clusters in the plane
+  const int n = 300;
+  const TypeParam centers[] = {-10, 0, 10, 10, 0, -10};
+  vector<TypeParam> data(n * 2);
+  vector<TypeParam> noise(n * 2);
+  caffe_rng_gaussian<TypeParam>(n * 2, 0, 0.5, &noise[0]);
+  for (int i = 0; i < n; ++i) {
+    data[i * 2] = centers[(i % 3) * 2] + noise[i * 2];
+    data[i * 2 + 1] = centers[(i % 3) * 2 + 1] + noise[i * 2 + 1];
+  }
+  for (int batch_size = 0; batch_size <= 20; batch_size += 20) {
+    vector<TypeParam> centroids(3 * 2);
+    vector<int> labels(n);
+    caffe_cpu_kmeans(n, 2, &data[0], 3, 100, batch_size, 1701,
+        &centroids[0], &labels[0]);
+    for (int i = 0; i < n; ++i) {
+      EXPECT_EQ(labels[i % 3], labels[i]);
+    }
+    for (int c = 0; c < 3; ++c) {
+      const TypeParam* centroid = &centroids[labels[c] * 2];
+      EXPECT_NEAR(centers[c * 2], centroid[0], 0.5);
+      EXPECT_NEAR(centers[c * 2 + 1], centroid[1], 0.5);
+    }
+  }
+}
+
+TYPED_TEST(ProductQuantizationTest, TestPackCodes) {
+  // 3-bit codes, the eleventh straddles the first two words
+  const int n = 12;
+  int codes[n];
+  for (int i = 0; i < n; ++i) {
+    codes[i] = (i * 5 + 3) % 8;
+  }
+  unsigned int packed[2];
+  ASSERT_EQ(2, caffe_packed_codes_size(n, 3));
+  caffe_pack_codes(n, codes, 3, packed);
+  for (int i = 0; i < n; ++i) {
+    const int offset = i * 3;
+    int code = 0;
+    for (int b = 0; b < 3; ++b) {
+      const int bit = offset + b;
+      code = (code << 1) | ((packed[bit / 32] >> (31 - bit % 32)) & 1);
+    }
+    EXPECT_EQ(codes[i], code);
+  }
+}
+
+TYPED_TEST(ProductQuantizationTest, TestInnerProductLayout) {
+  typedef TypeParam Dtype;
+  this->blob_bottom_->Reshape(2, 3, 2, 1);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param;
+  InnerProductParameter* inner_product_param =
+      layer_param.mutable_inner_product_param();
+  inner_product_param->set_num_output(12);
+  inner_product_param->mutable_bias_filler()->set_type("gaussian");
+  InnerProductLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  // 3-bit codes of 36 (slice, output) pairs straddle the packed words
+  ProductQuantizationOptions options;
+  options.k = 8;
+  options.m = 2;
+  this->FillFromCodebook(options.k, options.m, 1, layer.blobs()[0].get());
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+
+  shared_ptr<Blob<Dtype> > codebook(new Blob<Dtype>());
+  shared_ptr<Blob<Dtype> > codes(new Blob<Dtype>());
+  QuantizeInnerProductWeights(*layer.blobs()[0], options, codebook.get(),
+      codes.get());
+  LayerParameter q_param;
+  InnerProductQParameter* inner_product_q_param =
+      q_param.mutable_inner_product_q_param();
+  inner_product_q_param->set_num_output(12);
+  inner_product_q_param->set_k(options.k);
+  inner_product_q_param->set_m(options.m);
+  InnerProductQLayer<Dtype> q_layer(q_param);
+  q_layer.SetUp(this->blob_bottom_vec_, this->blob_top_q_vec_);
+  // the quantized blobs match the shapes the layer allocates
+  EXPECT_EQ(q_layer.blobs()[0]->shape(), codebook->shape());
+  EXPECT_EQ(q_layer.blobs()[2]->shape(), codes->shape());
+  q_layer.blobs()[0] = codebook;
+  q_layer.blobs()[1] = layer.blobs()[1];
+  q_layer.blobs()[2] = codes;
+  q_layer.WeightAlign();
+  q_layer.Forward(this->blob_bottom_vec_, this->blob_top_q_vec_);
+  this->CheckTopsEqual();
+}
+
+TYPED_TEST(ProductQuantizationTest, TestConvolutionLayout) {
+  typedef TypeParam Dtype;
+  this->blob_bottom_->Reshape(2, 6, 5, 4);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_pad(1);
+  convolution_param->set_num_output(4);
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  ConvolutionLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  ProductQuantizationOptions options;
+  options.k = 8;
+  options.m = 2;
+  this->FillFromCodebook(options.k, options.m, 9, layer.blobs()[0].get());
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+
+  shared_ptr<Blob<Dtype> > codebook(new Blob<Dtype>());
+  shared_ptr<Blob<Dtype> > codes(new Blob<Dtype>());
+  QuantizeConvolutionWeights(*layer.blobs()[0], options, codebook.get(),
+      codes.get());
+  convolution_param->set_k(options.k);
+  convolution_param->set_m(options.m);
+  ConvolutionQLayer<Dtype> q_layer(layer_param);
+  vector<shared_ptr<Blob<Dtype> > >& blobs = q_layer.blobs();
+  blobs.push_back(codebook);
+  blobs.push_back(layer.blobs()[1]);
+  blobs.push_back(codes);
+  q_layer.SetUp(this->blob_bottom_vec_, this->blob_top_q_vec_);
+  q_layer.Forward(this->blob_bottom_vec_, this->blob_top_q_vec_);
+  this->CheckTopsEqual();
+}
+
+TYPED_TEST(ProductQuantizationTest, TestSolverKeepsCodes) {
+  typedef TypeParam Dtype;
+  // as quantize_net writes a layer that had no param specs
+  const string& proto =
+     "base_lr: 0.1 "
+     "lr_policy: 'fixed' "
+     "weight_decay: 0.1 "
+     "max_iter: 1 "
+     "snapshot_after_train: false "
+     "net_param { "
+     "  name: 'TestNetwork' "
+     "  layer { "
+     "    name: 'data' "
+     "    type: 'DummyData' "
+     "    dummy_data_param { "
+     "      shape { dim: 2 dim: 6 } "
+     "      shape { dim: 2 dim: 12 } "
+     "      data_filler { type: 'gaussian' } "
+     "      data_filler { type: 'gaussian' } "
+     "    } "
+     "    top: 'data' "
+     "    top: 'target' "
+     "  } "
+     "  layer { "
+     "    name: 'innerprod' "
+     "    type: 'InnerProductQ' "
+     "    inner_product_q_param { num_output: 12 k: 8 m: 2 } "
+     "    bottom: 'data' "
+     "    top: 'innerprod' "
+     "  } "
+     "  layer { "
+     "    name: 'loss' "
+     "    type: 'EuclideanLoss' "
+     "    bottom: 'innerprod' "
+     "    bottom: 'target' "
+     "  } "
+     "} ";
+  SolverParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  FreezeQuantizedCodes(param.mutable_net_param()->mutable_layer(1));
+  EXPECT_EQ(3, param.net_param().layer(1).param_size());
+  SGDSolver<Dtype> solver(param);
+
+  vector<int> weights_shape(2, 12);
+  weights_shape[1] = 6;
+  Blob<Dtype> weights(weights_shape);
+  ProductQuantizationOptions options;
+  options.k = 8;
+  options.m = 2;
+  this->FillFromCodebook(options.k, options.m, 1, &weights);
+  Layer<Dtype>& layer = *solver.net()->layer_by_name("innerprod");
+  QuantizeInnerProductWeights(weights, options, layer.blobs()[0].get(),
+      layer.blobs()[2].get());
+  layer.WeightAlign();
+  Blob<Dtype> codebook;
+  codebook.CopyFrom(*layer.blobs()[0], false, true);
+  Blob<Dtype> codes;
+  codes.CopyFrom(*layer.blobs()[2], false, true);
+  solver.Step(1);
+  // the codebook is trained, the codes are left bit-exact
+  bool trained = false;
+  for (int i = 0; i < codebook.count(); ++i) {
+    trained |= codebook.cpu_data()[i] != layer.blobs()[0]->cpu_data()[i];
+  }
+  EXPECT_TRUE(trained);
+  for (int i = 0; i < codes.count(); ++i) {
+    EXPECT_EQ(0, memcmp(codes.cpu_data() + i, layer.blobs()[2]->cpu_data() + i,
+        sizeof(Dtype)));
+  }
+}
+
+}  // namespace caffe
@@ -1,3 +1,10 @@
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>  // NOLINT(readability/streams)
 #include <string>
 #include <utility>
 #include <vector>
@@ -41,6 +48,54 @@ class SolverTest : public MultiDeviceTest<TypeParam> {
   shared_ptr<Solver<Dtype> > solver_;
 };
 
+// Records the reports and checks them against the params of the net.
+template <typename Dtype>
+class SparsityRecorder : public Solver<Dtype>::SparsityCallback {
+ public:
+  explicit SparsityRecorder(Solver<Dtype>* solver) : solver_(solver) {}
+
+  vector<int> iters_;
+
+ protected:
+  virtual void on_sparsity(int iter, const vector<ParamSparsity>& params) {
+    iters_.push_back(iter);
+    const vector<Blob<Dtype>*>& net_params =
+        solver_->net()->learnable_params();
+    ASSERT_EQ(net_params.size(), params.size());
+    EXPECT_EQ("innerprod.weights", params[0].name);
+    EXPECT_EQ("innerprod.1", params[1].name);
+    for (int i = 0; i < params.size(); ++i) {
+      const Blob<Dtype>& param = *net_params[i];
+      const int rows = param.shape(0);
+      const int cols = param.count() / rows;
+      int zeros = 0, zero_rows = 0;
+      vector<int> col_nonzeros(cols, 0);
+      for (int r = 0; r < rows; ++r) {
+        int row_nonzeros = 0;
+        for (int c = 0; c < cols; ++c) {
+          const bool nonzero = param.cpu_data()[r * cols + c] != 0;
+          zeros += !nonzero;
+          row_nonzeros += nonzero;
+          col_nonzeros[c] += nonzero;
+        }
+        zero_rows += !row_nonzeros;
+      }
+      const int zero_cols =
+          std::count(col_nonzeros.begin(), col_nonzeros.end(), 0);
+      EXPECT_EQ(param.count(), params[i].count);
+      EXPECT_FLOAT_EQ(100.f * zeros / param.count(), params[i].element);
+      EXPECT_FLOAT_EQ(100.f * zero_rows / rows, params[i].row);
+      EXPECT_FLOAT_EQ(100.f * zero_cols / cols, params[i].column);
+    }
+    ASSERT_EQ(1, params[0].blocks.size());
+    EXPECT_EQ(2, params[0].blocks[0].ydimen);
+    EXPECT_EQ(12, params[0].blocks[0].xdimen);
+    EXPECT_GT(params[0].regularization, 0);
+  }
+
+  Solver<Dtype>* solver_;
+};
+
 TYPED_TEST_CASE(SolverTest, TestDtypesAndDevices);
 
 TYPED_TEST(SolverTest, TestInitTrainTestNets) {
@@ -106,4 +161,166 @@ TYPED_TEST(SolverTest, TestInitTrainTestNets) {
   EXPECT_TRUE(this->solver_->test_nets()[1]->has_layer("accuracy"));
 }
 
+TYPED_TEST(SolverTest, TestSparseModesTestTrainedWeights) {
+  typedef typename TypeParam::Dtype Dtype;
+  if (Caffe::mode() != Caffe::CPU) {
+    // the sparse modes run on the CPU
+    return;
+  }
+  // The test net runs at every iteration on the weights of the train net as
+  // they are then, not on the sparse copies made at its first Forward.
+  const string& net_proto =
+     "  name: 'TestNetwork' "
+     "  layer { "
+     "    name: 'data' "
+     "    type: 'DummyData' "
+     "    dummy_data_param { "
+     "      shape { dim: 2 dim: 2 dim: 4 dim: 4 } "
+     "      shape { dim: 2 } "
+     "      data_filler { type: 'constant' value: 1 } "
+     "      data_filler { type: 'constant' value: 0 } "
+     "    } "
+     "    top: 'data' "
+     "    top: 'label' "
+     "  } "
+     "  layer { "
+     "    name: 'conv' "
+     "    type: 'Convolution' "
+     "    convolution_param { "
+     "      num_output: 3 "
+     "      kernel_size: 3 "
+     "      conv_mode: LOWERED_CSRMM "
+     "      weight_filler { type: 'gaussian' std: 0.1 } "
+     "    } "
+     "    bottom: 'data' "
+     "    top: 'conv' "
+     "  } "
+     "  layer { "
+     "    name: 'innerprod' "
+     "    type: 'InnerProduct' "
+     "    inner_product_param { "
+     "      num_output: 4 "
+     "      ip_mode: CSRMM "
+     "      weight_filler { type: 'gaussian' std: 0.1 } "
+     "    } "
+     "    bottom: 'conv' "
+     "    top: 'innerprod' "
+     "  } "
+     "  layer { "
+     "    name: 'loss' "
+     "    type: 'SoftmaxWithLoss' "
+     "    bottom: 'innerprod' "
+     "    bottom: 'label' "
+     "    include: { phase: TRAIN } "
+     "  } ";
+  const string& proto =
+     "snapshot_after_train: false "
+     "random_seed: 1701 "
+     "base_lr: 0.5 "
+     "lr_policy: 'fixed' "
+     "max_iter: 2 "
+     "test_interval: 1 "
+     "test_iter: 1 "
+     "net_param { " + net_proto + "} ";
+  this->InitSolverFromProtoString(proto);
+  // the first Test runs on the initial weights
+  this->solver_->Step(1);
+  Net<Dtype>& test_net = *this->solver_->test_nets()[0];
+  Blob<Dtype> initial_output;
+  initial_output.CopyFrom(*test_net.blob_by_name("innerprod"), false, true);
+  // the last one on the weights after two updates
+  this->solver_->Solve();
+
+  // the same net in LOWERED_GEMM and GEMM with the trained weights
+  NetParameter dense_param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(net_proto,
+      &dense_param));
+  dense_param.mutable_layer(1)->mutable_convolution_param()->clear_conv_mode();
+  dense_param.mutable_layer(2)->mutable_inner_product_param()->clear_ip_mode();
+  dense_param.mutable_state()->set_phase(TEST);
+  Net<Dtype> dense_net(dense_param);
+  NetParameter trained_param;
+  this->solver_->net()->ToProto(&trained_param);
+  dense_net.CopyTrainedLayersFrom(trained_param);
+  dense_net.Forward();
+  const Blob<Dtype>& output = *test_net.blob_by_name("innerprod");
+  const Blob<Dtype>& dense_output = *dense_net.blob_by_name("innerprod");
+  bool changed = false;
+  for (int i = 0; i < output.count(); ++i) {
+    EXPECT_NEAR(dense_output.cpu_data()[i], output.cpu_data()[i], 1e-4);
+    changed |= std::fabs(initial_output.cpu_data()[i] -
+        output.cpu_data()[i]) > 1e-3;
+  }
+  EXPECT_TRUE(changed);
+}
+
+TYPED_TEST(SolverTest, TestSparsityReport) {
+  typedef typename TypeParam::Dtype Dtype;
+  char dir[] = "/tmp/caffe_sparsity_XXXXXX";
+  ASSERT_TRUE(mkdtemp(dir) != NULL);
+  const string filename = string(dir) + "/sparsity.csv";
+  // with base_lr 0 the weights keep the zeros of the sparse filler, and
+  // the weight decay still adds a regularization term
+  const string& proto =
+     "snapshot_after_train: false "
+     "base_lr: 0 "
+     "lr_policy: 'fixed' "
+     "weight_decay: 0.1 "
+     "max_iter: 5 "
+     "sparsity_interval: 2 "
+     "sparsity_file: '" + filename + "' "
+     "net_param { "
+     "  name: 'TestNetwork' "
+     "  layer { "
+     "    name: 'data' "
+     "    type: 'DummyData' "
+     "    dummy_data_param { "
+     "      shape { dim: 5 dim: 2 dim: 3 dim: 4 } "
+     "      shape { dim: 5 } "
+     "    } "
+     "    top: 'data' "
+     "    top: 'label' "
+     "  } "
+     "  layer { "
+     "    name: 'innerprod' "
+     "    type: 'InnerProduct' "
+     "    param { name: 'weights' block_group_lasso { xdimen: 12 ydimen: 2 } } "
+     "    inner_product_param { "
+     "      num_output: 10 "
+     "      weight_filler { type: 'gaussian' sparse: 3 } "
+     "    } "
+     "    bottom: 'data' "
+     "    top: 'innerprod' "
+     "  } "
+     "  layer { "
+     "    name: 'loss' "
+     "    type: 'SoftmaxWithLoss' "
+     "    bottom: 'innerprod' "
+     "    bottom: 'label' "
+     "  } "
+     "} ";
+  this->InitSolverFromProtoString(proto);
+  SparsityRecorder<Dtype> recorder(this->solver_.get());
+  this->solver_->add_sparsity_callback(&recorder);
+  this->solver_->Solve();
+  ASSERT_EQ(3, recorder.iters_.size());
+  EXPECT_EQ(0, recorder.iters_[0]);
+  EXPECT_EQ(2, recorder.iters_[1]);
+  EXPECT_EQ(4, recorder.iters_[2]);
+  // a header and a line per param and report
+  std::ifstream file(filename.c_str());
+  string line;
+  vector<string> lines;
+  while (std::getline(file, line)) {
+    lines.push_back(line);
+  }
+  ASSERT_EQ(7, lines.size());
+  EXPECT_EQ("iter,param,count,element,row,column,blocks,regularization",
+      lines[0]);
+  EXPECT_EQ(0, lines[5].find("4,innerprod.weights,240,"));
+  EXPECT_NE(string::npos, lines[5].find(",2x12:"));
+  std::remove(filename.c_str());
+  rmdir(dir);
+}
+
 }  // namespace caffe
@@ -2926,6 +2926,40 @@ TEST_F(NetUpgradeTest, TestUpgradeV1LayerType) {
   }
 }
 
+TEST_F(NetUpgradeTest, TestUpgradeInt8FusedRelu) {
+  const string& input_proto =
+      "layer { "
+      "  name: 'conv' "
+      "  type: 'Convolution' "
+      "  convolution_param { conv_mode: LOWERED_INT8 int8_fused_relu: true } "
+      "} "
+      "layer { "
+      "  name: 'fc' "
+      "  type: 'InnerProduct' "
+      "  inner_product_param { ip_mode: INT8 int8_fused_relu: false } "
+      "} ";
+  const string& expected_output_proto =
+      "layer { "
+      "  name: 'conv' "
+      "  type: 'Convolution' "
+      "  convolution_param { conv_mode: LOWERED_INT8 fused_activation: RELU } "
+      "} "
+      "layer { "
+      "  name: 'fc' "
+      "  type: 'InnerProduct' "
+      "  inner_product_param { ip_mode: INT8 } "
+      "} ";
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(input_proto, &param));
+  NetParameter expected_param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(expected_output_proto,
+      &expected_param));
+  ASSERT_TRUE(NetNeedsInt8FusedReluUpgrade(param));
+  UpgradeNetInt8FusedRelu(&param);
+  EXPECT_FALSE(NetNeedsInt8FusedReluUpgrade(param));
+  EXPECT_EQ(expected_param.DebugString(), param.DebugString());
+}
+
 class SolverTypeUpgradeTest : public ::testing::Test {
  protected:
   void RunSolverTypeUpgradeTest(
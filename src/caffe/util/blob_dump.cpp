@@ -0,0 +1,216 @@
+#include <boost/thread.hpp>
+#include <stdint.h>
+
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "caffe/util/blob_dump.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/mmio.hpp"
+
+namespace caffe {
+
+static const char kBlobDumpMagic[4] = {'C', 'B', 'L', 'B'};
+
+// Bytes before the data of a RAW dump with num_axes axes.
+static size_t BlobDumpHeaderSize(const int num_axes) {
+  const size_t size = 4 + 3 * sizeof(uint32_t) + num_axes * sizeof(int64_t);
+  return (size + kBlobDumpAlignment - 1) / kBlobDumpAlignment *
+      kBlobDumpAlignment;
+}
+
+template <typename Dtype>
+void WriteBlobDump(const Blob<Dtype>& blob, const string& filename) {
+  const int num_axes = blob.num_axes();
+  vector<char> header(BlobDumpHeaderSize(num_axes), 0);
+  const uint32_t fields[3] = {kBlobDumpVersion, sizeof(Dtype),
+      static_cast<uint32_t>(num_axes)};
+  memcpy(&header[0], kBlobDumpMagic, 4);
+  memcpy(&header[4], fields, sizeof(fields));
+  for (int i = 0; i < num_axes; ++i) {
+    const int64_t dim = blob.shape(i);
+    memcpy(&header[4 + sizeof(fields) + i * sizeof(dim)], &dim, sizeof(dim));
+  }
+  FILE* fp = fopen(filename.c_str(), "wb");
+  if (fp == NULL) {
+    LOG(WARNING) << "Cannot open " << filename << " to dump a blob";
+    return;
+  }
+  if (fwrite(&header[0], 1, header.size(), fp) != header.size() ||
+      fwrite(blob.cpu_data(), sizeof(Dtype), blob.count(), fp) !=
+      static_cast<size_t>(blob.count())) {
+    LOG(WARNING) << "Failed to write the blob dump " << filename;
+  }
+  fclose(fp);
+}
+
+template <typename Dtype>
+void ReadBlobDump(const string& filename, Blob<Dtype>* blob) {
+  FILE* fp = fopen(filename.c_str(), "rb");
+  CHECK(fp) << "Cannot open the blob dump " << filename;
+  char magic[4];
+  uint32_t fields[3];
+  CHECK_EQ(fread(magic, 1, 4, fp), 4) << filename << " is truncated";
+  CHECK_EQ(memcmp(magic, kBlobDumpMagic, 4), 0)
+      << filename << " is not a blob dump";
+  CHECK_EQ(fread(fields, sizeof(uint32_t), 3, fp), 3)
+      << filename << " is truncated";
+  CHECK_EQ(fields[0], kBlobDumpVersion) << "Unknown blob dump version";
+  CHECK_EQ(fields[1], sizeof(Dtype)) << filename << " holds "
+      << fields[1] << "-byte elements";
+  CHECK_LE(fields[2], kMaxBlobAxes);
+  vector<int> shape(fields[2]);
+  for (int i = 0; i < shape.size(); ++i) {
+    int64_t dim;
+    CHECK_EQ(fread(&dim, sizeof(dim), 1, fp), 1)
+        << filename << " is truncated";
+    CHECK_LE(dim, INT_MAX);
+    shape[i] = dim;
+  }
+  blob->Reshape(shape);
+  CHECK_EQ(fseek(fp, BlobDumpHeaderSize(shape.size()), SEEK_SET), 0);
+  CHECK_EQ(fread(blob->mutable_cpu_data(), sizeof(Dtype), blob->count(), fp),
+      blob->count()) << filename << " is truncated";
+  fclose(fp);
+}
+
+template <typename Dtype>
+void WriteBlobMatrixMarket(const Blob<Dtype>& blob, const string& filename) {
+  FILE* fp = fopen(filename.c_str(), "w");
+  if (fp == NULL) {
+    LOG(WARNING) << "Cannot open " << filename << " to dump a blob";
+    return;
+  }
+  MM_typecode matcode;
+  mm_initialize_typecode(&matcode);
+  mm_set_matrix(&matcode);
+  mm_set_coordinate(&matcode);
+  mm_set_real(&matcode);
+  mm_set_general(&matcode);
+  mm_write_banner(fp, matcode);
+  const int count = blob.count();
+  const int rows = blob.num_axes() > 0 ? blob.shape(0) : 1;
+  const int cols = rows > 0 ? count / rows : 0;
+  const Dtype* data = blob.cpu_data();
+  int nnz = 0;
+  for (int i = 0; i < count; ++i) {
+    nnz += data[i] != 0;
+  }
+  mm_write_mtx_crd_size(fp, rows, cols, nnz);
+  // enough digits to read the values back exactly
+  const int digits = sizeof(Dtype) == sizeof(float) ? 9 : 17;
+  for (int i = 0; i < count; ++i) {
+    if (data[i] != 0) {
+      // MatrixMarket indices start at 1
+      fprintf(fp, "%d %d %.*g\n", i / cols + 1, i % cols + 1, digits,
+          static_cast<double>(data[i]));
+    }
+  }
+  if (ferror(fp)) {
+    LOG(WARNING) << "Failed to write the blob dump " << filename;
+  }
+  fclose(fp);
+}
+
+template <typename Dtype>
+class TypedBlobDump : public BlobDump {
+ public:
+  TypedBlobDump(const Blob<Dtype>& blob, const string& filename,
+      DumpParameter_Format format)
+      : filename_(filename), format_(format) {
+    copy_.ReshapeLike(blob);
+    caffe_copy(blob.count(), blob.cpu_data(), copy_.mutable_cpu_data());
+  }
+  virtual void Write() const {
+    switch (format_) {
+    case DumpParameter_Format_RAW:
+      WriteBlobDump(copy_, filename_);
+      break;
+    case DumpParameter_Format_MATRIX_MARKET:
+      WriteBlobMatrixMarket(copy_, filename_);
+      break;
+    default:
+      LOG(FATAL) << "Unknown dump format: " << format_;
+    }
+  }
+
+ private:
+  Blob<Dtype> copy_;
+  string filename_;
+  DumpParameter_Format format_;
+};
+
+class BlobDumpWriter::sync {
+ public:
+  boost::mutex mutex_;
+  boost::condition_variable condition_;
+};
+
+BlobDumpWriter& BlobDumpWriter::Get() {
+  static BlobDumpWriter writer;
+  return writer;
+}
+
+BlobDumpWriter::BlobDumpWriter()
+    : sync_(new sync()), pending_(0) {
+}
+
+BlobDumpWriter::~BlobDumpWriter() {
+  Flush();
+  StopInternalThread();
+}
+
+template <typename Dtype>
+void BlobDumpWriter::Push(const Blob<Dtype>& blob, const string& filename,
+    DumpParameter_Format format) {
+  // the copy is taken here, the caller may overwrite blob on return
+  BlobDump* dump = new TypedBlobDump<Dtype>(blob, filename, format);
+  {
+    boost::mutex::scoped_lock lock(sync_->mutex_);
+    if (!is_started()) {
+      StartInternalThread();
+    }
+    ++pending_;
+  }
+  queue_.push(dump);
+}
+
+void BlobDumpWriter::Flush() {
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  while (pending_ > 0) {
+    sync_->condition_.wait(lock);
+  }
+}
+
+void BlobDumpWriter::InternalThreadEntry() {
+  try {
+    while (!must_stop()) {
+      BlobDump* dump = queue_.pop();
+      dump->Write();
+      delete dump;
+      boost::mutex::scoped_lock lock(sync_->mutex_);
+      --pending_;
+      sync_->condition_.notify_all();
+    }
+  } catch (boost::thread_interrupted&) {
+    // Interrupted exception is expected on shutdown
+  }
+}
+
+template void WriteBlobDump(const Blob<float>& blob, const string& filename);
+template void WriteBlobDump(const Blob<double>& blob, const string& filename);
+template void ReadBlobDump(const string& filename, Blob<float>* blob);
+template void ReadBlobDump(const string& filename, Blob<double>* blob);
+template void WriteBlobMatrixMarket(const Blob<float>& blob,
+    const string& filename);
+template void WriteBlobMatrixMarket(const Blob<double>& blob,
+    const string& filename);
+template void BlobDumpWriter::Push(const Blob<float>& blob,
+    const string& filename, DumpParameter_Format format);
+template void BlobDumpWriter::Push(const Blob<double>& blob,
+    const string& filename, DumpParameter_Format format);
+
+}  // namespace caffe
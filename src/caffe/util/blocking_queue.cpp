@@ -3,6 +3,7 @@
 
 #include "caffe/layers/base_data_layer.hpp"
 #include "caffe/parallel.hpp"
+#include "caffe/util/blob_dump.hpp"
 #include "caffe/util/blocking_queue.hpp"
 
 namespace caffe {
@@ -87,5 +88,6 @@ size_t BlockingQueue<T>::size() const {
 
 template class BlockingQueue<Batch<float>*>;
 template class BlockingQueue<Batch<double>*>;
+template class BlockingQueue<BlobDump*>;
 
 }  // namespace caffe
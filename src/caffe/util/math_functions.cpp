@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <random>
 #include <limits>
 
@@ -5,6 +6,10 @@
 #include <omp.h>
 #endif
 
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
 #include "caffe/common.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/util/rng.hpp"
@@ -273,6 +278,20 @@ void caffe_abs<double>(const int n, const double* a, double* y) {
     vdAbs(n, a, y);
 }
 
+int caffe_set_blas_num_threads(const int threads) {
+#if defined(USE_MKL)
+  const int previous = mkl_get_max_threads();
+  mkl_set_num_threads(threads);
+  return previous;
+#elif defined(USE_OPENBLAS)
+  const int previous = openblas_get_num_threads();
+  openblas_set_num_threads(threads);
+  return previous;
+#else
+  return 1;
+#endif
+}
+
 unsigned int caffe_rng_rand() {
   return (*caffe_rng())();
 }
@@ -390,6 +409,62 @@ float caffe_cpu_dot<float>(const int n, const float* x, const float* y);
 template
 double caffe_cpu_dot<double>(const int n, const double* x, const double* y);
 
+#ifndef USE_MKL
+// Portable versions of the MKL sparse routines below. They follow the same
+// zero-based CSR conventions as mkl_?dnscsr and mkl_?csrmm ("GXXCX"), so the
+// callers do not need to know which BLAS Caffe was built against.
+template <typename Dtype>
+static void caffe_cpu_dense2csr_portable(const int M, const int N,
+    const Dtype* A,
+    Dtype* A_nonzero_buf, int* A_nonzero_idx_buf, int* A_idx_pointer_buf){
+	int nnz = 0;
+	for (int i = 0; i < M; ++i) {
+		A_idx_pointer_buf[i] = nnz;
+		const Dtype* A_row = A + i * N;
+		for (int j = 0; j < N; ++j) {
+			if (A_row[j] != 0) {
+				A_nonzero_buf[nnz] = A_row[j];
+				A_nonzero_idx_buf[nnz] = j;
+				++nnz;
+			}
+		}
+	}
+	A_idx_pointer_buf[M] = nnz;
+}
+
+// C = alpha * A * B + beta * C, where A (M x K) is in CSR format and
+// B (K x N) and C (M x N) are dense and row-major.
+// As in MKL, row i of A is stored at offsets
+// [A_idx_pointerB_[i] - A_idx_pointerB_[0], A_idx_pointerE_[i] - A_idx_pointerB_[0]),
+// so a sub-block of rows can be passed by shifting all four arrays.
+template <typename Dtype>
+static void caffe_cpu_csrmm_portable(const int M, const int N, const int K,
+    const Dtype alpha,
+    const Dtype* A_nonzero_buf, const int* A_nonzero_idx_buf, const int* A_idx_pointerB_,const int* A_idx_pointerE_,
+    const Dtype* B,
+    const Dtype beta, Dtype* C){
+	const int base = A_idx_pointerB_[0];
+#pragma omp parallel for schedule(dynamic, 4)
+	for (int i = 0; i < M; ++i) {
+		Dtype* C_row = C + i * N;
+		if (beta == 0) {
+			caffe_set(N, Dtype(0), C_row);
+		} else if (beta != 1) {
+			for (int k = 0; k < N; ++k) {
+				C_row[k] *= beta;
+			}
+		}
+		for (int j = A_idx_pointerB_[i] - base; j < A_idx_pointerE_[i] - base; ++j) {
+			const Dtype v = alpha * A_nonzero_buf[j];
+			const Dtype* B_row = B + A_nonzero_idx_buf[j] * N;
+			for (int k = 0; k < N; ++k) {
+				C_row[k] += v * B_row[k];
+			}
+		}
+	}
+}
+#endif
+
 template <>
 void caffe_cpu_sparse_dense2csr<float>(const int M, const int N,
     float* A,
@@ -405,7 +480,8 @@ void caffe_cpu_sparse_dense2csr<float>(const int M, const int N,
 				<<"because there is no space in the arrays acsr and ja according to the value nzmax.";
 	}
 #else
-	NOT_IMPLEMENTED;
+	caffe_cpu_dense2csr_portable(M, N, A,
+			A_nonzero_buf, A_nonzero_idx_buf, A_idx_pointer_buf);
 #endif
 }
 
@@ -424,7 +500,8 @@ void caffe_cpu_sparse_dense2csr<double>(const int M, const int N,
 				<<"because there is no space in the arrays acsr and ja according to the value nzmax.";
 	}
 #else
-	NOT_IMPLEMENTED;
+	caffe_cpu_dense2csr_portable(M, N, A,
+			A_nonzero_buf, A_nonzero_idx_buf, A_idx_pointer_buf);
 #endif
 }
 
@@ -495,7 +572,9 @@ void caffe_cpu_sparse_mmcsr<float>(const int M, const int N, const int K,
 //	  }
 //	}
 #else
-	NOT_IMPLEMENTED;
+	caffe_cpu_csrmm_portable(M, N, K, alpha,
+			A_nonzero_buf, A_nonzero_idx_buf, A_idx_pointerB_, A_idx_pointerE_,
+			B, beta, C);
 #endif
 }
 
@@ -516,10 +595,642 @@ void caffe_cpu_sparse_mmcsr<double>(const int M, const int N, const int K,
 			B, &N,
 			&beta , C, &N);
 #else
-	NOT_IMPLEMENTED;
+	caffe_cpu_csrmm_portable(M, N, K, alpha,
+			A_nonzero_buf, A_nonzero_idx_buf, A_idx_pointerB_, A_idx_pointerE_,
+			B, beta, C);
+#endif
+}
+
+template <typename Dtype>
+void caffe_cpu_sparse_csrmv(const int M,
+    const Dtype* A_nonzero_buf, const int* A_nonzero_idx_buf, const int* A_idx_pointer_buf,
+    const Dtype* x, Dtype* y){
+#pragma omp parallel
+	{
+#ifdef OPEN_MP
+		const int nthreads = omp_get_num_threads();
+		const int tid = omp_get_thread_num();
+#else
+		const int nthreads = 1;
+		const int tid = 0;
+#endif
+		// each thread streams a contiguous block of rows holding about the
+		// same number of nonzeros, so x is the only data shared among them
+		const long nnz = A_idx_pointer_buf[M];
+		const int begin = tid == 0 ? 0 : std::lower_bound(A_idx_pointer_buf, A_idx_pointer_buf + M,
+				nnz * tid / nthreads) - A_idx_pointer_buf;
+		const int end = tid == nthreads - 1 ? M : std::lower_bound(A_idx_pointer_buf, A_idx_pointer_buf + M,
+				nnz * (tid + 1) / nthreads) - A_idx_pointer_buf;
+		for (int i = begin; i < end; ++i) {
+			Dtype sum0 = 0, sum1 = 0;
+			int j = A_idx_pointer_buf[i];
+			const int row_end = A_idx_pointer_buf[i + 1];
+			for (; j + 2 <= row_end; j += 2) {
+				sum0 += A_nonzero_buf[j] * x[A_nonzero_idx_buf[j]];
+				sum1 += A_nonzero_buf[j + 1] * x[A_nonzero_idx_buf[j + 1]];
+			}
+			if (j < row_end) {
+				sum0 += A_nonzero_buf[j] * x[A_nonzero_idx_buf[j]];
+			}
+			y[i] = sum0 + sum1;
+		}
+	}
+}
+
+template void caffe_cpu_sparse_csrmv<float>(const int M,
+    const float* A_nonzero_buf, const int* A_nonzero_idx_buf, const int* A_idx_pointer_buf,
+    const float* x, float* y);
+template void caffe_cpu_sparse_csrmv<double>(const int M,
+    const double* A_nonzero_buf, const int* A_nonzero_idx_buf, const int* A_idx_pointer_buf,
+    const double* x, double* y);
+
+template <typename Dtype>
+int caffe_cpu_compress_nonzeros(const int n, const Dtype* x, int* indices,
+    Dtype* values) {
+	int nnz = 0;
+	for (int i = 0; i < n; ++i) {
+		if (x[i] != 0) {
+			indices[nnz] = i;
+			values[nnz] = x[i];
+			++nnz;
+		}
+	}
+	return nnz;
+}
+
+template int caffe_cpu_compress_nonzeros<float>(const int n, const float* x,
+    int* indices, float* values);
+template int caffe_cpu_compress_nonzeros<double>(const int n, const double* x,
+    int* indices, double* values);
+
+template <typename Dtype>
+void caffe_cpu_sparse_input_gemv(const int N, const int nnz, const int* indices,
+    const Dtype* values, const Dtype* A, Dtype* y) {
+	caffe_set(N, Dtype(0), y);
+	for (int j = 0; j < nnz; ++j) {
+		const Dtype* a = A + static_cast<long>(indices[j]) * N;
+		const Dtype v = values[j];
+		for (int i = 0; i < N; ++i) {
+			y[i] += v * a[i];
+		}
+	}
+}
+
+#ifdef __AVX2__
+// Four rows at a time, so that y is loaded and stored once per four rows.
+template <>
+void caffe_cpu_sparse_input_gemv<float>(const int N, const int nnz,
+    const int* indices, const float* values, const float* A, float* y) {
+	caffe_set(N, 0.f, y);
+	int j = 0;
+	for (; j + 4 <= nnz; j += 4) {
+		const float* a0 = A + static_cast<long>(indices[j]) * N;
+		const float* a1 = A + static_cast<long>(indices[j + 1]) * N;
+		const float* a2 = A + static_cast<long>(indices[j + 2]) * N;
+		const float* a3 = A + static_cast<long>(indices[j + 3]) * N;
+		const __m256 v0 = _mm256_set1_ps(values[j]);
+		const __m256 v1 = _mm256_set1_ps(values[j + 1]);
+		const __m256 v2 = _mm256_set1_ps(values[j + 2]);
+		const __m256 v3 = _mm256_set1_ps(values[j + 3]);
+		int i = 0;
+		for (; i + 8 <= N; i += 8) {
+			__m256 sum = _mm256_loadu_ps(y + i);
+			sum = _mm256_add_ps(sum, _mm256_mul_ps(v0, _mm256_loadu_ps(a0 + i)));
+			sum = _mm256_add_ps(sum, _mm256_mul_ps(v1, _mm256_loadu_ps(a1 + i)));
+			sum = _mm256_add_ps(sum, _mm256_mul_ps(v2, _mm256_loadu_ps(a2 + i)));
+			sum = _mm256_add_ps(sum, _mm256_mul_ps(v3, _mm256_loadu_ps(a3 + i)));
+			_mm256_storeu_ps(y + i, sum);
+		}
+		for (; i < N; ++i) {
+			y[i] += values[j] * a0[i] + values[j + 1] * a1[i] +
+					values[j + 2] * a2[i] + values[j + 3] * a3[i];
+		}
+	}
+	for (; j < nnz; ++j) {
+		const float* a = A + static_cast<long>(indices[j]) * N;
+		const float v = values[j];
+		for (int i = 0; i < N; ++i) {
+			y[i] += v * a[i];
+		}
+	}
+}
+#else
+template void caffe_cpu_sparse_input_gemv<float>(const int N, const int nnz,
+    const int* indices, const float* values, const float* A, float* y);
+#endif
+template void caffe_cpu_sparse_input_gemv<double>(const int N, const int nnz,
+    const int* indices, const double* values, const double* A, double* y);
+
+template <typename Dtype>
+int caffe_cpu_dense2bsr(const int M, const int N, const int br, const int bc,
+    const Dtype* A, Dtype* values, int* block_indices, int* block_pointers) {
+	CHECK_EQ(M % br, 0) << "blocks of " << br << " rows do not tile " << M << " rows";
+	CHECK_EQ(N % bc, 0) << "blocks of " << bc << " columns do not tile " << N << " columns";
+	int nblocks = 0;
+	block_pointers[0] = 0;
+	for (int i = 0; i < M / br; ++i) {
+		const Dtype* A_rows = A + static_cast<long>(i) * br * N;
+		for (int j = 0; j < N / bc; ++j) {
+			bool nonzero = false;
+			for (int r = 0; r < br && !nonzero; ++r) {
+				for (int c = 0; c < bc; ++c) {
+					if (A_rows[r * N + j * bc + c] != 0) {
+						nonzero = true;
+						break;
+					}
+				}
+			}
+			if (!nonzero) { continue; }
+			Dtype* block = values + static_cast<long>(nblocks) * br * bc;
+			for (int r = 0; r < br; ++r) {
+				caffe_copy(bc, A_rows + r * N + j * bc, block + r * bc);
+			}
+			block_indices[nblocks++] = j;
+		}
+		block_pointers[i + 1] = nblocks;
+	}
+	return nblocks;
+}
+
+template int caffe_cpu_dense2bsr<float>(const int M, const int N,
+    const int br, const int bc, const float* A,
+    float* values, int* block_indices, int* block_pointers);
+template int caffe_cpu_dense2bsr<double>(const int M, const int N,
+    const int br, const int bc, const double* A,
+    double* values, int* block_indices, int* block_pointers);
+
+// caffe_cpu_bsrmm computes C in strips of every block row, whose br rows
+// are accumulated in this many bytes of vector registers (8 AVX registers)
+// while the blocks of the block row stream by: the taller the blocks, the
+// narrower the strips. The block rows are computed strip after strip, the
+// strip of B they all read staying in cache meanwhile.
+static const int kBsrAccumulatorBytes = 256;
+
+// One strip of n columns of a block row of C (BR x BC blocks), from the
+// blocks [begin, end). B and C point at the first column of the strip and
+// have rows of N. With BR and BC fixed the block loops unroll into vector
+// code over the strip.
+template <typename Dtype, int BR, int BC>
+static inline void bsr_strip(const int N, const int n, const Dtype* values,
+    const int* block_indices, const int begin, const int end,
+    const Dtype* B, Dtype* C) {
+	Dtype acc[BR][kBsrAccumulatorBytes / BR / sizeof(Dtype)];
+	for (int r = 0; r < BR; ++r) {
+		for (int k = 0; k < n; ++k) {
+			acc[r][k] = 0;
+		}
+	}
+	for (int b = begin; b < end; ++b) {
+		const Dtype* block = values + static_cast<long>(b) * BR * BC;
+		const Dtype* B_rows = B + static_cast<long>(block_indices[b]) * BC * N;
+		for (int c = 0; c < BC; ++c) {
+			const Dtype* x = B_rows + c * N;
+			for (int r = 0; r < BR; ++r) {
+				const Dtype w = block[r * BC + c];
+#pragma omp simd
+				for (int k = 0; k < n; ++k) {
+					acc[r][k] += w * x[k];
+				}
+			}
+		}
+	}
+	for (int r = 0; r < BR; ++r) {
+		for (int k = 0; k < n; ++k) {
+			C[r * N + k] = acc[r][k];
+		}
+	}
+}
+
+// The same for a full strip, kBsrAccumulatorBytes / BR wide.
+template <typename Dtype, int BR, int BC>
+struct BsrFullStrip {
+	static inline void Run(const int N, const Dtype* values,
+			const int* block_indices, const int begin, const int end,
+			const Dtype* B, Dtype* C) {
+		bsr_strip<Dtype, BR, BC>(N, kBsrAccumulatorBytes / BR / sizeof(Dtype),
+				values, block_indices, begin, end, B, C);
+	}
+};
+
+#ifdef __AVX2__
+static inline __m256 bsr_madd(const __m256 a, const __m256 b, const __m256 c) {
+#ifdef __FMA__
+	return _mm256_fmadd_ps(a, b, c);
+#else
+	return _mm256_add_ps(_mm256_mul_ps(a, b), c);
+#endif
+}
+
+static inline __m256d bsr_madd(const __m256d a, const __m256d b,
+    const __m256d c) {
+#ifdef __FMA__
+	return _mm256_fmadd_pd(a, b, c);
+#else
+	return _mm256_add_pd(_mm256_mul_pd(a, b), c);
+#endif
+}
+
+// The strip is V registers of each of the BR rows, all 8 of them held
+// in registers for the whole block row: every row of B in a block is
+// loaded once and every weight broadcast once. The loops over the block
+// are unrolled, so that the accumulators are not spilled.
+template <int BR, int BC>
+struct BsrFullStrip<float, BR, BC> {
+	static inline void Run(const int N, const float* values,
+			const int* block_indices, const int begin, const int end,
+			const float* B, float* C) {
+		const int V = kBsrAccumulatorBytes / BR / sizeof(__m256);
+		__m256 acc[BR][V];
+#pragma GCC unroll 8
+		for (int r = 0; r < BR; ++r) {
+#pragma GCC unroll 8
+			for (int v = 0; v < V; ++v) {
+				acc[r][v] = _mm256_setzero_ps();
+			}
+		}
+		for (int b = begin; b < end; ++b) {
+			const float* block = values + static_cast<long>(b) * BR * BC;
+			const float* B_rows = B + static_cast<long>(block_indices[b]) * BC * N;
+#pragma GCC unroll 8
+			for (int c = 0; c < BC; ++c) {
+				__m256 x[V];
+#pragma GCC unroll 8
+				for (int v = 0; v < V; ++v) {
+					x[v] = _mm256_loadu_ps(B_rows + c * N + 8 * v);
+				}
+#pragma GCC unroll 8
+				for (int r = 0; r < BR; ++r) {
+					const __m256 w = _mm256_broadcast_ss(block + r * BC + c);
+#pragma GCC unroll 8
+					for (int v = 0; v < V; ++v) {
+						acc[r][v] = bsr_madd(w, x[v], acc[r][v]);
+					}
+				}
+			}
+		}
+#pragma GCC unroll 8
+		for (int r = 0; r < BR; ++r) {
+#pragma GCC unroll 8
+			for (int v = 0; v < V; ++v) {
+				_mm256_storeu_ps(C + r * N + 8 * v, acc[r][v]);
+			}
+		}
+	}
+};
+
+template <int BR, int BC>
+struct BsrFullStrip<double, BR, BC> {
+	static inline void Run(const int N, const double* values,
+			const int* block_indices, const int begin, const int end,
+			const double* B, double* C) {
+		const int V = kBsrAccumulatorBytes / BR / sizeof(__m256d);
+		__m256d acc[BR][V];
+#pragma GCC unroll 8
+		for (int r = 0; r < BR; ++r) {
+#pragma GCC unroll 8
+			for (int v = 0; v < V; ++v) {
+				acc[r][v] = _mm256_setzero_pd();
+			}
+		}
+		for (int b = begin; b < end; ++b) {
+			const double* block = values + static_cast<long>(b) * BR * BC;
+			const double* B_rows = B + static_cast<long>(block_indices[b]) * BC * N;
+#pragma GCC unroll 8
+			for (int c = 0; c < BC; ++c) {
+				__m256d x[V];
+#pragma GCC unroll 8
+				for (int v = 0; v < V; ++v) {
+					x[v] = _mm256_loadu_pd(B_rows + c * N + 4 * v);
+				}
+#pragma GCC unroll 8
+				for (int r = 0; r < BR; ++r) {
+					const __m256d w = _mm256_broadcast_sd(block + r * BC + c);
+#pragma GCC unroll 8
+					for (int v = 0; v < V; ++v) {
+						acc[r][v] = bsr_madd(w, x[v], acc[r][v]);
+					}
+				}
+			}
+		}
+#pragma GCC unroll 8
+		for (int r = 0; r < BR; ++r) {
+#pragma GCC unroll 8
+			for (int v = 0; v < V; ++v) {
+				_mm256_storeu_pd(C + r * N + 4 * v, acc[r][v]);
+			}
+		}
+	}
+};
+#endif
+
+// One strip of a block row: a full strip, the partial last one, or the
+// single column of a matrix-vector product.
+template <typename Dtype, int BR, int BC>
+static void bsr_block_row(const int N, const int n, const Dtype* values,
+    const int* block_indices, const int begin, const int end,
+    const Dtype* B, Dtype* C) {
+	if (N == 1) {
+		// y = A * x: the rows of every block against a slice of x
+		Dtype acc[BR] = {0};
+		for (int b = begin; b < end; ++b) {
+			const Dtype* block = values + static_cast<long>(b) * BR * BC;
+			const Dtype* x = B + block_indices[b] * BC;
+			for (int r = 0; r < BR; ++r) {
+				Dtype sum = 0;
+#pragma omp simd reduction(+:sum)
+				for (int c = 0; c < BC; ++c) {
+					sum += block[r * BC + c] * x[c];
+				}
+				acc[r] += sum;
+			}
+		}
+		for (int r = 0; r < BR; ++r) {
+			C[r] = acc[r];
+		}
+	} else if (n * sizeof(Dtype) * BR == kBsrAccumulatorBytes) {
+		BsrFullStrip<Dtype, BR, BC>::Run(N, values, block_indices, begin, end,
+				B, C);
+	} else {
+		bsr_strip<Dtype, BR, BC>(N, n, values, block_indices, begin, end, B, C);
+	}
+}
+
+// The same for any block shape.
+template <typename Dtype>
+static void bsr_block_row_generic(const int br, const int bc, const int N,
+    const int n, const Dtype* values, const int* block_indices,
+    const int begin, const int end, const Dtype* B, Dtype* C) {
+	for (int r = 0; r < br; ++r) {
+		Dtype* C_row = C + r * N;
+		caffe_set(n, Dtype(0), C_row);
+		for (int b = begin; b < end; ++b) {
+			const Dtype* block = values + static_cast<long>(b) * br * bc + r * bc;
+			const Dtype* B_rows = B + static_cast<long>(block_indices[b]) * bc * N;
+			for (int c = 0; c < bc; ++c) {
+				const Dtype w = block[c];
+				const Dtype* x = B_rows + c * N;
+				for (int k = 0; k < n; ++k) {
+					C_row[k] += w * x[k];
+				}
+			}
+		}
+	}
+}
+
+// The micro-kernel compiled for br x bc blocks, or NULL if there is none.
+template <typename Dtype>
+struct BsrKernel {
+	typedef void (*Func)(const int N, const int n, const Dtype* values,
+			const int* block_indices, const int begin, const int end,
+			const Dtype* B, Dtype* C);
+
+	template <int BR>
+	static Func Get(const int bc) {
+		switch (bc) {
+		case 1: return bsr_block_row<Dtype, BR, 1>;
+		case 2: return bsr_block_row<Dtype, BR, 2>;
+		case 4: return bsr_block_row<Dtype, BR, 4>;
+		case 8: return bsr_block_row<Dtype, BR, 8>;
+		default: return NULL;
+		}
+	}
+
+	static Func Get(const int br, const int bc) {
+		switch (br) {
+		case 1: return Get<1>(bc);
+		case 2: return Get<2>(bc);
+		case 4: return Get<4>(bc);
+		case 8: return Get<8>(bc);
+		default: return NULL;
+		}
+	}
+};
+
+template <typename Dtype>
+void caffe_cpu_bsrmm(const int M, const int N, const int br, const int bc,
+    const Dtype* values, const int* block_indices, const int* block_pointers,
+    const Dtype* B, Dtype* C) {
+	const typename BsrKernel<Dtype>::Func kernel = BsrKernel<Dtype>::Get(br, bc);
+	const int strip_width = N == 1 ? 1 :
+			kBsrAccumulatorBytes / (kernel ? br : 1) / sizeof(Dtype);
+	const int strips = (N + strip_width - 1) / strip_width;
+	const int block_rows = M / br;
+#pragma omp parallel for schedule(dynamic, 4)
+	for (int t = 0; t < strips * block_rows; ++t) {
+		const int i = t % block_rows;
+		const int k = t / block_rows * strip_width;
+		const int n = std::min(strip_width, N - k);
+		Dtype* C_rows = C + static_cast<long>(i) * br * N + k;
+		if (kernel) {
+			kernel(N, n, values, block_indices, block_pointers[i],
+					block_pointers[i + 1], B + k, C_rows);
+		} else {
+			bsr_block_row_generic(br, bc, N, n, values, block_indices,
+					block_pointers[i], block_pointers[i + 1], B + k, C_rows);
+		}
+	}
+}
+
+template void caffe_cpu_bsrmm<float>(const int M, const int N,
+    const int br, const int bc, const float* values,
+    const int* block_indices, const int* block_pointers,
+    const float* B, float* C);
+template void caffe_cpu_bsrmm<double>(const int M, const int N,
+    const int br, const int bc, const double* values,
+    const int* block_indices, const int* block_pointers,
+    const double* B, double* C);
+
+template <typename Dtype>
+bool caffe_cpu_quantize_int8(const int n, const Dtype scale, const Dtype* x,
+    int8_t* y) {
+	bool negative = false;
+#pragma omp parallel for reduction(||:negative)
+	for (int i = 0; i < n; ++i) {
+		const Dtype v = std::min(std::max(std::nearbyint(scale * x[i]),
+				Dtype(-127)), Dtype(127));
+		y[i] = static_cast<int8_t>(v);
+		negative = negative || v < 0;
+	}
+	return negative;
+}
+
+template bool caffe_cpu_quantize_int8<float>(const int n, const float scale,
+    const float* x, int8_t* y);
+template bool caffe_cpu_quantize_int8<double>(const int n, const double scale,
+    const double* x, int8_t* y);
+
+template <typename Dtype>
+void caffe_cpu_relu(const int n, const Dtype negative_slope, Dtype* x) {
+	for (int i = 0; i < n; ++i) {
+		x[i] = std::max(x[i], Dtype(0)) + negative_slope * std::min(x[i], Dtype(0));
+	}
+}
+
+template void caffe_cpu_relu<float>(const int n, const float negative_slope,
+    float* x);
+template void caffe_cpu_relu<double>(const int n, const double negative_slope,
+    double* x);
+
+template <typename Dtype>
+void caffe_cpu_elu(const int n, const Dtype alpha, Dtype* x) {
+	for (int i = 0; i < n; ++i) {
+		if (x[i] <= 0) {
+			x[i] = alpha * (std::exp(x[i]) - Dtype(1));
+		}
+	}
+}
+
+template void caffe_cpu_elu<float>(const int n, const float alpha, float* x);
+template void caffe_cpu_elu<double>(const int n, const double alpha, double* x);
+
+#ifdef __AVX2__
+static inline int32_t hsum_epi32(const __m256i v) {
+	__m128i s = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+	s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+	s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtsi128_si32(s);
+}
+
+// With X >= 0 (at most 127), VNNI or else maddubs multiplies 32 byte pairs
+// at once, and the sums of two products fit in int16; otherwise both
+// operands are widened to int16 first.
+template <int MR, int NR, bool kNonnegative>
+static inline void dot_block_int8(const int ld, const int8_t* W,
+    const int8_t* X, int32_t* acc) {
+	const __m256i ones = _mm256_set1_epi16(1);
+	__m256i sum[MR][NR];
+	for (int r = 0; r < MR; ++r) {
+		for (int c = 0; c < NR; ++c) {
+			sum[r][c] = _mm256_setzero_si256();
+		}
+	}
+	for (int k = 0; k < ld; k += 32) {
+		if (kNonnegative) {
+			__m256i x[NR];
+			for (int c = 0; c < NR; ++c) {
+				x[c] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(X + c * ld + k));
+			}
+			for (int r = 0; r < MR; ++r) {
+				const __m256i w = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(W + r * ld + k));
+				for (int c = 0; c < NR; ++c) {
+#if defined(__AVXVNNI__)
+					sum[r][c] = _mm256_dpbusd_avx_epi32(sum[r][c], x[c], w);
+#elif defined(__AVX512VNNI__) && defined(__AVX512VL__)
+					sum[r][c] = _mm256_dpbusd_epi32(sum[r][c], x[c], w);
+#else
+					sum[r][c] = _mm256_add_epi32(sum[r][c],
+							_mm256_madd_epi16(_mm256_maddubs_epi16(x[c], w), ones));
 #endif
+				}
+			}
+		} else {
+			for (int h = 0; h < 32; h += 16) {
+				__m256i x[NR];
+				for (int c = 0; c < NR; ++c) {
+					x[c] = _mm256_cvtepi8_epi16(_mm_loadu_si128(
+							reinterpret_cast<const __m128i*>(X + c * ld + k + h)));
+				}
+				for (int r = 0; r < MR; ++r) {
+					const __m256i w = _mm256_cvtepi8_epi16(_mm_loadu_si128(
+							reinterpret_cast<const __m128i*>(W + r * ld + k + h)));
+					for (int c = 0; c < NR; ++c) {
+						sum[r][c] = _mm256_add_epi32(sum[r][c], _mm256_madd_epi16(x[c], w));
+					}
+				}
+			}
+		}
+	}
+	for (int r = 0; r < MR; ++r) {
+		for (int c = 0; c < NR; ++c) {
+			acc[r * NR + c] = hsum_epi32(sum[r][c]);
+		}
+	}
+}
+#else
+template <int MR, int NR, bool kNonnegative>
+static inline void dot_block_int8(const int ld, const int8_t* W,
+    const int8_t* X, int32_t* acc) {
+	for (int r = 0; r < MR; ++r) {
+		for (int c = 0; c < NR; ++c) {
+			const int8_t* w = W + r * ld;
+			const int8_t* x = X + c * ld;
+			int32_t sum = 0;
+#pragma omp simd reduction(+:sum)
+			for (int k = 0; k < ld; ++k) {
+				sum += static_cast<int32_t>(w[k]) * x[k];
+			}
+			acc[r * NR + c] = sum;
+		}
+	}
+}
+#endif
+
+template <bool kNonnegative, typename Dtype>
+static void gemm_int8(const bool trans_C, const int M, const int N,
+    const int K, const int8_t* W, const int8_t* X, const Dtype* scale,
+    const Dtype* bias, const bool relu, Dtype* C) {
+	// blocks of MR rows of W by NR rows of X are computed in registers; a
+	// task takes kRowBlock rows of W, kept in cache, by kColBlock rows of X
+	const int MR = 4, NR = 2;
+	const int kRowBlock = 64, kColBlock = 16;
+	const int ld = caffe_int8_row_size(K);
+	const int row_blocks = (M + kRowBlock - 1) / kRowBlock;
+	const int col_blocks = (N + kColBlock - 1) / kColBlock;
+#pragma omp parallel for collapse(2) schedule(static)
+	for (int ib = 0; ib < row_blocks; ++ib) {
+		for (int jb = 0; jb < col_blocks; ++jb) {
+			const int i_end = std::min(M, (ib + 1) * kRowBlock);
+			const int j_end = std::min(N, (jb + 1) * kColBlock);
+			int32_t acc[MR * NR];
+			for (int j = jb * kColBlock; j < j_end; j += NR) {
+				const int nr = std::min(NR, j_end - j);
+				for (int i = ib * kRowBlock; i < i_end; i += MR) {
+					const int mr = std::min(MR, i_end - i);
+					if (mr == MR && nr == NR) {
+						dot_block_int8<MR, NR, kNonnegative>(ld, W + i * ld, X + j * ld, acc);
+					} else {
+						for (int r = 0; r < mr; ++r) {
+							for (int c = 0; c < nr; ++c) {
+								dot_block_int8<1, 1, kNonnegative>(ld, W + (i + r) * ld,
+										X + (j + c) * ld, acc + r * NR + c);
+							}
+						}
+					}
+					// requantize into the output, with the bias and ReLU fused
+					for (int r = 0; r < mr; ++r) {
+						const Dtype b = bias ? bias[i + r] : Dtype(0);
+						for (int c = 0; c < nr; ++c) {
+							Dtype v = scale[i + r] * acc[r * NR + c] + b;
+							if (relu && v < 0) { v = 0; }
+							C[trans_C ? (j + c) * M + i + r : (i + r) * N + j + c] = v;
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+template <typename Dtype>
+void caffe_cpu_gemm_int8(const bool trans_C, const int M, const int N,
+    const int K, const int8_t* W, const int8_t* X, const bool x_nonnegative,
+    const Dtype* scale, const Dtype* bias, const bool relu, Dtype* C) {
+	if (x_nonnegative) {
+		gemm_int8<true>(trans_C, M, N, K, W, X, scale, bias, relu, C);
+	} else {
+		gemm_int8<false>(trans_C, M, N, K, W, X, scale, bias, relu, C);
+	}
 }
 
+template void caffe_cpu_gemm_int8<float>(const bool trans_C, const int M,
+    const int N, const int K, const int8_t* W, const int8_t* X,
+    const bool x_nonnegative, const float* scale, const float* bias,
+    const bool relu, float* C);
+template void caffe_cpu_gemm_int8<double>(const bool trans_C, const int M,
+    const int N, const int K, const int8_t* W, const int8_t* X,
+    const bool x_nonnegative, const double* scale, const double* bias,
+    const bool relu, double* C);
+
 template <>
 float caffe_cpu_asum<float>(const int n, const float* x) {
   return cblas_sasum(n, x, 1);
@@ -647,6 +1358,146 @@ void caffe_cpu_all_zero_mask(const int M, const int N, const int *X, int* y);
 template
 void caffe_cpu_all_zero_mask(const int M, const int N, const unsigned int *X, unsigned int* y);
 
+template <typename Dtype>
+void caffe_cpu_nonzerout_bitmask(const int n, const Dtype* x, unsigned int* y){
+	const int words = (n + 31) / 32;
+#pragma omp parallel for
+	for(int w=0; w<words; ++w){
+		const int begin = w * 32;
+		const int end = std::min(n, begin + 32);
+		unsigned int bits = 0;
+		for(int i=begin; i<end; ++i){
+			bits |= (unsigned int)caffe_if_nonzerout<Dtype>(x[i]) << (i - begin);
+		}
+		y[w] = bits;
+	}
+}
+template
+void caffe_cpu_nonzerout_bitmask(const int n, const float* x, unsigned int* y);
+template
+void caffe_cpu_nonzerout_bitmask(const int n, const double* x, unsigned int* y);
+template
+void caffe_cpu_nonzerout_bitmask(const int n, const int* x, unsigned int* y);
+template
+void caffe_cpu_nonzerout_bitmask(const int n, const unsigned int* x, unsigned int* y);
+
+template <typename Dtype>
+void caffe_cpu_all_zero_bitmask(const int M, const int N, const Dtype *X, unsigned int* y, const int offset){
+	vector<bool> row_alive(M, false);
+	vector<bool> col_alive(N, false);
+	for(int row=0; row<M; ++row){
+		for(int col=0; col<N; ++col){
+			if(X[col+row*N]!=0){
+				row_alive[row] = true;
+				col_alive[col] = true;
+			}
+		}
+	}
+	//only clear bits, so that masks of several groups can be combined
+	for(int row=0; row<M; ++row){
+		for(int col=0; col<N; ++col){
+			if(!row_alive[row] || !col_alive[col]){
+				const int i = offset + col + row*N;
+				y[i >> 5] &= ~(1u << (i & 31));
+			}
+		}
+	}
+}
+template
+void caffe_cpu_all_zero_bitmask(const int M, const int N, const float *X, unsigned int* y, const int offset);
+template
+void caffe_cpu_all_zero_bitmask(const int M, const int N, const double *X, unsigned int* y, const int offset);
+template
+void caffe_cpu_all_zero_bitmask(const int M, const int N, const int *X, unsigned int* y, const int offset);
+template
+void caffe_cpu_all_zero_bitmask(const int M, const int N, const unsigned int *X, unsigned int* y, const int offset);
+
+template <typename Dtype>
+void caffe_cpu_connected_update(const int n, const unsigned int* mask, Dtype* x, Dtype* y){
+	const int words = (n + 31) / 32;
+#pragma omp parallel for
+	for(int w=0; w<words; ++w){
+		const int begin = w * 32;
+		const int end = std::min(n, begin + 32);
+		const unsigned int bits = mask[w];
+		if(bits == 0xFFFFFFFFu){
+			for(int i=begin; i<end; ++i){
+				y[i] -= x[i];
+			}
+		}else if(bits == 0){
+			for(int i=begin; i<end; ++i){
+				x[i] = 0;
+			}
+		}else{
+			for(int i=begin; i<end; ++i){
+				if((bits >> (i - begin)) & 1u){
+					y[i] -= x[i];
+				}else{
+					x[i] = 0;
+				}
+			}
+		}
+	}
+}
+template
+void caffe_cpu_connected_update(const int n, const unsigned int* mask, float* x, float* y);
+template
+void caffe_cpu_connected_update(const int n, const unsigned int* mask, double* x, double* y);
+
+template <typename Dtype>
+static inline Dtype caffe_cpu_sgd_update_range(const int begin, const int end,
+		const Dtype decay, const Dtype momentum, const Dtype rate,
+		Dtype* data, Dtype* diff, Dtype* history){
+	const Dtype thre = Dtype(ZEROUT_THRESHOLD);
+	Dtype sumsq = 0;
+#pragma omp simd reduction(+:sumsq)
+	for(int i=begin; i<end; ++i){
+		const Dtype w = data[i];
+		sumsq += w * w;
+		const Dtype h = rate * (diff[i] + decay * w) + momentum * history[i];
+		history[i] = h;
+		diff[i] = h;
+		const Dtype updated = w - h;
+		data[i] = (updated < thre && updated > -thre) ? Dtype(0) : updated;
+	}
+	return sumsq;
+}
+
+template <typename Dtype>
+Dtype caffe_cpu_sgd_update(const int n, const unsigned int* mask,
+		const Dtype decay, const Dtype momentum, const Dtype rate,
+		Dtype* data, Dtype* diff, Dtype* history){
+	const int words = (n + 31) / 32;
+	Dtype sumsq = 0;
+#pragma omp parallel for reduction(+:sumsq)
+	for(int w=0; w<words; ++w){
+		const int begin = w * 32;
+		const int end = std::min(n, begin + 32);
+		const unsigned int bits = mask ? mask[w] : 0xFFFFFFFFu;
+		if(bits == 0xFFFFFFFFu){
+			sumsq += caffe_cpu_sgd_update_range(begin, end, decay, momentum, rate,
+					data, diff, history);
+		}else if(bits){
+			//disconnected elements are left untouched
+			for(int i=begin; i<end; ++i){
+				if((bits >> (i - begin)) & 1u){
+					sumsq += caffe_cpu_sgd_update_range(i, i + 1, decay, momentum, rate,
+							data, diff, history);
+				}
+			}
+		}
+	}
+	return sumsq;
+}
+template
+float caffe_cpu_sgd_update(const int n, const unsigned int* mask,
+		const float decay, const float momentum, const float rate,
+		float* data, float* diff, float* history);
+template
+double caffe_cpu_sgd_update(const int n, const unsigned int* mask,
+		const double decay, const double momentum, const double rate,
+		double* data, double* diff, double* history);
+
 template <typename Dtype>
 Dtype caffe_cpu_group_sparsity(const int M, const int N, const Dtype *x, bool dimen){
 	Dtype sparsity = (Dtype)0;
@@ -679,6 +1530,57 @@ Dtype caffe_cpu_group_sparsity(const int M, const int N, const Dtype *x, bool di
 template float caffe_cpu_group_sparsity(const int M, const int N, const float *x, bool dimen);
 template double caffe_cpu_group_sparsity(const int M, const int N, const double *x, bool dimen);
 
+template <typename Dtype>
+void caffe_cpu_sparsity_stats(const int M, const int N, const Dtype *x,
+		int* zeros, int* zero_rows, int* zero_cols){
+	vector<char> col_nonzero(N, 0);
+	*zeros = 0;
+	*zero_rows = 0;
+	for(int row=0; row<M; ++row){
+		const Dtype* x_row = x + row*N;
+		int row_zeros = 0;
+		for(int col=0; col<N; ++col){
+			const bool zero = x_row[col]==0;
+			row_zeros += zero;
+			col_nonzero[col] |= !zero;
+		}
+		*zeros += row_zeros;
+		*zero_rows += row_zeros==N;
+	}
+	*zero_cols = N - std::count(col_nonzero.begin(), col_nonzero.end(), 1);
+}
+template void caffe_cpu_sparsity_stats(const int M, const int N, const float *x,
+		int* zeros, int* zero_rows, int* zero_cols);
+template void caffe_cpu_sparsity_stats(const int M, const int N, const double *x,
+		int* zeros, int* zero_rows, int* zero_cols);
+
+template <typename Dtype>
+int caffe_cpu_zero_blocks(const int n, const int c,
+		const int blk_size_n, const int blk_size_c, const Dtype *x){
+	CHECK_EQ(n%blk_size_n, 0);
+	CHECK_EQ(c%blk_size_c, 0);
+	int count = 0;
+	for(int by=0; by<n; by+=blk_size_n){
+		for(int bx=0; bx<c; bx+=blk_size_c){
+			bool zero = true;
+			for(int y=by; y<by+blk_size_n && zero; ++y){
+				for(int x_idx=bx; x_idx<bx+blk_size_c; ++x_idx){
+					if(x[y*c+x_idx]!=0){
+						zero = false;
+						break;
+					}
+				}
+			}
+			count += zero;
+		}
+	}
+	return count;
+}
+template int caffe_cpu_zero_blocks(const int n, const int c,
+		const int blk_size_n, const int blk_size_c, const float *x);
+template int caffe_cpu_zero_blocks(const int n, const int c,
+		const int blk_size_n, const int blk_size_c, const double *x);
+
 template <typename Dtype>
 void caffe_cpu_del_zero_cols(const int M, const int N, const Dtype *x, Dtype *y, int * left_cols, const int* mask){
 	int dst_col = 0;
@@ -748,6 +1650,50 @@ void caffe_cpu_dispatch_rows(const int M, const int N, Dtype *x, const int* row_
 template void caffe_cpu_dispatch_rows<float>(const int M, const int N, float *x, const int* row_mask);
 template void caffe_cpu_dispatch_rows<double>(const int M, const int N, double *x, const int* row_mask);
 
+template <typename Dtype>
+void caffe_cpu_bar_group_lasso(const int n, const int c, const Dtype *x, Dtype* y, bool along_column_or_row){
+	if(along_column_or_row){
+		//each thread sums squares over a tile of columns, walking the rows contiguously
+		const int tile = 64;
+#pragma omp parallel for
+		for(int c0=0; c0<c; c0+=tile){
+			const int c1 = std::min(c, c0 + tile);
+			Dtype sum_val[tile];
+			for(int col=c0; col<c1; ++col) sum_val[col-c0] = 0;
+			for(int row=0; row<n; ++row){
+				const Dtype* x_row = x + row*c;
+#pragma omp simd
+				for(int col=c0; col<c1; ++col){
+					sum_val[col-c0] += x_row[col]*x_row[col];
+				}
+			}
+			for(int col=c0; col<c1; ++col){
+				sum_val[col-c0] = sum_val[col-c0]>0 ? sqrt(sum_val[col-c0]) : Dtype(0);
+			}
+			for(int row=0; row<n; ++row){
+				for(int col=c0; col<c1; ++col){
+					y[row*c+col] = sum_val[col-c0];
+				}
+			}
+		}
+	}else{
+#pragma omp parallel for
+		for(int row=0; row<n; ++row){
+			const Dtype* x_row = x + row*c;
+			Dtype sum_val = 0;
+#pragma omp simd reduction(+:sum_val)
+			for(int col=0; col<c; ++col){
+				sum_val += x_row[col]*x_row[col];
+			}
+			caffe_set(c, sum_val>0 ? Dtype(sqrt(sum_val)) : Dtype(0), y + row*c);
+		}
+	}
+}
+template void caffe_cpu_bar_group_lasso<float>(const int n, const int c,
+		const float *x, float* y, bool along_column_or_row);
+template void caffe_cpu_bar_group_lasso<double>(const int n, const int c,
+		const double *x, double* y, bool along_column_or_row);
+
 template <typename Dtype>
 void caffe_cpu_block_group_lasso(const int n, const int c,
 		const int blk_size_n, const int blk_size_c,
@@ -222,6 +222,32 @@ template void caffe_gpu_zerout<unsigned int>(void * mutable_gpu_data, const int
 template void caffe_gpu_zerout<float>(void * mutable_gpu_data, const int count, float th);
 template void caffe_gpu_zerout<double>(void * mutable_gpu_data, const int count, double th);
 
+template <typename Dtype>
+__global__ void connected_update_kernel(const int n, const unsigned int* mask,
+    Dtype* x, Dtype* y) {
+  CUDA_KERNEL_LOOP(index, n) {
+    if ((mask[index >> 5] >> (index & 31)) & 1u) {
+      y[index] -= x[index];
+    } else {
+      x[index] = 0;
+    }
+  }
+}
+
+template <typename Dtype>
+void caffe_gpu_connected_update(const int n, const unsigned int* mask,
+    Dtype* x, Dtype* y) {
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  connected_update_kernel<Dtype><<<CAFFE_GET_BLOCKS(n), CAFFE_CUDA_NUM_THREADS>>>(
+      n, mask, x, y);
+  CUDA_POST_KERNEL_CHECK;
+}
+
+template void caffe_gpu_connected_update<float>(const int n,
+    const unsigned int* mask, float* x, float* y);
+template void caffe_gpu_connected_update<double>(const int n,
+    const unsigned int* mask, double* x, double* y);
+
 //template <>
 //void caffe_gpu_zerout<int>(void * mutable_gpu_data, int count, int th){
 //	zerout_kernel<<<32768,256>>>(mutable_gpu_data,  count,  th);
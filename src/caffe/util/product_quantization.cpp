@@ -0,0 +1,270 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/product_quantization.hpp"
+#include "caffe/util/rng.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+static inline Dtype squared_distance(const int dim, const Dtype* a,
+    const Dtype* b) {
+  Dtype distance = 0;
+  for (int r = 0; r < dim; ++r) {
+    const Dtype d = a[r] - b[r];
+    distance += d * d;
+  }
+  return distance;
+}
+
+template <typename Dtype>
+static inline int nearest_centroid(const int dim, const Dtype* x, const int k,
+    const Dtype* centroids, Dtype* distance) {
+  int nearest = 0;
+  Dtype best = squared_distance(dim, x, centroids);
+  for (int c = 1; c < k; ++c) {
+    const Dtype d = squared_distance(dim, x, centroids + c * dim);
+    if (d < best) {
+      best = d;
+      nearest = c;
+    }
+  }
+  *distance = best;
+  return nearest;
+}
+
+template <typename Dtype>
+void caffe_cpu_kmeans(const int n, const int dim, const Dtype* data,
+    const int k, const int max_iter, const int batch_size,
+    const unsigned int seed, Dtype* centroids, int* labels) {
+  CHECK_GT(n, 0);
+  CHECK_GT(k, 0);
+  rng_t rng(seed);
+  std::uniform_real_distribution<double> uniform(0, 1);
+  // k-means++: every next centroid is drawn with probability proportional
+  // to the squared distance from the nearest centroid chosen so far
+  vector<Dtype> distances(n);
+  const int first = std::min(n - 1, static_cast<int>(uniform(rng) * n));
+  caffe_copy(dim, data + first * dim, centroids);
+  for (int i = 0; i < n; ++i) {
+    distances[i] = squared_distance(dim, data + i * dim, centroids);
+  }
+  for (int c = 1; c < k; ++c) {
+    double total = 0;
+    for (int i = 0; i < n; ++i) {
+      total += distances[i];
+    }
+    int chosen = std::min(n - 1, static_cast<int>(uniform(rng) * n));
+    if (total > 0) {
+      double r = uniform(rng) * total;
+      for (chosen = 0; chosen < n - 1; ++chosen) {
+        r -= distances[chosen];
+        if (r < 0 && distances[chosen] > 0) { break; }
+      }
+    }
+    Dtype* centroid = centroids + c * dim;
+    caffe_copy(dim, data + chosen * dim, centroid);
+    for (int i = 0; i < n; ++i) {
+      distances[i] = std::min(distances[i],
+          squared_distance(dim, data + i * dim, centroid));
+    }
+  }
+
+  if (batch_size > 0) {
+    // mini-batch k-means: every sampled row moves its centroid by a step
+    // that decays with the number of rows the centroid has absorbed
+    std::uniform_int_distribution<int> pick(0, n - 1);
+    vector<int> batch(batch_size);
+    vector<int> batch_labels(batch_size);
+    vector<int> counts(k, 0);
+    for (int iter = 0; iter < max_iter; ++iter) {
+      for (int b = 0; b < batch_size; ++b) {
+        batch[b] = pick(rng);
+        Dtype distance;
+        batch_labels[b] = nearest_centroid(dim, data + batch[b] * dim, k,
+            centroids, &distance);
+      }
+      for (int b = 0; b < batch_size; ++b) {
+        const int c = batch_labels[b];
+        const Dtype eta = Dtype(1) / ++counts[c];
+        const Dtype* x = data + batch[b] * dim;
+        Dtype* centroid = centroids + c * dim;
+        for (int r = 0; r < dim; ++r) {
+          centroid[r] += eta * (x[r] - centroid[r]);
+        }
+      }
+    }
+  } else {
+    vector<Dtype> sums(k * dim);
+    vector<int> counts(k);
+    std::fill(labels, labels + n, -1);
+    for (int iter = 0; iter < max_iter; ++iter) {
+      bool changed = false;
+      for (int i = 0; i < n; ++i) {
+        const int label = nearest_centroid(dim, data + i * dim, k, centroids,
+            &distances[i]);
+        changed |= label != labels[i];
+        labels[i] = label;
+      }
+      if (!changed) { break; }
+      std::fill(sums.begin(), sums.end(), Dtype(0));
+      std::fill(counts.begin(), counts.end(), 0);
+      for (int i = 0; i < n; ++i) {
+        caffe_axpy(dim, Dtype(1), data + i * dim, &sums[labels[i] * dim]);
+        ++counts[labels[i]];
+      }
+      for (int c = 0; c < k; ++c) {
+        if (counts[c] > 0) {
+          caffe_cpu_scale(dim, Dtype(1) / counts[c], &sums[c * dim],
+              centroids + c * dim);
+        } else {
+          // an empty cluster takes over the row worst served so far
+          const int farthest = std::max_element(distances.begin(),
+              distances.end()) - distances.begin();
+          caffe_copy(dim, data + farthest * dim, centroids + c * dim);
+          distances[farthest] = 0;
+        }
+      }
+    }
+  }
+  for (int i = 0; i < n; ++i) {
+    labels[i] = nearest_centroid(dim, data + i * dim, k, centroids,
+        &distances[i]);
+  }
+}
+
+template void caffe_cpu_kmeans<float>(const int n, const int dim,
+    const float* data, const int k, const int max_iter, const int batch_size,
+    const unsigned int seed, float* centroids, int* labels);
+template void caffe_cpu_kmeans<double>(const int n, const int dim,
+    const double* data, const int k, const int max_iter, const int batch_size,
+    const unsigned int seed, double* centroids, int* labels);
+
+void caffe_pack_codes(const int n, const int* codes, const int bits,
+    unsigned int* packed) {
+  CHECK_GT(bits, 0);
+  CHECK_LT(bits, 32);
+  memset(packed, 0, caffe_packed_codes_size(n, bits) * sizeof(unsigned int));
+  for (int i = 0; i < n; ++i) {
+    const long long offset = static_cast<long long>(i) * bits;  // NOLINT
+    const int word = offset / 32;
+    const int shift = 32 - bits - offset % 32;
+    const unsigned int code = codes[i];
+    if (shift >= 0) {
+      packed[word] |= code << shift;
+    } else {
+      packed[word] |= code >> -shift;
+      packed[word + 1] |= code << (32 + shift);
+    }
+  }
+}
+
+// Clusters the m-dimensional column slices of the weights seen as
+// outer x cols x inner, where every (outer, inner) pair is a row to encode.
+// The codes are stored slice-major; the codebook either slice x codeword x
+// dimension or, by_dimension, (slice, dimension) x codeword.
+template <typename Dtype>
+static void product_quantize(const Dtype* weights, const int outer,
+    const int cols, const int inner, const bool by_dimension,
+    const ProductQuantizationOptions& options, Dtype* codebook,
+    Blob<Dtype>* packed_codes) {
+  const int k = options.k;
+  const int m = options.m;
+  const int bits = static_cast<int>(log2(k));
+  CHECK_EQ(1 << bits, k) << "k must be a power of two.";
+  CHECK_GE(k, 2);
+  CHECK_LE(k, 256) << "Codeword indices must fit in a byte.";
+  CHECK_EQ(cols % m, 0) << "Input size must be a multiple of m.";
+  const int num_slices = cols / m;
+  const int n = outer * inner;
+  vector<int> codes(num_slices * n);
+#pragma omp parallel for schedule(dynamic)
+  for (int s = 0; s < num_slices; ++s) {
+    vector<Dtype> rows(n * m);
+    vector<Dtype> centroids(k * m);
+    for (int a = 0; a < outer; ++a) {
+      for (int p = 0; p < inner; ++p) {
+        for (int r = 0; r < m; ++r) {
+          rows[(a * inner + p) * m + r] =
+              weights[(a * cols + s * m + r) * inner + p];
+        }
+      }
+    }
+    caffe_cpu_kmeans(n, m, &rows[0], k, options.max_iter, options.batch_size,
+        options.seed + s, &centroids[0], &codes[s * n]);
+    for (int c = 0; c < k; ++c) {
+      for (int r = 0; r < m; ++r) {
+        codebook[by_dimension ? (s * m + r) * k + c : (s * k + c) * m + r] =
+            centroids[c * m + r];
+      }
+    }
+  }
+  // the words are copied bitwise into the blob, as the layers read them
+  const int words = caffe_packed_codes_size(codes.size(), bits);
+  vector<unsigned int> packed(words);
+  caffe_pack_codes(codes.size(), &codes[0], bits, &packed[0]);
+  const int word_bytes = words * sizeof(unsigned int);
+  packed_codes->Reshape(vector<int>(1,
+      (word_bytes + sizeof(Dtype) - 1) / sizeof(Dtype)));
+  caffe_set(packed_codes->count(), Dtype(0),
+      packed_codes->mutable_cpu_data());
+  memcpy(packed_codes->mutable_cpu_data(), &packed[0], word_bytes);
+}
+
+template <typename Dtype>
+void QuantizeInnerProductWeights(const Blob<Dtype>& weights,
+    const ProductQuantizationOptions& options, Blob<Dtype>* codebook,
+    Blob<Dtype>* packed_codes) {
+  CHECK_EQ(weights.num_axes(), 2);
+  const int num_output = weights.shape(0);
+  const int num_input = weights.shape(1);
+  vector<int> codebook_shape(2);
+  codebook_shape[0] = num_input;
+  codebook_shape[1] = options.k;
+  codebook->Reshape(codebook_shape);
+  product_quantize(weights.cpu_data(), num_output, num_input, 1, true,
+      options, codebook->mutable_cpu_data(), packed_codes);
+}
+
+template <typename Dtype>
+void QuantizeConvolutionWeights(const Blob<Dtype>& weights,
+    const ProductQuantizationOptions& options, Blob<Dtype>* codebook,
+    Blob<Dtype>* packed_codes) {
+  CHECK_GE(weights.num_axes(), 2);
+  const int num_output = weights.shape(0);
+  const int channels = weights.shape(1);
+  CHECK_EQ(channels % options.m, 0) << "Channels must be a multiple of m.";
+  vector<int> codebook_shape(2);
+  codebook_shape[0] = options.k * channels / options.m;
+  codebook_shape[1] = options.m;
+  codebook->Reshape(codebook_shape);
+  product_quantize(weights.cpu_data(), num_output, channels, weights.count(2),
+      false, options, codebook->mutable_cpu_data(), packed_codes);
+}
+
+void FreezeQuantizedCodes(LayerParameter* layer) {
+  while (layer->param_size() < 3) {
+    layer->add_param();
+  }
+  layer->mutable_param(2)->set_lr_mult(0);
+  layer->mutable_param(2)->set_decay_mult(0);
+}
+
+template void QuantizeInnerProductWeights<float>(const Blob<float>& weights,
+    const ProductQuantizationOptions& options, Blob<float>* codebook,
+    Blob<float>* packed_codes);
+template void QuantizeInnerProductWeights<double>(const Blob<double>& weights,
+    const ProductQuantizationOptions& options, Blob<double>* codebook,
+    Blob<double>* packed_codes);
+template void QuantizeConvolutionWeights<float>(const Blob<float>& weights,
+    const ProductQuantizationOptions& options, Blob<float>* codebook,
+    Blob<float>* packed_codes);
+template void QuantizeConvolutionWeights<double>(const Blob<double>& weights,
+    const ProductQuantizationOptions& options, Blob<double>* codebook,
+    Blob<double>* packed_codes);
+
+}  // namespace caffe
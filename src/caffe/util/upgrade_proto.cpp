@@ -15,7 +15,8 @@ namespace caffe {
 bool NetNeedsUpgrade(const NetParameter& net_param) {
   return NetNeedsV0ToV1Upgrade(net_param) || NetNeedsV1ToV2Upgrade(net_param)
       || NetNeedsDataUpgrade(net_param) || NetNeedsInputUpgrade(net_param)
-      || NetNeedsBatchNormUpgrade(net_param);
+      || NetNeedsBatchNormUpgrade(net_param)
+      || NetNeedsInt8FusedReluUpgrade(net_param);
 }
 
 bool UpgradeNetAsNeeded(const string& param_file, NetParameter* param) {
@@ -80,6 +81,13 @@ bool UpgradeNetAsNeeded(const string& param_file, NetParameter* param) {
     LOG(INFO) << "Successfully upgraded batch norm layers using deprecated "
               << "params.";
   }
+  if (NetNeedsInt8FusedReluUpgrade(*param)) {
+    LOG(INFO) << "Attempting to upgrade layers using deprecated "
+              << "int8_fused_relu: " << param_file;
+    UpgradeNetInt8FusedRelu(param);
+    LOG(INFO) << "Successfully upgraded layers using deprecated "
+              << "int8_fused_relu.";
+  }
   return success;
 }
 
@@ -1031,6 +1039,37 @@ void UpgradeNetBatchNorm(NetParameter* net_param) {
   }
 }
 
+bool NetNeedsInt8FusedReluUpgrade(const NetParameter& net_param) {
+  for (int i = 0; i < net_param.layer_size(); ++i) {
+    const LayerParameter& layer = net_param.layer(i);
+    if (layer.convolution_param().has_int8_fused_relu() ||
+        layer.inner_product_param().has_int8_fused_relu()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void UpgradeNetInt8FusedRelu(NetParameter* net_param) {
+  for (int i = 0; i < net_param->layer_size(); ++i) {
+    LayerParameter* layer = net_param->mutable_layer(i);
+    if (layer->convolution_param().has_int8_fused_relu()) {
+      ConvolutionParameter* param = layer->mutable_convolution_param();
+      if (param->int8_fused_relu()) {
+        param->set_fused_activation(ConvolutionParameter_FusedActivation_RELU);
+      }
+      param->clear_int8_fused_relu();
+    }
+    if (layer->inner_product_param().has_int8_fused_relu()) {
+      InnerProductParameter* param = layer->mutable_inner_product_param();
+      if (param->int8_fused_relu()) {
+        param->set_fused_activation(ConvolutionParameter_FusedActivation_RELU);
+      }
+      param->clear_int8_fused_relu();
+    }
+  }
+}
+
 // Return true iff the solver contains any old solver_type specified as enums
 bool SolverNeedsTypeUpgrade(const SolverParameter& solver_param) {
   if (solver_param.has_solver_type()) {
@@ -0,0 +1,46 @@
+#include <algorithm>
+#include <memory>
+
+#include "caffe/util/workspace.hpp"
+
+namespace caffe {
+
+static thread_local std::unique_ptr<Workspace> thread_workspace_;
+
+Workspace& Workspace::Get() {
+  if (!thread_workspace_.get()) {
+    thread_workspace_.reset(new Workspace());
+  }
+  return *(thread_workspace_.get());
+}
+
+void Workspace::Grow(shared_ptr<SyncedMemory>* memory, size_t size) {
+  if (!*memory || size > (*memory)->size()) {
+    // SyncedMemory allocates lazily, so growing costs nothing until used.
+    memory->reset(new SyncedMemory(size));
+  }
+}
+
+void Workspace::Reserve(size_t size) {
+  requested_ += size;
+  // Each buffer is only allocated if it is borrowed from its side.
+  Grow(&cpu_memory_, size);
+  Grow(&gpu_memory_, size);
+}
+
+void* Workspace::mutable_cpu_data(size_t size) {
+  Grow(&cpu_memory_, size);
+  return cpu_memory_->mutable_cpu_data();
+}
+
+void* Workspace::mutable_gpu_data(size_t size) {
+  Grow(&gpu_memory_, size);
+  return gpu_memory_->mutable_gpu_data();
+}
+
+size_t Workspace::size() const {
+  return std::max(cpu_memory_ ? cpu_memory_->size() : 0,
+      gpu_memory_ ? gpu_memory_->size() : 0);
+}
+
+}  // namespace caffe
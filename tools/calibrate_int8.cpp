@@ -0,0 +1,195 @@
+// This program calibrates a trained net for int8 inference: it runs the net
+// on its TEST data, records the largest magnitude each Convolution and
+// InnerProduct layer receives, and switches these layers to int8 (conv_mode
+// LOWERED_INT8, ip_mode INT8) with the matching input scale.
+// Usage:
+//    calibrate_int8 [FLAGS] NET_PROTOTXT WEIGHTS ITERATIONS OUT_PROTOTXT
+//
+// The weights are unchanged: the layers quantize them when they are loaded.
+// OUT_PROTOTXT can still be trained, the int8 layers running in float while
+// training. The in-place ReLU following a calibrated layer is only folded into
+// its int8 gemm in the net written to --deploy_prototxt, which then can only
+// run inference.
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "boost/algorithm/string.hpp"
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/net.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/io.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+using std::map;
+using std::set;
+using std::string;
+using std::vector;
+
+DEFINE_string(layers, "",
+    "Optional; a comma-separated list of the layers to calibrate, "
+    "otherwise every Convolution and InnerProduct layer that supports int8");
+DEFINE_string(deploy_prototxt, "",
+    "Optional; also write there the int8 net with the in-place ReLU following "
+    "each calibrated layer folded into its int8 gemm, for inference only");
+
+static bool SupportsInt8(const LayerParameter& layer) {
+  if (layer.type() == "Convolution") {
+    const ConvolutionParameter& param = layer.convolution_param();
+    return param.engine() != ConvolutionParameter_Engine_QUANT &&
+        param.engine() != ConvolutionParameter_Engine_CUDNN &&
+        !param.force_nd_im2col() && param.kernel_size_size() <= 2 &&
+        param.pad_size() <= 2 && param.stride_size() <= 2 &&
+        param.dilation_size() <= 2 && (!param.has_axis() || param.axis() == 1);
+  }
+  return layer.type() == "InnerProduct";
+}
+
+// Folds the ReLU into the layer if it is the in-place ReLU, without leak,
+// that next reads the layer's top.
+static bool FuseReLU(NetParameter* net_param, const int index) {
+  const LayerParameter& layer = net_param->layer(index);
+  if (layer.top_size() != 1) {
+    return false;
+  }
+  const string& top = layer.top(0);
+  for (int i = index + 1; i < net_param->layer_size(); ++i) {
+    const LayerParameter& next = net_param->layer(i);
+    if (std::find(next.bottom().begin(), next.bottom().end(), top) ==
+        next.bottom().end()) {
+      continue;
+    }
+    if (next.type() != "ReLU" || next.top_size() != 1 ||
+        next.top(0) != top || next.relu_param().negative_slope() != 0 ||
+        next.include_size() > 0 || next.exclude_size() > 0) {
+      return false;
+    }
+    LOG(INFO) << "Fused " << next.name() << " into " << layer.name();
+    net_param->mutable_layer()->DeleteSubrange(i, 1);
+    return true;
+  }
+  return false;
+}
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  // Print output to stderr (while still logging)
+  FLAGS_alsologtostderr = 1;
+
+#ifndef GFLAGS_GFLAGS_H_
+  namespace gflags = google;
+#endif
+
+  gflags::SetUsageMessage("Calibrate the Convolution and InnerProduct\n"
+        "layers of a trained net for int8 inference.\n"
+        "Usage:\n"
+        "    calibrate_int8 [FLAGS] NET_PROTOTXT WEIGHTS ITERATIONS "
+        "OUT_PROTOTXT\n");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  if (argc != 5) {
+    gflags::ShowUsageWithFlagsRestrict(argv[0], "tools/calibrate_int8");
+    return 1;
+  }
+  const int iterations = atoi(argv[3]);
+  CHECK_GT(iterations, 0);
+
+  NetParameter net_param;
+  ReadNetParamsFromTextFileOrDie(argv[1], &net_param);
+  set<string> requested;
+  if (!FLAGS_layers.empty()) {
+    vector<string> names;
+    boost::split(names, FLAGS_layers, boost::is_any_of(","));
+    requested.insert(names.begin(), names.end());
+  }
+
+  // the scales are measured with the float layers
+  Caffe::set_mode(Caffe::CPU);
+  Net<float> net(argv[1], TEST);
+  net.CopyTrainedLayersFrom(argv[2]);
+  const vector<shared_ptr<Layer<float> > >& layers = net.layers();
+  map<string, float> max_input;
+  for (int i = 0; i < layers.size(); ++i) {
+    const string& name = net.layer_names()[i];
+    if (SupportsInt8(layers[i]->layer_param()) &&
+        (requested.empty() || requested.count(name))) {
+      max_input[name] = 0;
+    }
+  }
+  for (set<string>::const_iterator it = requested.begin();
+       it != requested.end(); ++it) {
+    CHECK(max_input.count(*it)) << "Layer " << *it
+        << " is unknown or cannot run in int8.";
+  }
+
+  for (int iter = 0; iter < iterations; ++iter) {
+    for (int i = 0; i < layers.size(); ++i) {
+      map<string, float>::iterator range =
+          max_input.find(net.layer_names()[i]);
+      if (range != max_input.end()) {
+        const Blob<float>* bottom = net.bottom_vecs()[i][0];
+        const float* data = bottom->cpu_data();
+        for (int j = 0; j < bottom->count(); ++j) {
+          range->second = std::max(range->second, std::fabs(data[j]));
+        }
+      }
+      net.ForwardFromTo(i, i);
+    }
+  }
+
+  for (int i = 0; i < net_param.layer_size(); ++i) {
+    LayerParameter* layer = net_param.mutable_layer(i);
+    map<string, float>::const_iterator range = max_input.find(layer->name());
+    if (range == max_input.end()) {
+      continue;
+    }
+    // inputs that are all zero quantize to zero whatever the scale
+    const float scale = range->second > 0 ? 127 / range->second : 1;
+    if (layer->type() == "Convolution") {
+      ConvolutionParameter* param = layer->mutable_convolution_param();
+      param->set_conv_mode(ConvolutionParameter_ConvMode_LOWERED_INT8);
+      param->set_int8_input_scale(scale);
+    } else {
+      InnerProductParameter* param = layer->mutable_inner_product_param();
+      param->set_ip_mode(InnerProductParameter_IpMode_INT8);
+      param->set_int8_input_scale(scale);
+    }
+    LOG(INFO) << "Layer " << layer->name() << ": max |input| "
+        << range->second << ", int8_input_scale " << scale;
+  }
+
+  WriteProtoToTextFile(net_param, argv[4]);
+  LOG(INFO) << "Wrote the int8 net definition to " << argv[4];
+  if (FLAGS_deploy_prototxt.empty()) {
+    return 0;
+  }
+  // the fused ReLU has no backward, so it is left out of the net above
+  NetParameter deploy_param(net_param);
+  for (int i = 0; i < deploy_param.layer_size(); ++i) {
+    LayerParameter* layer = deploy_param.mutable_layer(i);
+    if (!max_input.count(layer->name()) || !FuseReLU(&deploy_param, i)) {
+      continue;
+    }
+    // without slope, so that the int8 gemm applies it
+    if (layer->type() == "Convolution") {
+      layer->mutable_convolution_param()->set_fused_activation(
+          ConvolutionParameter_FusedActivation_RELU);
+    } else {
+      layer->mutable_inner_product_param()->set_fused_activation(
+          ConvolutionParameter_FusedActivation_RELU);
+    }
+  }
+  WriteProtoToTextFile(deploy_param, FLAGS_deploy_prototxt);
+  LOG(INFO) << "Wrote the int8 deploy net definition to "
+      << FLAGS_deploy_prototxt;
+  return 0;
+}
@@ -0,0 +1,315 @@
+// This program simplifies a trained net for inference: it folds the
+// BatchNorm, Scale and Bias layers that follow a Convolution or InnerProduct
+// layer into its weights and bias, and fuses the ReLU, ELU or channel shared
+// PReLU that then follows into the layer itself (fused_activation), so that
+// the activations are no longer read and written once per layer.
+// Usage:
+//    fuse_net NET_PROTOTXT WEIGHTS OUT_PROTOTXT OUT_WEIGHTS
+//
+// The net is instantiated in the TEST phase to follow the blobs, so use the
+// deploy definition if the data of NET_PROTOTXT is not at hand; OUT_PROTOTXT
+// is the TEST net. A layer is folded only if it is the sole reader of the
+// output of the producer, either in place or not; in the latter case the
+// producer takes over its top. The fused layers run on the CPU only.
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "glog/logging.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/net.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/io.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+using std::map;
+using std::set;
+using std::string;
+using std::vector;
+
+// What becomes of a Convolution or InnerProduct layer.
+struct Fusion {
+  string top;
+  vector<shared_ptr<Blob<float> > > blobs;
+  ConvolutionParameter_FusedActivation activation;
+  float alpha;
+};
+
+// Whether the layer computes its output channels along axis 1, the channels
+// of BatchNorm, Scale and Bias, from weights of its own.
+static bool CanFold(const Net<float>& net, const int i) {
+  Layer<float>& layer = *net.layers()[i];
+  const LayerParameter& param = layer.layer_param();
+  if (net.bottom_ids(i).size() != 1 || net.top_ids(i).size() != 1) {
+    return false;
+  }
+  for (int k = 0; k < param.param_size(); ++k) {
+    if (!param.param(k).name().empty()) {
+      // the weights are shared with another layer
+      return false;
+    }
+  }
+  const Blob<float>& bottom = *net.bottom_vecs()[i][0];
+  const string type = layer.type();
+  if (type == "Convolution") {
+    const ConvolutionParameter& conv_param = param.convolution_param();
+    return conv_param.engine() != ConvolutionParameter_Engine_QUANT &&
+        bottom.CanonicalAxisIndex(conv_param.axis()) == 1;
+  } else if (type == "InnerProduct") {
+    const InnerProductParameter& ip_param = param.inner_product_param();
+    return !ip_param.transpose() && bottom.num_axes() >= 2 &&
+        bottom.CanonicalAxisIndex(ip_param.axis()) == 1;
+  }
+  return false;
+}
+
+// The layer after `after` that reads blob b, if it reads nothing else and
+// writes a single top, otherwise -1.
+static int NextReader(const Net<float>& net, const int after, const int b) {
+  for (int j = after + 1; j < net.layers().size(); ++j) {
+    const vector<int>& bottom_ids = net.bottom_ids(j);
+    if (std::find(bottom_ids.begin(), bottom_ids.end(), b) !=
+        bottom_ids.end()) {
+      return bottom_ids.size() == 1 && net.top_ids(j).size() == 1 ? j : -1;
+    }
+  }
+  return -1;
+}
+
+// Writes the channel-wise y = scale * x + shift that the layer computes with
+// its stored parameters; returns false if it computes something else.
+static bool ChannelwiseAffine(Layer<float>& layer,
+    const Blob<float>& bottom, vector<float>* scale, vector<float>* shift) {
+  const LayerParameter& param = layer.layer_param();
+  const string type = layer.type();
+  const int channels = scale->size();
+  if (type == "BatchNorm") {
+    const BatchNormParameter& bn_param = param.batch_norm_param();
+    if (bn_param.has_use_global_stats() && !bn_param.use_global_stats()) {
+      return false;
+    }
+    const float stored_factor = layer.blobs()[2]->cpu_data()[0];
+    const float factor = stored_factor == 0 ? 0 : 1 / stored_factor;
+    const float* mean = layer.blobs()[0]->cpu_data();
+    const float* variance = layer.blobs()[1]->cpu_data();
+    for (int c = 0; c < channels; ++c) {
+      (*scale)[c] = 1 / std::sqrt(variance[c] * factor + bn_param.eps());
+      (*shift)[c] = -mean[c] * factor * (*scale)[c];
+    }
+    return true;
+  } else if (type == "Scale" || type == "Bias") {
+    const int axis = type == "Scale" ? param.scale_param().axis() :
+        param.bias_param().axis();
+    const int num_axes = type == "Scale" ? param.scale_param().num_axes() :
+        param.bias_param().num_axes();
+    if (bottom.CanonicalAxisIndex(axis) != 1 ||
+        (num_axes != 1 && !(num_axes == -1 && bottom.num_axes() == 2))) {
+      return false;
+    }
+    std::fill(scale->begin(), scale->end(), 1.f);
+    std::fill(shift->begin(), shift->end(), 0.f);
+    int k = 0;
+    if (type == "Scale") {
+      std::copy(layer.blobs()[k]->cpu_data(),
+          layer.blobs()[k]->cpu_data() + channels, scale->begin());
+      ++k;
+    }
+    if (k < layer.blobs().size()) {
+      std::copy(layer.blobs()[k]->cpu_data(),
+          layer.blobs()[k]->cpu_data() + channels, shift->begin());
+    }
+    return true;
+  }
+  return false;
+}
+
+// Sets the activation computed by the layer, returning false if the
+// producer cannot compute it.
+static bool Activation(Layer<float>& layer, Fusion* fusion) {
+  const LayerParameter& param = layer.layer_param();
+  const string type = layer.type();
+  if (type == "ReLU") {
+    fusion->activation = ConvolutionParameter_FusedActivation_RELU;
+    fusion->alpha = param.relu_param().negative_slope();
+    return true;
+  } else if (type == "ELU") {
+    fusion->activation = ConvolutionParameter_FusedActivation_ELU;
+    fusion->alpha = param.elu_param().alpha();
+    return true;
+  } else if (type == "PReLU" && param.prelu_param().channel_shared()) {
+    fusion->activation = ConvolutionParameter_FusedActivation_RELU;
+    fusion->alpha = layer.blobs()[0]->cpu_data()[0];
+    return true;
+  }
+  return false;
+}
+
+// Copies the layers of from into to but the removed ones, with the changes
+// of the fused ones.
+static void Rewrite(const NetParameter& from, const set<string>& removed,
+    const map<string, Fusion>& fusions, const bool with_blobs,
+    NetParameter* to) {
+  to->CopyFrom(from);
+  to->clear_layer();
+  for (int i = 0; i < from.layer_size(); ++i) {
+    const LayerParameter& layer = from.layer(i);
+    if (removed.count(layer.name())) {
+      continue;
+    }
+    LayerParameter* copy = to->add_layer();
+    copy->CopyFrom(layer);
+    map<string, Fusion>::const_iterator it = fusions.find(layer.name());
+    if (it == fusions.end()) {
+      continue;
+    }
+    const Fusion& fusion = it->second;
+    if (copy->top_size() == 1) {
+      copy->set_top(0, fusion.top);
+    }
+    if (copy->type() == "Convolution") {
+      ConvolutionParameter* param = copy->mutable_convolution_param();
+      param->set_bias_term(fusion.blobs.size() > 1);
+      if (fusion.activation !=
+          ConvolutionParameter_FusedActivation_NO_ACTIVATION) {
+        param->set_fused_activation(fusion.activation);
+        param->set_fused_alpha(fusion.alpha);
+      }
+    } else {
+      InnerProductParameter* param = copy->mutable_inner_product_param();
+      param->set_bias_term(fusion.blobs.size() > 1);
+      if (fusion.activation !=
+          ConvolutionParameter_FusedActivation_NO_ACTIVATION) {
+        param->set_fused_activation(fusion.activation);
+        param->set_fused_alpha(fusion.alpha);
+      }
+    }
+    if (with_blobs) {
+      copy->clear_blobs();
+      for (int k = 0; k < fusion.blobs.size(); ++k) {
+        fusion.blobs[k]->ToProto(copy->add_blobs());
+      }
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  // Print output to stderr (while still logging)
+  FLAGS_alsologtostderr = 1;
+
+  if (argc != 5) {
+    LOG(ERROR) << "Usage: fuse_net NET_PROTOTXT WEIGHTS OUT_PROTOTXT "
+        "OUT_WEIGHTS";
+    return 1;
+  }
+
+  NetParameter trained_param;
+  ReadNetParamsFromBinaryFileOrDie(argv[2], &trained_param);
+  Caffe::set_mode(Caffe::CPU);
+  Net<float> net(argv[1], TEST);
+  net.CopyTrainedLayersFrom(trained_param);
+  const vector<shared_ptr<Layer<float> > >& layers = net.layers();
+
+  set<string> removed;
+  map<string, Fusion> fusions;
+  for (int i = 0; i < layers.size(); ++i) {
+    if (!CanFold(net, i)) {
+      continue;
+    }
+    Layer<float>& layer = *layers[i];
+    const string& name = layer.layer_param().name();
+    const Blob<float>& weights = *layer.blobs()[0];
+    const int outputs = weights.shape(0);
+    const int inner = weights.count(1);
+    // the layer computes scale * (W x + bias) + shift
+    vector<float> scale(outputs, 1.f);
+    vector<float> shift(outputs, 0.f);
+    int last = i;
+    int b = net.top_ids(i)[0];
+    for (int j = NextReader(net, last, b); j >= 0;
+         j = NextReader(net, last, b)) {
+      const Blob<float>& input = *net.bottom_vecs()[j][0];
+      if (input.num_axes() < 2 || input.shape(1) != outputs) {
+        break;
+      }
+      vector<float> next_scale(outputs);
+      vector<float> next_shift(outputs);
+      if (!ChannelwiseAffine(*layers[j], input, &next_scale, &next_shift)) {
+        break;
+      }
+      for (int c = 0; c < outputs; ++c) {
+        scale[c] *= next_scale[c];
+        shift[c] = next_scale[c] * shift[c] + next_shift[c];
+      }
+      LOG(INFO) << "Folded " << layers[j]->layer_param().name() << " into "
+          << name;
+      removed.insert(layers[j]->layer_param().name());
+      last = j;
+      b = net.top_ids(j)[0];
+    }
+    Fusion fusion;
+    fusion.activation = ConvolutionParameter_FusedActivation_NO_ACTIVATION;
+    fusion.alpha = 0;
+    const int j = NextReader(net, last, b);
+    if (j >= 0 && Activation(*layers[j], &fusion)) {
+      LOG(INFO) << "Fused " << layers[j]->layer_param().name() << " into "
+          << name;
+      removed.insert(layers[j]->layer_param().name());
+      last = j;
+      b = net.top_ids(j)[0];
+    }
+    if (last == i) {
+      continue;
+    }
+    fusion.top = net.blob_names()[b];
+    fusion.blobs.push_back(shared_ptr<Blob<float> >(new Blob<float>()));
+    fusion.blobs[0]->CopyFrom(weights, false, true);
+    float* weight_data = fusion.blobs[0]->mutable_cpu_data();
+    for (int o = 0; o < outputs; ++o) {
+      for (int k = 0; k < inner; ++k) {
+        weight_data[o * inner + k] *= scale[o];
+      }
+    }
+    const bool has_bias = layer.blobs().size() > 1;
+    bool needs_bias = has_bias;
+    for (int o = 0; o < outputs; ++o) {
+      needs_bias |= shift[o] != 0;
+    }
+    if (needs_bias) {
+      fusion.blobs.push_back(shared_ptr<Blob<float> >(
+          new Blob<float>(vector<int>(1, outputs))));
+      float* bias_data = fusion.blobs[1]->mutable_cpu_data();
+      for (int o = 0; o < outputs; ++o) {
+        const float bias = has_bias ? layer.blobs()[1]->cpu_data()[o] : 0;
+        bias_data[o] = scale[o] * bias + shift[o];
+      }
+    }
+    fusions[name] = fusion;
+  }
+
+  NetParameter net_param;
+  ReadNetParamsFromTextFileOrDie(argv[1], &net_param);
+  net_param.mutable_state()->set_phase(TEST);
+  NetParameter test_param;
+  Net<float>::FilterNet(net_param, &test_param);
+  test_param.clear_state();
+  NetParameter fused_param;
+  Rewrite(test_param, removed, fusions, false, &fused_param);
+  NetParameter fused_weights;
+  Rewrite(trained_param, removed, fusions, true, &fused_weights);
+
+  LOG(INFO) << "Layers: " << layers.size() << " -> "
+      << layers.size() - removed.size();
+  WriteProtoToTextFile(fused_param, argv[3]);
+  LOG(INFO) << "Wrote the fused net definition to " << argv[3];
+  WriteProtoToBinaryFile(fused_weights, argv[4]);
+  LOG(INFO) << "Wrote the fused weights to " << argv[4];
+  return 0;
+}
@@ -0,0 +1,578 @@
+// This program physically removes the channels a structurally sparse net does
+// not need: the outputs of all-zero filters (rows) and the inputs no filter
+// reads (columns). Producers get a smaller num_output and every consumer
+// drops the matching inputs, so the pruned net is smaller and dense.
+// Usage:
+//    prune_net NET_PROTOTXT WEIGHTS OUT_PROTOTXT OUT_WEIGHTS
+//
+// The net is instantiated in the TEST phase to follow the channels, so use
+// the deploy definition if the data of NET_PROTOTXT is not at hand.
+//
+// A channel is removed only if nothing downstream needs it:
+//  - Convolution (group 1) and InnerProduct layers produce and consume
+//    channels. A channel they do not read is dropped; a channel they read
+//    that is constant (e.g. a zero filter with its bias, after BatchNorm,
+//    Scale and ReLU) is folded into their bias, unless zero padding makes
+//    the constant vary at the borders.
+//  - BatchNorm, Scale, ReLU, Sigmoid, TanH, Dropout, Pooling and Split keep
+//    the channels, and Eltwise and Concat (along the channels) tie those of
+//    their bottoms to their top.
+//  - Any other layer, and the inputs and outputs of the net, keep all the
+//    channels they touch.
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "glog/logging.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/net.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/io.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+using std::map;
+using std::string;
+using std::vector;
+
+// Which channels of a blob are the same everywhere, and their values.
+struct ChannelInfo {
+  vector<bool> constant;
+  vector<float> value;
+  explicit ChannelInfo(const int channels = 0)
+      : constant(channels, false), value(channels, 0) {}
+};
+
+enum LayerKind { UNSUPPORTED, WEIGHTED, CHANNELWISE, ELTWISE, CONCAT };
+
+static int Channels(const Blob<float>& blob) {
+  return blob.num_axes() >= 2 ? blob.shape(1) : 0;
+}
+
+static LayerKind Kind(Layer<float>& layer,
+    const vector<Blob<float>*>& bottom) {
+  const LayerParameter& param = layer.layer_param();
+  const string type = layer.type();
+  if (type == "Convolution") {
+    const ConvolutionParameter& conv_param = param.convolution_param();
+    return bottom.size() == 1 && conv_param.group() == 1 &&
+        conv_param.engine() != ConvolutionParameter_Engine_QUANT &&
+        bottom[0]->CanonicalAxisIndex(conv_param.axis()) == 1 ?
+        WEIGHTED : UNSUPPORTED;
+  } else if (type == "InnerProduct") {
+    return bottom[0]->num_axes() >= 2 &&
+        bottom[0]->CanonicalAxisIndex(param.inner_product_param().axis()) == 1 ?
+        WEIGHTED : UNSUPPORTED;
+  } else if (type == "Scale") {
+    const ScaleParameter& scale_param = param.scale_param();
+    return bottom.size() == 1 && scale_param.num_axes() == 1 &&
+        bottom[0]->CanonicalAxisIndex(scale_param.axis()) == 1 ?
+        CHANNELWISE : UNSUPPORTED;
+  } else if (type == "BatchNorm" || type == "ReLU" || type == "Sigmoid" ||
+      type == "TanH" || type == "Dropout" || type == "Pooling" ||
+      type == "Split") {
+    return CHANNELWISE;
+  } else if (type == "Eltwise") {
+    return ELTWISE;
+  } else if (type == "Concat") {
+    return bottom[0]->CanonicalAxisIndex(param.concat_param().axis()) == 1 ?
+        CONCAT : UNSUPPORTED;
+  }
+  return UNSUPPORTED;
+}
+
+static bool ZeroPadding(const ConvolutionParameter& param) {
+  for (int i = 0; i < param.pad_size(); ++i) {
+    if (param.pad(i) != 0) { return false; }
+  }
+  return param.pad_h() == 0 && param.pad_w() == 0;
+}
+
+// The weights of Convolution and InnerProduct layers seen as outputs x
+// channels x inner, where inner is the kernel size or the spatial size of
+// the bottom, and where they are stored.
+struct WeightLayout {
+  int outputs, channels, inner;
+  bool transposed;
+  int index(const int o, const int c, const int k) const {
+    return transposed ? (c * inner + k) * outputs + o :
+        (o * channels + c) * inner + k;
+  }
+};
+
+static WeightLayout Layout(Layer<float>& layer,
+    const Blob<float>& bottom) {
+  WeightLayout layout;
+  const Blob<float>& weights = *layer.blobs()[0];
+  layout.channels = Channels(bottom);
+  layout.transposed = layer.type() == string("InnerProduct") &&
+      layer.layer_param().inner_product_param().transpose();
+  layout.outputs = layout.transposed ? weights.shape(1) : weights.shape(0);
+  layout.inner = weights.count() / (layout.outputs * layout.channels);
+  return layout;
+}
+
+// Whether some output reads each channel: the rows of the (channels x inner)
+// x outputs view, or the columns of the outputs x (channels x inner) view,
+// that are not all zero.
+static vector<bool> UsedChannels(const WeightLayout& layout,
+    const float* weights) {
+  const int cols = layout.channels * layout.inner;
+  vector<int> zero(cols);
+  if (layout.transposed) {
+    caffe_cpu_if_all_zero(cols, layout.outputs, weights, &zero[0], false);
+  } else {
+    caffe_cpu_if_all_zero(layout.outputs, cols, weights, &zero[0], true);
+  }
+  vector<bool> used(layout.channels, false);
+  for (int i = 0; i < cols; ++i) {
+    if (!zero[i]) { used[i / layout.inner] = true; }
+  }
+  return used;
+}
+
+// Whether a constant input channel can be folded into the bias of a
+// Convolution or InnerProduct layer.
+static bool Foldable(Layer<float>& layer, const ChannelInfo& input,
+    const int c) {
+  if (!input.constant[c]) { return false; }
+  if (input.value[c] == 0) { return true; }
+  if (layer.type() == string("Convolution")) {
+    const ConvolutionParameter& param = layer.layer_param().convolution_param();
+    return param.bias_term() && ZeroPadding(param);
+  }
+  return layer.layer_param().inner_product_param().bias_term();
+}
+
+static ChannelInfo WeightedOutput(Layer<float>& layer,
+    const Blob<float>& bottom, const ChannelInfo& input) {
+  const WeightLayout layout = Layout(layer, bottom);
+  const float* weights = layer.blobs()[0]->cpu_data();
+  const bool bias_term = layer.blobs().size() > 1;
+  // the outputs that read nothing but foldable constants are constant too
+  vector<float> masked(weights, weights + layer.blobs()[0]->count());
+  vector<float> sums(layout.outputs, 0);
+  for (int c = 0; c < layout.channels; ++c) {
+    if (!Foldable(layer, input, c)) { continue; }
+    for (int o = 0; o < layout.outputs; ++o) {
+      for (int k = 0; k < layout.inner; ++k) {
+        const int i = layout.index(o, c, k);
+        sums[o] += input.value[c] * masked[i];
+        masked[i] = 0;
+      }
+    }
+  }
+  vector<int> zero(layout.outputs);
+  const int cols = layout.channels * layout.inner;
+  if (layout.transposed) {
+    caffe_cpu_if_all_zero(cols, layout.outputs, &masked[0], &zero[0], true);
+  } else {
+    caffe_cpu_if_all_zero(layout.outputs, cols, &masked[0], &zero[0], false);
+  }
+  ChannelInfo output(layout.outputs);
+  for (int o = 0; o < layout.outputs; ++o) {
+    output.constant[o] = zero[o];
+    output.value[o] = sums[o] +
+        (bias_term ? layer.blobs()[1]->cpu_data()[o] : 0);
+  }
+  return output;
+}
+
+static ChannelInfo ChannelwiseOutput(Layer<float>& layer,
+    const ChannelInfo& input) {
+  const LayerParameter& param = layer.layer_param();
+  const string type = layer.type();
+  ChannelInfo output = input;
+  for (int c = 0; c < output.value.size(); ++c) {
+    float& v = output.value[c];
+    if (type == "BatchNorm") {
+      const float scale_factor = layer.blobs()[2]->cpu_data()[0];
+      const float scale = scale_factor == 0 ? 0 : 1 / scale_factor;
+      v = (v - layer.blobs()[0]->cpu_data()[c] * scale) /
+          std::sqrt(layer.blobs()[1]->cpu_data()[c] * scale +
+          param.batch_norm_param().eps());
+    } else if (type == "Scale") {
+      v = v * layer.blobs()[0]->cpu_data()[c] +
+          (layer.blobs().size() > 1 ? layer.blobs()[1]->cpu_data()[c] : 0);
+    } else if (type == "ReLU") {
+      v = v > 0 ? v : v * param.relu_param().negative_slope();
+    } else if (type == "Sigmoid") {
+      v = 1 / (1 + std::exp(-v));
+    } else if (type == "TanH") {
+      v = std::tanh(v);
+    } else if (type == "Pooling" && v != 0 &&
+        param.pooling_param().pool() == PoolingParameter_PoolMethod_AVE &&
+        (param.pooling_param().pad() != 0 || param.pooling_param().pad_h() != 0 ||
+        param.pooling_param().pad_w() != 0)) {
+      // averages over the padding vary at the borders
+      output.constant[c] = false;
+    }
+  }
+  return output;
+}
+
+static ChannelInfo EltwiseOutput(const EltwiseParameter& param,
+    const vector<ChannelInfo>& inputs) {
+  ChannelInfo output(inputs[0].value.size());
+  for (int c = 0; c < output.value.size(); ++c) {
+    bool constant = true;
+    float v = param.operation() == EltwiseParameter_EltwiseOp_PROD ? 1 : 0;
+    for (int j = 0; j < inputs.size(); ++j) {
+      const float x = inputs[j].value[c];
+      constant = constant && inputs[j].constant[c];
+      switch (param.operation()) {
+      case EltwiseParameter_EltwiseOp_PROD:
+        v *= x;
+        break;
+      case EltwiseParameter_EltwiseOp_SUM:
+        v += (param.coeff_size() ? param.coeff(j) : 1) * x;
+        break;
+      case EltwiseParameter_EltwiseOp_MAX:
+        v = j == 0 ? x : std::max(v, x);
+        break;
+      }
+    }
+    output.constant[c] = constant;
+    output.value[c] = constant ? v : 0;
+  }
+  return output;
+}
+
+// Union-find over the channels of all blobs; a channel is removed only if
+// every channel tied to it can be.
+class ChannelSets {
+ public:
+  explicit ChannelSets(const int size)
+      : parent_(size), removable_(size, true) {
+    for (int i = 0; i < size; ++i) { parent_[i] = i; }
+  }
+  int Find(int i) {
+    while (parent_[i] != i) {
+      parent_[i] = parent_[parent_[i]];
+      i = parent_[i];
+    }
+    return i;
+  }
+  void Tie(const int a, const int b) {
+    const int ra = Find(a);
+    const int rb = Find(b);
+    if (ra != rb) {
+      parent_[ra] = rb;
+      removable_[rb] = removable_[rb] && removable_[ra];
+    }
+  }
+  void Keep(const int i) { removable_[Find(i)] = false; }
+  bool Removable(const int i) { return removable_[Find(i)]; }
+
+ private:
+  vector<int> parent_;
+  vector<bool> removable_;
+};
+
+// Copies blob into pruned without the removed entries along each axis; an
+// empty mask keeps the whole axis.
+static void PruneBlob(const Blob<float>& blob,
+    const vector<vector<bool> >& removed, Blob<float>* pruned) {
+  vector<int> shape = blob.shape();
+  for (int a = 0; a < removed.size(); ++a) {
+    if (!removed[a].empty()) {
+      shape[a] -= std::count(removed[a].begin(), removed[a].end(), true);
+    }
+  }
+  pruned->Reshape(shape);
+  float* out = pruned->mutable_cpu_data();
+  const float* in = blob.cpu_data();
+  vector<int> indices(blob.num_axes(), 0);
+  for (int i = 0; i < blob.count(); ++i) {
+    int offset = i;
+    bool keep = true;
+    for (int a = blob.num_axes() - 1; a >= 0; --a) {
+      indices[a] = offset % blob.shape(a);
+      offset /= blob.shape(a);
+      if (a < removed.size() && !removed[a].empty() &&
+          removed[a][indices[a]]) {
+        keep = false;
+      }
+    }
+    if (keep) { *out++ = in[i]; }
+  }
+}
+
+// The input channel masks expanded to the rows or columns of the weights.
+static vector<bool> ExpandMask(const vector<bool>& mask, const int inner) {
+  vector<bool> expanded(mask.size() * inner);
+  for (int i = 0; i < expanded.size(); ++i) {
+    expanded[i] = mask[i / inner];
+  }
+  return expanded;
+}
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  // Print output to stderr (while still logging)
+  FLAGS_alsologtostderr = 1;
+
+  if (argc != 5) {
+    LOG(ERROR) << "Usage: prune_net NET_PROTOTXT WEIGHTS OUT_PROTOTXT "
+        "OUT_WEIGHTS";
+    return 1;
+  }
+
+  NetParameter trained_param;
+  ReadNetParamsFromBinaryFileOrDie(argv[2], &trained_param);
+  Caffe::set_mode(Caffe::CPU);
+  Net<float> net(argv[1], TEST);
+  net.CopyTrainedLayersFrom(trained_param);
+  const vector<shared_ptr<Layer<float> > >& layers = net.layers();
+  const vector<shared_ptr<Blob<float> > >& blobs = net.blobs();
+
+  // follow the constant channels through the net, as every layer sees them
+  vector<ChannelInfo> info(blobs.size());
+  for (int b = 0; b < blobs.size(); ++b) {
+    info[b] = ChannelInfo(Channels(*blobs[b]));
+  }
+  vector<LayerKind> kinds(layers.size());
+  vector<vector<ChannelInfo> > inputs(layers.size());
+  for (int i = 0; i < layers.size(); ++i) {
+    const vector<int>& bottom_ids = net.bottom_ids(i);
+    const vector<int>& top_ids = net.top_ids(i);
+    kinds[i] = bottom_ids.empty() ? UNSUPPORTED :
+        Kind(*layers[i], net.bottom_vecs()[i]);
+    for (int j = 0; j < bottom_ids.size(); ++j) {
+      inputs[i].push_back(info[bottom_ids[j]]);
+    }
+    for (int j = 0; j < top_ids.size(); ++j) {
+      ChannelInfo& output = info[top_ids[j]];
+      switch (kinds[i]) {
+      case WEIGHTED:
+        output = WeightedOutput(*layers[i], *blobs[bottom_ids[0]],
+            inputs[i][0]);
+        break;
+      case CHANNELWISE:
+        output = ChannelwiseOutput(*layers[i], inputs[i][0]);
+        break;
+      case ELTWISE:
+        output = EltwiseOutput(layers[i]->layer_param().eltwise_param(),
+            inputs[i]);
+        break;
+      case CONCAT:
+        output = ChannelInfo();
+        for (int k = 0; k < inputs[i].size(); ++k) {
+          output.constant.insert(output.constant.end(),
+              inputs[i][k].constant.begin(), inputs[i][k].constant.end());
+          output.value.insert(output.value.end(),
+              inputs[i][k].value.begin(), inputs[i][k].value.end());
+        }
+        break;
+      default:
+        output = ChannelInfo(Channels(*blobs[top_ids[j]]));
+      }
+    }
+  }
+
+  // tie the channels layers pass on and keep those something needs
+  vector<int> first(blobs.size() + 1, 0);
+  for (int b = 0; b < blobs.size(); ++b) {
+    first[b + 1] = first[b] + Channels(*blobs[b]);
+  }
+  ChannelSets sets(first.back());
+  for (int k = 0; k < net.input_blob_indices().size(); ++k) {
+    const int b = net.input_blob_indices()[k];
+    for (int c = first[b]; c < first[b + 1]; ++c) { sets.Keep(c); }
+  }
+  for (int k = 0; k < net.output_blob_indices().size(); ++k) {
+    const int b = net.output_blob_indices()[k];
+    for (int c = first[b]; c < first[b + 1]; ++c) { sets.Keep(c); }
+  }
+  for (int i = 0; i < layers.size(); ++i) {
+    const vector<int>& bottom_ids = net.bottom_ids(i);
+    const vector<int>& top_ids = net.top_ids(i);
+    if (kinds[i] == UNSUPPORTED) {
+      for (int j = 0; j < bottom_ids.size(); ++j) {
+        for (int c = first[bottom_ids[j]]; c < first[bottom_ids[j] + 1]; ++c) {
+          sets.Keep(c);
+        }
+      }
+      for (int j = 0; j < top_ids.size(); ++j) {
+        for (int c = first[top_ids[j]]; c < first[top_ids[j] + 1]; ++c) {
+          sets.Keep(c);
+        }
+      }
+    } else if (kinds[i] == WEIGHTED) {
+      const int b = bottom_ids[0];
+      const vector<bool> used = UsedChannels(Layout(*layers[i], *blobs[b]),
+          layers[i]->blobs()[0]->cpu_data());
+      for (int c = 0; c < used.size(); ++c) {
+        if (used[c] && !Foldable(*layers[i], inputs[i][0], c)) {
+          sets.Keep(first[b] + c);
+        }
+      }
+    } else {
+      // the channels of the tops follow those of the bottoms
+      int offset = 0;
+      for (int j = 0; j < bottom_ids.size(); ++j) {
+        const int b = bottom_ids[j];
+        for (int c = 0; c < Channels(*blobs[b]); ++c) {
+          for (int t = 0; t < top_ids.size(); ++t) {
+            sets.Tie(first[b] + c, first[top_ids[t]] + offset + c);
+          }
+        }
+        if (kinds[i] == CONCAT) { offset += Channels(*blobs[b]); }
+      }
+    }
+  }
+  // never empty a blob
+  for (bool changed = true; changed; ) {
+    changed = false;
+    for (int b = 0; b < blobs.size(); ++b) {
+      bool all = first[b + 1] > first[b];
+      for (int c = first[b]; c < first[b + 1] && all; ++c) {
+        all = sets.Removable(c);
+      }
+      if (all) {
+        sets.Keep(first[b]);
+        changed = true;
+      }
+    }
+  }
+  vector<vector<bool> > removed(blobs.size());
+  for (int b = 0; b < blobs.size(); ++b) {
+    for (int c = first[b]; c < first[b + 1]; ++c) {
+      removed[b].push_back(sets.Removable(c));
+    }
+  }
+
+  // shrink the layers that hold per-channel parameters
+  map<string, vector<shared_ptr<Blob<float> > > > pruned_blobs;
+  map<string, int> num_outputs;
+  int params_before = 0;
+  int params_after = 0;
+  for (int i = 0; i < layers.size(); ++i) {
+    Layer<float>& layer = *layers[i];
+    for (int k = 0; k < layer.blobs().size(); ++k) {
+      params_before += layer.blobs()[k]->count();
+    }
+    if (kinds[i] != WEIGHTED && layer.type() != string("BatchNorm") &&
+        layer.type() != string("Scale")) {
+      for (int k = 0; k < layer.blobs().size(); ++k) {
+        params_after += layer.blobs()[k]->count();
+      }
+      continue;
+    }
+    const int b = net.bottom_ids(i)[0];
+    const vector<bool>& out_mask = removed[net.top_ids(i)[0]];
+    const int kept_outputs = std::count(out_mask.begin(), out_mask.end(), false);
+    const int kept_inputs = std::count(removed[b].begin(), removed[b].end(),
+        false);
+    vector<shared_ptr<Blob<float> > > pruned;
+    if (kinds[i] == WEIGHTED) {
+      const WeightLayout layout = Layout(layer, *blobs[b]);
+      if (kept_outputs == layout.outputs && kept_inputs == layout.channels) {
+        for (int k = 0; k < layer.blobs().size(); ++k) {
+          params_after += layer.blobs()[k]->count();
+        }
+        continue;
+      }
+      const float* weights = layer.blobs()[0]->cpu_data();
+      vector<vector<bool> > weight_masks(2);
+      if (layout.transposed) {
+        weight_masks[0] = ExpandMask(removed[b], layout.inner);
+        weight_masks[1] = out_mask;
+      } else if (layer.type() == string("InnerProduct")) {
+        weight_masks[0] = out_mask;
+        weight_masks[1] = ExpandMask(removed[b], layout.inner);
+      } else {
+        weight_masks[0] = out_mask;
+        weight_masks[1] = removed[b];
+      }
+      pruned.push_back(shared_ptr<Blob<float> >(new Blob<float>()));
+      PruneBlob(*layer.blobs()[0], weight_masks, pruned.back().get());
+      if (layer.blobs().size() > 1) {
+        // the removed constant inputs live on in the bias
+        Blob<float> bias;
+        bias.CopyFrom(*layer.blobs()[1], false, true);
+        float* bias_data = bias.mutable_cpu_data();
+        for (int c = 0; c < layout.channels; ++c) {
+          if (!removed[b][c] || !inputs[i][0].constant[c]) { continue; }
+          for (int o = 0; o < layout.outputs; ++o) {
+            for (int k = 0; k < layout.inner; ++k) {
+              bias_data[o] += inputs[i][0].value[c] *
+                  weights[layout.index(o, c, k)];
+            }
+          }
+        }
+        pruned.push_back(shared_ptr<Blob<float> >(new Blob<float>()));
+        PruneBlob(bias, vector<vector<bool> >(1, out_mask),
+            pruned.back().get());
+      }
+      num_outputs[layer.layer_param().name()] = kept_outputs;
+      LOG(INFO) << "Layer " << layer.layer_param().name() << ": "
+          << layout.channels << " -> " << kept_inputs << " inputs, "
+          << layout.outputs << " -> " << kept_outputs << " outputs";
+    } else {
+      if (kept_outputs == out_mask.size()) {
+        for (int k = 0; k < layer.blobs().size(); ++k) {
+          params_after += layer.blobs()[k]->count();
+        }
+        continue;
+      }
+      for (int k = 0; k < layer.blobs().size(); ++k) {
+        // the scale factor of BatchNorm is not per channel
+        const bool per_channel = layer.blobs()[k]->count() == out_mask.size();
+        pruned.push_back(shared_ptr<Blob<float> >(new Blob<float>()));
+        PruneBlob(*layer.blobs()[k], vector<vector<bool> >(1,
+            per_channel ? out_mask : vector<bool>()), pruned.back().get());
+      }
+    }
+    for (int k = 0; k < pruned.size(); ++k) {
+      params_after += pruned[k]->count();
+    }
+    pruned_blobs[layer.layer_param().name()] = pruned;
+  }
+
+  NetParameter net_param;
+  ReadNetParamsFromTextFileOrDie(argv[1], &net_param);
+  for (int i = 0; i < net_param.layer_size(); ++i) {
+    LayerParameter* layer = net_param.mutable_layer(i);
+    map<string, int>::const_iterator it = num_outputs.find(layer->name());
+    if (it == num_outputs.end()) { continue; }
+    if (layer->type() == "Convolution") {
+      layer->mutable_convolution_param()->set_num_output(it->second);
+    } else {
+      layer->mutable_inner_product_param()->set_num_output(it->second);
+    }
+  }
+  for (int i = 0; i < trained_param.layer_size(); ++i) {
+    LayerParameter* layer = trained_param.mutable_layer(i);
+    map<string, vector<shared_ptr<Blob<float> > > >::const_iterator it =
+        pruned_blobs.find(layer->name());
+    if (it == pruned_blobs.end()) { continue; }
+    layer->clear_blobs();
+    for (int k = 0; k < it->second.size(); ++k) {
+      it->second[k]->ToProto(layer->add_blobs());
+    }
+    map<string, int>::const_iterator num_output =
+        num_outputs.find(layer->name());
+    if (num_output != num_outputs.end()) {
+      if (layer->has_convolution_param()) {
+        layer->mutable_convolution_param()->set_num_output(num_output->second);
+      } else if (layer->has_inner_product_param()) {
+        layer->mutable_inner_product_param()->set_num_output(
+            num_output->second);
+      }
+    }
+  }
+
+  LOG(INFO) << "Parameters: " << params_before << " -> " << params_after;
+  WriteProtoToTextFile(net_param, argv[3]);
+  LOG(INFO) << "Wrote the pruned net definition to " << argv[3];
+  WriteProtoToBinaryFile(trained_param, argv[4]);
+  LOG(INFO) << "Wrote the pruned weights to " << argv[4];
+  return 0;
+}
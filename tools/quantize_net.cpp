@@ -0,0 +1,152 @@
+// This program product-quantizes the weights of Convolution and InnerProduct
+// layers of a trained net, turning them into quantized Convolution
+// (engine: QUANT) and InnerProductQ layers.
+// Usage:
+//    quantize_net [FLAGS] NET_PROTOTXT WEIGHTS LAYERS OUT_PROTOTXT OUT_WEIGHTS
+//
+// where LAYERS is a comma-separated list of layer names. The rewritten net
+// definition goes to OUT_PROTOTXT and the weights, with every converted
+// layer holding its codebook and bit-packed codeword indices, to OUT_WEIGHTS.
+
+#include <string>
+#include <vector>
+
+#include "boost/algorithm/string.hpp"
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/product_quantization.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+using std::string;
+using std::vector;
+
+DEFINE_int32(k, 32, "Codewords per subspace, a power of two up to 256");
+DEFINE_int32(m, 4, "Dimensions per subspace");
+DEFINE_int32(iterations, 30,
+    "Lloyd iterations, or mini-batch steps when --batch_size is set");
+DEFINE_int32(batch_size, 0,
+    "Rows sampled per mini-batch k-means step; 0 runs full Lloyd k-means");
+DEFINE_int32(seed, 1701, "Seed of the k-means++ initialization");
+
+static LayerParameter* FindLayer(NetParameter* net_param, const string& name) {
+  for (int i = 0; i < net_param->layer_size(); ++i) {
+    if (net_param->layer(i).name() == name) {
+      return net_param->mutable_layer(i);
+    }
+  }
+  return NULL;
+}
+
+static void QuantizeLayer(LayerParameter* layer, LayerParameter* trained,
+    const ProductQuantizationOptions& options) {
+  CHECK_GT(trained->blobs_size(), 0) << "Layer " << layer->name()
+      << " has no trained weights.";
+  Blob<float> weights;
+  weights.FromProto(trained->blobs(0), true);
+  Blob<float> bias;
+  Blob<float> codebook;
+  Blob<float> codes;
+  if (layer->type() == "Convolution") {
+    ConvolutionParameter* param = layer->mutable_convolution_param();
+    CHECK_EQ(param->group(), 1) << "Grouped convolutions are not supported.";
+    CHECK(param->bias_term()) << "Quantized convolutions need a bias term.";
+    CHECK_EQ(weights.num_axes(), 4) << "Only 2D convolutions are supported.";
+    QuantizeConvolutionWeights(weights, options, &codebook, &codes);
+    bias.FromProto(trained->blobs(1), true);
+    param->set_engine(ConvolutionParameter_Engine_QUANT);
+    param->set_k(options.k);
+    param->set_m(options.m);
+    param->clear_weight_filler();
+    param->clear_bias_filler();
+  } else if (layer->type() == "InnerProduct") {
+    const InnerProductParameter& param = layer->inner_product_param();
+    CHECK(!param.transpose()) << "Transposed weights are not supported.";
+    QuantizeInnerProductWeights(weights, options, &codebook, &codes);
+    // InnerProductQ always has a bias
+    if (param.bias_term()) {
+      bias.FromProto(trained->blobs(1), true);
+    } else {
+      bias.Reshape(vector<int>(1, param.num_output()));
+      caffe_set(bias.count(), 0.f, bias.mutable_cpu_data());
+    }
+    InnerProductQParameter* q_param = layer->mutable_inner_product_q_param();
+    q_param->set_num_output(param.num_output());
+    q_param->set_k(options.k);
+    q_param->set_m(options.m);
+    q_param->set_axis(param.axis());
+    layer->clear_inner_product_param();
+    layer->set_type("InnerProductQ");
+    trained->set_type("InnerProductQ");
+  } else {
+    LOG(FATAL) << "Layer " << layer->name() << " of type " << layer->type()
+        << " cannot be quantized.";
+  }
+  // The codeword indices are not learnable, whether or not the layer set its
+  // learning rates explicitly.
+  FreezeQuantizedCodes(layer);
+  trained->clear_blobs();
+  codebook.ToProto(trained->add_blobs());
+  bias.ToProto(trained->add_blobs());
+  codes.ToProto(trained->add_blobs());
+}
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  // Print output to stderr (while still logging)
+  FLAGS_alsologtostderr = 1;
+
+#ifndef GFLAGS_GFLAGS_H_
+  namespace gflags = google;
+#endif
+
+  gflags::SetUsageMessage("Product-quantize Convolution and InnerProduct\n"
+        "layers of a trained net.\n"
+        "Usage:\n"
+        "    quantize_net [FLAGS] NET_PROTOTXT WEIGHTS LAYERS OUT_PROTOTXT "
+        "OUT_WEIGHTS\n"
+        "LAYERS is a comma-separated list of layer names.\n");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  if (argc != 6) {
+    gflags::ShowUsageWithFlagsRestrict(argv[0], "tools/quantize_net");
+    return 1;
+  }
+
+  NetParameter net_param;
+  ReadNetParamsFromTextFileOrDie(argv[1], &net_param);
+  NetParameter trained_param;
+  ReadNetParamsFromBinaryFileOrDie(argv[2], &trained_param);
+  vector<string> layer_names;
+  boost::split(layer_names, argv[3], boost::is_any_of(","));
+
+  ProductQuantizationOptions options;
+  options.k = FLAGS_k;
+  options.m = FLAGS_m;
+  options.max_iter = FLAGS_iterations;
+  options.batch_size = FLAGS_batch_size;
+  options.seed = FLAGS_seed;
+  CPUTimer timer;
+  for (int i = 0; i < layer_names.size(); ++i) {
+    LayerParameter* layer = FindLayer(&net_param, layer_names[i]);
+    CHECK(layer) << "Unknown layer " << layer_names[i];
+    LayerParameter* trained = FindLayer(&trained_param, layer_names[i]);
+    CHECK(trained) << "No trained weights for layer " << layer_names[i];
+    timer.Start();
+    QuantizeLayer(layer, trained, options);
+    LOG(INFO) << "Quantized layer " << layer_names[i] << " in "
+        << timer.Seconds() << " s";
+  }
+
+  WriteProtoToTextFile(net_param, argv[4]);
+  LOG(INFO) << "Wrote the quantized net definition to " << argv[4];
+  WriteProtoToBinaryFile(trained_param, argv[5]);
+  LOG(INFO) << "Wrote the quantized weights to " << argv[5];
+  return 0;
+}